@@ -162,6 +162,30 @@ extern "C" {
     (S3_MAX_METADATA_SIZE / (sizeof(S3_METADATA_HEADER_NAME_PREFIX "nv") - 1))
 
 
+/**
+ * S3_MAX_UPLOAD_ID_SIZE is the maximum size of a multipart upload id that
+ * libs3 supports, including the terminating \0.
+ **/
+#define S3_MAX_UPLOAD_ID_SIZE              512
+
+
+/**
+ * S3_MAX_COPY_OBJECT_SIZE is the largest object that S3_copy_object can copy
+ * in a single request.  Larger objects must be copied in parts with
+ * S3_copy_object_part.
+ **/
+#define S3_MAX_COPY_OBJECT_SIZE            (5ULL * 1024 * 1024 * 1024)
+
+
+/**
+ * S3_MIN_MULTIPART_PART_SIZE is the smallest size allowed for every part of
+ * a multipart upload but the last, and S3_MAX_MULTIPART_PART_COUNT is the
+ * largest number of parts that an upload may have.
+ **/
+#define S3_MIN_MULTIPART_PART_SIZE         (5ULL * 1024 * 1024)
+#define S3_MAX_MULTIPART_PART_COUNT        10000
+
+
 /**
  * S3_MAX_ACL_GRANT_COUNT is the maximum number of ACL grants that may be
  * set on a bucket or object at one time.  It is also the maximum number of
@@ -210,6 +234,18 @@ extern "C" {
 #define S3_INIT_WINSOCK                    1
 
 
+/**
+ * This constant is used by the S3_initialize() function to request that
+ * libs3 speak HTTP/2 to S3, multiplexing the concurrent requests of an
+ * S3RequestContext over a shared connection rather than opening one
+ * connection per request.  It is not part of S3_INIT_ALL; HTTP/1.1 is used
+ * unless this flag is given, and also with any server that does not offer
+ * HTTP/2.  S3_initialize() fails if the linked libcurl was built without
+ * HTTP/2 support.
+ **/
+#define S3_INIT_HTTP2                      2
+
+
 /**
  * This convenience constant is used by the S3_initialize() function to
  * indicate that all libraries required by libs3 should be initialized.
@@ -712,6 +748,19 @@ typedef struct S3ListBucketContent
      * access permissions allow it to be viewed.
      **/
     const char *ownerDisplayName;
+
+    /**
+     * This is the length of key, in bytes, not including its terminating
+     * NUL.
+     **/
+    int keyLen;
+
+    /**
+     * This is the last modified date exactly as reported by S3, in ISO 8601
+     * format.  It is always present, even if lastModified was not parsed
+     * (see S3ListBucketHandler.rawLastModified).
+     **/
+    const char *lastModifiedString;
 } S3ListBucketContent;
 
 
@@ -863,6 +912,74 @@ typedef struct S3ErrorDetails
 } S3ErrorDetails;
 
 
+/**
+ * S3RequestTiming describes how long each stage of a finished request took,
+ * as measured by libcurl, for the S3RequestTimingCallback.  The times are in
+ * microseconds from when the request started, so that each includes the
+ * stages before it; those for stages that the request never reached are 0.
+ **/
+typedef struct S3RequestTiming
+{
+    /**
+     * The HTTP verb of the request: GET, HEAD, PUT, DELETE or POST
+     **/
+    const char *verb;
+
+    /**
+     * The URI that was requested
+     **/
+    const char *uri;
+
+    /**
+     * The status that the request completed with, as passed to its
+     * S3ResponseCompleteCallback
+     **/
+    S3Status status;
+
+    /**
+     * The HTTP response code, or 0 if there was no response
+     **/
+    int httpResponseCode;
+
+    /**
+     * Nonzero if the request was sent on a connection kept from an earlier
+     * request, so that there was no name lookup, connect or TLS handshake
+     **/
+    int connectionReused;
+
+    /**
+     * When the host name had been resolved
+     **/
+    int64_t nameLookupTime;
+
+    /**
+     * When the TCP connection had been made
+     **/
+    int64_t connectTime;
+
+    /**
+     * When the TLS handshake had been done; 0 for unencrypted requests
+     **/
+    int64_t appConnectTime;
+
+    /**
+     * When the first byte of the response was received
+     **/
+    int64_t startTransferTime;
+
+    /**
+     * When the request finished
+     **/
+    int64_t totalTime;
+
+    /**
+     * The number of body bytes sent and received
+     **/
+    int64_t bytesSent;
+    int64_t bytesReceived;
+} S3RequestTiming;
+
+
 /** **************************************************************************
  * Callback Signatures
  ************************************************************************** **/
@@ -904,6 +1021,17 @@ typedef void (S3ResponseCompleteCallback)(S3Status status,
                                           const S3ErrorDetails *errorDetails,
                                           void *callbackData);
 
+
+/**
+ * This callback, if set with S3_set_request_timing_callback(), is made when
+ * any request finishes, just before its S3ResponseCompleteCallback, and in
+ * the same thread.
+ *
+ * @param timing describes how long each stage of the request took; it is
+ *        only valid for the duration of the callback
+ **/
+typedef void (S3RequestTimingCallback)(const S3RequestTiming *timing);
+
                                     
 /**
  * This callback is made for each bucket resulting from a list service
@@ -1075,9 +1203,19 @@ typedef struct S3ListBucketHandler
      * The listBucketCallback is called as items are reported back from S3 as
      * responses to the request.  This may be called more than one time per
      * list bucket request, each time providing more items from the list
-     * operation.
+     * operation.  Normally it is called once for each page of results that
+     * S3 returns.
      **/
     S3ListBucketCallback *listBucketCallback;
+
+    /**
+     * If nonzero, the lastModified date of each S3ListBucketContent is not
+     * parsed and is reported as -1; the caller can parse lastModifiedString
+     * itself for those items whose date it actually needs.  Callers that
+     * only want keys should set this, as date parsing is the most expensive
+     * per-item work in a listing.
+     **/
+    int rawLastModified;
 } S3ListBucketHandler;
 
 
@@ -1150,6 +1288,10 @@ typedef struct S3GetObjectHandler
  *        not initialize winsock elsewhere.  On non-Microsoft Windows
  *        platforms it has no effect.
  *
+ *        S3_INIT_HTTP2 is not a dependency library but an opt-in: pass it
+ *        in addition to the other flags to have libs3 use HTTP/2.  It is
+ *        only consulted by the call that first initializes libs3.
+ *
  *        As a convenience, the macro S3_INIT_ALL is provided, which will do
  *        all necessary initialization; however, be warned that things may
  *        break if your application re-initializes the dependent libraries
@@ -1272,6 +1414,17 @@ S3Status S3_convert_acl(char *aclXml, char *ownerId, char *ownerDisplayName,
 int S3_status_is_retryable(S3Status status);
 
 
+/**
+ * Sets a callback to be made with the timing of every request as it
+ * finishes, for tracing where the time of slow requests goes.  Each retry of
+ * a request is a request of its own.  This should be called before any
+ * requests are made, and is not thread-safe.
+ *
+ * @param callback is the callback to make, or NULL to stop making one
+ **/
+void S3_set_request_timing_callback(S3RequestTimingCallback *callback);
+
+
 /** **************************************************************************
  * Request Context Management Functions
  ************************************************************************** **/
@@ -1589,6 +1742,43 @@ void S3_list_bucket(const S3BucketContext *bucketContext,
                     const S3ListBucketHandler *handler, void *callbackData);
 
 
+/**
+ * Lists all keys within a bucket, or beneath a prefix, using many concurrent
+ * requests.  The keyspace is first split up by listing it with a delimiter,
+ * recursively to a small depth until there is enough fan-out, and then the
+ * resulting prefixes are listed concurrently on one internal request
+ * context.  This is much faster than S3_list_bucket for large buckets whose
+ * keys are organized by the delimiter; for a bucket without any delimiters
+ * in its keys it degrades to a sequential listing.
+ *
+ * Keys are delivered to the handler's listBucketCallback in key order,
+ * exactly as a sequential listing would return them, but in pages which do
+ * not correspond to S3's pages.  The isTruncated parameter of the callback
+ * is always 0, nextMarker is the last key of each page, and no common
+ * prefixes are reported.  The listing is complete when the handler's
+ * completeCallback is made, which happens exactly once.
+ *
+ * This function always performs its requests synchronously.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param prefix if present, gives a prefix for matching keys
+ * @param delimiter is the delimiter used to split up the keyspace; if NULL,
+ *        "/" is used
+ * @param maxConcurrency is the maximum number of requests to have
+ *        outstanding at once
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed 
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_list_bucket_parallel(const S3BucketContext *bucketContext,
+                             const char *prefix, const char *delimiter,
+                             int maxConcurrency,
+                             const S3ListBucketHandler *handler,
+                             void *callbackData);
+
+
 /** **************************************************************************
  * Object Functions
  ************************************************************************** **/
@@ -1663,6 +1853,125 @@ void S3_copy_object(const S3BucketContext *bucketContext,
                     const S3ResponseHandler *handler, void *callbackData);
 
 
+
+/**
+ * Starts a multipart upload of an object.  The object does not exist until
+ * its parts have been supplied and S3_complete_multipart has been called;
+ * an upload that is not going to be completed should be aborted with
+ * S3_abort_multipart, because S3 keeps (and charges for) its parts until
+ * then.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object to be uploaded
+ * @param putProperties optionally provides additional properties to apply to
+ *        the object, as for S3_put_object
+ * @param uploadIdReturnSize specifies the number of bytes provided in the
+ *        uploadIdReturn buffer; S3_MAX_UPLOAD_ID_SIZE is always enough
+ * @param uploadIdReturn is a buffer into which the id of the new upload will
+ *        be written
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed 
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_initiate_multipart(const S3BucketContext *bucketContext,
+                           const char *key,
+                           const S3PutProperties *putProperties,
+                           int uploadIdReturnSize, char *uploadIdReturn,
+                           S3RequestContext *requestContext,
+                           const S3ResponseHandler *handler,
+                           void *callbackData);
+
+
+/**
+ * Copies a range of an object into one part of a multipart upload, entirely
+ * within S3.
+ *
+ * @param bucketContext gives the source bucket and associated parameters for
+ *        this request
+ * @param key is the source key
+ * @param destinationBucket gives the bucket of the multipart upload.  If
+ *        NULL, the source bucket will be used.
+ * @param destinationKey gives the key of the multipart upload
+ * @param uploadId is the id of the multipart upload, as returned by
+ *        S3_initiate_multipart
+ * @param partNumber is the number of this part, from 1 to
+ *        S3_MAX_MULTIPART_PART_COUNT
+ * @param startByte is the first byte of the source to copy
+ * @param byteCount is the number of bytes of the source to copy
+ * @param eTagReturnSize specifies the number of bytes provided in the
+ *        eTagReturn buffer
+ * @param eTagReturn is a buffer into which the eTag of the part will be
+ *        written; it must be passed to S3_complete_multipart
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed 
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_copy_object_part(const S3BucketContext *bucketContext,
+                         const char *key, const char *destinationBucket,
+                         const char *destinationKey, const char *uploadId,
+                         int partNumber, uint64_t startByte,
+                         uint64_t byteCount, int eTagReturnSize,
+                         char *eTagReturn, S3RequestContext *requestContext,
+                         const S3ResponseHandler *handler,
+                         void *callbackData);
+
+
+/**
+ * Completes a multipart upload, assembling the object from its parts.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object being uploaded
+ * @param uploadId is the id of the multipart upload
+ * @param partsCount is the number of parts, which are numbered from 1 to
+ *        partsCount
+ * @param partETags gives the eTag of each part, in order
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed 
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_complete_multipart(const S3BucketContext *bucketContext,
+                           const char *key, const char *uploadId,
+                           int partsCount, const char **partETags,
+                           S3RequestContext *requestContext,
+                           const S3ResponseHandler *handler,
+                           void *callbackData);
+
+
+/**
+ * Aborts a multipart upload, discarding any parts already uploaded.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object being uploaded
+ * @param uploadId is the id of the multipart upload
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed 
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_abort_multipart(const S3BucketContext *bucketContext, const char *key,
+                        const char *uploadId,
+                        S3RequestContext *requestContext,
+                        const S3ResponseHandler *handler, void *callbackData);
+
+
 /**
  * Gets an object from S3.  The contents of the object are returned in the
  * handler's getObjectDataCallback.
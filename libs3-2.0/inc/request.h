@@ -39,7 +39,8 @@ typedef enum
     HttpRequestTypeHEAD,
     HttpRequestTypePUT,
     HttpRequestTypeCOPY,
-    HttpRequestTypeDELETE
+    HttpRequestTypeDELETE,
+    HttpRequestTypePOST
 } HttpRequestType;
 
 
@@ -72,7 +73,8 @@ typedef struct RequestParams
     // Get conditions
     const S3GetConditions *getConditions;
 
-    // Start byte
+    // Start byte; for a copy, this is the start of the range of the source
+    // to copy
     uint64_t startByte;
 
     // Byte count
@@ -150,6 +152,9 @@ typedef struct Request
     // Data passed to the callbacks
     void *callbackData;
 
+    // The type of request, for reporting its timing
+    HttpRequestType httpRequestType;
+
     // Handler of response headers
     ResponseHeadersHandler responseHeadersHandler;
 
@@ -158,6 +163,13 @@ typedef struct Request
 
     // Parser of errors
     ErrorParser errorParser;
+
+    // If the request is in a request context, the class of concurrency limit
+    // it is counted against, its number in that class, and the next request
+    // queued behind it waiting for the limit
+    int limitClass;
+    unsigned int limitSequence;
+    struct Request *limitNext;
 } Request;
 
 
@@ -171,6 +183,9 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
 // Deinitialize the API
 void request_api_deinitialize();
 
+// Set by request_api_initialize if requests are to use HTTP/2
+extern int http2G;
+
 // Perform a request; if context is 0, performs the request immediately;
 // otherwise, sets it up to be performed by context.
 void request_perform(const RequestParams *params, S3RequestContext *context);
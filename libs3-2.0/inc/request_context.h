@@ -28,13 +28,62 @@
 #define REQUEST_CONTEXT_H
 
 #include "libs3.h"
+#include "request.h"
+
+
+// Requests in a request context are started through a separate concurrency
+// limit for each class of request, as S3 throttles reads and writes
+// separately
+typedef enum
+{
+    RequestClassRead,                                   // GET, HEAD
+    RequestClassWrite,                                  // PUT, COPY, POST,
+                                                        // DELETE
+    RequestClassCount
+} RequestClass;
+
+
+// The limit grows additively while the time to first byte stays near the
+// lowest seen, and is cut multiplicatively when S3 responds with 503 Slow
+// Down or the time to first byte rises
+typedef struct ConcurrencyLimit
+{
+    // The number of requests allowed to be running
+    double limit;
+
+    // Nonzero until the limit is first cut; until then the limit grows by one
+    // for every success rather than by one for every limit's worth
+    int slowStart;
+
+    // The number of requests running
+    int running;
+
+    // The lowest time to first byte seen, in seconds
+    double minLatency;
+
+    // Each request started is numbered; requests numbered before the last
+    // cut saw the old limit, and don't cut it again
+    unsigned int sequence, cutSequence;
+
+    // Requests waiting for the limit to allow them to start, in order
+    struct Request *queueHead, *queueTail;
+} ConcurrencyLimit;
+
 
 struct S3RequestContext
 {
     CURLM *curlm;
 
     struct Request *requests;
+
+    ConcurrencyLimit limits[RequestClassCount];
 };
 
 
+// Adds a request of the given type to the context; it is started as soon as
+// its class's concurrency limit allows
+void request_context_add(S3RequestContext *context, Request *request,
+                         HttpRequestType type);
+
+
 #endif /* REQUEST_CONTEXT_H */
@@ -30,23 +30,122 @@
 #include "libs3.h"
 
 
+// Element table
+// ----------------------------------------------------------------------------
+
+// Every element of the S3 response dialect that some callback cares about,
+// as (id, parent id, element name).  Each element's parent must be listed
+// before it.  The scanner resolves each start tag against this table once,
+// so callbacks can switch on a SimpleXmlElement instead of comparing full
+// element paths for every chunk of text.  Elements not listed here are
+// reported as SimpleXmlElementUnknown (as are all of their children).
+#define SIMPLEXML_ELEMENTS(X)                                                 \
+    X(LocationConstraint, None, "LocationConstraint")                         \
+    X(Error, None, "Error")                                                   \
+    X(ErrorCode, Error, "Code")                                               \
+    X(ErrorMessage, Error, "Message")                                         \
+    X(ErrorResource, Error, "Resource")                                       \
+    X(ErrorFurtherDetails, Error, "FurtherDetails")                           \
+    X(ListBucketResult, None, "ListBucketResult")                             \
+    X(ListBucketResultIsTruncated, ListBucketResult, "IsTruncated")           \
+    X(ListBucketResultNextMarker, ListBucketResult, "NextMarker")             \
+    X(ListBucketResultContents, ListBucketResult, "Contents")                 \
+    X(ListBucketResultContentsKey, ListBucketResultContents, "Key")           \
+    X(ListBucketResultContentsLastModified, ListBucketResultContents,         \
+      "LastModified")                                                         \
+    X(ListBucketResultContentsETag, ListBucketResultContents, "ETag")         \
+    X(ListBucketResultContentsSize, ListBucketResultContents, "Size")         \
+    X(ListBucketResultContentsOwner, ListBucketResultContents, "Owner")       \
+    X(ListBucketResultContentsOwnerID, ListBucketResultContentsOwner, "ID")   \
+    X(ListBucketResultContentsOwnerDisplayName,                               \
+      ListBucketResultContentsOwner, "DisplayName")                           \
+    X(ListBucketResultCommonPrefixes, ListBucketResult, "CommonPrefixes")     \
+    X(ListBucketResultCommonPrefixesPrefix, ListBucketResultCommonPrefixes,   \
+      "Prefix")                                                               \
+    X(AccessControlPolicy, None, "AccessControlPolicy")                       \
+    X(AccessControlPolicyOwner, AccessControlPolicy, "Owner")                 \
+    X(AccessControlPolicyOwnerID, AccessControlPolicyOwner, "ID")             \
+    X(AccessControlPolicyOwnerDisplayName, AccessControlPolicyOwner,          \
+      "DisplayName")                                                          \
+    X(AccessControlList, AccessControlPolicy, "AccessControlList")            \
+    X(AclGrant, AccessControlList, "Grant")                                   \
+    X(AclGrantGrantee, AclGrant, "Grantee")                                   \
+    X(AclGrantGranteeEmailAddress, AclGrantGrantee, "EmailAddress")           \
+    X(AclGrantGranteeID, AclGrantGrantee, "ID")                               \
+    X(AclGrantGranteeDisplayName, AclGrantGrantee, "DisplayName")             \
+    X(AclGrantGranteeURI, AclGrantGrantee, "URI")                             \
+    X(AclGrantPermission, AclGrant, "Permission")                             \
+    X(CopyObjectResult, None, "CopyObjectResult")                             \
+    X(CopyObjectResultLastModified, CopyObjectResult, "LastModified")         \
+    X(CopyObjectResultETag, CopyObjectResult, "ETag")                         \
+    X(CopyPartResult, None, "CopyPartResult")                                 \
+    X(CopyPartResultLastModified, CopyPartResult, "LastModified")             \
+    X(CopyPartResultETag, CopyPartResult, "ETag")                             \
+    X(InitiateMultipartUploadResult, None, "InitiateMultipartUploadResult")   \
+    X(InitiateMultipartUploadResultUploadId, InitiateMultipartUploadResult,   \
+      "UploadId")                                                             \
+    X(ListAllMyBucketsResult, None, "ListAllMyBucketsResult")                 \
+    X(ListAllMyBucketsResultOwner, ListAllMyBucketsResult, "Owner")           \
+    X(ListAllMyBucketsResultOwnerID, ListAllMyBucketsResultOwner, "ID")       \
+    X(ListAllMyBucketsResultOwnerDisplayName, ListAllMyBucketsResultOwner,    \
+      "DisplayName")                                                          \
+    X(ListAllMyBucketsResultBuckets, ListAllMyBucketsResult, "Buckets")       \
+    X(ListAllMyBucketsResultBucket, ListAllMyBucketsResultBuckets, "Bucket")  \
+    X(ListAllMyBucketsResultBucketName, ListAllMyBucketsResultBucket, "Name") \
+    X(ListAllMyBucketsResultBucketCreationDate, ListAllMyBucketsResultBucket, \
+      "CreationDate")                                                         \
+    X(BucketLoggingStatus, None, "BucketLoggingStatus")                       \
+    X(LoggingEnabled, BucketLoggingStatus, "LoggingEnabled")                  \
+    X(LoggingEnabledTargetBucket, LoggingEnabled, "TargetBucket")             \
+    X(LoggingEnabledTargetPrefix, LoggingEnabled, "TargetPrefix")             \
+    X(LoggingEnabledTargetGrants, LoggingEnabled, "TargetGrants")             \
+    X(TargetGrant, LoggingEnabledTargetGrants, "Grant")                       \
+    X(TargetGrantGrantee, TargetGrant, "Grantee")                             \
+    X(TargetGrantGranteeEmailAddress, TargetGrantGrantee, "EmailAddress")     \
+    X(TargetGrantGranteeID, TargetGrantGrantee, "ID")                         \
+    X(TargetGrantGranteeDisplayName, TargetGrantGrantee, "DisplayName")       \
+    X(TargetGrantGranteeURI, TargetGrantGrantee, "URI")                       \
+    X(TargetGrantPermission, TargetGrant, "Permission")
+
+
+typedef enum
+{
+    // The document itself; this is the parent of the root element
+    SimpleXmlElementNone                                    = 0,
+    SimpleXmlElementUnknown                                 = 1,
+#define SIMPLEXML_ELEMENT_ENUM(id, parent, name) SimpleXmlElement##id,
+    SIMPLEXML_ELEMENTS(SIMPLEXML_ELEMENT_ENUM)
+#undef SIMPLEXML_ELEMENT_ENUM
+    SimpleXmlElementCount
+} SimpleXmlElement;
+
+
 // Simple XML callback.
 //
+// element: the element that the data belongs to, as resolved from the
+// element table above.
+//
 // elementPath: is the full "path" of the element; i.e.
 // <foo><bar><baz>data</baz></bar></foo> would have 'data' in the element
-// foo/bar/baz.
+// foo/bar/baz.  Only needed for elements which are not in the element table.
+//
+// data points directly into the buffer passed to simplexml_add() (or, for
+// entity references, to a small decoded copy) and is not NUL terminated;
+// character data of an element may arrive in any number of pieces.
 // 
 // Return of anything other than S3StatusOK causes the calling
 // simplexml_add() function to immediately stop and return the status.
 //
 // data is passed in as 0 on end of element
-typedef S3Status (SimpleXmlCallback)(const char *elementPath, const char *data,
+typedef S3Status (SimpleXmlCallback)(SimpleXmlElement element,
+                                     const char *elementPath, const char *data,
                                      int dataLen, void *callbackData);
 
+// Deepest element nesting that will be parsed
+#define SIMPLEXML_MAX_DEPTH 64
+
 typedef struct SimpleXml
 {
-    void *xmlParser;
-
     SimpleXmlCallback *callback;
 
     void *callbackData;
@@ -55,6 +154,22 @@ typedef struct SimpleXml
 
     int elementPathLen;
 
+    // Element id, and length of elementPath before it, for each open element
+    int elementDepth;
+
+    SimpleXmlElement elements[SIMPLEXML_MAX_DEPTH];
+
+    int elementPathLens[SIMPLEXML_MAX_DEPTH];
+
+    // Scanner state carried across simplexml_add() calls
+    int state;
+
+    int stateCount;
+
+    char token[16];
+
+    int tokenLen;
+
     S3Status status;
 } SimpleXml;
 
@@ -53,16 +53,21 @@
 // character takes 3 characters: %NN)
 #define MAX_URLENCODED_KEY_SIZE (3 * S3_MAX_KEY_SIZE)
 
+// This is the maximum size of a sub resource, the longest of which is the
+// one identifying a part of a multipart upload
+#define MAX_SUB_RESOURCE_SIZE \
+    ((sizeof("?partNumber=10000&uploadId=") - 1) + S3_MAX_UPLOAD_ID_SIZE)
+
 // This is the maximum size of a URI that could be passed to S3:
 // https://s3.amazonaws.com/${BUCKET}/${KEY}?acl
 // 255 is the maximum bucket length
 #define MAX_URI_SIZE \
     ((sizeof("https:///") - 1) + S3_MAX_HOSTNAME_SIZE + 255 + 1 +       \
-     MAX_URLENCODED_KEY_SIZE + (sizeof("?torrent" - 1)) + 1)
+     MAX_URLENCODED_KEY_SIZE + MAX_SUB_RESOURCE_SIZE + 1)
 
 // Maximum size of a canonicalized resource
 #define MAX_CANONICALIZED_RESOURCE_SIZE \
-    (1 + 255 + 1 + MAX_URLENCODED_KEY_SIZE + (sizeof("?torrent") - 1) + 1)
+    (1 + 255 + 1 + MAX_URLENCODED_KEY_SIZE + MAX_SUB_RESOURCE_SIZE + 1)
 
 
 // Utilities -----------------------------------------------------------------
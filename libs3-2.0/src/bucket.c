@@ -26,6 +26,8 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <sys/select.h>
+#include <time.h>
 #include "libs3.h"
 #include "request.h"
 #include "simplexml.h"
@@ -47,15 +49,18 @@ typedef struct TestBucketData
 } TestBucketData;
 
 
-static S3Status testBucketXmlCallback(const char *elementPath,
+static S3Status testBucketXmlCallback(SimpleXmlElement element,
+                                      const char *elementPath,
                                       const char *data, int dataLen,
                                       void *callbackData)
 {
+    (void) elementPath;
+
     TestBucketData *tbData = (TestBucketData *) callbackData;
 
     int fit;
 
-    if (data && !strcmp(elementPath, "LocationConstraint")) {
+    if (data && (element == SimpleXmlElementLocationConstraint)) {
         string_buffer_append(tbData->locationConstraint, data, dataLen, fit);
     }
 
@@ -386,31 +391,34 @@ void S3_delete_bucket(S3Protocol protocol, S3UriStyle uriStyle,
 
 // list bucket ----------------------------------------------------------------
 
-typedef struct ListBucketContents
-{
-    string_buffer(key, 1024);
-    string_buffer(lastModified, 256);
-    string_buffer(eTag, 256);
-    string_buffer(size, 24);
-    string_buffer(ownerId, 256);
-    string_buffer(ownerDisplayName, 256);
-} ListBucketContents;
+// All of the strings of a page of results are kept in one growable arena,
+// each stored as an int length, the bytes, and a terminating NUL.  Entries
+// refer to their strings by arena offset, since the arena moves when it
+// grows.  A whole page is delivered in one callback, and the arena is reused
+// for the next page.
 
+// Initial arena size; enough for a typical page of 1000 keys
+#define LIST_BUCKET_ARENA_INITIAL_SIZE (128 * 1024)
+// We deliver at most this many Contents or CommonPrefixes in one callback;
+// S3 never returns more than 1000 of each in a page
+#define LIST_BUCKET_MAX_BATCH 1000
 
-static void initialize_list_bucket_contents(ListBucketContents *contents)
+typedef enum
 {
-    string_buffer_initialize(contents->key);
-    string_buffer_initialize(contents->lastModified);
-    string_buffer_initialize(contents->eTag);
-    string_buffer_initialize(contents->size);
-    string_buffer_initialize(contents->ownerId);
-    string_buffer_initialize(contents->ownerDisplayName);
-}
-
-// We read up to 32 Contents at a time
-#define MAX_CONTENTS 32
-// We read up to 8 CommonPrefixes at a time
-#define MAX_COMMON_PREFIXES 8
+    ListBucketFieldKey,
+    ListBucketFieldLastModified,
+    ListBucketFieldETag,
+    ListBucketFieldSize,
+    ListBucketFieldOwnerId,
+    ListBucketFieldOwnerDisplayName,
+    ListBucketFieldCount
+} ListBucketField;
+
+typedef struct ListBucketEntry
+{
+    // Arena offset of each field, or -1 if the field was not present
+    int fields[ListBucketFieldCount];
+} ListBucketEntry;
 
 typedef struct ListBucketData
 {
@@ -420,26 +428,154 @@ typedef struct ListBucketData
     S3ListBucketCallback *listBucketCallback;
     S3ResponseCompleteCallback *responseCompleteCallback;
     void *callbackData;
+    int rawLastModified;
 
     string_buffer(isTruncated, 64);
     string_buffer(nextMarker, 1024);
 
+    char *arena;
+    int arenaSize, arenaLen;
+
+    // Arena offset of the string currently being appended to, and the
+    // element that it belongs to
+    int openString;
+    SimpleXmlElement openElement;
+
     int contentsCount;
-    ListBucketContents contents[MAX_CONTENTS];
+    int entriesSize, contentsSize;
+    ListBucketEntry *entries;
+    S3ListBucketContent *contents;
 
     int commonPrefixesCount;
-    char commonPrefixes[MAX_COMMON_PREFIXES][1024];
-    int commonPrefixLens[MAX_COMMON_PREFIXES];
+    int commonPrefixOffsetsSize, commonPrefixesSize;
+    int *commonPrefixOffsets;
+    const char **commonPrefixes;
 } ListBucketData;
 
 
+static void initialize_list_bucket_entry(ListBucketEntry *entry)
+{
+    int i;
+    for (i = 0; i < ListBucketFieldCount; i++) {
+        entry->fields[i] = -1;
+    }
+}
+
+
 static void initialize_list_bucket_data(ListBucketData *lbData)
 {
+    lbData->arenaLen = 0;
+    lbData->openString = -1;
+    lbData->openElement = SimpleXmlElementNone;
     lbData->contentsCount = 0;
-    initialize_list_bucket_contents(lbData->contents);
+    initialize_list_bucket_entry(lbData->entries);
     lbData->commonPrefixesCount = 0;
-    lbData->commonPrefixes[0][0] = 0;
-    lbData->commonPrefixLens[0] = 0;
+    lbData->commonPrefixOffsets[0] = -1;
+}
+
+
+static void deinitialize_list_bucket_data(ListBucketData *lbData)
+{
+    free(lbData->arena);
+    free(lbData->entries);
+    free(lbData->contents);
+    free(lbData->commonPrefixOffsets);
+    free(lbData->commonPrefixes);
+}
+
+
+// Grows *array, of *size elements of elementSize bytes, to hold at least
+// count elements
+static int grow_array(void **array, int *size, int elementSize, int count)
+{
+    if (count <= *size) {
+        return 1;
+    }
+
+    int newSize = *size ? *size : 64;
+    while (newSize < count) {
+        newSize *= 2;
+    }
+
+    void *newArray = realloc(*array, (size_t) newSize * elementSize);
+    if (!newArray) {
+        return 0;
+    }
+
+    *array = newArray;
+    *size = newSize;
+    return 1;
+}
+
+
+static int arena_reserve(ListBucketData *lbData, int len)
+{
+    void *arena = lbData->arena;
+    int ret = grow_array(&arena, &(lbData->arenaSize), 1,
+                         lbData->arenaLen + len);
+    lbData->arena = (char *) arena;
+    return ret;
+}
+
+
+static const char *arena_string(ListBucketData *lbData, int offset)
+{
+    return (offset < 0) ? 0 : &(lbData->arena[offset + sizeof(int)]);
+}
+
+
+static int arena_string_length(ListBucketData *lbData, int offset)
+{
+    int len = 0;
+    if (offset >= 0) {
+        memcpy(&len, &(lbData->arena[offset]), sizeof(int));
+    }
+    return len;
+}
+
+
+// Appends data to the string for element, starting a new string if element
+// is not the element that the open string belongs to.  Returns the arena
+// offset of the string, or -1 if out of memory.
+static int arena_append(ListBucketData *lbData, SimpleXmlElement element,
+                        const char *data, int dataLen)
+{
+    if (lbData->openElement != element) {
+        if (!arena_reserve(lbData, sizeof(int))) {
+            return -1;
+        }
+        lbData->openString = lbData->arenaLen;
+        lbData->openElement = element;
+        lbData->arenaLen += sizeof(int);
+    }
+
+    if (!arena_reserve(lbData, dataLen)) {
+        return -1;
+    }
+    memcpy(&(lbData->arena[lbData->arenaLen]), data, dataLen);
+    lbData->arenaLen += dataLen;
+
+    return lbData->openString;
+}
+
+
+// Terminates the open string, if there is one, and stores its length
+static int arena_close(ListBucketData *lbData)
+{
+    if (lbData->openString < 0) {
+        return 1;
+    }
+
+    if (!arena_reserve(lbData, 1)) {
+        return 0;
+    }
+    int len = lbData->arenaLen - lbData->openString - sizeof(int);
+    memcpy(&(lbData->arena[lbData->openString]), &len, sizeof(int));
+    lbData->arena[lbData->arenaLen++] = 0;
+
+    lbData->openString = -1;
+    lbData->openElement = SimpleXmlElementNone;
+    return 1;
 }
 
 
@@ -451,135 +587,167 @@ static S3Status make_list_bucket_callback(ListBucketData *lbData)
     int isTruncated = (!strcmp(lbData->isTruncated, "true") ||
                        !strcmp(lbData->isTruncated, "1")) ? 1 : 0;
 
-    // Convert the contents
-    S3ListBucketContent contents[lbData->contentsCount];
-
+    // Convert the contents; entries past contentsCount have never been
+    // completed, so they are not reported
     int contentsCount = lbData->contentsCount;
+    void *contents = lbData->contents;
+    if (!grow_array(&contents, &(lbData->contentsSize),
+                    sizeof(S3ListBucketContent), contentsCount)) {
+        return S3StatusOutOfMemory;
+    }
+    lbData->contents = (S3ListBucketContent *) contents;
     for (i = 0; i < contentsCount; i++) {
-        S3ListBucketContent *contentDest = &(contents[i]);
-        ListBucketContents *contentSrc = &(lbData->contents[i]);
-        contentDest->key = contentSrc->key;
-        contentDest->lastModified = 
-            parseIso8601Time(contentSrc->lastModified);
-        contentDest->eTag = contentSrc->eTag;
-        contentDest->size = parseUnsignedInt(contentSrc->size);
-        contentDest->ownerId =
-            contentSrc->ownerId[0] ?contentSrc->ownerId : 0;
-        contentDest->ownerDisplayName = (contentSrc->ownerDisplayName[0] ?
-                                         contentSrc->ownerDisplayName : 0);
+        S3ListBucketContent *contentDest = &(lbData->contents[i]);
+        const int *fields = lbData->entries[i].fields;
+        const char *key = arena_string(lbData, fields[ListBucketFieldKey]);
+        const char *lastModified = 
+            arena_string(lbData, fields[ListBucketFieldLastModified]);
+        const char *size = arena_string(lbData, fields[ListBucketFieldSize]);
+        const char *eTag = arena_string(lbData, fields[ListBucketFieldETag]);
+        const char *ownerId = 
+            arena_string(lbData, fields[ListBucketFieldOwnerId]);
+        const char *ownerDisplayName = 
+            arena_string(lbData, fields[ListBucketFieldOwnerDisplayName]);
+        contentDest->key = key ? key : "";
+        contentDest->keyLen = 
+            arena_string_length(lbData, fields[ListBucketFieldKey]);
+        contentDest->lastModifiedString = lastModified ? lastModified : "";
+        contentDest->lastModified = lbData->rawLastModified ? -1 :
+            parseIso8601Time(contentDest->lastModifiedString);
+        contentDest->eTag = eTag ? eTag : "";
+        contentDest->size = size ? parseUnsignedInt(size) : 0;
+        contentDest->ownerId = (ownerId && ownerId[0]) ? ownerId : 0;
+        contentDest->ownerDisplayName = 
+            (ownerDisplayName && ownerDisplayName[0]) ? ownerDisplayName : 0;
     }
 
     // Make the common prefixes array
     int commonPrefixesCount = lbData->commonPrefixesCount;
-    char *commonPrefixes[commonPrefixesCount];
+    void *commonPrefixes = lbData->commonPrefixes;
+    if (!grow_array(&commonPrefixes, &(lbData->commonPrefixesSize),
+                    sizeof(const char *), commonPrefixesCount)) {
+        return S3StatusOutOfMemory;
+    }
+    lbData->commonPrefixes = (const char **) commonPrefixes;
     for (i = 0; i < commonPrefixesCount; i++) {
-        commonPrefixes[i] = lbData->commonPrefixes[i];
+        const char *prefix = 
+            arena_string(lbData, lbData->commonPrefixOffsets[i]);
+        lbData->commonPrefixes[i] = prefix ? prefix : "";
     }
 
     return (*(lbData->listBucketCallback))
         (isTruncated, lbData->nextMarker,
-         contentsCount, contents, commonPrefixesCount, 
-         (const char **) commonPrefixes, lbData->callbackData);
+         contentsCount, lbData->contents, commonPrefixesCount, 
+         lbData->commonPrefixes, lbData->callbackData);
+}
+
+
+// Makes the callback for everything collected so far and starts a new batch
+static S3Status flush_list_bucket_data(ListBucketData *lbData)
+{
+    S3Status status = make_list_bucket_callback(lbData);
+    initialize_list_bucket_data(lbData);
+    return status;
 }
 
 
-static S3Status listBucketXmlCallback(const char *elementPath,
+static S3Status listBucketXmlCallback(SimpleXmlElement element,
+                                      const char *elementPath,
                                       const char *data, int dataLen,
                                       void *callbackData)
 {
+    (void) elementPath;
+
     ListBucketData *lbData = (ListBucketData *) callbackData;
 
     int fit;
 
     if (data) {
-        if (!strcmp(elementPath, "ListBucketResult/IsTruncated")) {
+        ListBucketField field;
+        switch (element) {
+        case SimpleXmlElementListBucketResultIsTruncated:
             string_buffer_append(lbData->isTruncated, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListBucketResult/NextMarker")) {
+            return S3StatusOK;
+        case SimpleXmlElementListBucketResultNextMarker:
             string_buffer_append(lbData->nextMarker, data, dataLen, fit);
+            return S3StatusOK;
+        case SimpleXmlElementListBucketResultCommonPrefixesPrefix: {
+            int offset = arena_append(lbData, element, data, dataLen);
+            if (offset < 0) {
+                return S3StatusOutOfMemory;
+            }
+            lbData->commonPrefixOffsets[lbData->commonPrefixesCount] = offset;
+            return S3StatusOK;
         }
-        else if (!strcmp(elementPath, "ListBucketResult/Contents/Key")) {
-            ListBucketContents *contents = 
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->key, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, 
-                         "ListBucketResult/Contents/LastModified")) {
-            ListBucketContents *contents = 
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->lastModified, data, dataLen, fit);
+        case SimpleXmlElementListBucketResultContentsKey:
+            field = ListBucketFieldKey;
+            break;
+        case SimpleXmlElementListBucketResultContentsLastModified:
+            field = ListBucketFieldLastModified;
+            break;
+        case SimpleXmlElementListBucketResultContentsETag:
+            field = ListBucketFieldETag;
+            break;
+        case SimpleXmlElementListBucketResultContentsSize:
+            field = ListBucketFieldSize;
+            break;
+        case SimpleXmlElementListBucketResultContentsOwnerID:
+            field = ListBucketFieldOwnerId;
+            break;
+        case SimpleXmlElementListBucketResultContentsOwnerDisplayName:
+            field = ListBucketFieldOwnerDisplayName;
+            break;
+        default:
+            // Whitespace between elements, or elements we don't report
+            return S3StatusOK;
         }
-        else if (!strcmp(elementPath, "ListBucketResult/Contents/ETag")) {
-            ListBucketContents *contents = 
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->eTag, data, dataLen, fit);
+        int offset = arena_append(lbData, element, data, dataLen);
+        if (offset < 0) {
+            return S3StatusOutOfMemory;
         }
-        else if (!strcmp(elementPath, "ListBucketResult/Contents/Size")) {
-            ListBucketContents *contents = 
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->size, data, dataLen, fit);
+        lbData->entries[lbData->contentsCount].fields[field] = offset;
+        return S3StatusOK;
+    }
+
+    if (!arena_close(lbData)) {
+        return S3StatusOutOfMemory;
+    }
+
+    if (element == SimpleXmlElementListBucketResultContents) {
+        // Finished a Contents
+        lbData->contentsCount++;
+        if (lbData->contentsCount == LIST_BUCKET_MAX_BATCH) {
+            return flush_list_bucket_data(lbData);
         }
-        else if (!strcmp(elementPath, "ListBucketResult/Contents/Owner/ID")) {
-            ListBucketContents *contents = 
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->ownerId, data, dataLen, fit);
+        // Initialize the next one
+        void *entries = lbData->entries;
+        if (!grow_array(&entries, &(lbData->entriesSize),
+                        sizeof(ListBucketEntry), lbData->contentsCount + 1)) {
+            return S3StatusOutOfMemory;
         }
-        else if (!strcmp(elementPath, 
-                         "ListBucketResult/Contents/Owner/DisplayName")) {
-            ListBucketContents *contents = 
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append
-                (contents->ownerDisplayName, data, dataLen, fit);
+        lbData->entries = (ListBucketEntry *) entries;
+        initialize_list_bucket_entry
+            (&(lbData->entries[lbData->contentsCount]));
+    }
+    else if (element == SimpleXmlElementListBucketResultCommonPrefixesPrefix) {
+        // Finished a Prefix
+        lbData->commonPrefixesCount++;
+        if (lbData->commonPrefixesCount == LIST_BUCKET_MAX_BATCH) {
+            return flush_list_bucket_data(lbData);
         }
-        else if (!strcmp(elementPath, 
-                         "ListBucketResult/CommonPrefixes/Prefix")) {
-            int which = lbData->commonPrefixesCount;
-            lbData->commonPrefixLens[which] +=
-                snprintf(lbData->commonPrefixes[which],
-                         sizeof(lbData->commonPrefixes[which]) -
-                         lbData->commonPrefixLens[which] - 1,
-                         "%.*s", dataLen, data);
-            if (lbData->commonPrefixLens[which] >=
-                (int) sizeof(lbData->commonPrefixes[which])) {
-                return S3StatusXmlParseFailure;
-            }
+        // Initialize the next one
+        void *offsets = lbData->commonPrefixOffsets;
+        if (!grow_array(&offsets, &(lbData->commonPrefixOffsetsSize),
+                        sizeof(int), lbData->commonPrefixesCount + 1)) {
+            return S3StatusOutOfMemory;
         }
+        lbData->commonPrefixOffsets = (int *) offsets;
+        lbData->commonPrefixOffsets[lbData->commonPrefixesCount] = -1;
     }
-    else {
-        if (!strcmp(elementPath, "ListBucketResult/Contents")) {
-            // Finished a Contents
-            lbData->contentsCount++;
-            if (lbData->contentsCount == MAX_CONTENTS) {
-                // Make the callback
-                S3Status status = make_list_bucket_callback(lbData);
-                if (status != S3StatusOK) {
-                    return status;
-                }
-                initialize_list_bucket_data(lbData);
-            }
-            else {
-                // Initialize the next one
-                initialize_list_bucket_contents
-                    (&(lbData->contents[lbData->contentsCount]));
-            }
-        }
-        else if (!strcmp(elementPath,
-                         "ListBucketResult/CommonPrefixes/Prefix")) {
-            // Finished a Prefix
-            lbData->commonPrefixesCount++;
-            if (lbData->commonPrefixesCount == MAX_COMMON_PREFIXES) {
-                // Make the callback
-                S3Status status = make_list_bucket_callback(lbData);
-                if (status != S3StatusOK) {
-                    return status;
-                }
-                initialize_list_bucket_data(lbData);
-            }
-            else {
-                // Initialize the next one
-                lbData->commonPrefixes[lbData->commonPrefixesCount][0] = 0;
-                lbData->commonPrefixLens[lbData->commonPrefixesCount] = 0;
-            }
+    else if (element == SimpleXmlElementListBucketResult) {
+        // Finished the page
+        if (lbData->contentsCount || lbData->commonPrefixesCount) {
+            return flush_list_bucket_data(lbData);
         }
     }
 
@@ -615,7 +783,8 @@ static void listBucketCompleteCallback(S3Status requestStatus,
 {
     ListBucketData *lbData = (ListBucketData *) callbackData;
 
-    // Make the callback if there is anything
+    // Make the callback if there is anything left over, which only happens
+    // if the document was cut short
     if (lbData->contentsCount || lbData->commonPrefixesCount) {
         make_list_bucket_callback(lbData);
     }
@@ -625,6 +794,8 @@ static void listBucketCompleteCallback(S3Status requestStatus,
 
     simplexml_deinitialize(&(lbData->simpleXml));
 
+    deinitialize_list_bucket_data(lbData);
+
     free(lbData);
 }
 
@@ -698,6 +869,25 @@ void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
         return;
     }
 
+    lbData->arena = (char *) malloc(LIST_BUCKET_ARENA_INITIAL_SIZE);
+    lbData->arenaSize = LIST_BUCKET_ARENA_INITIAL_SIZE;
+    lbData->entries = (ListBucketEntry *) malloc(sizeof(ListBucketEntry));
+    lbData->entriesSize = 1;
+    lbData->contents = 0;
+    lbData->contentsSize = 0;
+    lbData->commonPrefixOffsets = (int *) malloc(sizeof(int));
+    lbData->commonPrefixOffsetsSize = 1;
+    lbData->commonPrefixes = 0;
+    lbData->commonPrefixesSize = 0;
+
+    if (!lbData->arena || !lbData->entries || !lbData->commonPrefixOffsets) {
+        deinitialize_list_bucket_data(lbData);
+        free(lbData);
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
     simplexml_initialize(&(lbData->simpleXml), &listBucketXmlCallback, lbData);
     
     lbData->responsePropertiesCallback = 
@@ -706,6 +896,7 @@ void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
     lbData->responseCompleteCallback = 
         handler->responseHandler.completeCallback;
     lbData->callbackData = callbackData;
+    lbData->rawLastModified = handler->rawLastModified;
 
     string_buffer_initialize(lbData->isTruncated);
     string_buffer_initialize(lbData->nextMarker);
@@ -741,3 +932,736 @@ void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
     // Perform the request
     request_perform(&params, requestContext);
 }
+
+
+// list bucket parallel -------------------------------------------------------
+
+// The keyspace is split into partitions, kept in a doubly-linked list in key
+// order.  A partition is either a run of keys that have already been listed,
+// or a prefix that still has to be listed.  A prefix partition is first
+// "discovered" with a delimiter listing, which replaces it with the keys
+// directly beneath it and one new prefix partition per common prefix; once
+// there is enough fan-out, the remaining prefixes are listed in full,
+// concurrently, on one request context.  Results are delivered from the head
+// of the list as it becomes complete, so the caller sees keys in order.
+
+// Prefixes are split no deeper than this below the requested prefix
+#define LIST_PARALLEL_MAX_DEPTH 4
+// Prefixes are split while there are fewer than this many outstanding
+// partitions per unit of concurrency
+#define LIST_PARALLEL_FANOUT 4
+// A request that S3 throttles is made again, up to this many times; in the
+// meantime the request context cuts back how many requests it runs at once
+#define LIST_PARALLEL_MAX_THROTTLED 5
+// A throttled request is made again after this many milliseconds, doubling
+// each time the same partition is throttled; the second half of each delay
+// is random, so that partitions throttled together don't all retry together
+#define LIST_PARALLEL_THROTTLED_DELAY 100
+
+typedef struct ListParallelPage
+{
+    struct ListParallelPage *next;
+
+    int contentsCount;
+    // The contents, followed by all of their strings, in one allocation
+    S3ListBucketContent *contents;
+} ListParallelPage;
+
+typedef enum
+{
+    ListPartitionStateKeys,
+    ListPartitionStateDiscover,
+    ListPartitionStateList,
+    ListPartitionStateRunning,
+    // Throttled, and waiting for retryTime to make its request again
+    ListPartitionStateThrottled,
+    ListPartitionStateDone
+} ListPartitionState;
+
+typedef struct ListPartition
+{
+    struct ListPartition *prev, *next;
+
+    struct ListParallelData *lpData;
+
+    ListPartitionState state;
+    // Nonzero if the running request is a delimiter listing
+    int discovering;
+    int depth;
+    char *prefix;
+
+    int isTruncated;
+    // The marker that the running request started from, and the one that
+    // the next request will start from
+    char *requestMarker, *marker;
+
+    // The number of times that S3 has throttled this partition's requests,
+    // and while throttled, when its request is to be made again (in
+    // milliseconds of the monotonic clock)
+    int throttledCount;
+    int64_t retryTime;
+
+    ListParallelPage *pagesHead, *pagesTail;
+} ListPartition;
+
+typedef struct ListParallelData
+{
+    S3BucketContext bucketContext;
+    const char *delimiter;
+    int maxConcurrency;
+
+    S3RequestContext *requestContext;
+    S3ListBucketHandler partitionHandler;
+
+    const S3ListBucketHandler *handler;
+    void *callbackData;
+
+    ListPartition *head, *tail;
+    int pendingCount, runningCount, throttledCount;
+    int scheduling;
+
+    // Seeds the random part of throttling delays
+    unsigned int seed;
+
+    S3Status status;
+    int completed;
+} ListParallelData;
+
+
+static int string_size(const char *str)
+{
+    return str ? (strlen(str) + 1) : 0;
+}
+
+
+static const char *copy_string(char **dest, const char *str)
+{
+    if (!str) {
+        return 0;
+    }
+
+    const char *ret = *dest;
+    int size = strlen(str) + 1;
+    memcpy(*dest, str, size);
+    *dest += size;
+    return ret;
+}
+
+
+// strdup() is not available under strict C99
+static char *duplicate_string(const char *str)
+{
+    int size = strlen(str) + 1;
+    char *ret = (char *) malloc(size);
+
+    if (ret) {
+        memcpy(ret, str, size);
+    }
+
+    return ret;
+}
+
+
+static ListParallelPage *copy_list_parallel_page
+    (int contentsCount, const S3ListBucketContent *contents)
+{
+    ListParallelPage *page = 
+        (ListParallelPage *) malloc(sizeof(ListParallelPage));
+
+    if (!page) {
+        return 0;
+    }
+
+    int i, size = contentsCount * sizeof(S3ListBucketContent);
+    for (i = 0; i < contentsCount; i++) {
+        size += (contents[i].keyLen + 1) + string_size(contents[i].eTag) +
+            string_size(contents[i].ownerId) + 
+            string_size(contents[i].ownerDisplayName) +
+            string_size(contents[i].lastModifiedString);
+    }
+
+    if (!(page->contents = (S3ListBucketContent *) malloc(size))) {
+        free(page);
+        return 0;
+    }
+
+    char *strings = (char *) &(page->contents[contentsCount]);
+
+    for (i = 0; i < contentsCount; i++) {
+        S3ListBucketContent *content = &(page->contents[i]);
+        *content = contents[i];
+        memcpy(strings, contents[i].key, contents[i].keyLen + 1);
+        content->key = strings;
+        strings += contents[i].keyLen + 1;
+        content->eTag = copy_string(&strings, contents[i].eTag);
+        content->ownerId = copy_string(&strings, contents[i].ownerId);
+        content->ownerDisplayName = 
+            copy_string(&strings, contents[i].ownerDisplayName);
+        content->lastModifiedString = 
+            copy_string(&strings, contents[i].lastModifiedString);
+    }
+
+    page->next = 0;
+    page->contentsCount = contentsCount;
+
+    return page;
+}
+
+
+static void add_list_parallel_page(ListPartition *partition,
+                                   ListParallelPage *page)
+{
+    if (partition->pagesTail) {
+        partition->pagesTail->next = page;
+    }
+    else {
+        partition->pagesHead = page;
+    }
+    partition->pagesTail = page;
+}
+
+
+// Creates a partition and links it in before next, or at the tail if next is
+// 0
+static ListPartition *create_list_partition(ListParallelData *lpData,
+                                            ListPartition *next,
+                                            ListPartitionState state,
+                                            const char *prefix, int depth)
+{
+    ListPartition *partition = (ListPartition *) malloc(sizeof(ListPartition));
+
+    if (!partition) {
+        return 0;
+    }
+
+    partition->prefix = 0;
+    if (prefix && !(partition->prefix = duplicate_string(prefix))) {
+        free(partition);
+        return 0;
+    }
+
+    partition->lpData = lpData;
+    partition->state = state;
+    partition->discovering = 0;
+    partition->depth = depth;
+    partition->isTruncated = 0;
+    partition->requestMarker = partition->marker = 0;
+    partition->throttledCount = 0;
+    partition->retryTime = 0;
+    partition->pagesHead = partition->pagesTail = 0;
+
+    partition->next = next;
+    partition->prev = next ? next->prev : lpData->tail;
+    if (partition->prev) {
+        partition->prev->next = partition;
+    }
+    else {
+        lpData->head = partition;
+    }
+    if (next) {
+        next->prev = partition;
+    }
+    else {
+        lpData->tail = partition;
+    }
+
+    if ((state == ListPartitionStateDiscover) ||
+        (state == ListPartitionStateList)) {
+        lpData->pendingCount++;
+    }
+
+    return partition;
+}
+
+
+static void destroy_list_partition(ListParallelData *lpData,
+                                   ListPartition *partition)
+{
+    if (partition->prev) {
+        partition->prev->next = partition->next;
+    }
+    else {
+        lpData->head = partition->next;
+    }
+    if (partition->next) {
+        partition->next->prev = partition->prev;
+    }
+    else {
+        lpData->tail = partition->prev;
+    }
+
+    while (partition->pagesHead) {
+        ListParallelPage *page = partition->pagesHead;
+        partition->pagesHead = page->next;
+        free(page->contents);
+        free(page);
+    }
+
+    free(partition->prefix);
+    free(partition->requestMarker);
+    free(partition->marker);
+    free(partition);
+}
+
+
+static int64_t now_milliseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((int64_t) ts.tv_sec) * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+// Records the first failure and reports it to the caller right away, while
+// the error details are still valid; nothing more is delivered after this
+static void fail_list_parallel(ListParallelData *lpData, S3Status status,
+                               const S3ErrorDetails *error)
+{
+    if (lpData->status != S3StatusOK) {
+        return;
+    }
+
+    lpData->status = status;
+    lpData->completed = 1;
+
+    (*(lpData->handler->responseHandler.completeCallback))
+        (status, error, lpData->callbackData);
+}
+
+
+// Delivers everything at the head of the list that is complete
+static void deliver_list_parallel(ListParallelData *lpData)
+{
+    while (lpData->head && (lpData->status == S3StatusOK)) {
+        ListPartition *partition = lpData->head;
+
+        while (partition->pagesHead) {
+            ListParallelPage *page = partition->pagesHead;
+            partition->pagesHead = page->next;
+            if (!partition->pagesHead) {
+                partition->pagesTail = 0;
+            }
+
+            S3Status status = (*(lpData->handler->listBucketCallback))
+                (0, page->contents[page->contentsCount - 1].key,
+                 page->contentsCount, page->contents, 0, 0,
+                 lpData->callbackData);
+
+            free(page->contents);
+            free(page);
+
+            if (status != S3StatusOK) {
+                fail_list_parallel(lpData, status, 0);
+                return;
+            }
+        }
+
+        if ((partition->state != ListPartitionStateKeys) &&
+            (partition->state != ListPartitionStateDone)) {
+            return;
+        }
+
+        destroy_list_partition(lpData, partition);
+    }
+}
+
+
+static void start_list_partition(ListPartition *partition)
+{
+    ListParallelData *lpData = partition->lpData;
+
+    lpData->runningCount++;
+
+    free(partition->requestMarker);
+    partition->requestMarker = partition->marker;
+    partition->marker = 0;
+
+    S3_list_bucket(&(lpData->bucketContext), partition->prefix,
+                   partition->requestMarker,
+                   partition->discovering ? lpData->delimiter : 0, 0,
+                   lpData->requestContext, &(lpData->partitionHandler),
+                   partition);
+}
+
+
+// Starts pending partitions, earliest first, while there is spare
+// concurrency
+static void schedule_list_parallel(ListParallelData *lpData)
+{
+    // Starting a request can complete it immediately on error, which calls
+    // back into here
+    if (lpData->scheduling) {
+        return;
+    }
+    lpData->scheduling = 1;
+
+    ListPartition *partition = lpData->head;
+
+    while (partition && lpData->pendingCount && 
+           (lpData->status == S3StatusOK) &&
+           (lpData->runningCount < lpData->maxConcurrency)) {
+        ListPartition *next = partition->next;
+        if ((partition->state == ListPartitionStateDiscover) ||
+            (partition->state == ListPartitionStateList)) {
+            lpData->pendingCount--;
+            partition->discovering = 
+                (partition->state == ListPartitionStateDiscover);
+            partition->state = ListPartitionStateRunning;
+            start_list_partition(partition);
+        }
+        partition = next;
+    }
+
+    lpData->scheduling = 0;
+}
+
+
+// Makes throttled partitions whose delay has passed pending again, and
+// returns the number of milliseconds until the next one's delay passes, or
+// -1 if there are none left
+static int64_t release_list_partitions(ListParallelData *lpData)
+{
+    int64_t now = now_milliseconds(), wait = -1;
+
+    ListPartition *partition = lpData->throttledCount ? lpData->head : 0;
+    for (; partition; partition = partition->next) {
+        if (partition->state != ListPartitionStateThrottled) {
+            continue;
+        }
+        if (partition->retryTime > now) {
+            if ((wait == -1) || ((partition->retryTime - now) < wait)) {
+                wait = partition->retryTime - now;
+            }
+            continue;
+        }
+        lpData->throttledCount--;
+        lpData->pendingCount++;
+        partition->state = partition->discovering ?
+            ListPartitionStateDiscover : ListPartitionStateList;
+    }
+
+    return wait;
+}
+
+
+// Like S3_runall_request_context, but also waits out the delays of throttled
+// partitions and starts them again, until no partition is running or
+// throttled
+static S3Status run_list_parallel(ListParallelData *lpData)
+{
+    S3RequestContext *requestContext = lpData->requestContext;
+
+    for (;;) {
+        // Throttled partitions are abandoned once the listing has failed
+        int64_t wait = -1;
+        if (lpData->status == S3StatusOK) {
+            wait = release_list_partitions(lpData);
+            schedule_list_parallel(lpData);
+        }
+
+        if (!lpData->runningCount && (wait == -1)) {
+            return S3StatusOK;
+        }
+
+        fd_set readfds, writefds, exceptfds;
+        FD_ZERO(&readfds);
+        FD_ZERO(&writefds);
+        FD_ZERO(&exceptfds);
+        int maxfd;
+        S3Status status = S3_get_request_context_fdsets
+            (requestContext, &readfds, &writefds, &exceptfds, &maxfd);
+        if (status != S3StatusOK) {
+            return status;
+        }
+        // As in S3_runall_request_context, don't wait on requests that have
+        // no fds yet; but with nothing running, the select just sleeps until
+        // the next throttled partition is due
+        if ((maxfd != -1) || !lpData->runningCount) {
+            int64_t timeout = lpData->runningCount ?
+                S3_get_request_context_timeout(requestContext) : -1;
+            if ((wait != -1) && ((timeout == -1) || (wait < timeout))) {
+                timeout = wait;
+            }
+            struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+            select(maxfd + 1, &readfds, &writefds, &exceptfds,
+                   (timeout == -1) ? 0 : &tv);
+        }
+
+        int requestsRemaining;
+        status = S3_runonce_request_context(requestContext,
+                                            &requestsRemaining);
+        if (status != S3StatusOK) {
+            return status;
+        }
+    }
+}
+
+
+// Splits one page of a delimiter listing of partition into the partitions
+// that precede it
+static S3Status discover_list_partition(ListPartition *partition,
+                                       int contentsCount,
+                                       const S3ListBucketContent *contents,
+                                       int commonPrefixesCount,
+                                       const char **commonPrefixes)
+{
+    ListParallelData *lpData = partition->lpData;
+
+    int depth = partition->depth + 1;
+
+    int c = 0, p = 0;
+
+    while ((c < contentsCount) || (p < commonPrefixesCount)) {
+        // Every key under a common prefix sorts after the prefix itself, so
+        // keys and prefixes merge by plain string comparison
+        int keys = 0;
+        while (((c + keys) < contentsCount) &&
+               ((p == commonPrefixesCount) ||
+                (strcmp(contents[c + keys].key, commonPrefixes[p]) < 0))) {
+            keys++;
+        }
+
+        if (keys) {
+            ListParallelPage *page = copy_list_parallel_page
+                (keys, &(contents[c]));
+            if (!page) {
+                return S3StatusOutOfMemory;
+            }
+            ListPartition *prev = partition->prev;
+            if (!prev || (prev->state != ListPartitionStateKeys)) {
+                if (!(prev = create_list_partition
+                      (lpData, partition, ListPartitionStateKeys, 0, 0))) {
+                    free(page->contents);
+                    free(page);
+                    return S3StatusOutOfMemory;
+                }
+            }
+            add_list_parallel_page(prev, page);
+            c += keys;
+        }
+
+        if (p < commonPrefixesCount) {
+            // The marker of this request may be the last common prefix of
+            // the previous one, which some servers report again
+            if (!partition->requestMarker || 
+                strcmp(partition->requestMarker, commonPrefixes[p])) {
+                ListPartitionState state = 
+                    ((depth < LIST_PARALLEL_MAX_DEPTH) &&
+                     ((lpData->pendingCount + lpData->runningCount +
+                       lpData->throttledCount) <
+                      (LIST_PARALLEL_FANOUT * lpData->maxConcurrency))) ?
+                    ListPartitionStateDiscover : ListPartitionStateList;
+                if (!create_list_partition(lpData, partition, state, 
+                                           commonPrefixes[p], depth)) {
+                    return S3StatusOutOfMemory;
+                }
+            }
+            p++;
+        }
+    }
+
+    return S3StatusOK;
+}
+
+
+static S3Status listPartitionPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    ListPartition *partition = (ListPartition *) callbackData;
+    ListParallelData *lpData = partition->lpData;
+
+    if (lpData->status != S3StatusOK) {
+        return lpData->status;
+    }
+
+    return (*(lpData->handler->responseHandler.propertiesCallback))
+        (responseProperties, lpData->callbackData);
+}
+
+
+static S3Status listPartitionCallback(int isTruncated, const char *nextMarker,
+                                      int contentsCount, 
+                                      const S3ListBucketContent *contents,
+                                      int commonPrefixesCount,
+                                      const char **commonPrefixes,
+                                      void *callbackData)
+{
+    ListPartition *partition = (ListPartition *) callbackData;
+    ListParallelData *lpData = partition->lpData;
+
+    if (lpData->status != S3StatusOK) {
+        return lpData->status;
+    }
+
+    if (partition->discovering) {
+        S3Status status = discover_list_partition
+            (partition, contentsCount, contents, commonPrefixesCount,
+             commonPrefixes);
+        if (status != S3StatusOK) {
+            return status;
+        }
+    }
+    else if (contentsCount) {
+        ListParallelPage *page = 
+            copy_list_parallel_page(contentsCount, contents);
+        if (!page) {
+            return S3StatusOutOfMemory;
+        }
+        add_list_parallel_page(partition, page);
+    }
+
+    partition->isTruncated = isTruncated;
+
+    // S3 only returns NextMarker for delimiter listings; otherwise the last
+    // key is the marker for the next page
+    if (!nextMarker || !nextMarker[0]) {
+        nextMarker = 0;
+        if (contentsCount) {
+            nextMarker = contents[contentsCount - 1].key;
+        }
+        if (commonPrefixesCount && 
+            (!nextMarker || 
+             (strcmp(commonPrefixes[commonPrefixesCount - 1], 
+                     nextMarker) > 0))) {
+            nextMarker = commonPrefixes[commonPrefixesCount - 1];
+        }
+    }
+    if (nextMarker) {
+        char *marker = duplicate_string(nextMarker);
+        if (!marker) {
+            return S3StatusOutOfMemory;
+        }
+        free(partition->marker);
+        partition->marker = marker;
+    }
+
+    deliver_list_parallel(lpData);
+
+    return lpData->status;
+}
+
+
+static void listPartitionCompleteCallback(S3Status requestStatus, 
+                                          const S3ErrorDetails *s3ErrorDetails,
+                                          void *callbackData)
+{
+    ListPartition *partition = (ListPartition *) callbackData;
+    ListParallelData *lpData = partition->lpData;
+
+    lpData->runningCount--;
+
+    // Nothing was listed, so the same request can be made again, once S3 has
+    // had time to recover
+    if ((requestStatus == S3StatusErrorSlowDown) && 
+        (lpData->status == S3StatusOK) &&
+        (partition->throttledCount++ < LIST_PARALLEL_MAX_THROTTLED)) {
+        free(partition->marker);
+        partition->marker = partition->requestMarker;
+        partition->requestMarker = 0;
+        int delay = LIST_PARALLEL_THROTTLED_DELAY << 
+            (partition->throttledCount - 1);
+        partition->state = ListPartitionStateThrottled;
+        partition->retryTime = now_milliseconds() + (delay / 2) +
+            (rand_r(&(lpData->seed)) % ((delay / 2) + 1));
+        lpData->throttledCount++;
+        return;
+    }
+
+    if (requestStatus != S3StatusOK) {
+        fail_list_parallel(lpData, requestStatus, s3ErrorDetails);
+        return;
+    }
+
+    if (lpData->status != S3StatusOK) {
+        return;
+    }
+
+    if (partition->isTruncated && partition->marker) {
+        partition->isTruncated = 0;
+        start_list_partition(partition);
+        return;
+    }
+
+    if (partition->discovering) {
+        // Everything beneath it now precedes it in the list
+        destroy_list_partition(lpData, partition);
+    }
+    else {
+        partition->state = ListPartitionStateDone;
+    }
+
+    deliver_list_parallel(lpData);
+
+    schedule_list_parallel(lpData);
+}
+
+
+void S3_list_bucket_parallel(const S3BucketContext *bucketContext,
+                             const char *prefix, const char *delimiter,
+                             int maxConcurrency,
+                             const S3ListBucketHandler *handler,
+                             void *callbackData)
+{
+    ListParallelData lpData =
+    {
+        *bucketContext,
+        delimiter ? delimiter : "/",
+        (maxConcurrency > 0) ? maxConcurrency : 1,
+        0,
+        {
+            { &listPartitionPropertiesCallback, 
+              &listPartitionCompleteCallback },
+            &listPartitionCallback,
+            handler->rawLastModified
+        },
+        handler,
+        callbackData,
+        0, 0,
+        0, 0, 0,
+        0,
+        0,
+        S3StatusOK,
+        0
+    };
+
+    S3Status status = S3_create_request_context(&(lpData.requestContext));
+
+    if (status != S3StatusOK) {
+        (*(handler->responseHandler.completeCallback))
+            (status, 0, callbackData);
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    lpData.seed = (unsigned int) ts.tv_nsec;
+
+    if (create_list_partition(&lpData, 0, ListPartitionStateDiscover, 
+                              prefix, 0)) {
+        status = run_list_parallel(&lpData);
+    }
+    else {
+        status = S3StatusOutOfMemory;
+    }
+
+    if (status != S3StatusOK) {
+        fail_list_parallel(&lpData, status, 0);
+    }
+    else if (lpData.head) {
+        // Nothing is running but something was left undelivered
+        fail_list_parallel(&lpData, S3StatusInternalError, 0);
+    }
+
+    // Any requests still in the context are completed as interrupted, and
+    // need their partitions to still exist
+    S3_destroy_request_context(lpData.requestContext);
+
+    while (lpData.head) {
+        destroy_list_partition(&lpData, lpData.head);
+    }
+
+    if (!lpData.completed) {
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusOK, 0, callbackData);
+    }
+}
@@ -28,7 +28,8 @@
 #include "error_parser.h"
 
 
-static S3Status errorXmlCallback(const char *elementPath, const char *data,
+static S3Status errorXmlCallback(SimpleXmlElement element,
+                                 const char *elementPath, const char *data,
                                  int dataLen, void *callbackData)
 {
     // We ignore end of element callbacks because we don't care about them
@@ -40,26 +41,27 @@ static S3Status errorXmlCallback(const char *elementPath, const char *data,
 
     int fit;
 
-    if (!strcmp(elementPath, "Error")) {
+    switch (element) {
+    case SimpleXmlElementError:
         // Ignore, this is the Error element itself, we only care about subs
-    }
-    else if (!strcmp(elementPath, "Error/Code")) {
+        break;
+    case SimpleXmlElementErrorCode:
         string_buffer_append(errorParser->code, data, dataLen, fit);
-    }
-    else if (!strcmp(elementPath, "Error/Message")) {
+        break;
+    case SimpleXmlElementErrorMessage:
         string_buffer_append(errorParser->message, data, dataLen, fit);
         errorParser->s3ErrorDetails.message = errorParser->message;
-    }
-    else if (!strcmp(elementPath, "Error/Resource")) {
+        break;
+    case SimpleXmlElementErrorResource:
         string_buffer_append(errorParser->resource, data, dataLen, fit);
         errorParser->s3ErrorDetails.resource = errorParser->resource;
-    }
-    else if (!strcmp(elementPath, "Error/FurtherDetails")) {
+        break;
+    case SimpleXmlElementErrorFurtherDetails:
         string_buffer_append(errorParser->furtherDetails, data, dataLen, fit);
         errorParser->s3ErrorDetails.furtherDetails = 
             errorParser->furtherDetails;
-    }
-    else {
+        break;
+    default: {
         if (strncmp(elementPath, "Error/", sizeof("Error/") - 1)) {
             // If for some weird reason it's not within the Error element,
             // ignore it
@@ -109,6 +111,8 @@ static S3Status errorXmlCallback(const char *elementPath, const char *data,
               [errorParser->s3ErrorDetails.extraDetailsCount++]);
         nv->name = name;
         nv->value = value;
+        break;
+    }
     }
 
     return S3StatusOK;
@@ -271,16 +271,19 @@ typedef struct ConvertAclData
 } ConvertAclData;
 
 
-static S3Status convertAclXmlCallback(const char *elementPath,
+static S3Status convertAclXmlCallback(SimpleXmlElement element,
+                                      const char *elementPath,
                                       const char *data, int dataLen,
                                       void *callbackData)
 {
+    (void) elementPath;
+
     ConvertAclData *caData = (ConvertAclData *) callbackData;
 
     int fit;
 
     if (data) {
-        if (!strcmp(elementPath, "AccessControlPolicy/Owner/ID")) {
+        if (element == SimpleXmlElementAccessControlPolicyOwnerID) {
             caData->ownerIdLen += 
                 snprintf(&(caData->ownerId[caData->ownerIdLen]),
                          S3_MAX_GRANTEE_USER_ID_SIZE - caData->ownerIdLen - 1,
@@ -289,8 +292,8 @@ static S3Status convertAclXmlCallback(const char *elementPath,
                 return S3StatusUserIdTooLong;
             }
         }
-        else if (!strcmp(elementPath, "AccessControlPolicy/Owner/"
-                         "DisplayName")) {
+        else if (element ==
+                 SimpleXmlElementAccessControlPolicyOwnerDisplayName) {
             caData->ownerDisplayNameLen += 
                 snprintf(&(caData->ownerDisplayName
                            [caData->ownerDisplayNameLen]),
@@ -302,45 +305,35 @@ static S3Status convertAclXmlCallback(const char *elementPath,
                 return S3StatusUserDisplayNameTooLong;
             }
         }
-        else if (!strcmp(elementPath, 
-                    "AccessControlPolicy/AccessControlList/Grant/"
-                    "Grantee/EmailAddress")) {
+        else if (element == SimpleXmlElementAclGrantGranteeEmailAddress) {
             // AmazonCustomerByEmail
             string_buffer_append(caData->emailAddress, data, dataLen, fit);
             if (!fit) {
                 return S3StatusEmailAddressTooLong;
             }
         }
-        else if (!strcmp(elementPath,
-                         "AccessControlPolicy/AccessControlList/Grant/"
-                         "Grantee/ID")) {
+        else if (element == SimpleXmlElementAclGrantGranteeID) {
             // CanonicalUser
             string_buffer_append(caData->userId, data, dataLen, fit);
             if (!fit) {
                 return S3StatusUserIdTooLong;
             }
         }
-        else if (!strcmp(elementPath,
-                         "AccessControlPolicy/AccessControlList/Grant/"
-                         "Grantee/DisplayName")) {
+        else if (element == SimpleXmlElementAclGrantGranteeDisplayName) {
             // CanonicalUser
             string_buffer_append(caData->userDisplayName, data, dataLen, fit);
             if (!fit) {
                 return S3StatusUserDisplayNameTooLong;
             }
         }
-        else if (!strcmp(elementPath,
-                         "AccessControlPolicy/AccessControlList/Grant/"
-                         "Grantee/URI")) {
+        else if (element == SimpleXmlElementAclGrantGranteeURI) {
             // Group
             string_buffer_append(caData->groupUri, data, dataLen, fit);
             if (!fit) {
                 return S3StatusGroupUriTooLong;
             }
         }
-        else if (!strcmp(elementPath,
-                         "AccessControlPolicy/AccessControlList/Grant/"
-                         "Permission")) {
+        else if (element == SimpleXmlElementAclGrantPermission) {
             // Permission
             string_buffer_append(caData->permission, data, dataLen, fit);
             if (!fit) {
@@ -349,8 +342,7 @@ static S3Status convertAclXmlCallback(const char *elementPath,
         }
     }
     else {
-        if (!strcmp(elementPath, "AccessControlPolicy/AccessControlList/"
-                    "Grant")) {
+        if (element == SimpleXmlElementAclGrant) {
             // A grant has just been completed; so add the next S3AclGrant
             // based on the values read
             if (*(caData->aclGrantCountReturn) == S3_MAX_ACL_GRANT_COUNT) {
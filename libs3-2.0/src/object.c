@@ -90,19 +90,24 @@ typedef struct CopyObjectData
 } CopyObjectData;
 
 
-static S3Status copyObjectXmlCallback(const char *elementPath,
+static S3Status copyObjectXmlCallback(SimpleXmlElement element,
+                                      const char *elementPath,
                                       const char *data, int dataLen,
                                       void *callbackData)
 {
+    (void) elementPath;
+
     CopyObjectData *coData = (CopyObjectData *) callbackData;
 
     int fit;
 
     if (data) {
-        if (!strcmp(elementPath, "CopyObjectResult/LastModified")) {
+        if ((element == SimpleXmlElementCopyObjectResultLastModified) ||
+            (element == SimpleXmlElementCopyPartResultLastModified)) {
             string_buffer_append(coData->lastModified, data, dataLen, fit);
         }
-        else if (!strcmp(elementPath, "CopyObjectResult/ETag")) {
+        else if ((element == SimpleXmlElementCopyObjectResultETag) ||
+                 (element == SimpleXmlElementCopyPartResultETag)) {
             if (coData->eTagReturnSize && coData->eTagReturn) {
                 coData->eTagReturnLen +=
                     snprintf(&(coData->eTagReturn[coData->eTagReturnLen]),
@@ -166,19 +171,14 @@ static void copyObjectCompleteCallback(S3Status requestStatus,
 }
 
 
-void S3_copy_object(const S3BucketContext *bucketContext, const char *key,
-                    const char *destinationBucket, const char *destinationKey,
-                    const S3PutProperties *putProperties,
-                    int64_t *lastModifiedReturn, int eTagReturnSize,
-                    char *eTagReturn, S3RequestContext *requestContext,
-                    const S3ResponseHandler *handler, void *callbackData)
+static CopyObjectData *create_copy_object_data
+    (int64_t *lastModifiedReturn, int eTagReturnSize, char *eTagReturn,
+     const S3ResponseHandler *handler, void *callbackData)
 {
-    // Create the callback data
     CopyObjectData *data = 
         (CopyObjectData *) malloc(sizeof(CopyObjectData));
     if (!data) {
-        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
-        return;
+        return 0;
     }
 
     simplexml_initialize(&(data->simpleXml), &copyObjectXmlCallback, data);
@@ -196,6 +196,26 @@ void S3_copy_object(const S3BucketContext *bucketContext, const char *key,
     data->eTagReturnLen = 0;
     string_buffer_initialize(data->lastModified);
 
+    return data;
+}
+
+
+void S3_copy_object(const S3BucketContext *bucketContext, const char *key,
+                    const char *destinationBucket, const char *destinationKey,
+                    const S3PutProperties *putProperties,
+                    int64_t *lastModifiedReturn, int eTagReturnSize,
+                    char *eTagReturn, S3RequestContext *requestContext,
+                    const S3ResponseHandler *handler, void *callbackData)
+{
+    // Create the callback data
+    CopyObjectData *data = create_copy_object_data
+        (lastModifiedReturn, eTagReturnSize, eTagReturn, handler,
+         callbackData);
+    if (!data) {
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
     // Set up the RequestParams
     RequestParams params =
     {
@@ -229,6 +249,65 @@ void S3_copy_object(const S3BucketContext *bucketContext, const char *key,
 }
 
 
+void S3_copy_object_part(const S3BucketContext *bucketContext,
+                         const char *key, const char *destinationBucket,
+                         const char *destinationKey, const char *uploadId,
+                         int partNumber, uint64_t startByte,
+                         uint64_t byteCount, int eTagReturnSize,
+                         char *eTagReturn, S3RequestContext *requestContext,
+                         const S3ResponseHandler *handler,
+                         void *callbackData)
+{
+    char subResource[MAX_SUB_RESOURCE_SIZE];
+    if (snprintf(subResource, sizeof(subResource), 
+                 "partNumber=%d&uploadId=%s", partNumber, uploadId) >=
+        (int) sizeof(subResource)) {
+        (*(handler->completeCallback))
+            (S3StatusUriTooLong, 0, callbackData);
+        return;
+    }
+
+    // Create the callback data
+    CopyObjectData *data = create_copy_object_data
+        (0, eTagReturnSize, eTagReturn, handler, callbackData);
+    if (!data) {
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypeCOPY,                          // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          destinationBucket ? destinationBucket : 
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey },           // secretAccessKey
+        destinationKey,                               // key
+        0,                                            // queryParams
+        subResource,                                  // subResource
+        bucketContext->bucketName,                    // copySourceBucketName
+        key,                                          // copySourceKey
+        0,                                            // getConditions
+        startByte,                                    // startByte
+        byteCount,                                    // byteCount
+        0,                                            // putProperties
+        &copyObjectPropertiesCallback,                // propertiesCallback
+        0,                                            // toS3Callback
+        0,                                            // toS3CallbackTotalSize
+        &copyObjectDataCallback,                      // fromS3Callback
+        &copyObjectCompleteCallback,                  // completeCallback
+        data                                          // callbackData
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+}
+
+
 // get object ----------------------------------------------------------------
 
 void S3_get_object(const S3BucketContext *bucketContext, const char *key,
@@ -343,3 +422,370 @@ void S3_delete_object(const S3BucketContext *bucketContext, const char *key,
     // Perform the request
     request_perform(&params, requestContext);
 }
+
+
+// initiate multipart --------------------------------------------------------
+
+typedef struct InitiateMultipartData
+{
+    SimpleXml simpleXml;
+
+    S3ResponsePropertiesCallback *responsePropertiesCallback;
+    S3ResponseCompleteCallback *responseCompleteCallback;
+    void *callbackData;
+
+    int uploadIdReturnSize;
+    char *uploadIdReturn;
+    int uploadIdReturnLen;
+} InitiateMultipartData;
+
+
+static S3Status initiateMultipartXmlCallback(SimpleXmlElement element,
+                                             const char *elementPath,
+                                             const char *data, int dataLen,
+                                             void *callbackData)
+{
+    (void) elementPath;
+
+    InitiateMultipartData *imData = (InitiateMultipartData *) callbackData;
+
+    if (data && 
+        (element == SimpleXmlElementInitiateMultipartUploadResultUploadId)) {
+        imData->uploadIdReturnLen +=
+            snprintf(&(imData->uploadIdReturn[imData->uploadIdReturnLen]),
+                     imData->uploadIdReturnSize - 
+                     imData->uploadIdReturnLen, "%.*s", dataLen, data);
+        if (imData->uploadIdReturnLen >= imData->uploadIdReturnSize) {
+            return S3StatusXmlParseFailure;
+        }
+    }
+
+    return S3StatusOK;
+}
+
+
+static S3Status initiateMultipartPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    InitiateMultipartData *imData = (InitiateMultipartData *) callbackData;
+    
+    return (*(imData->responsePropertiesCallback))
+        (responseProperties, imData->callbackData);
+}
+
+
+static S3Status initiateMultipartDataCallback(int bufferSize, 
+                                              const char *buffer,
+                                              void *callbackData)
+{
+    InitiateMultipartData *imData = (InitiateMultipartData *) callbackData;
+
+    return simplexml_add(&(imData->simpleXml), buffer, bufferSize);
+}
+
+
+static void initiateMultipartCompleteCallback
+    (S3Status requestStatus, const S3ErrorDetails *s3ErrorDetails,
+     void *callbackData)
+{
+    InitiateMultipartData *imData = (InitiateMultipartData *) callbackData;
+
+    // An upload id is the whole point of the request
+    if ((requestStatus == S3StatusOK) && !imData->uploadIdReturnLen) {
+        requestStatus = S3StatusXmlParseFailure;
+    }
+
+    (*(imData->responseCompleteCallback))
+        (requestStatus, s3ErrorDetails, imData->callbackData);
+
+    simplexml_deinitialize(&(imData->simpleXml));
+
+    free(imData);
+}
+
+
+void S3_initiate_multipart(const S3BucketContext *bucketContext,
+                           const char *key,
+                           const S3PutProperties *putProperties,
+                           int uploadIdReturnSize, char *uploadIdReturn,
+                           S3RequestContext *requestContext,
+                           const S3ResponseHandler *handler,
+                           void *callbackData)
+{
+    if (uploadIdReturnSize < 1) {
+        (*(handler->completeCallback))
+            (S3StatusInternalError, 0, callbackData);
+        return;
+    }
+
+    // Create the callback data
+    InitiateMultipartData *data = 
+        (InitiateMultipartData *) malloc(sizeof(InitiateMultipartData));
+    if (!data) {
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    simplexml_initialize(&(data->simpleXml), &initiateMultipartXmlCallback,
+                         data);
+
+    data->responsePropertiesCallback = handler->propertiesCallback;
+    data->responseCompleteCallback = handler->completeCallback;
+    data->callbackData = callbackData;
+
+    data->uploadIdReturnSize = uploadIdReturnSize;
+    data->uploadIdReturn = uploadIdReturn;
+    data->uploadIdReturn[0] = 0;
+    data->uploadIdReturnLen = 0;
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypePOST,                          // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey },           // secretAccessKey
+        key,                                          // key
+        0,                                            // queryParams
+        "uploads",                                    // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        putProperties,                                // putProperties
+        &initiateMultipartPropertiesCallback,         // propertiesCallback
+        0,                                            // toS3Callback
+        0,                                            // toS3CallbackTotalSize
+        &initiateMultipartDataCallback,               // fromS3Callback
+        &initiateMultipartCompleteCallback,           // completeCallback
+        data                                          // callbackData
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+}
+
+
+// complete multipart --------------------------------------------------------
+
+typedef struct CompleteMultipartData
+{
+    // S3 can report a failure to complete in the body of a 200 response, so
+    // the body is always run through an error parser
+    ErrorParser errorParser;
+
+    S3ResponsePropertiesCallback *responsePropertiesCallback;
+    S3ResponseCompleteCallback *responseCompleteCallback;
+    void *callbackData;
+
+    // The CompleteMultipartUpload document that is sent
+    char *doc;
+    int docLen, docBytesWritten;
+} CompleteMultipartData;
+
+
+static S3Status completeMultipartPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    CompleteMultipartData *cmData = (CompleteMultipartData *) callbackData;
+    
+    return (*(cmData->responsePropertiesCallback))
+        (responseProperties, cmData->callbackData);
+}
+
+
+static int completeMultipartToS3Callback(int bufferSize, char *buffer,
+                                         void *callbackData)
+{
+    CompleteMultipartData *cmData = (CompleteMultipartData *) callbackData;
+
+    if (!cmData->docLen) {
+        return 0;
+    }
+
+    int remaining = (cmData->docLen - cmData->docBytesWritten);
+
+    int toCopy = bufferSize > remaining ? remaining : bufferSize;
+    
+    if (!toCopy) {
+        return 0;
+    }
+
+    memcpy(buffer, &(cmData->doc[cmData->docBytesWritten]), toCopy);
+
+    cmData->docBytesWritten += toCopy;
+
+    return toCopy;
+}
+
+
+static S3Status completeMultipartFromS3Callback(int bufferSize,
+                                                const char *buffer,
+                                                void *callbackData)
+{
+    CompleteMultipartData *cmData = (CompleteMultipartData *) callbackData;
+
+    return error_parser_add(&(cmData->errorParser), (char *) buffer, 
+                            bufferSize);
+}
+
+
+static void completeMultipartCompleteCallback
+    (S3Status requestStatus, const S3ErrorDetails *s3ErrorDetails,
+     void *callbackData)
+{
+    CompleteMultipartData *cmData = (CompleteMultipartData *) callbackData;
+
+    if ((requestStatus == S3StatusOK) && cmData->errorParser.codeLen) {
+        error_parser_convert_status(&(cmData->errorParser), &requestStatus);
+        s3ErrorDetails = &(cmData->errorParser.s3ErrorDetails);
+    }
+
+    (*(cmData->responseCompleteCallback))
+        (requestStatus, s3ErrorDetails, cmData->callbackData);
+
+    error_parser_deinitialize(&(cmData->errorParser));
+
+    free(cmData->doc);
+
+    free(cmData);
+}
+
+
+void S3_complete_multipart(const S3BucketContext *bucketContext,
+                           const char *key, const char *uploadId,
+                           int partsCount, const char **partETags,
+                           S3RequestContext *requestContext,
+                           const S3ResponseHandler *handler,
+                           void *callbackData)
+{
+    char subResource[MAX_SUB_RESOURCE_SIZE];
+    if (snprintf(subResource, sizeof(subResource), "uploadId=%s", 
+                 uploadId) >= (int) sizeof(subResource)) {
+        (*(handler->completeCallback))
+            (S3StatusUriTooLong, 0, callbackData);
+        return;
+    }
+
+    // Create the callback data
+    CompleteMultipartData *data = 
+        (CompleteMultipartData *) malloc(sizeof(CompleteMultipartData));
+    if (!data) {
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    // Compose the document
+#define PART_FORMAT "<Part><PartNumber>%d</PartNumber><ETag>%s</ETag></Part>"
+
+    int i, docSize = sizeof("<CompleteMultipartUpload>"
+                            "</CompleteMultipartUpload>");
+    for (i = 0; i < partsCount; i++) {
+        docSize += sizeof(PART_FORMAT) + 16 + strlen(partETags[i]);
+    }
+
+    if (!(data->doc = (char *) malloc(docSize))) {
+        free(data);
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    data->docLen = snprintf(data->doc, docSize, "%s", 
+                            "<CompleteMultipartUpload>");
+    for (i = 0; i < partsCount; i++) {
+        data->docLen += snprintf(&(data->doc[data->docLen]), 
+                                 docSize - data->docLen, PART_FORMAT, 
+                                 i + 1, partETags[i]);
+    }
+    data->docLen += snprintf(&(data->doc[data->docLen]), 
+                             docSize - data->docLen, "%s", 
+                             "</CompleteMultipartUpload>");
+    data->docBytesWritten = 0;
+
+    error_parser_initialize(&(data->errorParser));
+
+    data->responsePropertiesCallback = handler->propertiesCallback;
+    data->responseCompleteCallback = handler->completeCallback;
+    data->callbackData = callbackData;
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypePOST,                          // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey },           // secretAccessKey
+        key,                                          // key
+        0,                                            // queryParams
+        subResource,                                  // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        0,                                            // putProperties
+        &completeMultipartPropertiesCallback,         // propertiesCallback
+        &completeMultipartToS3Callback,               // toS3Callback
+        data->docLen,                                 // toS3CallbackTotalSize
+        &completeMultipartFromS3Callback,             // fromS3Callback
+        &completeMultipartCompleteCallback,           // completeCallback
+        data                                          // callbackData
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+}
+
+
+// abort multipart -----------------------------------------------------------
+
+void S3_abort_multipart(const S3BucketContext *bucketContext, const char *key,
+                        const char *uploadId,
+                        S3RequestContext *requestContext,
+                        const S3ResponseHandler *handler, void *callbackData)
+{
+    char subResource[MAX_SUB_RESOURCE_SIZE];
+    if (snprintf(subResource, sizeof(subResource), "uploadId=%s", 
+                 uploadId) >= (int) sizeof(subResource)) {
+        (*(handler->completeCallback))
+            (S3StatusUriTooLong, 0, callbackData);
+        return;
+    }
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypeDELETE,                        // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey },           // secretAccessKey
+        key,                                          // key
+        0,                                            // queryParams
+        subResource,                                  // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        0,                                            // putProperties
+        handler->propertiesCallback,                  // propertiesCallback
+        0,                                            // toS3Callback
+        0,                                            // toS3CallbackTotalSize
+        0,                                            // fromS3Callback
+        handler->completeCallback,                    // completeCallback
+        callbackData                                  // callbackData
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+}
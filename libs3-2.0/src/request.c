@@ -38,6 +38,18 @@
 #define USER_AGENT_SIZE 256
 #define REQUEST_STACK_SIZE 32
 
+// A transfer is aborted as stalled, so that it can be retried, if it stays
+// below STALL_MIN_SPEED bytes per second for STALL_TIME seconds.  Once the
+// usual speed of transfers in its direction is known, it is instead aborted
+// if it stays below 1/STALL_SPEED_FRACTION of that for STALL_KNOWN_TIME
+// seconds.  Only transfers of at least STALL_SAMPLE_SIZE bytes are long
+// enough to say what the usual speed is.
+#define STALL_MIN_SPEED 1024L
+#define STALL_TIME 15L
+#define STALL_SPEED_FRACTION 16
+#define STALL_KNOWN_TIME 5L
+#define STALL_SAMPLE_SIZE (256 * 1024)
+
 static char userAgentG[USER_AGENT_SIZE];
 
 static pthread_mutex_t requestStackMutexG;
@@ -46,8 +58,18 @@ static Request *requestStackG[REQUEST_STACK_SIZE];
 
 static int requestStackCountG;
 
+static pthread_mutex_t transferSpeedMutexG;
+
+// Moving averages of the speeds of recent transfers in each direction, in
+// bytes per second, or 0 if not known yet
+static double downloadSpeedG, uploadSpeedG;
+
 char defaultHostNameG[S3_MAX_HOSTNAME_SIZE];
 
+int http2G;
+
+static S3RequestTimingCallback *requestTimingCallbackG;
+
 
 typedef struct RequestComputedValues
 {
@@ -349,6 +371,14 @@ static S3Status compose_amz_headers(const RequestParams *params,
         if (params->putProperties) {
             headers_append(1, "%s", "x-amz-metadata-directive: REPLACE");
         }
+        // A copy of part of the source (into one part of a multipart
+        // upload) gives the range with x-amz-copy-source-range
+        if (params->byteCount) {
+            headers_append(1, "x-amz-copy-source-range: bytes=%llu-%llu",
+                           (unsigned long long) params->startByte,
+                           (unsigned long long) (params->startByte + 
+                                                 params->byteCount - 1));
+        }
     }
 
     return S3StatusOK;
@@ -486,8 +516,9 @@ static S3Status compose_standard_headers(const RequestParams *params,
                   S3StatusBadIfNotMatchETag, 
                   S3StatusIfNotMatchETagTooLong);
     
-    // Range header
-    if (params->startByte || params->byteCount) {
+    // Range header; a copy's range is an x-amz header instead
+    if ((params->httpRequestType != HttpRequestTypeCOPY) &&
+        (params->startByte || params->byteCount)) {
         if (params->byteCount) {
             snprintf(values->rangeHeader, sizeof(values->rangeHeader),
                      "Range: bytes=%llu-%llu", 
@@ -676,6 +707,8 @@ static const char *http_request_type_to_verb(HttpRequestType requestType)
     case HttpRequestTypePUT:
     case HttpRequestTypeCOPY:
         return "PUT";
+    case HttpRequestTypePOST:
+        return "POST";
     default: // HttpRequestTypeDELETE
         return "DELETE";
     }
@@ -804,7 +837,7 @@ static S3Status setup_curl(Request *request,
     }
 
     // Debugging only
-    // curl_easy_setopt_safe(CURLOPT_VERBOSE, 1);
+    // curl_easy_setopt_safe(CURLOPT_VERBOSE, 1L);
     
     // Set private data to request for the benefit of S3RequestContext
     curl_easy_setopt_safe(CURLOPT_PRIVATE, request);
@@ -823,16 +856,16 @@ static S3Status setup_curl(Request *request,
 
     // Ask curl to parse the Last-Modified header.  This is easier than
     // parsing it ourselves.
-    curl_easy_setopt_safe(CURLOPT_FILETIME, 1);
+    curl_easy_setopt_safe(CURLOPT_FILETIME, 1L);
 
     // Curl docs suggest that this is necessary for multithreaded code.
     // However, it also points out that DNS timeouts will not be honored
     // during DNS lookup, which can be worked around by using the c-ares
     // library, which we do not do yet.
-    curl_easy_setopt_safe(CURLOPT_NOSIGNAL, 1);
+    curl_easy_setopt_safe(CURLOPT_NOSIGNAL, 1L);
 
     // Turn off Curl's built-in progress meter
-    curl_easy_setopt_safe(CURLOPT_NOPROGRESS, 1);
+    curl_easy_setopt_safe(CURLOPT_NOPROGRESS, 1L);
 
     // xxx todo - support setting the proxy for Curl to use (can't use https
     // for proxies though)
@@ -841,7 +874,7 @@ static S3Status setup_curl(Request *request,
 
     // I think this is useful - we don't need interactive performance, we need
     // to complete large operations quickly
-    curl_easy_setopt_safe(CURLOPT_TCP_NODELAY, 1);
+    curl_easy_setopt_safe(CURLOPT_TCP_NODELAY, 1L);
     
     // Don't use Curl's 'netrc' feature
     curl_easy_setopt_safe(CURLOPT_NETRC, CURL_NETRC_IGNORED);
@@ -849,23 +882,63 @@ static S3Status setup_curl(Request *request,
     // Don't verify S3's certificate, there are known to be issues with
     // them sometimes
     // xxx todo - support an option for verifying the S3 CA (default false)
-    curl_easy_setopt_safe(CURLOPT_SSL_VERIFYPEER, 0);
+    curl_easy_setopt_safe(CURLOPT_SSL_VERIFYPEER, 0L);
 
     // Follow any redirection directives that S3 sends
-    curl_easy_setopt_safe(CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt_safe(CURLOPT_FOLLOWLOCATION, 1L);
 
     // A safety valve in case S3 goes bananas with redirects
-    curl_easy_setopt_safe(CURLOPT_MAXREDIRS, 10);
+    curl_easy_setopt_safe(CURLOPT_MAXREDIRS, 10L);
 
     // Set the User-Agent; maybe Amazon will track these?
     curl_easy_setopt_safe(CURLOPT_USERAGENT, userAgentG);
 
-    // Set the low speed limit and time; we abort transfers that stay at
-    // less than 1K per second for more than 15 seconds.
-    // xxx todo - make these configurable
+    // Speak HTTP/2 if asked to, so that the requests of a request context
+    // share connections.  It is negotiated with the server (by ALPN over
+    // HTTPS, by an Upgrade over HTTP), falling back to HTTP/1.1 for servers
+    // that don't offer it.  A request waits for a connection being set up to
+    // show whether it can be multiplexed, rather than opening another one
+    // alongside.
+#if LIBCURL_VERSION_NUM >= 0x073100
+    if (http2G) {
+        curl_easy_setopt_safe
+            (CURLOPT_HTTP_VERSION, 
+             (params->bucketContext.protocol == S3ProtocolHTTPS) ?
+             CURL_HTTP_VERSION_2TLS : CURL_HTTP_VERSION_2_0);
+        curl_easy_setopt_safe(CURLOPT_PIPEWAIT, 1L);
+    }
+    else
+#endif
+    {
+        curl_easy_setopt_safe(CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    }
+
+    // Set the low speed limit and time, below which a transfer is taken to
+    // have stalled.  A copy has no data to measure, and S3 can take a long
+    // time over one, so those only get the fixed limit.
     // xxx todo - allow configurable max send and receive speed
-    curl_easy_setopt_safe(CURLOPT_LOW_SPEED_LIMIT, 1024);
-    curl_easy_setopt_safe(CURLOPT_LOW_SPEED_TIME, 15);
+    double usualSpeed = 0;
+    pthread_mutex_lock(&transferSpeedMutexG);
+    switch (params->httpRequestType) {
+    case HttpRequestTypeGET:
+        usualSpeed = downloadSpeedG;
+        break;
+    case HttpRequestTypePUT:
+        usualSpeed = uploadSpeedG;
+        break;
+    default:
+        break;
+    }
+    pthread_mutex_unlock(&transferSpeedMutexG);
+    long stallSpeed = usualSpeed / STALL_SPEED_FRACTION;
+    if (stallSpeed > STALL_MIN_SPEED) {
+        curl_easy_setopt_safe(CURLOPT_LOW_SPEED_LIMIT, stallSpeed);
+        curl_easy_setopt_safe(CURLOPT_LOW_SPEED_TIME, STALL_KNOWN_TIME);
+    }
+    else {
+        curl_easy_setopt_safe(CURLOPT_LOW_SPEED_LIMIT, STALL_MIN_SPEED);
+        curl_easy_setopt_safe(CURLOPT_LOW_SPEED_TIME, STALL_TIME);
+    }
 
     // Append standard headers
 #define append_standard_header(fieldName)                               \
@@ -887,6 +960,20 @@ static S3Status setup_curl(Request *request,
         request->headers = curl_slist_append(request->headers, 
                                              "Transfer-Encoding:");
     }
+    else if (params->httpRequestType == HttpRequestTypePOST) {
+        // Curl would otherwise send a form Content-Type, which is not what
+        // was signed
+        if (!values->contentTypeHeader[0]) {
+            request->headers = curl_slist_append(request->headers,
+                                                 "Content-Type:");
+        }
+        // As for a PUT, wait for the 100 Continue before sending the body;
+        // curl_read_func treats the headers as done when it is first called
+        if (params->toS3CallbackTotalSize) {
+            request->headers = curl_slist_append(request->headers,
+                                                 "Expect: 100-continue");
+        }
+    }
     
     append_standard_header(cacheControlHeader);
     append_standard_header(contentTypeHeader);
@@ -917,15 +1004,20 @@ static S3Status setup_curl(Request *request,
     // Set request type.
     switch (params->httpRequestType) {
     case HttpRequestTypeHEAD:
-    curl_easy_setopt_safe(CURLOPT_NOBODY, 1);
+    curl_easy_setopt_safe(CURLOPT_NOBODY, 1L);
         break;
     case HttpRequestTypePUT:
     case HttpRequestTypeCOPY:
-        curl_easy_setopt_safe(CURLOPT_UPLOAD, 1);
+        curl_easy_setopt_safe(CURLOPT_UPLOAD, 1L);
         break;
     case HttpRequestTypeDELETE:
     curl_easy_setopt_safe(CURLOPT_CUSTOMREQUEST, "DELETE");
         break;
+    case HttpRequestTypePOST:
+        curl_easy_setopt_safe(CURLOPT_POST, 1L);
+        curl_easy_setopt_safe(CURLOPT_POSTFIELDSIZE_LARGE, 
+                              (curl_off_t) params->toS3CallbackTotalSize);
+        break;
     default: // HttpRequestTypeGET
         break;
     }
@@ -1023,6 +1115,8 @@ static S3Status request_get(const RequestParams *params,
 
     request->callbackData = params->callbackData;
 
+    request->httpRequestType = params->httpRequestType;
+
     response_headers_handler_initialize(&(request->responseHeadersHandler));
 
     request->propertiesCallbackMade = 0;
@@ -1076,6 +1170,21 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
         defaultHostName = S3_DEFAULT_HOSTNAME;
     }
 
+    http2G = (flags & S3_INIT_HTTP2) ? 1 : 0;
+
+#if LIBCURL_VERSION_NUM >= 0x073100
+    if (http2G && 
+        !(curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP2)) {
+        curl_global_cleanup();
+        return S3StatusInternalError;
+    }
+#else
+    if (http2G) {
+        curl_global_cleanup();
+        return S3StatusInternalError;
+    }
+#endif
+
     if (snprintf(defaultHostNameG, S3_MAX_HOSTNAME_SIZE, 
                  "%s", defaultHostName) >= S3_MAX_HOSTNAME_SIZE) {
         return S3StatusUriTooLong;
@@ -1085,12 +1194,16 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
 
     requestStackCountG = 0;
 
+    // The usual transfer speeds are kept from one initialization to the next
+    pthread_mutex_init(&transferSpeedMutexG, 0);
+
     if (!userAgentInfo || !*userAgentInfo) {
         userAgentInfo = "Unknown";
     }
 
-    char platform[96];
     struct utsname utsn;
+    // room for both, with a space between them
+    char platform[sizeof(utsn.sysname) + sizeof(utsn.machine)];
     if (uname(&utsn)) {
         strncpy(platform, "Unknown", sizeof(platform));
         // Because strncpy doesn't always zero terminate
@@ -1113,6 +1226,8 @@ void request_api_deinitialize()
 {
     pthread_mutex_destroy(&requestStackMutexG);
 
+    pthread_mutex_destroy(&transferSpeedMutexG);
+
     while (requestStackCountG--) {
         request_destroy(requestStackG[requestStackCountG]);
     }
@@ -1173,27 +1288,9 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
         return_status(status);
     }
 
-    // If a RequestContext was provided, add the request to the curl multi
+    // If a RequestContext was provided, add the request to it
     if (context) {
-        CURLMcode code = curl_multi_add_handle(context->curlm, request->curl);
-        if (code == CURLM_OK) {
-            if (context->requests) {
-                request->prev = context->requests->prev;
-                request->next = context->requests;
-                context->requests->prev->next = request;
-                context->requests->prev = request;
-            }
-            else {
-                context->requests = request->next = request->prev = request;
-            }
-        }
-        else {
-            if (request->status == S3StatusOK) {
-                request->status = (code == CURLM_OUT_OF_MEMORY) ?
-                    S3StatusOutOfMemory : S3StatusInternalError;
-            }
-            request_finish(request);
-        }
+        request_context_add(context, request, params->httpRequestType);
     }
     // Else, perform the request immediately
     else {
@@ -1208,6 +1305,116 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
 }
 
 
+// Transfer sizes and speeds are read from curl as curl_off_t where it has
+// them; the double versions are deprecated since 7.55.0
+#if LIBCURL_VERSION_NUM >= 0x073700
+#define CURLINFO_SIZE_DOWNLOAD_COUNT CURLINFO_SIZE_DOWNLOAD_T
+#define CURLINFO_SPEED_DOWNLOAD_COUNT CURLINFO_SPEED_DOWNLOAD_T
+#define CURLINFO_SIZE_UPLOAD_COUNT CURLINFO_SIZE_UPLOAD_T
+#define CURLINFO_SPEED_UPLOAD_COUNT CURLINFO_SPEED_UPLOAD_T
+typedef curl_off_t CurlCount;
+#else
+#define CURLINFO_SIZE_DOWNLOAD_COUNT CURLINFO_SIZE_DOWNLOAD
+#define CURLINFO_SPEED_DOWNLOAD_COUNT CURLINFO_SPEED_DOWNLOAD
+#define CURLINFO_SIZE_UPLOAD_COUNT CURLINFO_SIZE_UPLOAD
+#define CURLINFO_SPEED_UPLOAD_COUNT CURLINFO_SPEED_UPLOAD
+typedef double CurlCount;
+#endif
+
+
+// Gets one of the CURLINFO_*_COUNT sizes or speeds above; returns nonzero
+// if curl has it
+static int curl_count(Request *request, CURLINFO info, double *value)
+{
+    CurlCount count;
+
+    if (curl_easy_getinfo(request->curl, info, &count) != CURLE_OK) {
+        return 0;
+    }
+    *value = (double) count;
+    return 1;
+}
+
+
+// Folds the speed of a finished transfer into the usual speed for its
+// direction
+static void update_transfer_speed(Request *request)
+{
+    double size, speed, *usualSpeed = 0;
+
+    if (curl_count(request, CURLINFO_SIZE_DOWNLOAD_COUNT, &size) &&
+        (size >= STALL_SAMPLE_SIZE) &&
+        curl_count(request, CURLINFO_SPEED_DOWNLOAD_COUNT, &speed)) {
+        usualSpeed = &downloadSpeedG;
+    }
+    else if (curl_count(request, CURLINFO_SIZE_UPLOAD_COUNT, &size) &&
+             (size >= STALL_SAMPLE_SIZE) &&
+             curl_count(request, CURLINFO_SPEED_UPLOAD_COUNT, &speed)) {
+        usualSpeed = &uploadSpeedG;
+    }
+
+    if (!usualSpeed) {
+        return;
+    }
+
+    pthread_mutex_lock(&transferSpeedMutexG);
+    *usualSpeed = *usualSpeed ? (((*usualSpeed * 7) + speed) / 8) : speed;
+    pthread_mutex_unlock(&transferSpeedMutexG);
+}
+
+
+// Returns a curl time, in seconds, in microseconds
+static int64_t curl_time(Request *request, CURLINFO info)
+{
+    double seconds;
+
+    if (curl_easy_getinfo(request->curl, info, &seconds) != CURLE_OK) {
+        return 0;
+    }
+    return (int64_t) (seconds * 1000000);
+}
+
+
+// Makes the request timing callback, if there is one, for a finished request
+static void report_request_timing(Request *request)
+{
+    S3RequestTiming timing;
+    long code, connects;
+    double sent, received;
+
+    if (!requestTimingCallbackG) {
+        return;
+    }
+
+    timing.verb = http_request_type_to_verb(request->httpRequestType);
+    timing.uri = request->uri;
+    timing.status = request->status;
+    // curl's code is that of the final response, not of a 100 Continue
+    timing.httpResponseCode = 
+        (curl_easy_getinfo(request->curl, CURLINFO_RESPONSE_CODE,
+                           &code) == CURLE_OK) ? (int) code : 
+        request->httpResponseCode;
+    // A request that opened no connection of its own reused one
+    timing.connectionReused = 
+        ((curl_easy_getinfo(request->curl, CURLINFO_NUM_CONNECTS,
+                            &connects) == CURLE_OK) && !connects);
+    timing.nameLookupTime = curl_time(request, CURLINFO_NAMELOOKUP_TIME);
+    timing.connectTime = curl_time(request, CURLINFO_CONNECT_TIME);
+    timing.appConnectTime = curl_time(request, CURLINFO_APPCONNECT_TIME);
+    timing.startTransferTime = 
+        curl_time(request, CURLINFO_STARTTRANSFER_TIME);
+    timing.totalTime = curl_time(request, CURLINFO_TOTAL_TIME);
+    timing.bytesSent = 
+        curl_count(request, CURLINFO_SIZE_UPLOAD_COUNT, &sent) ? 
+        (int64_t) sent : 0;
+    timing.bytesReceived = 
+        curl_count(request, CURLINFO_SIZE_DOWNLOAD_COUNT, &received) ?
+        (int64_t) received : 0;
+
+    (*requestTimingCallbackG)(&timing);
+}
+
+
 void request_finish(Request *request)
 {
     // If we haven't detected this already, we now know that the headers are
@@ -1280,6 +1487,12 @@ void request_finish(Request *request)
         }
     }
 
+    if (request->status == S3StatusOK) {
+        update_transfer_speed(request);
+    }
+
+    report_request_timing(request);
+
     (*(request->completeCallback))
         (request->status, &(request->errorParser.s3ErrorDetails),
          request->callbackData);
@@ -1390,3 +1603,9 @@ S3Status S3_generate_authenticated_query_string
     return compose_uri(buffer, S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE,
                        bucketContext, urlEncodedKey, resource, queryParams);
 }
+
+
+void S3_set_request_timing_callback(S3RequestTimingCallback *callback)
+{
+    requestTimingCallbackG = callback;
+}
@@ -31,6 +31,190 @@
 #include "request_context.h"
 
 
+// The concurrency limit that each class of request starts with, and the most
+// it can grow to
+#define CONCURRENCY_LIMIT_INITIAL 8
+#define CONCURRENCY_LIMIT_MAX 512
+
+// A time to first byte more than this many times the lowest seen, plus
+// CONCURRENCY_LATENCY_SLACK seconds, means that S3 is queueing our requests
+#define CONCURRENCY_LATENCY_TOLERANCE 2.0
+#define CONCURRENCY_LATENCY_SLACK 0.005
+
+// How much the limit is cut by for throttling, and for rising latency
+#define CONCURRENCY_THROTTLED_FACTOR 0.5
+#define CONCURRENCY_LATENCY_FACTOR 0.9
+
+
+// concurrency limits ---------------------------------------------------------
+
+static void start_request(S3RequestContext *context, Request *request)
+{
+    ConcurrencyLimit *limit = &(context->limits[request->limitClass]);
+
+    CURLMcode code = curl_multi_add_handle(context->curlm, request->curl);
+    if (code == CURLM_OK) {
+        if (context->requests) {
+            request->prev = context->requests->prev;
+            request->next = context->requests;
+            context->requests->prev->next = request;
+            context->requests->prev = request;
+        }
+        else {
+            context->requests = request->next = request->prev = request;
+        }
+        request->limitSequence = limit->sequence++;
+        limit->running++;
+    }
+    else {
+        if (request->status == S3StatusOK) {
+            request->status = (code == CURLM_OUT_OF_MEMORY) ?
+                S3StatusOutOfMemory : S3StatusInternalError;
+        }
+        request_finish(request);
+    }
+}
+
+
+// Starts queued requests, in order, while their limits allow
+static void start_queued_requests(S3RequestContext *context)
+{
+    int i;
+    for (i = 0; i < RequestClassCount; i++) {
+        ConcurrencyLimit *limit = &(context->limits[i]);
+        while (limit->queueHead && (limit->running < (int) limit->limit)) {
+            Request *request = limit->queueHead;
+            if (!(limit->queueHead = request->limitNext)) {
+                limit->queueTail = 0;
+            }
+            request->limitNext = 0;
+            start_request(context, request);
+        }
+    }
+}
+
+
+static int count_queued_requests(S3RequestContext *context)
+{
+    int i, count = 0;
+    for (i = 0; i < RequestClassCount; i++) {
+        Request *request = context->limits[i].queueHead;
+        while (request) {
+            count++;
+            request = request->limitNext;
+        }
+    }
+
+    return count;
+}
+
+
+static void cut_concurrency_limit(ConcurrencyLimit *limit, Request *request,
+                                  double factor)
+{
+    // Everything that was running when the limit was last cut may fail the
+    // same way; only cut once for all of them
+    if ((int) (request->limitSequence - limit->cutSequence) < 0) {
+        return;
+    }
+
+    limit->limit *= factor;
+    if (limit->limit < 1) {
+        limit->limit = 1;
+    }
+    limit->slowStart = 0;
+    limit->cutSequence = limit->sequence;
+}
+
+
+// Adjusts the limit of a request that has just finished, according to how S3
+// responded to it
+static void update_concurrency_limit(S3RequestContext *context,
+                                     Request *request, CURLcode result)
+{
+    ConcurrencyLimit *limit = &(context->limits[request->limitClass]);
+
+    // The limit was in use if this request was one of a full window
+    int limited = ((limit->running * 2) >= (int) limit->limit);
+
+    limit->running--;
+
+    long httpResponseCode = 0;
+    curl_easy_getinfo(request->curl, CURLINFO_RESPONSE_CODE, 
+                      &httpResponseCode);
+
+    if ((httpResponseCode == 503) || (httpResponseCode == 429)) {
+        cut_concurrency_limit(limit, request, CONCURRENCY_THROTTLED_FACTOR);
+        return;
+    }
+
+    // Failures short of a response say nothing about S3's load
+    if ((result != CURLE_OK) || !httpResponseCode) {
+        return;
+    }
+
+    // Measure from the request being sent, to leave out the time taken to
+    // connect
+    double preTransfer, startTransfer;
+    if ((curl_easy_getinfo(request->curl, CURLINFO_PRETRANSFER_TIME,
+                           &preTransfer) != CURLE_OK) ||
+        (curl_easy_getinfo(request->curl, CURLINFO_STARTTRANSFER_TIME,
+                           &startTransfer) != CURLE_OK)) {
+        return;
+    }
+    double latency = startTransfer - preTransfer;
+
+    if (!limit->minLatency || (latency < limit->minLatency)) {
+        limit->minLatency = latency;
+    }
+
+    if (latency > ((limit->minLatency * CONCURRENCY_LATENCY_TOLERANCE) +
+                   CONCURRENCY_LATENCY_SLACK)) {
+        cut_concurrency_limit(limit, request, CONCURRENCY_LATENCY_FACTOR);
+    }
+    else if (limited) {
+        limit->limit += limit->slowStart ? 1 : (1 / limit->limit);
+        if (limit->limit > CONCURRENCY_LIMIT_MAX) {
+            limit->limit = CONCURRENCY_LIMIT_MAX;
+        }
+    }
+}
+
+
+void request_context_add(S3RequestContext *context, Request *request,
+                         HttpRequestType type)
+{
+    switch (type) {
+    case HttpRequestTypeGET:
+    case HttpRequestTypeHEAD:
+        request->limitClass = RequestClassRead;
+        break;
+    default:
+        request->limitClass = RequestClassWrite;
+        break;
+    }
+
+    ConcurrencyLimit *limit = &(context->limits[request->limitClass]);
+
+    request->limitNext = 0;
+
+    if (limit->queueHead || (limit->running >= (int) limit->limit)) {
+        if (limit->queueTail) {
+            limit->queueTail->limitNext = request;
+        }
+        else {
+            limit->queueHead = request;
+        }
+        limit->queueTail = request;
+    }
+    else {
+        start_request(context, request);
+    }
+}
+
+
+// request context ------------------------------------------------------------
+
 S3Status S3_create_request_context(S3RequestContext **requestContextReturn)
 {
     *requestContextReturn = 
@@ -45,8 +229,31 @@ S3Status S3_create_request_context(S3RequestContext **requestContextReturn)
         return S3StatusOutOfMemory;
     }
 
+#if LIBCURL_VERSION_NUM >= 0x073100
+    // Let HTTP/2 requests share a connection
+    if (http2G && 
+        (curl_multi_setopt((*requestContextReturn)->curlm, 
+                           CURLMOPT_PIPELINING, (long) CURLPIPE_MULTIPLEX)
+         != CURLM_OK)) {
+        curl_multi_cleanup((*requestContextReturn)->curlm);
+        free(*requestContextReturn);
+        return S3StatusInternalError;
+    }
+#endif
+
     (*requestContextReturn)->requests = 0;
 
+    int i;
+    for (i = 0; i < RequestClassCount; i++) {
+        ConcurrencyLimit *limit = &((*requestContextReturn)->limits[i]);
+        limit->limit = CONCURRENCY_LIMIT_INITIAL;
+        limit->slowStart = 1;
+        limit->running = 0;
+        limit->minLatency = 0;
+        limit->sequence = limit->cutSequence = 0;
+        limit->queueHead = limit->queueTail = 0;
+    }
+
     return S3StatusOK;
 }
 
@@ -66,6 +273,18 @@ void S3_destroy_request_context(S3RequestContext *requestContext)
         r = rNext;
     } while (r != rFirst);
 
+    // And the same for the requests that never got started
+    int i;
+    for (i = 0; i < RequestClassCount; i++) {
+        ConcurrencyLimit *limit = &(requestContext->limits[i]);
+        while (limit->queueHead) {
+            r = limit->queueHead;
+            limit->queueHead = r->limitNext;
+            r->status = S3StatusInterrupted;
+            request_finish(r);
+        }
+    }
+
     free(requestContext);
 }
 
@@ -136,7 +355,7 @@ S3Status S3_runonce_request_context(S3RequestContext *requestContext,
                 return S3StatusInternalError;
             }
             // Remove the request from the list of requests
-            if (request->prev == request->next) {
+            if (request->next == request) {
                 // It was the only one on the list
                 requestContext->requests = 0;
             }
@@ -157,15 +376,22 @@ S3Status S3_runonce_request_context(S3RequestContext *requestContext,
                                          msg->easy_handle) != CURLM_OK) {
                 return S3StatusInternalError;
             }
+            update_concurrency_limit(requestContext, request,
+                                     msg->data.result);
             // Finish the request, ensuring that all callbacks have been made,
             // and also releases the request
             request_finish(request);
             // Now, since a callback was made, there may be new requests 
-            // queued up to be performed immediately, so do so
+            // queued up to be performed immediately, and the request that
+            // finished may have made room for queued ones, so do so
+            start_queued_requests(requestContext);
             status = CURLM_CALL_MULTI_PERFORM;
         }
     } while (status == CURLM_CALL_MULTI_PERFORM);
 
+    // Requests still waiting for their limit are remaining too
+    *requestsRemainingReturn += count_queued_requests(requestContext);
+
     return S3StatusOK;
 }
 
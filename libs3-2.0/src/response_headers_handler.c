@@ -26,6 +26,7 @@
 
 #include <ctype.h>
 #include <string.h>
+#include <strings.h>
 #include "response_headers_handler.h"
 
 
@@ -112,44 +113,47 @@ void response_headers_handler_add(ResponseHeadersHandler *handler,
 
     int valuelen = (end - c) + 1, fit;
 
-    if (!strncmp(header, "x-amz-request-id", namelen)) {
+    // Header names are compared without regard to case, as HTTP/2 sends
+    // them all in lower case
+
+    if (!strncasecmp(header, "x-amz-request-id", namelen)) {
         responseProperties->requestId = 
             string_multibuffer_current(handler->responsePropertyStrings);
         string_multibuffer_add(handler->responsePropertyStrings, c, 
                                valuelen, fit);
     }
-    else if (!strncmp(header, "x-amz-id-2", namelen)) {
+    else if (!strncasecmp(header, "x-amz-id-2", namelen)) {
         responseProperties->requestId2 = 
             string_multibuffer_current(handler->responsePropertyStrings);
         string_multibuffer_add(handler->responsePropertyStrings, c, 
                                valuelen, fit);
     }
-    else if (!strncmp(header, "Content-Type", namelen)) {
+    else if (!strncasecmp(header, "Content-Type", namelen)) {
         responseProperties->contentType = 
             string_multibuffer_current(handler->responsePropertyStrings);
         string_multibuffer_add(handler->responsePropertyStrings, c, 
                                valuelen, fit);
     }
-    else if (!strncmp(header, "Content-Length", namelen)) {
+    else if (!strncasecmp(header, "Content-Length", namelen)) {
         handler->responseProperties.contentLength = 0;
         while (*c) {
             handler->responseProperties.contentLength *= 10;
             handler->responseProperties.contentLength += (*c++ - '0');
         }
     }
-    else if (!strncmp(header, "Server", namelen)) {
+    else if (!strncasecmp(header, "Server", namelen)) {
         responseProperties->server = 
             string_multibuffer_current(handler->responsePropertyStrings);
         string_multibuffer_add(handler->responsePropertyStrings, c, 
                                valuelen, fit);
     }
-    else if (!strncmp(header, "ETag", namelen)) {
+    else if (!strncasecmp(header, "ETag", namelen)) {
         responseProperties->eTag = 
             string_multibuffer_current(handler->responsePropertyStrings);
         string_multibuffer_add(handler->responsePropertyStrings, c, 
                                valuelen, fit);
     }
-    else if (!strncmp(header, S3_METADATA_HEADER_NAME_PREFIX, 
+    else if (!strncasecmp(header, S3_METADATA_HEADER_NAME_PREFIX, 
                       sizeof(S3_METADATA_HEADER_NAME_PREFIX) - 1)) {
         // Make sure there is room for another x-amz-meta header
         if (handler->responseProperties.metaDataCount ==
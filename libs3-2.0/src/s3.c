@@ -62,6 +62,7 @@ static int showResponsePropertiesG = 0;
 static S3Protocol protocolG = S3ProtocolHTTPS;
 static S3UriStyle uriStyleG = S3UriStylePath;
 static int retriesG = 5;
+static int initFlagsG = S3_INIT_ALL;
 
 
 // Environment variables, saved as globals ----------------------------------
@@ -129,6 +130,8 @@ static char putenvBufG[256];
 #define BYTE_COUNT_PREFIX_LEN (sizeof(BYTE_COUNT_PREFIX) - 1)
 #define ALL_DETAILS_PREFIX "allDetails="
 #define ALL_DETAILS_PREFIX_LEN (sizeof(ALL_DETAILS_PREFIX) - 1)
+#define PARALLEL_PREFIX "parallel="
+#define PARALLEL_PREFIX_LEN (sizeof(PARALLEL_PREFIX) - 1)
 #define NO_STATUS_PREFIX "noStatus="
 #define NO_STATUS_PREFIX_LEN (sizeof(NO_STATUS_PREFIX) - 1)
 #define RESOURCE_PREFIX "resource="
@@ -146,7 +149,7 @@ static void S3_init()
     S3Status status;
     const char *hostname = getenv("S3_HOSTNAME");
     
-    if ((status = S3_initialize("s3", S3_INIT_ALL, hostname))
+    if ((status = S3_initialize("s3", initFlagsG, hostname))
         != S3StatusOK) {
         fprintf(stderr, "Failed to initialize libs3: %s\n", 
                 S3_get_status_name(status));
@@ -181,6 +184,8 @@ static void usageExit(FILE *out)
 "   -s/--show-properties : show response properties on stdout\n"
 "   -r/--retries         : retry retryable failures this number of times\n"
 "                          (default is 5)\n"
+"   -2/--http2           : use HTTP/2, sharing connections between the\n"
+"                          concurrent requests of a parallel list\n"
 "\n"
 "   Environment:\n"
 "\n"
@@ -216,6 +221,8 @@ static void usageExit(FILE *out)
 "     [delimiter]        : Delimiter for rolling up results set\n"
 "     [maxkeys]          : Maximum number of keys to return in results set\n"
 "     [allDetails]       : Show full details for each key\n"
+"     [parallel]         : Number of concurrent requests to list with; not\n"
+"                          allowed with marker, delimiter or maxkeys\n"
 "\n"
 "   getacl               : Get the ACL of a bucket or key\n"
 "     <bucket>[/<key>]   : Bucket or bucket/key to get the ACL of\n"
@@ -697,6 +704,7 @@ static struct option longOptionsG[] =
     { "unencrypted",          no_argument,        0,  'u' },
     { "show-properties",      no_argument,        0,  's' },
     { "retries",              required_argument,  0,  'r' },
+    { "http2",                no_argument,        0,  '2' },
     { 0,                      0,                  0,   0  }
 };
 
@@ -1193,7 +1201,7 @@ static S3Status listBucketCallback(int isTruncated, const char *nextMarker,
 
 static void list_bucket(const char *bucketName, const char *prefix,
                         const char *marker, const char *delimiter,
-                        int maxkeys, int allDetails)
+                        int maxkeys, int allDetails, int parallel)
 {
     S3_init();
     
@@ -1210,7 +1218,8 @@ static void list_bucket(const char *bucketName, const char *prefix,
     S3ListBucketHandler listBucketHandler =
     {
         { &responsePropertiesCallback, &responseCompleteCallback },
-        &listBucketCallback
+        &listBucketCallback,
+        0
     };
 
     list_bucket_callback_data data;
@@ -1219,16 +1228,29 @@ static void list_bucket(const char *bucketName, const char *prefix,
     data.keyCount = 0;
     data.allDetails = allDetails;
 
-    do {
-        data.isTruncated = 0;
+    if (parallel) {
+        // Keys already printed can't be taken back, so only retry if none
+        // were
         do {
-            S3_list_bucket(&bucketContext, prefix, data.nextMarker,
-                           delimiter, maxkeys, 0, &listBucketHandler, &data);
-        } while (S3_status_is_retryable(statusG) && should_retry());
-        if (statusG != S3StatusOK) {
-            break;
-        }
-    } while (data.isTruncated && (!maxkeys || (data.keyCount < maxkeys)));
+            S3_list_bucket_parallel(&bucketContext, prefix, 0, parallel,
+                                    &listBucketHandler, &data);
+        } while (S3_status_is_retryable(statusG) && !data.keyCount &&
+                 should_retry());
+    }
+    else {
+        do {
+            data.isTruncated = 0;
+            do {
+                S3_list_bucket(&bucketContext, prefix, data.nextMarker,
+                               delimiter, maxkeys, 0, &listBucketHandler,
+                               &data);
+            } while (S3_status_is_retryable(statusG) && should_retry());
+            if (statusG != S3StatusOK) {
+                break;
+            }
+        } while (data.isTruncated && 
+                 (!maxkeys || (data.keyCount < maxkeys)));
+    }
 
     if (statusG == S3StatusOK) {
         if (!data.keyCount) {
@@ -1253,7 +1275,7 @@ static void list(int argc, char **argv, int optindex)
     const char *bucketName = 0;
 
     const char *prefix = 0, *marker = 0, *delimiter = 0;
-    int maxkeys = 0, allDetails = 0;
+    int maxkeys = 0, allDetails = 0, parallel = 0;
     while (optindex < argc) {
         char *param = argv[optindex++];
         if (!strncmp(param, PREFIX_PREFIX, PREFIX_PREFIX_LEN)) {
@@ -1277,6 +1299,9 @@ static void list(int argc, char **argv, int optindex)
                 allDetails = 1;
             }
         }
+        else if (!strncmp(param, PARALLEL_PREFIX, PARALLEL_PREFIX_LEN)) {
+            parallel = convertInt(&(param[PARALLEL_PREFIX_LEN]), "parallel");
+        }
         else if (!bucketName) {
             bucketName = param;
         }
@@ -1286,9 +1311,15 @@ static void list(int argc, char **argv, int optindex)
         }
     }
 
+    if (parallel && (marker || delimiter || maxkeys)) {
+        fprintf(stderr, "\nERROR: parallel cannot be used with marker, "
+                "delimiter, or maxkeys\n");
+        usageExit(stderr);
+    }
+
     if (bucketName) {
         list_bucket(bucketName, prefix, marker, delimiter, maxkeys, 
-                    allDetails);
+                    allDetails, parallel);
     }
     else {
         list_service(allDetails);
@@ -2658,7 +2689,7 @@ int main(int argc, char **argv)
     // Parse args
     while (1) {
         int idx = 0;
-        int c = getopt_long(argc, argv, "fhusr:", longOptionsG, &idx);
+        int c = getopt_long(argc, argv, "fhusr:2", longOptionsG, &idx);
 
         if (c == -1) {
             // End of options
@@ -2678,6 +2709,9 @@ int main(int argc, char **argv)
         case 's':
             showResponsePropertiesG = 1;
             break;
+        case '2':
+            initFlagsG |= S3_INIT_HTTP2;
+            break;
         case 'r': {
             const char *v = optarg;
             retriesG = 0;
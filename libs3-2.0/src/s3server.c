@@ -0,0 +1,3154 @@
+/** **************************************************************************
+ * s3server.c
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License version 3
+ * along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+/**
+ * This is a stand-in for S3: a small server speaking enough of the S3 REST
+ * API over plain HTTP for libs3 (and programs built on it) to be tested and
+ * benchmarked against the local machine rather than a live bucket.  Point
+ * S3_HOSTNAME at it and use HTTP (s3 -u).
+ *
+ * It supports path-style requests for: listing, creating and deleting
+ * buckets; listing objects with prefix, delimiter, marker and max-keys;
+ * GET (with Range and the If-* conditions), HEAD, PUT, DELETE and copy of
+ * objects; multi-object delete; and multipart uploads, including copied
+ * parts.  Request signatures are not checked.  ACLs are accepted and
+ * ignored, and always read back as full control for the owner.
+ *
+ * Objects are kept in memory, or with --directory in files under a
+ * directory (one subdirectory per bucket), which are loaded again on start.
+ * Only the contents are kept in files; content types and metadata last
+ * only as long as the server.  Multipart uploads in progress are always
+ * kept in memory.
+ *
+ * --latency delays every response, and --bandwidth limits the speed at which
+ * each connection sends and receives request and response bodies, so that
+ * the effect of network conditions can be measured reproducibly.  --faults
+ * goes further, injecting latencies drawn from distributions, error
+ * responses (such as 503 SlowDown), connection resets and stalls part way
+ * through bodies, each with a given probability for each kind of request.
+ * Faults are drawn from a seeded generator, so that a run can be repeated
+ * with the same faults.
+ *
+ * It speaks HTTP/1.1 only, neither TLS nor h2c: the Upgrade that libcurl
+ * sends when libs3 is initialized with S3_INIT_HTTP2 is ignored, and the
+ * requests stay on HTTP/1.1 connections.  The HTTP/2 path (many requests
+ * multiplexed over one connection) is therefore not exercised by tests or
+ * benchmarks run against this server, and needs a real endpoint.
+ **/
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "libs3.h"
+#include "simplexml.h"
+#include "util.h"
+
+
+// Constants -----------------------------------------------------------------
+
+#define DEFAULT_PORT 8080
+
+// The largest request line and headers that will be accepted
+#define REQUEST_HEADERS_SIZE (64 * 1024)
+
+#define MAX_REQUEST_HEADERS 128
+
+// Maximum number of keys in a listing, and in a multi-object delete
+#define MAX_KEYS 1000
+
+// Bodies are sent and received in pieces of this size, so that a bandwidth
+// limit can be applied between them
+#define TRANSFER_CHUNK_SIZE (16 * 1024)
+
+// Size of a quoted ETag
+#define ETAG_SIZE 64
+
+#define OWNER_ID "s3server"
+#define OWNER_DISPLAY_NAME "s3server"
+
+
+// Command-line options, saved as globals ------------------------------------
+
+static const char *directoryG = 0;
+static long latencyMsG = 0;
+static int64_t bandwidthG = 0;
+static int verboseG = 0;
+
+
+// Store ---------------------------------------------------------------------
+
+// Object contents, shared by the store and the responses sending them
+typedef struct Blob
+{
+    int refs;
+
+    int64_t size;
+
+    char data[];
+} Blob;
+
+typedef struct Object
+{
+    char *key;
+
+    int64_t size;
+
+    char eTag[ETAG_SIZE];
+
+    time_t lastModified;
+
+    // Content-Type, or 0 for the default
+    char *contentType;
+
+    // The x-amz-meta- headers, each terminated by CRLF, or 0 if there are
+    // none
+    char *metaHeaders;
+
+    // The contents, if kept in memory
+    Blob *blob;
+} Object;
+
+typedef struct Bucket
+{
+    char *name;
+
+    time_t creationDate;
+
+    char *locationConstraint;
+
+    // The objects, sorted by key
+    Object **objects;
+
+    int objectsCount, objectsSize;
+
+    struct Bucket *next;
+} Bucket;
+
+typedef struct Part
+{
+    int partNumber;
+
+    char eTag[ETAG_SIZE];
+
+    Blob *blob;
+
+    struct Part *next;
+} Part;
+
+typedef struct Upload
+{
+    char uploadId[64];
+
+    char *bucketName;
+
+    char *key;
+
+    char *contentType;
+
+    char *metaHeaders;
+
+    // Sorted by part number
+    Part *parts;
+
+    struct Upload *next;
+} Upload;
+
+// Guards everything in the store, and the counters
+static pthread_mutex_t storeMutexG = PTHREAD_MUTEX_INITIALIZER;
+
+static Bucket *bucketsG = 0;
+
+static Upload *uploadsG = 0;
+
+static unsigned long long requestCountG = 0, uploadCountG = 0;
+
+
+// Utilities -----------------------------------------------------------------
+
+static void *checked_malloc(size_t size)
+{
+    void *ret = malloc(size ? size : 1);
+    if (!ret) {
+        fprintf(stderr, "s3server: out of memory\n");
+        exit(-1);
+    }
+    return ret;
+}
+
+
+static char *string_copy(const char *str)
+{
+    if (!str) {
+        return 0;
+    }
+    size_t len = strlen(str);
+    char *ret = (char *) checked_malloc(len + 1);
+    memcpy(ret, str, len + 1);
+    return ret;
+}
+
+
+static Blob *blob_new(int64_t size)
+{
+    Blob *blob = (Blob *) checked_malloc(sizeof(Blob) + size);
+    blob->refs = 1;
+    blob->size = size;
+    return blob;
+}
+
+
+// The store mutex must be held
+static void blob_release(Blob *blob)
+{
+    if (blob && !--blob->refs) {
+        free(blob);
+    }
+}
+
+
+static void blob_release_locked(Blob *blob)
+{
+    pthread_mutex_lock(&storeMutexG);
+    blob_release(blob);
+    pthread_mutex_unlock(&storeMutexG);
+}
+
+
+static void sleep_ms(long ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) && (errno == EINTR)) {
+    }
+}
+
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1000000000.0);
+}
+
+
+// Any quotes around an ETag are not part of it
+static int etags_match(const char *a, const char *b)
+{
+    while (*a == '"') {
+        a++;
+    }
+    while (*b == '"') {
+        b++;
+    }
+    int alen = strlen(a), blen = strlen(b);
+    while (alen && (a[alen - 1] == '"')) {
+        alen--;
+    }
+    while (blen && (b[blen - 1] == '"')) {
+        blen--;
+    }
+    return ((alen == blen) && !strncmp(a, b, alen));
+}
+
+
+static void compute_etag(const char *data, int64_t size, int partsCount,
+                         char *eTag)
+{
+    // Not MD5 like S3's, but just as opaque to clients
+    uint64_t h = 0;
+    int64_t done = 0;
+    while (done < size) {
+        int chunk = ((size - done) > (1 << 20)) ? (1 << 20) :
+            (int) (size - done);
+        h = (h * 31) + hash((const unsigned char *) &(data[done]), chunk);
+        done += chunk;
+    }
+    if (partsCount) {
+        snprintf(eTag, ETAG_SIZE, "\"%016llx%016llx-%d\"",
+                 (unsigned long long) h, (unsigned long long) size,
+                 partsCount);
+    }
+    else {
+        snprintf(eTag, ETAG_SIZE, "\"%016llx%016llx\"",
+                 (unsigned long long) h, (unsigned long long) size);
+    }
+}
+
+
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+static int64_t days_from_civil(int64_t y, int m, int d)
+{
+    y -= (m <= 2);
+    int64_t era = ((y >= 0) ? y : (y - 399)) / 400;
+    int64_t yoe = y - (era * 400);
+    int64_t doy = (((153 * (m + ((m > 2) ? -3 : 9))) + 2) / 5) + d - 1;
+    int64_t doe = (yoe * 365) + (yoe / 4) - (yoe / 100) + doy;
+    return (era * 146097) + doe - 719468;
+}
+
+
+// Parses an RFC 1123 date, returning -1 if it can't be parsed
+static time_t parse_http_date(const char *str)
+{
+    static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    int day, year, hour, minute, second;
+
+    if (sscanf(str, "%*3s, %d %3s %d %d:%d:%d", &day, month, &year, &hour,
+               &minute, &second) != 6) {
+        return -1;
+    }
+    const char *m = strstr(months, month);
+    if (!m || ((m - months) % 3)) {
+        return -1;
+    }
+    return (time_t) ((days_from_civil(year, ((m - months) / 3) + 1, day) *
+                      86400) + (hour * 3600) + (minute * 60) + second);
+}
+
+
+static void format_http_date(time_t t, char *buf, int bufSize)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, bufSize, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+
+static void format_iso8601_date(time_t t, char *buf, int bufSize)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, bufSize, "%Y-%m-%dT%H:%M:%S.000Z", &tm);
+}
+
+
+static int hex_value(char c)
+{
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+
+// Decodes len bytes of %-escaped src into dest; if plusIsSpace, '+' decodes
+// to a space, as in a query string (and as S3 has it in keys, which libs3
+// encodes spaces in that way).  Returns 0 if it doesn't fit.
+static int url_decode(char *dest, int destSize, const char *src, int len,
+                      int plusIsSpace)
+{
+    int i, j = 0;
+    for (i = 0; i < len; i++) {
+        if (j == (destSize - 1)) {
+            return 0;
+        }
+        if ((src[i] == '%') && (i + 2 < len) && (hex_value(src[i + 1]) >= 0) &&
+            (hex_value(src[i + 2]) >= 0)) {
+            dest[j++] = (hex_value(src[i + 1]) << 4) | hex_value(src[i + 2]);
+            i += 2;
+        }
+        else if (plusIsSpace && (src[i] == '+')) {
+            dest[j++] = ' ';
+        }
+        else {
+            dest[j++] = src[i];
+        }
+    }
+    dest[j] = 0;
+    return 1;
+}
+
+
+// Growable buffers ----------------------------------------------------------
+
+typedef struct Buffer
+{
+    char *data;
+
+    int64_t len, size;
+} Buffer;
+
+
+static void buffer_append(Buffer *buffer, const char *data, int64_t len)
+{
+    if ((buffer->len + len + 1) > buffer->size) {
+        int64_t size = buffer->size ? (buffer->size * 2) : 1024;
+        while (size < (buffer->len + len + 1)) {
+            size *= 2;
+        }
+        char *grown = (char *) realloc(buffer->data, size);
+        if (!grown) {
+            fprintf(stderr, "s3server: out of memory\n");
+            exit(-1);
+        }
+        buffer->data = grown;
+        buffer->size = size;
+    }
+    memcpy(&(buffer->data[buffer->len]), data, len);
+    buffer->len += len;
+    buffer->data[buffer->len] = 0;
+}
+
+
+static void buffer_printf(Buffer *buffer, const char *format, ...)
+{
+    char small[1024];
+    va_list args;
+
+    va_start(args, format);
+    int len = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+
+    if (len < (int) sizeof(small)) {
+        buffer_append(buffer, small, len);
+        return;
+    }
+
+    char *large = (char *) checked_malloc(len + 1);
+    va_start(args, format);
+    vsnprintf(large, len + 1, format, args);
+    va_end(args);
+    buffer_append(buffer, large, len);
+    free(large);
+}
+
+
+// Appends str escaped for XML character data
+static void buffer_append_xml(Buffer *buffer, const char *str)
+{
+    const char *start = str;
+    for (; *str; str++) {
+        const char *entity;
+        switch (*str) {
+        case '&':
+            entity = "&amp;";
+            break;
+        case '<':
+            entity = "&lt;";
+            break;
+        case '>':
+            entity = "&gt;";
+            break;
+        case '"':
+            entity = "&quot;";
+            break;
+        case '\'':
+            entity = "&apos;";
+            break;
+        default:
+            continue;
+        }
+        buffer_append(buffer, start, str - start);
+        buffer_append(buffer, entity, strlen(entity));
+        start = str + 1;
+    }
+    buffer_append(buffer, start, str - start);
+}
+
+
+// Directory store -----------------------------------------------------------
+
+// Objects are kept in files named for their keys, with '/', '%' and any
+// unprintable characters %-escaped, as is a leading '.' (so that no key
+// names "." or "..", or one of the temporary files)
+static int directory_file_name(const char *key, char *name, int nameSize)
+{
+    int len = 0;
+    for (; *key; key++) {
+        unsigned char c = *key;
+        if ((len + 4) > nameSize) {
+            return 0;
+        }
+        if ((c == '/') || (c == '%') || (c < 0x20) || (c >= 0x7F) ||
+            ((c == '.') && !len)) {
+            len += snprintf(&(name[len]), 4, "%%%02X", c);
+        }
+        else {
+            name[len++] = c;
+        }
+    }
+    name[len] = 0;
+    return 1;
+}
+
+
+static int directory_path(const char *bucketName, const char *key,
+                          char *path, int pathSize)
+{
+    char name[1024];
+    if (!key) {
+        return (snprintf(path, pathSize, "%s/%s", directoryG, bucketName) <
+                pathSize);
+    }
+    if (!directory_file_name(key, name, sizeof(name))) {
+        return 0;
+    }
+    return (snprintf(path, pathSize, "%s/%s/%s", directoryG, bucketName,
+                     name) < pathSize);
+}
+
+
+static int write_all(int fd, const char *data, int64_t len)
+{
+    while (len) {
+        ssize_t wrote = write(fd, data, len);
+        if (wrote < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        data += wrote;
+        len -= wrote;
+    }
+    return 1;
+}
+
+
+// Reads length bytes of the file at path from offset into a new Blob, or
+// returns 0
+static Blob *directory_read(const char *path, int64_t offset, int64_t length)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    Blob *blob = blob_new(length);
+    int64_t done = 0;
+    if (lseek(fd, offset, SEEK_SET) == (off_t) -1) {
+        done = -1;
+    }
+    while ((done >= 0) && (done < length)) {
+        ssize_t got = read(fd, &(blob->data[done]), length - done);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            done = -1;
+        }
+        else if (!got) {
+            done = -1;
+        }
+        else {
+            done += got;
+        }
+    }
+    close(fd);
+    if (done < 0) {
+        free(blob);
+        return 0;
+    }
+    return blob;
+}
+
+
+// Store functions -----------------------------------------------------------
+
+// The store mutex must be held by the caller of all of these
+
+static Bucket *find_bucket(const char *name)
+{
+    Bucket *bucket;
+    for (bucket = bucketsG; bucket; bucket = bucket->next) {
+        if (!strcmp(bucket->name, name)) {
+            return bucket;
+        }
+    }
+    return 0;
+}
+
+
+static Bucket *add_bucket(const char *name, time_t creationDate)
+{
+    Bucket *bucket = (Bucket *) checked_malloc(sizeof(Bucket));
+    bucket->name = string_copy(name);
+    bucket->creationDate = creationDate;
+    bucket->locationConstraint = 0;
+    bucket->objects = 0;
+    bucket->objectsCount = bucket->objectsSize = 0;
+
+    // Kept sorted by name, as S3 lists them
+    Bucket **prev = &bucketsG;
+    while (*prev && (strcmp((*prev)->name, name) < 0)) {
+        prev = &((*prev)->next);
+    }
+    bucket->next = *prev;
+    *prev = bucket;
+    return bucket;
+}
+
+
+// Returns the index of the first object with a key not less than key
+static int find_object_index(const Bucket *bucket, const char *key)
+{
+    int lo = 0, hi = bucket->objectsCount;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(bucket->objects[mid]->key, key) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+static Object *find_object(const Bucket *bucket, const char *key)
+{
+    int i = find_object_index(bucket, key);
+    if ((i < bucket->objectsCount) && !strcmp(bucket->objects[i]->key, key)) {
+        return bucket->objects[i];
+    }
+    return 0;
+}
+
+
+static void free_object(Object *object)
+{
+    free(object->key);
+    free(object->contentType);
+    free(object->metaHeaders);
+    blob_release(object->blob);
+    free(object);
+}
+
+
+// Adds object to bucket, replacing any object with the same key
+static void put_object(Bucket *bucket, Object *object)
+{
+    int i = find_object_index(bucket, object->key);
+    if ((i < bucket->objectsCount) &&
+        !strcmp(bucket->objects[i]->key, object->key)) {
+        free_object(bucket->objects[i]);
+        bucket->objects[i] = object;
+        return;
+    }
+    if (bucket->objectsCount == bucket->objectsSize) {
+        bucket->objectsSize = bucket->objectsSize ?
+            (bucket->objectsSize * 2) : 64;
+        Object **grown = (Object **) realloc
+            (bucket->objects, bucket->objectsSize * sizeof(Object *));
+        if (!grown) {
+            fprintf(stderr, "s3server: out of memory\n");
+            exit(-1);
+        }
+        bucket->objects = grown;
+    }
+    memmove(&(bucket->objects[i + 1]), &(bucket->objects[i]),
+            (bucket->objectsCount - i) * sizeof(Object *));
+    bucket->objects[i] = object;
+    bucket->objectsCount++;
+}
+
+
+static int delete_object(Bucket *bucket, const char *key)
+{
+    int i = find_object_index(bucket, key);
+    if ((i == bucket->objectsCount) || strcmp(bucket->objects[i]->key, key)) {
+        return 0;
+    }
+    if (directoryG) {
+        char path[4096];
+        if (directory_path(bucket->name, key, path, sizeof(path))) {
+            unlink(path);
+        }
+    }
+    free_object(bucket->objects[i]);
+    memmove(&(bucket->objects[i]), &(bucket->objects[i + 1]),
+            (bucket->objectsCount - i - 1) * sizeof(Object *));
+    bucket->objectsCount--;
+    return 1;
+}
+
+
+// Reads length bytes of object from offset; the result refers to the shared
+// contents for the memory store.  *data is set to the start of the bytes.
+// Returns 0 if the contents could not be read.
+static Blob *read_object(const Bucket *bucket, const Object *object,
+                         int64_t offset, int64_t length, const char **data)
+{
+    if (object->blob) {
+        object->blob->refs++;
+        *data = &(object->blob->data[offset]);
+        return object->blob;
+    }
+    char path[4096];
+    if (!directory_path(bucket->name, object->key, path, sizeof(path))) {
+        return 0;
+    }
+    Blob *blob = directory_read(path, offset, length);
+    *data = blob ? blob->data : 0;
+    return blob;
+}
+
+
+// Stores the contents of a new object, taking over the reference to blob.
+// For the directory store the contents are written to a file, which is
+// renamed into place by commit_object_contents() once the store lock is
+// held, so that a reader never sees a partly written file.  Returns 0 on
+// failure.
+static int write_object_contents(Object *object, Blob *blob, char *tempPath,
+                                 int tempPathSize, const char *bucketName)
+{
+    object->size = blob->size;
+    compute_etag(blob->data, blob->size, 0, object->eTag);
+    object->lastModified = time(NULL);
+
+    if (!directoryG) {
+        object->blob = blob;
+        return 1;
+    }
+
+    object->blob = 0;
+    static unsigned int tempCount = 0;
+    pthread_mutex_lock(&storeMutexG);
+    unsigned int n = tempCount++;
+    pthread_mutex_unlock(&storeMutexG);
+    if (snprintf(tempPath, tempPathSize, "%s/%s/.tmp.%u", directoryG,
+                 bucketName, n) >= tempPathSize) {
+        blob_release_locked(blob);
+        return 0;
+    }
+    int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        blob_release_locked(blob);
+        return 0;
+    }
+    int ok = write_all(fd, blob->data, blob->size);
+    ok = !close(fd) && ok;
+    blob_release_locked(blob);
+    if (!ok) {
+        unlink(tempPath);
+    }
+    return ok;
+}
+
+
+static int commit_object_contents(const Bucket *bucket, const Object *object,
+                                  const char *tempPath)
+{
+    if (!directoryG) {
+        return 1;
+    }
+    char path[4096];
+    if (!directory_path(bucket->name, object->key, path, sizeof(path)) ||
+        rename(tempPath, path)) {
+        unlink(tempPath);
+        return 0;
+    }
+    return 1;
+}
+
+
+// Loads the buckets and objects kept under the store directory
+static int load_directory()
+{
+    DIR *dir = opendir(directoryG);
+    if (!dir) {
+        fprintf(stderr, "s3server: cannot open %s: %s\n", directoryG,
+                strerror(errno));
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        char path[4096];
+        struct stat st;
+        if ((entry->d_name[0] == '.') ||
+            !directory_path(entry->d_name, 0, path, sizeof(path)) ||
+            stat(path, &st) || !S_ISDIR(st.st_mode)) {
+            continue;
+        }
+        Bucket *bucket = add_bucket(entry->d_name, st.st_mtime);
+        DIR *objectsDir = opendir(path);
+        if (!objectsDir) {
+            continue;
+        }
+        struct dirent *objectEntry;
+        while ((objectEntry = readdir(objectsDir))) {
+            char key[S3_MAX_KEY_SIZE + 1];
+            const char *name = objectEntry->d_name;
+            if (name[0] == '.') {
+                // A temporary file left behind, or . or ..
+                continue;
+            }
+            if ((snprintf(path, sizeof(path), "%s/%s/%s", directoryG,
+                          bucket->name, name) >= (int) sizeof(path)) ||
+                stat(path, &st) || !S_ISREG(st.st_mode) ||
+                !url_decode(key, sizeof(key), name, strlen(name), 0)) {
+                continue;
+            }
+            Blob *blob = directory_read(path, 0, st.st_size);
+            if (!blob) {
+                continue;
+            }
+            Object *object = (Object *) checked_malloc(sizeof(Object));
+            object->key = string_copy(key);
+            object->size = st.st_size;
+            compute_etag(blob->data, blob->size, 0, object->eTag);
+            object->lastModified = st.st_mtime;
+            object->contentType = object->metaHeaders = 0;
+            object->blob = 0;
+            free(blob);
+            put_object(bucket, object);
+        }
+        closedir(objectsDir);
+    }
+    closedir(dir);
+    return 1;
+}
+
+
+// Faults --------------------------------------------------------------------
+
+// Requests are told apart, for faults, by what they do.  A LIST is a GET of
+// a bucket or of the service, and a COPY is a PUT with x-amz-copy-source.
+typedef enum
+{
+    OpGet,
+    OpHead,
+    OpPut,
+    OpCopy,
+    OpDelete,
+    OpList,
+    OpPost,
+    OpOther,
+    OpCount
+} Op;
+
+static const char *opNamesG[OpCount] =
+{
+    "GET", "HEAD", "PUT", "COPY", "DELETE", "LIST", "POST", "OTHER"
+};
+
+typedef enum
+{
+    DistributionNone,
+    // a milliseconds
+    DistributionFixed,
+    // Between a and b milliseconds
+    DistributionUniform,
+    // Mean a and standard deviation b milliseconds
+    DistributionNormal,
+    // Median a milliseconds, and b the standard deviation of its logarithm
+    DistributionLogNormal,
+    // Mean a milliseconds
+    DistributionExponential
+} Distribution;
+
+#define MAX_FAULT_ERRORS 8
+
+typedef struct FaultError
+{
+    double probability;
+
+    int status;
+
+    char code[64];
+} FaultError;
+
+// The faults to inject into one kind of request
+typedef struct Faults
+{
+    Distribution latency;
+
+    double latencyA, latencyB;
+
+    FaultError errors[MAX_FAULT_ERRORS];
+
+    int errorsCount;
+
+    double resetProbability;
+
+    double stallProbability;
+
+    long stallMs;
+} Faults;
+
+static Faults faultsG[OpCount];
+
+// Each request's faults are drawn from a generator seeded with this and the
+// request's number, so that a run with the same seed and the same requests
+// gets the same faults however its connections interleave
+static uint64_t seedG = 0;
+
+
+// splitmix64
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+
+// Returns a number in [0, 1)
+static double random_fraction(uint64_t *state)
+{
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+static long random_latency(uint64_t *state, const Faults *faults)
+{
+    // Both are always drawn, so that what is drawn after doesn't depend on
+    // the distribution
+    double u1 = 1 - random_fraction(state), u2 = random_fraction(state);
+    // Box-Muller
+    double normal = sqrt(-2 * log(u1)) * cos(6.283185307179586 * u2);
+    double a = faults->latencyA, b = faults->latencyB, ms;
+
+    switch (faults->latency) {
+    case DistributionFixed:
+        ms = a;
+        break;
+    case DistributionUniform:
+        ms = a + ((b - a) * u2);
+        break;
+    case DistributionNormal:
+        ms = a + (b * normal);
+        break;
+    case DistributionLogNormal:
+        ms = a * exp(b * normal);
+        break;
+    case DistributionExponential:
+        ms = -a * log(u1);
+        break;
+    default:
+        ms = 0;
+        break;
+    }
+
+    return (ms > 0) ? (long) (ms + 0.5) : 0;
+}
+
+
+// Parses a rate of bytes per second, which may end in k or m.  Returns -1
+// if it isn't one.
+static int64_t parse_rate(const char *str)
+{
+    char *end;
+    int64_t rate = strtoll(str, &end, 10);
+    if ((end == str) || (rate < 0)) {
+        return -1;
+    }
+    if ((*end == 'k') || (*end == 'K')) {
+        rate *= 1024;
+        end++;
+    }
+    else if ((*end == 'm') || (*end == 'M')) {
+        rate *= 1024 * 1024;
+        end++;
+    }
+    return *end ? -1 : rate;
+}
+
+
+static const char *fault_error_message(const char *code)
+{
+    if (!strcmp(code, "SlowDown")) {
+        return "Please reduce your request rate.";
+    }
+    if (!strcmp(code, "InternalError")) {
+        return "We encountered an internal error. Please try again.";
+    }
+    if (!strcmp(code, "ServiceUnavailable")) {
+        return "Reduce your request rate.";
+    }
+    return "This error was injected by s3server.";
+}
+
+
+// Loads the faults to inject from a file of lines like these, in which
+// OP is one of the names in opNamesG or * for all, probabilities are from 0
+// to 1 and times are in milliseconds:
+//
+//   seed N
+//   bandwidth RATE
+//   latency OP fixed MS
+//   latency OP uniform MIN MAX
+//   latency OP normal MEAN STDDEV
+//   latency OP lognormal MEDIAN SIGMA
+//   latency OP exponential MEAN
+//   error OP PROBABILITY STATUS CODE
+//   reset OP PROBABILITY
+//   stall OP PROBABILITY MS
+//
+// Later lines for an OP replace earlier ones, except that error lines add
+// to the errors that may be returned.  Everything after a # is ignored.
+// Returns 0 on failure, having said why.
+static int load_faults(const char *file)
+{
+    FILE *f = fopen(file, "r");
+    if (!f) {
+        fprintf(stderr, "s3server: cannot open %s: %s\n", file,
+                strerror(errno));
+        return 0;
+    }
+
+    char line[1024];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineNumber++;
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = 0;
+        }
+
+        char what[32], op[32], arg1[64], arg2[64], arg3[64], extra[2];
+        int count = sscanf(line, "%31s %31s %63s %63s %63s %1s", what, op,
+                           arg1, arg2, arg3, extra);
+        if (count <= 0) {
+            continue;
+        }
+
+        int ok = 0;
+        if (!strcmp(what, "seed")) {
+            char *end;
+            seedG = strtoull(op, &end, 0);
+            ok = (count == 2) && !*end;
+        }
+        else if (!strcmp(what, "bandwidth")) {
+            ok = (count == 2) && ((bandwidthG = parse_rate(op)) >= 0);
+        }
+        else if (count >= 3) {
+            int i, first = 0, last = OpCount - 1;
+            if (strcmp(op, "*")) {
+                for (first = 0; first < OpCount; first++) {
+                    if (!strcasecmp(op, opNamesG[first])) {
+                        break;
+                    }
+                }
+                last = first;
+            }
+            double a = (count > 3) ? atof(arg2) : 0;
+            double b = (count > 4) ? atof(arg3) : 0;
+            double probability = atof(arg1);
+            ok = (first < OpCount);
+            for (i = first; ok && (i <= last); i++) {
+                Faults *faults = &(faultsG[i]);
+                if (!strcmp(what, "latency")) {
+                    faults->latencyA = a;
+                    faults->latencyB = b;
+                    if (!strcmp(arg1, "fixed") && (count == 4)) {
+                        faults->latency = DistributionFixed;
+                    }
+                    else if (!strcmp(arg1, "uniform") && (count == 5)) {
+                        faults->latency = DistributionUniform;
+                    }
+                    else if (!strcmp(arg1, "normal") && (count == 5)) {
+                        faults->latency = DistributionNormal;
+                    }
+                    else if (!strcmp(arg1, "lognormal") && (count == 5)) {
+                        faults->latency = DistributionLogNormal;
+                    }
+                    else if (!strcmp(arg1, "exponential") && (count == 4)) {
+                        faults->latency = DistributionExponential;
+                    }
+                    else {
+                        ok = 0;
+                    }
+                }
+                else if (!strcmp(what, "error") && (count == 5) &&
+                         (faults->errorsCount < MAX_FAULT_ERRORS)) {
+                    FaultError *error =
+                        &(faults->errors[faults->errorsCount++]);
+                    error->probability = probability;
+                    error->status = atoi(arg2);
+                    snprintf(error->code, sizeof(error->code), "%s", arg3);
+                    ok = (error->status >= 400) && (error->status <= 599);
+                }
+                else if (!strcmp(what, "reset") && (count == 3)) {
+                    faults->resetProbability = probability;
+                }
+                else if (!strcmp(what, "stall") && (count == 4)) {
+                    faults->stallProbability = probability;
+                    faults->stallMs = (long) a;
+                }
+                else {
+                    ok = 0;
+                }
+            }
+            ok = ok && (probability >= 0) && (probability <= 1) &&
+                (a >= 0) && (b >= 0);
+        }
+
+        if (!ok) {
+            fprintf(stderr, "s3server: %s:%d: invalid fault\n", file,
+                    lineNumber);
+            fclose(f);
+            return 0;
+        }
+    }
+
+    fclose(f);
+    return 1;
+}
+
+
+// Connections ---------------------------------------------------------------
+
+typedef struct Throttle
+{
+    double start;
+
+    int64_t bytes;
+} Throttle;
+
+typedef struct Connection
+{
+    int fd;
+
+    // Bytes received but not yet consumed, which may include the start of
+    // the next request
+    char in[REQUEST_HEADERS_SIZE];
+
+    int inLen;
+
+    // Bytes of in taken up by the current request (its headers, and any of
+    // its body that arrived with them)
+    int headersLen;
+
+    Throttle throttle;
+
+    // The generator that the current request's faults are drawn from
+    uint64_t random;
+
+    // A stall and a reset that are still to be injected into the current
+    // request, at faultAt bytes into a body, or -1 until a body with them
+    // has begun
+    long stallMs;
+
+    int reset;
+
+    int64_t faultAt;
+} Connection;
+
+
+// Waits as long as is needed to keep the transfer of bodies to the
+// bandwidth limit, having just transferred bytes more
+static void throttle(Connection *connection, int64_t bytes)
+{
+    if (!bandwidthG) {
+        return;
+    }
+    Throttle *t = &(connection->throttle);
+    if (!t->bytes) {
+        t->start = now_seconds();
+    }
+    t->bytes += bytes;
+    double wait = (t->start + ((double) t->bytes / bandwidthG)) -
+        now_seconds();
+    if (wait > 0) {
+        sleep_ms((long) (wait * 1000));
+    }
+}
+
+
+// Places the current request's stall and reset, if it has them and they
+// have not been placed yet, at random within a body of length bytes that
+// is about to be transferred
+static void start_body_faults(Connection *connection, int64_t length)
+{
+    if ((connection->stallMs || connection->reset) &&
+        (connection->faultAt < 0) && (length > 0)) {
+        connection->faultAt =
+            (int64_t) (next_random(&(connection->random)) % length);
+    }
+}
+
+
+// Limits a transfer of want bytes of a body, done bytes into it, so that it
+// ends where the next fault is due
+static int64_t fault_limit(Connection *connection, int64_t done,
+                           int64_t want)
+{
+    if ((connection->faultAt > done) &&
+        (want > connection->faultAt - done)) {
+        return connection->faultAt - done;
+    }
+    return want;
+}
+
+
+// Injects the faults due by done bytes into a body.  Returns 0 if the
+// connection has been reset, in which case it is to be closed.
+static int body_faults(Connection *connection, int64_t done)
+{
+    if ((connection->faultAt < 0) || (done < connection->faultAt)) {
+        return 1;
+    }
+    connection->faultAt = -1;
+    if (connection->stallMs) {
+        sleep_ms(connection->stallMs);
+        connection->stallMs = 0;
+    }
+    if (connection->reset) {
+        // Closing with a zero linger time sends an RST rather than a FIN
+        struct linger linger;
+        linger.l_onoff = 1;
+        linger.l_linger = 0;
+        setsockopt(connection->fd, SOL_SOCKET, SO_LINGER, &linger,
+                   sizeof(linger));
+        connection->reset = 0;
+        return 0;
+    }
+    return 1;
+}
+
+
+// Sends len bytes of data.  throttled is set for bodies, which are kept to
+// the bandwidth limit and have the current request's faults injected.
+static int send_all(Connection *connection, const char *data, int64_t len,
+                    int throttled)
+{
+    int64_t total = 0;
+    while (len) {
+        int64_t chunk = (throttled && bandwidthG &&
+                         (len > TRANSFER_CHUNK_SIZE)) ?
+            TRANSFER_CHUNK_SIZE : len;
+        if (throttled) {
+            if (!body_faults(connection, total)) {
+                return 0;
+            }
+            chunk = fault_limit(connection, total, chunk);
+        }
+        int64_t done = 0;
+        while (done < chunk) {
+            ssize_t sent = send(connection->fd, &(data[done]), chunk - done,
+                                0);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return 0;
+            }
+            done += sent;
+        }
+        if (throttled) {
+            throttle(connection, chunk);
+        }
+        data += chunk;
+        len -= chunk;
+        total += chunk;
+    }
+    return 1;
+}
+
+
+// Requests ------------------------------------------------------------------
+
+typedef struct Header
+{
+    const char *name, *value;
+} Header;
+
+typedef struct Request
+{
+    const char *method;
+
+    // The undecoded path and query string
+    const char *path, *query;
+
+    char bucketName[256];
+
+    char key[S3_MAX_KEY_SIZE + 1];
+
+    Header headers[MAX_REQUEST_HEADERS];
+
+    int headersCount;
+
+    int keepAlive;
+
+    // The body, or 0 if there was none
+    Blob *body;
+
+    unsigned long long requestId;
+} Request;
+
+
+static const char *get_header(const Request *request, const char *name)
+{
+    int i;
+    for (i = 0; i < request->headersCount; i++) {
+        if (!strcasecmp(request->headers[i].name, name)) {
+            return request->headers[i].value;
+        }
+    }
+    return 0;
+}
+
+
+// Returns nonzero if the query string has a parameter name, with its decoded
+// value (or an empty string) in value, unless valueSize is 0
+static int get_param(const Request *request, const char *name, char *value,
+                     int valueSize)
+{
+    int nameLen = strlen(name);
+    const char *p = request->query;
+    while (p && *p) {
+        const char *end = strchr(p, '&');
+        if (!end) {
+            end = p + strlen(p);
+        }
+        if (!strncmp(p, name, nameLen) &&
+            ((p[nameLen] == '=') || (&(p[nameLen]) == end))) {
+            if (!valueSize) {
+                return 1;
+            }
+            if (p[nameLen] == '=') {
+                const char *v = &(p[nameLen + 1]);
+                if (!url_decode(value, valueSize, v, end - v, 1)) {
+                    value[0] = 0;
+                }
+            }
+            else {
+                value[0] = 0;
+            }
+            return 1;
+        }
+        p = *end ? (end + 1) : end;
+    }
+    return 0;
+}
+
+
+// Reads more bytes into the connection's buffer; returns 0 on end of
+// connection or error
+static int connection_fill(Connection *connection)
+{
+    for (;;) {
+        // Leaving room for a terminator
+        ssize_t got = recv(connection->fd, &(connection->in[connection->inLen]),
+                           sizeof(connection->in) - 1 - connection->inLen, 0);
+        if (got > 0) {
+            connection->inLen += got;
+            return 1;
+        }
+        if ((got < 0) && (errno == EINTR)) {
+            continue;
+        }
+        return 0;
+    }
+}
+
+
+// Reads and parses the request line and headers of the next request.
+// Returns 1 on success, 0 if the connection is done, or -1 if the request
+// is malformed.
+static int read_request_headers(Connection *connection, Request *request)
+{
+    char *end;
+    for (;;) {
+        connection->in[connection->inLen] = 0;
+        if ((end = strstr(connection->in, "\r\n\r\n"))) {
+            break;
+        }
+        if (connection->inLen == (int) (sizeof(connection->in) - 1)) {
+            return -1;
+        }
+        if (!connection_fill(connection)) {
+            return 0;
+        }
+    }
+    connection->headersLen = (end - connection->in) + 4;
+    *end = 0;
+
+    char *line = connection->in, *next = strstr(line, "\r\n");
+    if (next) {
+        *next = 0;
+        next += 2;
+    }
+
+    // Request line: METHOD SP target SP version
+    char *sp1 = strchr(line, ' '), *sp2 = sp1 ? strchr(sp1 + 1, ' ') : 0;
+    if (!sp2) {
+        return -1;
+    }
+    *sp1 = *sp2 = 0;
+    request->method = line;
+    char *target = sp1 + 1;
+    request->keepAlive = !strcmp(sp2 + 1, "HTTP/1.1");
+
+    char *q = strchr(target, '?');
+    if (q) {
+        *q = 0;
+        request->query = q + 1;
+    }
+    else {
+        request->query = "";
+    }
+    request->path = target;
+
+    // Path style: /bucket/key
+    request->bucketName[0] = request->key[0] = 0;
+    if (*target == '/') {
+        target++;
+    }
+    char *slash = strchr(target, '/');
+    int bucketLen = slash ? (slash - target) : (int) strlen(target);
+    if (!url_decode(request->bucketName, sizeof(request->bucketName), target,
+                    bucketLen, 0) ||
+        (slash && !url_decode(request->key, sizeof(request->key), slash + 1,
+                              strlen(slash + 1), 1))) {
+        return -1;
+    }
+
+    request->headersCount = 0;
+    while (next && *next) {
+        line = next;
+        if ((next = strstr(line, "\r\n"))) {
+            *next = 0;
+            next += 2;
+        }
+        char *colon = strchr(line, ':');
+        if (!colon || (request->headersCount == MAX_REQUEST_HEADERS)) {
+            return -1;
+        }
+        *colon++ = 0;
+        while (is_blank(*colon)) {
+            colon++;
+        }
+        request->headers[request->headersCount].name = line;
+        request->headers[request->headersCount++].value = colon;
+    }
+
+    const char *connectionHeader = get_header(request, "Connection");
+    if (connectionHeader) {
+        if (!strcasecmp(connectionHeader, "close")) {
+            request->keepAlive = 0;
+        }
+        else if (!strcasecmp(connectionHeader, "keep-alive")) {
+            request->keepAlive = 1;
+        }
+    }
+
+    return 1;
+}
+
+
+// Reads the request's body, if it has one.  Returns 0 on failure.
+static int read_request_body(Connection *connection, Request *request)
+{
+    request->body = 0;
+
+    const char *contentLength = get_header(request, "Content-Length");
+    if (get_header(request, "Transfer-Encoding")) {
+        // Only used by clients that libs3 isn't
+        return 0;
+    }
+    if (!contentLength) {
+        return 1;
+    }
+    int64_t length = (int64_t) parseUnsignedInt(contentLength);
+
+    const char *expect = get_header(request, "Expect");
+    if (expect && !strcasecmp(expect, "100-continue")) {
+        static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        if (!send_all(connection, cont, sizeof(cont) - 1, 0)) {
+            return 0;
+        }
+    }
+
+    request->body = blob_new(length);
+
+    // Whatever followed the headers in the buffer comes first
+    int64_t have = connection->inLen - connection->headersLen;
+    if (have > length) {
+        have = length;
+    }
+    memcpy(request->body->data, &(connection->in[connection->headersLen]),
+           have);
+    connection->headersLen += have;
+
+    start_body_faults(connection, length);
+
+    while (have < length) {
+        if (!body_faults(connection, have)) {
+            return 0;
+        }
+        int64_t want = length - have;
+        if (bandwidthG && (want > TRANSFER_CHUNK_SIZE)) {
+            want = TRANSFER_CHUNK_SIZE;
+        }
+        want = fault_limit(connection, have, want);
+        ssize_t got = recv(connection->fd, &(request->body->data[have]), want,
+                           0);
+        if (got <= 0) {
+            if ((got < 0) && (errno == EINTR)) {
+                continue;
+            }
+            return 0;
+        }
+        have += got;
+        throttle(connection, got);
+    }
+    // Faults due within what arrived with the headers happen now
+    return body_faults(connection, have);
+}
+
+
+// Responses -----------------------------------------------------------------
+
+static const char *status_text(int code)
+{
+    switch (code) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 409: return "Conflict";
+    case 411: return "Length Required";
+    case 412: return "Precondition Failed";
+    case 416: return "Requested Range Not Satisfiable";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+    }
+}
+
+
+// Sends a response.  headers holds any extra headers, each terminated by
+// CRLF.  A HEAD response gives contentLength but has no body.
+static int send_response(Connection *connection, Request *request, int code,
+                         const char *headers, const char *body,
+                         int64_t contentLength)
+{
+    int hasBody = body && contentLength && strcmp(request->method, "HEAD");
+
+    // Faults that have no body to be injected into come before the response
+    start_body_faults(connection, hasBody ? contentLength : 1);
+    if (!hasBody && !body_faults(connection, 0)) {
+        return 0;
+    }
+
+    char date[64];
+    format_http_date(time(NULL), date, sizeof(date));
+
+    Buffer response = { 0, 0, 0 };
+    buffer_printf(&response,
+                  "HTTP/1.1 %d %s\r\n"
+                  "x-amz-request-id: %016llX\r\n"
+                  "x-amz-id-2: %016llX\r\n"
+                  "Date: %s\r\n"
+                  "Server: s3server\r\n"
+                  "Content-Length: %lld\r\n"
+                  "%s%s\r\n",
+                  code, status_text(code), request->requestId,
+                  request->requestId, date, (long long) contentLength,
+                  request->keepAlive ? "" : "Connection: close\r\n",
+                  headers ? headers : "");
+
+    int ok = send_all(connection, response.data, response.len, 0);
+    free(response.data);
+
+    if (ok && hasBody) {
+        ok = send_all(connection, body, contentLength, 1);
+    }
+
+    if (verboseG) {
+        fprintf(stderr, "%s /%s%s%s%s%s %d %lld\n", request->method,
+                request->bucketName, request->key[0] ? "/" : "",
+                request->key, request->query[0] ? "?" : "", request->query,
+                code, (long long) contentLength);
+    }
+
+    return ok;
+}
+
+
+static int send_xml(Connection *connection, Request *request, int code,
+                    const char *headers, Buffer *xml)
+{
+    Buffer allHeaders = { 0, 0, 0 };
+    buffer_printf(&allHeaders, "Content-Type: application/xml\r\n%s",
+                  headers ? headers : "");
+    int ok = send_response(connection, request, code, allHeaders.data,
+                           xml->data, xml->len);
+    free(allHeaders.data);
+    free(xml->data);
+    return ok;
+}
+
+
+static int send_error(Connection *connection, Request *request, int code,
+                      const char *errorCode, const char *message)
+{
+    Buffer xml = { 0, 0, 0 };
+    buffer_printf(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<Error><Code>%s</Code><Message>%s</Message><Resource>",
+                  errorCode, message);
+    buffer_append_xml(&xml, request->path);
+    buffer_printf(&xml, "</Resource><RequestId>%016llX</RequestId></Error>",
+                  request->requestId);
+
+    if (!strcmp(request->method, "HEAD")) {
+        // There is no body to explain a HEAD error
+        xml.len = 0;
+    }
+    return send_xml(connection, request, code, 0, &xml);
+}
+
+
+#define SEND_NO_SUCH_BUCKET()                                           \
+    send_error(connection, request, 404, "NoSuchBucket",                \
+               "The specified bucket does not exist.")
+
+#define SEND_NO_SUCH_KEY()                                              \
+    send_error(connection, request, 404, "NoSuchKey",                   \
+               "The specified key does not exist.")
+
+#define SEND_NO_SUCH_UPLOAD()                                           \
+    send_error(connection, request, 404, "NoSuchUpload",                \
+               "The specified upload does not exist.")
+
+#define SEND_NOT_IMPLEMENTED()                                          \
+    send_error(connection, request, 501, "NotImplemented",              \
+               "This request is not supported by s3server.")
+
+#define SEND_INTERNAL_ERROR()                                           \
+    send_error(connection, request, 500, "InternalError",               \
+               "The object could not be read or written.")
+
+
+// Appends the x-amz-meta- headers of the request
+static char *request_meta_headers(const Request *request)
+{
+    Buffer meta = { 0, 0, 0 };
+    int i;
+    for (i = 0; i < request->headersCount; i++) {
+        if (!strncasecmp(request->headers[i].name,
+                         S3_METADATA_HEADER_NAME_PREFIX,
+                         sizeof(S3_METADATA_HEADER_NAME_PREFIX) - 1)) {
+            buffer_printf(&meta, S3_METADATA_HEADER_NAME_PREFIX "%s: %s\r\n",
+                          &(request->headers[i].name
+                            [sizeof(S3_METADATA_HEADER_NAME_PREFIX) - 1]),
+                          request->headers[i].value);
+        }
+    }
+    return meta.data;
+}
+
+
+static void owner_xml(Buffer *xml)
+{
+    buffer_printf(xml, "<Owner><ID>" OWNER_ID "</ID><DisplayName>"
+                  OWNER_DISPLAY_NAME "</DisplayName></Owner>");
+}
+
+
+// Service and buckets -------------------------------------------------------
+
+static int list_service(Connection *connection, Request *request)
+{
+    Buffer xml = { 0, 0, 0 };
+    buffer_printf(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<ListAllMyBucketsResult>");
+    owner_xml(&xml);
+    buffer_printf(&xml, "<Buckets>");
+    pthread_mutex_lock(&storeMutexG);
+    Bucket *bucket;
+    for (bucket = bucketsG; bucket; bucket = bucket->next) {
+        char date[64];
+        format_iso8601_date(bucket->creationDate, date, sizeof(date));
+        buffer_printf(&xml, "<Bucket><Name>");
+        buffer_append_xml(&xml, bucket->name);
+        buffer_printf(&xml, "</Name><CreationDate>%s</CreationDate></Bucket>",
+                      date);
+    }
+    pthread_mutex_unlock(&storeMutexG);
+    buffer_printf(&xml, "</Buckets></ListAllMyBucketsResult>");
+    return send_xml(connection, request, 200, 0, &xml);
+}
+
+
+// Collects the text of elements of a request document
+typedef struct XmlFields
+{
+    // Paths of the elements wanted
+    const char **paths;
+
+    int pathsCount;
+
+    // Called at the end of each wanted element with its text
+    void (*callback)(int index, const char *text, void *callbackData);
+
+    void *callbackData;
+
+    char text[S3_MAX_KEY_SIZE + 1];
+
+    int textLen;
+} XmlFields;
+
+
+static S3Status xmlFieldsCallback(SimpleXmlElement element,
+                                  const char *elementPath, const char *data,
+                                  int dataLen, void *callbackData)
+{
+    (void) element;
+
+    XmlFields *fields = (XmlFields *) callbackData;
+    int i;
+    for (i = 0; i < fields->pathsCount; i++) {
+        if (!strcmp(elementPath, fields->paths[i])) {
+            break;
+        }
+    }
+    if (i == fields->pathsCount) {
+        return S3StatusOK;
+    }
+    if (data) {
+        if ((fields->textLen + dataLen) >= (int) sizeof(fields->text)) {
+            return S3StatusXmlParseFailure;
+        }
+        memcpy(&(fields->text[fields->textLen]), data, dataLen);
+        fields->textLen += dataLen;
+    }
+    else {
+        fields->text[fields->textLen] = 0;
+        (*(fields->callback))(i, fields->text, fields->callbackData);
+        fields->textLen = 0;
+    }
+    return S3StatusOK;
+}
+
+
+static int parse_xml_fields(const Blob *body, const char **paths,
+                            int pathsCount,
+                            void (*callback)(int, const char *, void *),
+                            void *callbackData)
+{
+    XmlFields fields;
+    fields.paths = paths;
+    fields.pathsCount = pathsCount;
+    fields.callback = callback;
+    fields.callbackData = callbackData;
+    fields.textLen = 0;
+
+    SimpleXml simpleXml;
+    simplexml_initialize(&simpleXml, &xmlFieldsCallback, &fields);
+    S3Status status = body ?
+        simplexml_add(&simpleXml, body->data, body->size) : S3StatusOK;
+    simplexml_deinitialize(&simpleXml);
+    return (status == S3StatusOK);
+}
+
+
+static void locationCallback(int index, const char *text, void *callbackData)
+{
+    (void) index;
+
+    char **location = (char **) callbackData;
+    free(*location);
+    *location = string_copy(text);
+}
+
+
+static int create_bucket(Connection *connection, Request *request)
+{
+    static const char *paths[] =
+        { "CreateBucketConfiguration/LocationConstraint" };
+    char *location = 0;
+    if (!parse_xml_fields(request->body, paths, 1, &locationCallback,
+                          &location)) {
+        return send_error(connection, request, 400, "MalformedXML",
+                          "The XML provided was not well-formed.");
+    }
+
+    pthread_mutex_lock(&storeMutexG);
+    if (find_bucket(request->bucketName)) {
+        pthread_mutex_unlock(&storeMutexG);
+        free(location);
+        // S3 gives this to the owner of an existing bucket
+        return send_response(connection, request, 200, 0, 0, 0);
+    }
+    if (directoryG) {
+        char path[4096];
+        if (!directory_path(request->bucketName, 0, path, sizeof(path)) ||
+            (mkdir(path, 0755) && (errno != EEXIST))) {
+            pthread_mutex_unlock(&storeMutexG);
+            free(location);
+            return send_error(connection, request, 400, "InvalidBucketName",
+                              "The specified bucket is not valid.");
+        }
+    }
+    Bucket *bucket = add_bucket(request->bucketName, time(NULL));
+    bucket->locationConstraint = location;
+    pthread_mutex_unlock(&storeMutexG);
+
+    return send_response(connection, request, 200, 0, 0, 0);
+}
+
+
+static int delete_bucket(Connection *connection, Request *request)
+{
+    pthread_mutex_lock(&storeMutexG);
+    Bucket **prev = &bucketsG;
+    while (*prev && strcmp((*prev)->name, request->bucketName)) {
+        prev = &((*prev)->next);
+    }
+    Bucket *bucket = *prev;
+    if (!bucket) {
+        pthread_mutex_unlock(&storeMutexG);
+        return SEND_NO_SUCH_BUCKET();
+    }
+    if (bucket->objectsCount) {
+        pthread_mutex_unlock(&storeMutexG);
+        return send_error(connection, request, 409, "BucketNotEmpty",
+                          "The bucket you tried to delete is not empty.");
+    }
+    if (directoryG) {
+        char path[4096];
+        if (directory_path(bucket->name, 0, path, sizeof(path))) {
+            rmdir(path);
+        }
+    }
+    *prev = bucket->next;
+    free(bucket->name);
+    free(bucket->locationConstraint);
+    free(bucket->objects);
+    free(bucket);
+    pthread_mutex_unlock(&storeMutexG);
+
+    return send_response(connection, request, 204, 0, 0, 0);
+}
+
+
+static int get_location(Connection *connection, Request *request)
+{
+    Buffer xml = { 0, 0, 0 };
+    buffer_printf(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<LocationConstraint>");
+    pthread_mutex_lock(&storeMutexG);
+    Bucket *bucket = find_bucket(request->bucketName);
+    if (bucket && bucket->locationConstraint) {
+        buffer_append_xml(&xml, bucket->locationConstraint);
+    }
+    pthread_mutex_unlock(&storeMutexG);
+    if (!bucket) {
+        free(xml.data);
+        return SEND_NO_SUCH_BUCKET();
+    }
+    buffer_printf(&xml, "</LocationConstraint>");
+    return send_xml(connection, request, 200, 0, &xml);
+}
+
+
+static int get_acl(Connection *connection, Request *request)
+{
+    pthread_mutex_lock(&storeMutexG);
+    Bucket *bucket = find_bucket(request->bucketName);
+    int found = bucket && (!request->key[0] || find_object(bucket,
+                                                           request->key));
+    pthread_mutex_unlock(&storeMutexG);
+    if (!found) {
+        return bucket ? SEND_NO_SUCH_KEY() : SEND_NO_SUCH_BUCKET();
+    }
+
+    Buffer xml = { 0, 0, 0 };
+    buffer_printf(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<AccessControlPolicy>");
+    owner_xml(&xml);
+    buffer_printf(&xml, "<AccessControlList><Grant>"
+                  "<Grantee xmlns:xsi=\"http://www.w3.org/2001/"
+                  "XMLSchema-instance\" xsi:type=\"CanonicalUser\">"
+                  "<ID>" OWNER_ID "</ID><DisplayName>" OWNER_DISPLAY_NAME
+                  "</DisplayName></Grantee><Permission>FULL_CONTROL"
+                  "</Permission></Grant></AccessControlList>"
+                  "</AccessControlPolicy>");
+    return send_xml(connection, request, 200, 0, &xml);
+}
+
+
+static int list_bucket(Connection *connection, Request *request)
+{
+    char prefix[S3_MAX_KEY_SIZE + 1], marker[S3_MAX_KEY_SIZE + 1];
+    char delimiter[S3_MAX_KEY_SIZE + 1], maxKeysString[32];
+    if (!get_param(request, "prefix", prefix, sizeof(prefix))) {
+        prefix[0] = 0;
+    }
+    if (!get_param(request, "marker", marker, sizeof(marker))) {
+        marker[0] = 0;
+    }
+    if (!get_param(request, "delimiter", delimiter, sizeof(delimiter))) {
+        delimiter[0] = 0;
+    }
+    int maxKeys = MAX_KEYS;
+    if (get_param(request, "max-keys", maxKeysString,
+                  sizeof(maxKeysString))) {
+        maxKeys = atoi(maxKeysString);
+        if ((maxKeys < 0) || (maxKeys > MAX_KEYS)) {
+            maxKeys = MAX_KEYS;
+        }
+    }
+    int prefixLen = strlen(prefix), delimiterLen = strlen(delimiter);
+
+    Buffer contents = { 0, 0, 0 }, commonPrefixes = { 0, 0, 0 };
+    char lastCommonPrefix[S3_MAX_KEY_SIZE + 1], next[S3_MAX_KEY_SIZE + 1];
+    lastCommonPrefix[0] = next[0] = 0;
+    int count = 0, truncated = 0;
+
+    pthread_mutex_lock(&storeMutexG);
+    Bucket *bucket = find_bucket(request->bucketName);
+    if (!bucket) {
+        pthread_mutex_unlock(&storeMutexG);
+        return SEND_NO_SUCH_BUCKET();
+    }
+    // Start at the first key past both the marker and the prefix
+    int i = find_object_index(bucket, (strcmp(marker, prefix) > 0) ?
+                              marker : prefix);
+    for (; i < bucket->objectsCount; i++) {
+        const Object *object = bucket->objects[i];
+        if (strncmp(object->key, prefix, prefixLen)) {
+            break;
+        }
+        if (!strcmp(object->key, marker)) {
+            continue;
+        }
+        if (delimiterLen) {
+            const char *d = strstr(&(object->key[prefixLen]), delimiter);
+            if (d) {
+                int len = (d - object->key) + delimiterLen;
+                // Keys rolled up into the marker, or into the common prefix
+                // just added, are skipped
+                if ((!strncmp(object->key, lastCommonPrefix, len) &&
+                     !lastCommonPrefix[len]) ||
+                    (strncmp(object->key, marker, len) <= 0)) {
+                    continue;
+                }
+                if (count == maxKeys) {
+                    truncated = 1;
+                    break;
+                }
+                memcpy(lastCommonPrefix, object->key, len);
+                lastCommonPrefix[len] = 0;
+                buffer_printf(&commonPrefixes, "<CommonPrefixes><Prefix>");
+                buffer_append_xml(&commonPrefixes, lastCommonPrefix);
+                buffer_printf(&commonPrefixes, "</Prefix></CommonPrefixes>");
+                strcpy(next, lastCommonPrefix);
+                count++;
+                continue;
+            }
+        }
+        if (count == maxKeys) {
+            truncated = 1;
+            break;
+        }
+        char date[64];
+        format_iso8601_date(object->lastModified, date, sizeof(date));
+        buffer_printf(&contents, "<Contents><Key>");
+        buffer_append_xml(&contents, object->key);
+        buffer_printf(&contents, "</Key><LastModified>%s</LastModified>"
+                      "<ETag>", date);
+        buffer_append_xml(&contents, object->eTag);
+        buffer_printf(&contents, "</ETag><Size>%lld</Size>",
+                      (long long) object->size);
+        owner_xml(&contents);
+        buffer_printf(&contents, "<StorageClass>STANDARD</StorageClass>"
+                      "</Contents>");
+        strcpy(next, object->key);
+        count++;
+    }
+    pthread_mutex_unlock(&storeMutexG);
+
+    Buffer xml = { 0, 0, 0 };
+    buffer_printf(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<ListBucketResult><Name>");
+    buffer_append_xml(&xml, request->bucketName);
+    buffer_printf(&xml, "</Name><Prefix>");
+    buffer_append_xml(&xml, prefix);
+    buffer_printf(&xml, "</Prefix><Marker>");
+    buffer_append_xml(&xml, marker);
+    buffer_printf(&xml, "</Marker><MaxKeys>%d</MaxKeys>", maxKeys);
+    if (delimiterLen) {
+        buffer_printf(&xml, "<Delimiter>");
+        buffer_append_xml(&xml, delimiter);
+        buffer_printf(&xml, "</Delimiter>");
+    }
+    buffer_printf(&xml, "<IsTruncated>%s</IsTruncated>",
+                  truncated ? "true" : "false");
+    // As S3 does, NextMarker is only given along with a delimiter
+    if (truncated && delimiterLen) {
+        buffer_printf(&xml, "<NextMarker>");
+        buffer_append_xml(&xml, next);
+        buffer_printf(&xml, "</NextMarker>");
+    }
+    if (contents.len) {
+        buffer_append(&xml, contents.data, contents.len);
+    }
+    if (commonPrefixes.len) {
+        buffer_append(&xml, commonPrefixes.data, commonPrefixes.len);
+    }
+    buffer_printf(&xml, "</ListBucketResult>");
+    free(contents.data);
+    free(commonPrefixes.data);
+
+    return send_xml(connection, request, 200, 0, &xml);
+}
+
+
+typedef struct DeleteData
+{
+    Buffer *xml;
+
+    int quiet;
+
+    Bucket *bucket;
+
+    int count;
+} DeleteData;
+
+
+// The store mutex is held while parsing the delete request
+static void deleteCallback(int index, const char *text, void *callbackData)
+{
+    DeleteData *data = (DeleteData *) callbackData;
+    if (index == 0) {
+        data->quiet = !strcmp(text, "true");
+        return;
+    }
+    if (++data->count > MAX_KEYS) {
+        return;
+    }
+    // Deleting a key that doesn't exist succeeds
+    delete_object(data->bucket, text);
+    if (!data->quiet) {
+        buffer_printf(data->xml, "<Deleted><Key>");
+        buffer_append_xml(data->xml, text);
+        buffer_printf(data->xml, "</Key></Deleted>");
+    }
+}
+
+
+static int delete_objects(Connection *connection, Request *request)
+{
+    static const char *paths[] = { "Delete/Quiet", "Delete/Object/Key" };
+
+    Buffer xml = { 0, 0, 0 };
+    buffer_printf(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<DeleteResult>");
+
+    DeleteData data = { &xml, 0, 0, 0 };
+    pthread_mutex_lock(&storeMutexG);
+    if (!(data.bucket = find_bucket(request->bucketName))) {
+        pthread_mutex_unlock(&storeMutexG);
+        free(xml.data);
+        return SEND_NO_SUCH_BUCKET();
+    }
+    int ok = parse_xml_fields(request->body, paths, 2, &deleteCallback,
+                              &data);
+    pthread_mutex_unlock(&storeMutexG);
+
+    if (!ok || (data.count > MAX_KEYS)) {
+        free(xml.data);
+        return send_error(connection, request, 400, "MalformedXML",
+                          "The XML provided was not well-formed.");
+    }
+    buffer_printf(&xml, "</DeleteResult>");
+    return send_xml(connection, request, 200, 0, &xml);
+}
+
+
+// Objects -------------------------------------------------------------------
+
+// Parses a Range header against an object of size bytes.  Returns 1 with
+// the range in *start and *length, 0 if there is no usable range (the whole
+// object is sent), or -1 if the range can't be satisfied.
+static int parse_range(const char *range, int64_t size, int64_t *start,
+                       int64_t *length)
+{
+    long long first, last;
+    if (!range || strncmp(range, "bytes=", 6) || strchr(range, ',')) {
+        return 0;
+    }
+    range += 6;
+    if (range[0] == '-') {
+        // The last n bytes
+        if ((sscanf(range + 1, "%lld", &last) != 1) || (last <= 0)) {
+            return -1;
+        }
+        *length = (last > size) ? size : last;
+        *start = size - *length;
+        return size ? 1 : -1;
+    }
+    int n = sscanf(range, "%lld-%lld", &first, &last);
+    if ((n < 1) || (first >= size)) {
+        return -1;
+    }
+    if ((n == 1) || (last >= size)) {
+        last = size - 1;
+    }
+    if (last < first) {
+        return -1;
+    }
+    *start = first;
+    *length = (last - first) + 1;
+    return 1;
+}
+
+
+// Returns 0 if the conditions of the request allow the object to be sent,
+// else the status code to respond with
+static int check_conditions(const Request *request, const char *eTag,
+                            time_t lastModified)
+{
+    const char *value;
+    if ((value = get_header(request, "If-Match")) &&
+        !etags_match(value, eTag)) {
+        return 412;
+    }
+    if ((value = get_header(request, "If-Unmodified-Since")) &&
+        (parse_http_date(value) >= 0) &&
+        (lastModified > parse_http_date(value))) {
+        return 412;
+    }
+    if ((value = get_header(request, "If-None-Match")) &&
+        etags_match(value, eTag)) {
+        return 304;
+    }
+    if ((value = get_header(request, "If-Modified-Since")) &&
+        (parse_http_date(value) >= 0) &&
+        (lastModified <= parse_http_date(value))) {
+        return 304;
+    }
+    return 0;
+}
+
+
+static int get_object(Connection *connection, Request *request)
+{
+    pthread_mutex_lock(&storeMutexG);
+    Bucket *bucket = find_bucket(request->bucketName);
+    Object *object = bucket ? find_object(bucket, request->key) : 0;
+    if (!object) {
+        pthread_mutex_unlock(&storeMutexG);
+        return bucket ? SEND_NO_SUCH_KEY() : SEND_NO_SUCH_BUCKET();
+    }
+
+    char eTag[ETAG_SIZE];
+    strcpy(eTag, object->eTag);
+    time_t lastModified = object->lastModified;
+    int64_t size = object->size;
+
+    int condition = check_conditions(request, eTag, lastModified);
+    if (condition) {
+        pthread_mutex_unlock(&storeMutexG);
+        if (condition == 304) {
+            char headers[ETAG_SIZE + 16];
+            snprintf(headers, sizeof(headers), "ETag: %s\r\n", eTag);
+            return send_response(connection, request, 304, headers, 0, 0);
+        }
+        return send_error(connection, request, 412, "PreconditionFailed",
+                          "At least one of the preconditions you specified "
+                          "did not hold.");
+    }
+
+    int64_t start = 0, length = size;
+    int ranged = parse_range(get_header(request, "Range"), size, &start,
+                             &length);
+    if (ranged < 0) {
+        pthread_mutex_unlock(&storeMutexG);
+        return send_error(connection, request, 416, "InvalidRange",
+                          "The requested range is not satisfiable");
+    }
+
+    Buffer headers = { 0, 0, 0 };
+    char date[64];
+    format_http_date(lastModified, date, sizeof(date));
+    buffer_printf(&headers, "Content-Type: %s\r\nETag: %s\r\n"
+                  "Last-Modified: %s\r\nAccept-Ranges: bytes\r\n%s",
+                  object->contentType ? object->contentType :
+                  "binary/octet-stream", eTag, date,
+                  object->metaHeaders ? object->metaHeaders : "");
+    if (ranged) {
+        buffer_printf(&headers, "Content-Range: bytes %lld-%lld/%lld\r\n",
+                      (long long) start, (long long) (start + length - 1),
+                      (long long) size);
+    }
+
+    const char *data = 0;
+    Blob *blob = 0;
+    if (strcmp(request->method, "HEAD") && length) {
+        // The contents are read with the lock held so that they are the
+        // contents that the ETag is for
+        blob = read_object(bucket, object, start, length, &data);
+    }
+    pthread_mutex_unlock(&storeMutexG);
+
+    int ok;
+    if (strcmp(request->method, "HEAD") && length && !blob) {
+        ok = SEND_INTERNAL_ERROR();
+    }
+    else {
+        ok = send_response(connection, request, ranged ? 206 : 200,
+                           headers.data, data ? data : "", length);
+    }
+    free(headers.data);
+    blob_release_locked(blob);
+    return ok;
+}
+
+
+static int delete_object_request(Connection *connection, Request *request)
+{
+    pthread_mutex_lock(&storeMutexG);
+    Bucket *bucket = find_bucket(request->bucketName);
+    if (bucket) {
+        // Deleting a key that doesn't exist succeeds
+        delete_object(bucket, request->key);
+    }
+    pthread_mutex_unlock(&storeMutexG);
+    if (!bucket) {
+        return SEND_NO_SUCH_BUCKET();
+    }
+    return send_response(connection, request, 204, 0, 0, 0);
+}
+
+
+// Finishes storing a new object: adds it to the bucket and responds.  The
+// contents have been written by write_object_contents().
+static int finish_put(Connection *connection, Request *request,
+                      Object *object, const char *tempPath, Buffer *xml)
+{
+    pthread_mutex_lock(&storeMutexG);
+    Bucket *bucket = find_bucket(request->bucketName);
+    if (!bucket || !commit_object_contents(bucket, object, tempPath)) {
+        pthread_mutex_unlock(&storeMutexG);
+        if (directoryG && !bucket) {
+            unlink(tempPath);
+        }
+        free_object(object);
+        if (xml) {
+            free(xml->data);
+        }
+        return bucket ? SEND_INTERNAL_ERROR() : SEND_NO_SUCH_BUCKET();
+    }
+    char headers[ETAG_SIZE + 16];
+    snprintf(headers, sizeof(headers), "ETag: %s\r\n", object->eTag);
+    if (xml) {
+        char date[64];
+        format_iso8601_date(object->lastModified, date, sizeof(date));
+        buffer_printf(xml, "<LastModified>%s</LastModified><ETag>", date);
+        buffer_append_xml(xml, object->eTag);
+        buffer_printf(xml, "</ETag>");
+    }
+    put_object(bucket, object);
+    pthread_mutex_unlock(&storeMutexG);
+
+    if (xml) {
+        buffer_printf(xml, "</CopyObjectResult>");
+        return send_xml(connection, request, 200, headers, xml);
+    }
+    return send_response(connection, request, 200, headers, 0, 0);
+}
+
+
+static Object *new_object(const char *key, const char *contentType,
+                          char *metaHeaders)
+{
+    Object *object = (Object *) checked_malloc(sizeof(Object));
+    object->key = string_copy(key);
+    object->contentType = string_copy(contentType);
+    object->metaHeaders = metaHeaders;
+    object->blob = 0;
+    return object;
+}
+
+
+static int put_object_request(Connection *connection, Request *request)
+{
+    pthread_mutex_lock(&storeMutexG);
+    int found = (find_bucket(request->bucketName) != 0);
+    pthread_mutex_unlock(&storeMutexG);
+    if (!found) {
+        return SEND_NO_SUCH_BUCKET();
+    }
+
+    Object *object = new_object(request->key,
+                                get_header(request, "Content-Type"),
+                                request_meta_headers(request));
+    Blob *blob = request->body;
+    request->body = 0;
+    if (!blob) {
+        blob = blob_new(0);
+    }
+    char tempPath[4096];
+    if (!write_object_contents(object, blob, tempPath, sizeof(tempPath),
+                               request->bucketName)) {
+        free_object(object);
+        return SEND_INTERNAL_ERROR();
+    }
+    return finish_put(connection, request, object, tempPath, 0);
+}
+
+
+// Reads the part of the source named by the request's x-amz-copy-source
+// (and x-amz-copy-source-range, if rangeAllowed) header into a new Blob.
+// Returns 0 having responded with an error if it can't.
+static Blob *read_copy_source(Connection *connection, Request *request,
+                              int rangeAllowed, char **contentType,
+                              char **metaHeaders)
+{
+    const char *source = get_header(request, "x-amz-copy-source");
+    char decoded[S3_MAX_KEY_SIZE + 258];
+    if (*source == '/') {
+        source++;
+    }
+    if (!url_decode(decoded, sizeof(decoded), source, strlen(source), 1) ||
+        !strchr(decoded, '/')) {
+        send_error(connection, request, 400, "InvalidArgument",
+                   "Copy Source must mention the source bucket and key.");
+        return 0;
+    }
+    char *sourceKey = strchr(decoded, '/');
+    *sourceKey++ = 0;
+
+    pthread_mutex_lock(&storeMutexG);
+    Bucket *bucket = find_bucket(decoded);
+    Object *object = bucket ? find_object(bucket, sourceKey) : 0;
+    if (!object) {
+        pthread_mutex_unlock(&storeMutexG);
+        if (bucket) {
+            SEND_NO_SUCH_KEY();
+        }
+        else {
+            SEND_NO_SUCH_BUCKET();
+        }
+        return 0;
+    }
+    int64_t start = 0, length = object->size;
+    const char *range = rangeAllowed ?
+        get_header(request, "x-amz-copy-source-range") : 0;
+    if (range && (parse_range(range, object->size, &start, &length) < 0)) {
+        pthread_mutex_unlock(&storeMutexG);
+        send_error(connection, request, 416, "InvalidRange",
+                   "The requested range is not satisfiable");
+        return 0;
+    }
+    if (contentType) {
+        *contentType = string_copy(object->contentType);
+        *metaHeaders = string_copy(object->metaHeaders);
+    }
+    const char *data;
+    Blob *contents = read_object(bucket, object, start, length, &data);
+    Blob *copy = 0;
+    if (contents) {
+        // A copy, so that the new object's contents stand alone
+        copy = blob_new(length);
+        memcpy(copy->data, data, length);
+        blob_release(contents);
+    }
+    pthread_mutex_unlock(&storeMutexG);
+
+    if (!copy) {
+        if (contentType) {
+            free(*contentType);
+            free(*metaHeaders);
+        }
+        SEND_INTERNAL_ERROR();
+    }
+    return copy;
+}
+
+
+static int copy_object(Connection *connection, Request *request)
+{
+    pthread_mutex_lock(&storeMutexG);
+    int found = (find_bucket(request->bucketName) != 0);
+    pthread_mutex_unlock(&storeMutexG);
+    if (!found) {
+        return SEND_NO_SUCH_BUCKET();
+    }
+
+    char *contentType, *metaHeaders;
+    Blob *blob = read_copy_source(connection, request, 0, &contentType,
+                                  &metaHeaders);
+    if (!blob) {
+        return 1;
+    }
+
+    const char *directive = get_header(request, "x-amz-metadata-directive");
+    if (directive && !strcmp(directive, "REPLACE")) {
+        free(contentType);
+        free(metaHeaders);
+        contentType = string_copy(get_header(request, "Content-Type"));
+        metaHeaders = request_meta_headers(request);
+    }
+
+    Object *object = new_object(request->key, 0, metaHeaders);
+    object->contentType = contentType;
+    char tempPath[4096];
+    if (!write_object_contents(object, blob, tempPath, sizeof(tempPath),
+                               request->bucketName)) {
+        free_object(object);
+        return SEND_INTERNAL_ERROR();
+    }
+
+    Buffer xml = { 0, 0, 0 };
+    buffer_printf(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<CopyObjectResult>");
+    return finish_put(connection, request, object, tempPath, &xml);
+}
+
+
+// Multipart uploads ---------------------------------------------------------
+
+// The store mutex must be held
+static Upload *find_upload(const Request *request, const char *uploadId)
+{
+    Upload *upload;
+    for (upload = uploadsG; upload; upload = upload->next) {
+        if (!strcmp(upload->uploadId, uploadId) &&
+            !strcmp(upload->bucketName, request->bucketName) &&
+            !strcmp(upload->key, request->key)) {
+            return upload;
+        }
+    }
+    return 0;
+}
+
+
+// The store mutex must be held
+static void free_upload(Upload *upload)
+{
+    Upload **prev = &uploadsG;
+    while (*prev != upload) {
+        prev = &((*prev)->next);
+    }
+    *prev = upload->next;
+    while (upload->parts) {
+        Part *part = upload->parts;
+        upload->parts = part->next;
+        blob_release(part->blob);
+        free(part);
+    }
+    free(upload->bucketName);
+    free(upload->key);
+    free(upload->contentType);
+    free(upload->metaHeaders);
+    free(upload);
+}
+
+
+static int initiate_upload(Connection *connection, Request *request)
+{
+    pthread_mutex_lock(&storeMutexG);
+    if (!find_bucket(request->bucketName)) {
+        pthread_mutex_unlock(&storeMutexG);
+        return SEND_NO_SUCH_BUCKET();
+    }
+    Upload *upload = (Upload *) checked_malloc(sizeof(Upload));
+    snprintf(upload->uploadId, sizeof(upload->uploadId), "%08lx%016llx",
+             (unsigned long) time(NULL), ++uploadCountG);
+    upload->bucketName = string_copy(request->bucketName);
+    upload->key = string_copy(request->key);
+    upload->contentType = string_copy(get_header(request, "Content-Type"));
+    upload->metaHeaders = request_meta_headers(request);
+    upload->parts = 0;
+    upload->next = uploadsG;
+    uploadsG = upload;
+
+    Buffer xml = { 0, 0, 0 };
+    buffer_printf(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<InitiateMultipartUploadResult><Bucket>");
+    buffer_append_xml(&xml, request->bucketName);
+    buffer_printf(&xml, "</Bucket><Key>");
+    buffer_append_xml(&xml, request->key);
+    buffer_printf(&xml, "</Key><UploadId>%s</UploadId>"
+                  "</InitiateMultipartUploadResult>", upload->uploadId);
+    pthread_mutex_unlock(&storeMutexG);
+
+    return send_xml(connection, request, 200, 0, &xml);
+}
+
+
+static int put_part(Connection *connection, Request *request,
+                    const char *uploadId, int partNumber)
+{
+    if ((partNumber < 1) || (partNumber > 10000)) {
+        return send_error(connection, request, 400, "InvalidArgument",
+                          "Part number must be an integer between 1 and "
+                          "10000, inclusive");
+    }
+
+    pthread_mutex_lock(&storeMutexG);
+    int found = (find_upload(request, uploadId) != 0);
+    pthread_mutex_unlock(&storeMutexG);
+    if (!found) {
+        return SEND_NO_SUCH_UPLOAD();
+    }
+
+    int copied = (get_header(request, "x-amz-copy-source") != 0);
+    Blob *blob;
+    if (copied) {
+        if (!(blob = read_copy_source(connection, request, 1, 0, 0))) {
+            return 1;
+        }
+    }
+    else {
+        blob = request->body ? request->body : blob_new(0);
+        request->body = 0;
+    }
+
+    Part *part = (Part *) checked_malloc(sizeof(Part));
+    part->partNumber = partNumber;
+    part->blob = blob;
+    compute_etag(blob->data, blob->size, 0, part->eTag);
+
+    pthread_mutex_lock(&storeMutexG);
+    Upload *upload = find_upload(request, uploadId);
+    if (!upload) {
+        // Aborted meanwhile
+        blob_release(blob);
+        pthread_mutex_unlock(&storeMutexG);
+        free(part);
+        return SEND_NO_SUCH_UPLOAD();
+    }
+    Part **prev = &(upload->parts);
+    while (*prev && ((*prev)->partNumber < partNumber)) {
+        prev = &((*prev)->next);
+    }
+    if (*prev && ((*prev)->partNumber == partNumber)) {
+        // Uploading a part again replaces it
+        Part *replaced = *prev;
+        *prev = replaced->next;
+        blob_release(replaced->blob);
+        free(replaced);
+    }
+    part->next = *prev;
+    *prev = part;
+    char eTag[ETAG_SIZE];
+    strcpy(eTag, part->eTag);
+    pthread_mutex_unlock(&storeMutexG);
+
+    if (copied) {
+        char date[64];
+        format_iso8601_date(time(NULL), date, sizeof(date));
+        Buffer xml = { 0, 0, 0 };
+        buffer_printf(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                      "<CopyPartResult><LastModified>%s</LastModified>"
+                      "<ETag>", date);
+        buffer_append_xml(&xml, eTag);
+        buffer_printf(&xml, "</ETag></CopyPartResult>");
+        return send_xml(connection, request, 200, 0, &xml);
+    }
+    char headers[ETAG_SIZE + 16];
+    snprintf(headers, sizeof(headers), "ETag: %s\r\n", eTag);
+    return send_response(connection, request, 200, headers, 0, 0);
+}
+
+
+typedef struct CompleteData
+{
+    Upload *upload;
+
+    // The parts named so far, in order
+    Part **parts;
+
+    int partsCount;
+
+    int partNumber;
+
+    // Set if a part is missing, out of order or has the wrong ETag
+    int invalid;
+} CompleteData;
+
+
+// The store mutex is held while parsing the complete request
+static void completeCallback(int index, const char *text, void *callbackData)
+{
+    CompleteData *data = (CompleteData *) callbackData;
+    if (index == 0) {
+        data->partNumber = atoi(text);
+        return;
+    }
+    Part *part;
+    for (part = data->upload->parts; part; part = part->next) {
+        if (part->partNumber == data->partNumber) {
+            break;
+        }
+    }
+    if (!part || !etags_match(part->eTag, text) || (data->partsCount &&
+        (data->parts[data->partsCount - 1]->partNumber >=
+         data->partNumber)) || (data->partsCount == 10000)) {
+        data->invalid = 1;
+        return;
+    }
+    data->parts[data->partsCount++] = part;
+}
+
+
+static int complete_upload(Connection *connection, Request *request,
+                           const char *uploadId)
+{
+    static const char *paths[] =
+        { "CompleteMultipartUpload/Part/PartNumber",
+          "CompleteMultipartUpload/Part/ETag" };
+
+    CompleteData data;
+    data.parts = (Part **) checked_malloc(10000 * sizeof(Part *));
+    data.partsCount = data.partNumber = data.invalid = 0;
+
+    pthread_mutex_lock(&storeMutexG);
+    if (!(data.upload = find_upload(request, uploadId))) {
+        pthread_mutex_unlock(&storeMutexG);
+        free(data.parts);
+        return SEND_NO_SUCH_UPLOAD();
+    }
+    if (!parse_xml_fields(request->body, paths, 2, &completeCallback,
+                          &data) || data.invalid || !data.partsCount) {
+        pthread_mutex_unlock(&storeMutexG);
+        free(data.parts);
+        return send_error(connection, request, 400, "InvalidPart",
+                          "One or more of the specified parts could not be "
+                          "found, or did not match.");
+    }
+
+    int64_t size = 0;
+    int i;
+    for (i = 0; i < data.partsCount; i++) {
+        size += data.parts[i]->blob->size;
+    }
+    Blob *blob = blob_new(size);
+    size = 0;
+    for (i = 0; i < data.partsCount; i++) {
+        memcpy(&(blob->data[size]), data.parts[i]->blob->data,
+               data.parts[i]->blob->size);
+        size += data.parts[i]->blob->size;
+    }
+    Object *object = new_object(request->key, data.upload->contentType,
+                                data.upload->metaHeaders);
+    data.upload->metaHeaders = 0;
+    free_upload(data.upload);
+    pthread_mutex_unlock(&storeMutexG);
+    free(data.parts);
+
+    char tempPath[4096];
+    if (!write_object_contents(object, blob, tempPath, sizeof(tempPath),
+                               request->bucketName)) {
+        free_object(object);
+        return SEND_INTERNAL_ERROR();
+    }
+    // Multipart ETags are marked with the number of parts, as S3's are
+    char *dash = &(object->eTag[strlen(object->eTag) - 1]);
+    snprintf(dash, ETAG_SIZE - (dash - object->eTag), "-%d\"",
+             data.partsCount);
+
+    pthread_mutex_lock(&storeMutexG);
+    Bucket *bucket = find_bucket(request->bucketName);
+    if (!bucket || !commit_object_contents(bucket, object, tempPath)) {
+        pthread_mutex_unlock(&storeMutexG);
+        free_object(object);
+        return bucket ? SEND_INTERNAL_ERROR() : SEND_NO_SUCH_BUCKET();
+    }
+    Buffer xml = { 0, 0, 0 };
+    buffer_printf(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<CompleteMultipartUploadResult><Bucket>");
+    buffer_append_xml(&xml, request->bucketName);
+    buffer_printf(&xml, "</Bucket><Key>");
+    buffer_append_xml(&xml, request->key);
+    buffer_printf(&xml, "</Key><ETag>");
+    buffer_append_xml(&xml, object->eTag);
+    buffer_printf(&xml, "</ETag></CompleteMultipartUploadResult>");
+    put_object(bucket, object);
+    pthread_mutex_unlock(&storeMutexG);
+
+    return send_xml(connection, request, 200, 0, &xml);
+}
+
+
+static int abort_upload(Connection *connection, Request *request,
+                        const char *uploadId)
+{
+    pthread_mutex_lock(&storeMutexG);
+    Upload *upload = find_upload(request, uploadId);
+    if (upload) {
+        free_upload(upload);
+    }
+    pthread_mutex_unlock(&storeMutexG);
+    if (!upload) {
+        return SEND_NO_SUCH_UPLOAD();
+    }
+    return send_response(connection, request, 204, 0, 0, 0);
+}
+
+
+// Dispatch ------------------------------------------------------------------
+
+// Handles one request; returns 0 if the connection can't be used again
+static int handle_request(Connection *connection, Request *request)
+{
+    const char *method = request->method;
+    char uploadId[128], partNumber[32], ignored[8];
+    int hasUploadId = get_param(request, "uploadId", uploadId,
+                                sizeof(uploadId));
+
+    if (!request->bucketName[0]) {
+        if (!strcmp(method, "GET")) {
+            return list_service(connection, request);
+        }
+        return SEND_NOT_IMPLEMENTED();
+    }
+
+    if (!request->key[0]) {
+        if (get_param(request, "acl", ignored, sizeof(ignored))) {
+            if (!strcmp(method, "GET")) {
+                return get_acl(connection, request);
+            }
+            // ACLs are accepted and ignored
+            return send_response(connection, request, 200, 0, 0, 0);
+        }
+        if (get_param(request, "location", ignored, sizeof(ignored)) &&
+            !strcmp(method, "GET")) {
+            return get_location(connection, request);
+        }
+        if (get_param(request, "delete", ignored, sizeof(ignored)) &&
+            !strcmp(method, "POST")) {
+            return delete_objects(connection, request);
+        }
+        if (request->query[0] && !get_param(request, "prefix", ignored, 0) &&
+            !get_param(request, "marker", ignored, 0) &&
+            !get_param(request, "delimiter", ignored, 0) &&
+            !get_param(request, "max-keys", ignored, 0)) {
+            return SEND_NOT_IMPLEMENTED();
+        }
+        if (!strcmp(method, "GET")) {
+            return list_bucket(connection, request);
+        }
+        if (!strcmp(method, "PUT")) {
+            return create_bucket(connection, request);
+        }
+        if (!strcmp(method, "DELETE")) {
+            return delete_bucket(connection, request);
+        }
+        return SEND_NOT_IMPLEMENTED();
+    }
+
+    if (get_param(request, "acl", ignored, sizeof(ignored))) {
+        if (!strcmp(method, "GET")) {
+            return get_acl(connection, request);
+        }
+        return send_response(connection, request, 200, 0, 0, 0);
+    }
+    if (!strcmp(method, "POST")) {
+        if (get_param(request, "uploads", ignored, sizeof(ignored))) {
+            return initiate_upload(connection, request);
+        }
+        if (hasUploadId) {
+            return complete_upload(connection, request, uploadId);
+        }
+        return SEND_NOT_IMPLEMENTED();
+    }
+    if (!strcmp(method, "PUT")) {
+        if (hasUploadId) {
+            if (!get_param(request, "partNumber", partNumber,
+                           sizeof(partNumber))) {
+                return SEND_NOT_IMPLEMENTED();
+            }
+            return put_part(connection, request, uploadId, atoi(partNumber));
+        }
+        if (get_header(request, "x-amz-copy-source")) {
+            return copy_object(connection, request);
+        }
+        return put_object_request(connection, request);
+    }
+    if (!strcmp(method, "DELETE")) {
+        if (hasUploadId) {
+            return abort_upload(connection, request, uploadId);
+        }
+        return delete_object_request(connection, request);
+    }
+    if (!strcmp(method, "GET") || !strcmp(method, "HEAD")) {
+        return get_object(connection, request);
+    }
+    return SEND_NOT_IMPLEMENTED();
+}
+
+
+static Op request_op(const Request *request)
+{
+    const char *method = request->method;
+
+    if (!strcmp(method, "GET")) {
+        return request->key[0] ? OpGet : OpList;
+    }
+    if (!strcmp(method, "HEAD")) {
+        return OpHead;
+    }
+    if (!strcmp(method, "PUT")) {
+        return get_header(request, "x-amz-copy-source") ? OpCopy : OpPut;
+    }
+    if (!strcmp(method, "DELETE")) {
+        return OpDelete;
+    }
+    if (!strcmp(method, "POST")) {
+        return OpPost;
+    }
+    return OpOther;
+}
+
+
+// Draws the faults to inject into a request: the stall and reset are left
+// in the connection, the latency to add is returned in latencyMs, and the
+// error to respond with, if any, is returned
+static const FaultError *choose_faults(Connection *connection,
+                                       const Request *request,
+                                       long *latencyMs)
+{
+    const Faults *faults = &(faultsG[request_op(request)]);
+    uint64_t *random = &(connection->random);
+    const FaultError *error = 0;
+    int i;
+
+    *random = seedG + (request->requestId * 0xD1B54A32D192ED03ULL);
+
+    // Every draw is made whatever the faults are, so that changing one
+    // fault leaves the others injected into the same requests
+    *latencyMs = latencyMsG + random_latency(random, faults);
+    double errorDraw = random_fraction(random);
+    for (i = 0; i < faults->errorsCount; i++) {
+        errorDraw -= faults->errors[i].probability;
+        if (errorDraw < 0) {
+            error = &(faults->errors[i]);
+            break;
+        }
+    }
+    connection->reset =
+        (random_fraction(random) < faults->resetProbability);
+    connection->stallMs =
+        (random_fraction(random) < faults->stallProbability) ?
+        faults->stallMs : 0;
+    connection->faultAt = -1;
+
+    if (verboseG && (error || connection->reset || connection->stallMs)) {
+        fprintf(stderr, "fault %016llX: %d %s%s stall %ld\n",
+                request->requestId, error ? error->status : 0,
+                error ? error->code : "-",
+                connection->reset ? " reset" : "", connection->stallMs);
+    }
+
+    return error;
+}
+
+
+static void *connection_thread(void *arg)
+{
+    Connection *connection = (Connection *) arg;
+    connection->inLen = 0;
+
+    int one = 1;
+    setsockopt(connection->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    for (;;) {
+        connection->stallMs = connection->reset = 0;
+        connection->faultAt = -1;
+
+        Request request;
+        request.method = 0;
+        int status = read_request_headers(connection, &request);
+        if (!status) {
+            break;
+        }
+        pthread_mutex_lock(&storeMutexG);
+        request.requestId = ++requestCountG;
+        pthread_mutex_unlock(&storeMutexG);
+        request.body = 0;
+
+        if (status < 0) {
+            request.keepAlive = 0;
+            if (!request.method) {
+                request.method = "";
+                request.path = request.query = "";
+                request.bucketName[0] = request.key[0] = 0;
+            }
+            send_error(connection, &request, 400, "BadRequest",
+                       "The request could not be parsed.");
+            break;
+        }
+
+        long latencyMs;
+        const FaultError *error = choose_faults(connection, &request,
+                                                &latencyMs);
+
+        connection->throttle.bytes = 0;
+        if (!read_request_body(connection, &request)) {
+            blob_release_locked(request.body);
+            break;
+        }
+
+        if (latencyMs) {
+            sleep_ms(latencyMs);
+        }
+
+        connection->throttle.bytes = 0;
+        int ok = (error ?
+                  send_error(connection, &request, error->status,
+                             error->code, fault_error_message(error->code)) :
+                  handle_request(connection, &request)) && request.keepAlive;
+        blob_release_locked(request.body);
+        if (!ok) {
+            break;
+        }
+
+        // Keep whatever followed this request
+        memmove(connection->in, &(connection->in[connection->headersLen]),
+                connection->inLen - connection->headersLen);
+        connection->inLen -= connection->headersLen;
+    }
+
+    close(connection->fd);
+    free(connection);
+    return 0;
+}
+
+
+// main ----------------------------------------------------------------------
+
+static struct option longOptionsG[] =
+{
+    { "port",                 required_argument,  0,  'p' },
+    { "address",              required_argument,  0,  'a' },
+    { "directory",            required_argument,  0,  'd' },
+    { "bucket",               required_argument,  0,  'b' },
+    { "latency",              required_argument,  0,  'l' },
+    { "bandwidth",            required_argument,  0,  'w' },
+    { "faults",               required_argument,  0,  'f' },
+    { "seed",                 required_argument,  0,  's' },
+    { "verbose",              no_argument,        0,  'v' },
+    { "help",                 no_argument,        0,  'h' },
+    { 0,                      0,                  0,   0  }
+};
+
+
+static void usageExit(FILE *out)
+{
+    fprintf(out,
+"\n Usage: s3server [options]\n"
+"\n"
+" Serves the S3 REST API over HTTP, for testing and benchmarking libs3\n"
+" against the local machine; set S3_HOSTNAME to ADDRESS:PORT and use HTTP\n"
+" (s3 -u).  Request signatures are not checked.\n"
+"\n"
+" Options:\n"
+"\n"
+"   -p/--port PORT       : port to listen on (default is %d)\n"
+"   -a/--address ADDRESS : IPv4 address to listen on (default is 127.0.0.1)\n"
+"   -d/--directory DIR   : keep objects in files under DIR, one\n"
+"                          subdirectory per bucket (default is to keep them\n"
+"                          in memory)\n"
+"   -b/--bucket BUCKET   : create BUCKET on start; may be repeated\n"
+"   -l/--latency MS      : delay every response by MS milliseconds\n"
+"   -w/--bandwidth RATE  : limit each connection to RATE bytes per second\n"
+"                          (may end in k or m) of request and response\n"
+"                          bodies\n"
+"   -f/--faults FILE     : inject the latencies, errors, resets and stalls\n"
+"                          described in FILE (see load_faults in\n"
+"                          s3server.c for its format)\n"
+"   -s/--seed N          : seed the faults with N, in place of the seed in\n"
+"                          the faults file\n"
+"   -v/--verbose         : log each request to stderr\n"
+"   -h/--help            : print this help\n"
+"\n", DEFAULT_PORT);
+
+    exit(-1);
+}
+
+
+int main(int argc, char **argv)
+{
+    int port = DEFAULT_PORT;
+    const char *address = "127.0.0.1";
+    const char *buckets[64];
+    int bucketsCount = 0;
+    const char *faultsFile = 0, *seed = 0;
+
+    for (;;) {
+        int idx = 0;
+        int c = getopt_long(argc, argv, "p:a:d:b:l:w:f:s:vh", longOptionsG, &idx);
+
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'a':
+            address = optarg;
+            break;
+        case 'd':
+            directoryG = optarg;
+            break;
+        case 'b':
+            if (bucketsCount == (int) (sizeof(buckets) / sizeof(buckets[0]))) {
+                fprintf(stderr, "s3server: too many buckets\n");
+                exit(-1);
+            }
+            buckets[bucketsCount++] = optarg;
+            break;
+        case 'l':
+            latencyMsG = atol(optarg);
+            break;
+        case 'w':
+            bandwidthG = parse_rate(optarg);
+            break;
+        case 'f':
+            faultsFile = optarg;
+            break;
+        case 's':
+            seed = optarg;
+            break;
+        case 'v':
+            verboseG = 1;
+            break;
+        case 'h':
+            usageExit(stdout);
+            break;
+        default:
+            usageExit(stderr);
+        }
+    }
+
+    if ((optind < argc) || (port <= 0) || (port > 65535) ||
+        (latencyMsG < 0) || (bandwidthG < 0)) {
+        usageExit(stderr);
+    }
+
+    // The faults file may set the bandwidth too
+    if (faultsFile && !load_faults(faultsFile)) {
+        exit(-1);
+    }
+    if (seed) {
+        seedG = strtoull(seed, 0, 0);
+    }
+
+    if (directoryG && !load_directory()) {
+        exit(-1);
+    }
+
+    int i;
+    for (i = 0; i < bucketsCount; i++) {
+        if (find_bucket(buckets[i])) {
+            continue;
+        }
+        if (directoryG) {
+            char path[4096];
+            if (!directory_path(buckets[i], 0, path, sizeof(path)) ||
+                (mkdir(path, 0755) && (errno != EEXIST))) {
+                fprintf(stderr, "s3server: cannot create bucket %s\n",
+                        buckets[i]);
+                exit(-1);
+            }
+        }
+        add_bucket(buckets[i], time(NULL));
+    }
+
+    // A client going away mid-response is not a reason to exit
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &(addr.sin_addr)) != 1) {
+        fprintf(stderr, "s3server: invalid address: %s\n", address);
+        exit(-1);
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if ((listener < 0) ||
+        bind(listener, (struct sockaddr *) &addr, sizeof(addr)) ||
+        listen(listener, 128)) {
+        fprintf(stderr, "s3server: cannot listen on %s:%d: %s\n", address,
+                port, strerror(errno));
+        exit(-1);
+    }
+
+    if (verboseG) {
+        fprintf(stderr, "s3server: listening on %s:%d\n", address, port);
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (;;) {
+        int fd = accept(listener, 0, 0);
+        if (fd < 0) {
+            if ((errno == EINTR) || (errno == ECONNABORTED) ||
+                (errno == EMFILE) || (errno == ENFILE)) {
+                continue;
+            }
+            fprintf(stderr, "s3server: accept failed: %s\n", strerror(errno));
+            exit(-1);
+        }
+        Connection *connection =
+            (Connection *) checked_malloc(sizeof(Connection));
+        connection->fd = fd;
+        connection->throttle.bytes = 0;
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, &connection_thread, connection)) {
+            close(fd);
+            free(connection);
+        }
+    }
+
+    return 0;
+}
@@ -47,33 +47,34 @@ typedef struct XmlCallbackData
 } XmlCallbackData;
 
 
-static S3Status xmlCallback(const char *elementPath, const char *data,
+static S3Status xmlCallback(SimpleXmlElement element,
+                            const char *elementPath, const char *data,
                             int dataLen, void *callbackData)
 {
+    (void) elementPath;
+
     XmlCallbackData *cbData = (XmlCallbackData *) callbackData;
 
     int fit;
 
     if (data) {
-        if (!strcmp(elementPath, "ListAllMyBucketsResult/Owner/ID")) {
+        if (element == SimpleXmlElementListAllMyBucketsResultOwnerID) {
             string_buffer_append(cbData->ownerId, data, dataLen, fit);
         }
-        else if (!strcmp(elementPath, 
-                         "ListAllMyBucketsResult/Owner/DisplayName")) {
+        else if (element ==
+                 SimpleXmlElementListAllMyBucketsResultOwnerDisplayName) {
             string_buffer_append(cbData->ownerDisplayName, data, dataLen, fit);
         }
-        else if (!strcmp(elementPath, 
-                         "ListAllMyBucketsResult/Buckets/Bucket/Name")) {
+        else if (element == SimpleXmlElementListAllMyBucketsResultBucketName) {
             string_buffer_append(cbData->bucketName, data, dataLen, fit);
         }
-        else if (!strcmp
-                 (elementPath, 
-                  "ListAllMyBucketsResult/Buckets/Bucket/CreationDate")) {
+        else if (element ==
+                 SimpleXmlElementListAllMyBucketsResultBucketCreationDate) {
             string_buffer_append(cbData->creationDate, data, dataLen, fit);
         }
     }
     else {
-        if (!strcmp(elementPath, "ListAllMyBucketsResult/Buckets/Bucket")) {
+        if (element == SimpleXmlElementListAllMyBucketsResultBucket) {
             // Parse date.  Assume ISO-8601 date format.
             time_t creationDate = parseIso8601Time(cbData->creationDate);
 
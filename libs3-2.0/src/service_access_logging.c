@@ -49,17 +49,19 @@ typedef struct ConvertBlsData
 } ConvertBlsData;
 
 
-static S3Status convertBlsXmlCallback(const char *elementPath,
+static S3Status convertBlsXmlCallback(SimpleXmlElement element,
+                                      const char *elementPath,
                                       const char *data, int dataLen,
                                       void *callbackData)
 {
+    (void) elementPath;
+
     ConvertBlsData *caData = (ConvertBlsData *) callbackData;
 
     int fit;
 
     if (data) {
-        if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                    "TargetBucket")) {
+        if (element == SimpleXmlElementLoggingEnabledTargetBucket) {
             caData->targetBucketReturnLen += 
                 snprintf(&(caData->targetBucketReturn
                            [caData->targetBucketReturnLen]),
@@ -69,8 +71,7 @@ static S3Status convertBlsXmlCallback(const char *elementPath,
                 return S3StatusTargetBucketTooLong;
             }
         }
-        else if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                    "TargetPrefix")) {
+        else if (element == SimpleXmlElementLoggingEnabledTargetPrefix) {
             caData->targetPrefixReturnLen += 
                 snprintf(&(caData->targetPrefixReturn
                            [caData->targetPrefixReturnLen]),
@@ -80,41 +81,35 @@ static S3Status convertBlsXmlCallback(const char *elementPath,
                 return S3StatusTargetPrefixTooLong;
             }
         }
-        else if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                         "TargetGrants/Grant/Grantee/EmailAddress")) {
+        else if (element == SimpleXmlElementTargetGrantGranteeEmailAddress) {
             // AmazonCustomerByEmail
             string_buffer_append(caData->emailAddress, data, dataLen, fit);
             if (!fit) {
                 return S3StatusEmailAddressTooLong;
             }
         }
-        else if (!strcmp(elementPath,
-                         "AccessControlPolicy/AccessControlList/Grant/"
-                         "Grantee/ID")) {
+        else if (element == SimpleXmlElementTargetGrantGranteeID) {
             // CanonicalUser
             string_buffer_append(caData->userId, data, dataLen, fit);
             if (!fit) {
                 return S3StatusUserIdTooLong;
             }
         }
-        else if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                         "TargetGrants/Grant/Grantee/DisplayName")) {
+        else if (element == SimpleXmlElementTargetGrantGranteeDisplayName) {
             // CanonicalUser
             string_buffer_append(caData->userDisplayName, data, dataLen, fit);
             if (!fit) {
                 return S3StatusUserDisplayNameTooLong;
             }
         }
-        else if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                         "TargetGrants/Grant/Grantee/URI")) {
+        else if (element == SimpleXmlElementTargetGrantGranteeURI) {
             // Group
             string_buffer_append(caData->groupUri, data, dataLen, fit);
             if (!fit) {
                 return S3StatusGroupUriTooLong;
             }
         }
-        else if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                         "TargetGrants/Grant/Permission")) {
+        else if (element == SimpleXmlElementTargetGrantPermission) {
             // Permission
             string_buffer_append(caData->permission, data, dataLen, fit);
             if (!fit) {
@@ -123,8 +118,7 @@ static S3Status convertBlsXmlCallback(const char *elementPath,
         }
     }
     else {
-        if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                    "TargetGrants/Grant")) {
+        if (element == SimpleXmlElementTargetGrant) {
             // A grant has just been completed; so add the next S3AclGrant
             // based on the values read
             if (*(caData->aclGrantCountReturn) == S3_MAX_ACL_GRANT_COUNT) {
@@ -24,183 +24,548 @@
  *
  ************************************************************************** **/
 
-#include <libxml/parser.h>
 #include <string.h>
 #include "simplexml.h"
 
-// Use libxml2 for parsing XML.  XML is severely overused in modern
-// computing.  It is useful for only a very small subset of tasks, but
-// software developers who don't know better and are afraid to go against the
-// grain use it for everything, and in most cases, it is completely
-// inappropriate.  Usually, the document structure is severely under-specified
-// as well, as is the case with S3.  We do our best by just caring about the
-// most important aspects of the S3 "XML document" responses: the elements and
-// their values.  The SAX API (just about the lamest API ever devised and
-// proof that XML sucks - well, the real proof is how crappy all of the XML
-// parsing libraries are, including libxml2 - but I digress) is used here
-// because we don't need much from the parser and SAX is fast and low memory.
+// S3 "XML documents" are a tiny, flat dialect: a handful of known elements,
+// no namespaces that matter, no attributes that matter, and character data
+// that is almost always plain ASCII.  A general purpose parser does a lot of
+// work that is wasted on that (building element names, attribute lists,
+// entity tables, and so on), so we use a small incremental scanner instead.
+// It keeps all of its state in the SimpleXml structure, never allocates, and
+// hands character data to the callback as spans of the caller's buffer.
 //
 // Note that for simplicity we assume all ASCII here.  No attempts are made to
 // detect non-ASCII sequences in utf-8 and convert them into ASCII in any way.
-// S3 appears to only use ASCII anyway.
+// S3 appears to only use ASCII anyway.  Numeric character references above
+// 127 are emitted as utf-8.
 
 
-static xmlEntityPtr saxGetEntity(void *user_data, const xmlChar *name)
+// Element table -------------------------------------------------------------
+
+typedef struct ElementDefinition
+{
+    SimpleXmlElement parent;
+    const char *name;
+    int nameLen;
+} ElementDefinition;
+
+static const ElementDefinition elementDefinitionsG[SimpleXmlElementCount] =
+{
+    { SimpleXmlElementNone, "", 0 }, // SimpleXmlElementNone
+    { SimpleXmlElementNone, "", 0 }, // SimpleXmlElementUnknown
+#define SIMPLEXML_ELEMENT_DEFINITION(id, parent, name)                        \
+    { SimpleXmlElement##parent, name, sizeof(name) - 1 },
+    SIMPLEXML_ELEMENTS(SIMPLEXML_ELEMENT_DEFINITION)
+#undef SIMPLEXML_ELEMENT_DEFINITION
+};
+
+
+static SimpleXmlElement find_element(SimpleXmlElement parent,
+                                     const char *name, int nameLen)
 {
-    (void) user_data;
+    if (parent == SimpleXmlElementUnknown) {
+        return SimpleXmlElementUnknown;
+    }
 
-    return xmlGetPredefinedEntity(name);
+    // Children are always listed after their parent
+    int i;
+    for (i = parent + 1; i < SimpleXmlElementCount; i++) {
+        const ElementDefinition *def = &(elementDefinitionsG[i]);
+        if ((def->parent == parent) && (def->nameLen == nameLen) &&
+            !memcmp(def->name, name, nameLen)) {
+            return (SimpleXmlElement) i;
+        }
+    }
+
+    return SimpleXmlElementUnknown;
 }
 
 
-static void saxStartElement(void *user_data, const xmlChar *nameUtf8,
-                            const xmlChar **attr)
+// Scanner -------------------------------------------------------------------
+
+typedef enum
+{
+    ScanStateText,
+    ScanStateEntity,
+    ScanStateTagOpen,
+    ScanStateStartTagName,
+    ScanStateStartTag,
+    ScanStateStartTagQuote,
+    ScanStateStartTagEmpty,
+    ScanStateEndTagName,
+    ScanStateEndTag,
+    ScanStateMarkup,
+    ScanStateCommentOpen,
+    ScanStateComment,
+    ScanStateCDataOpen,
+    ScanStateCData,
+    ScanStateDeclaration,
+    ScanStateProcessingInstruction
+} ScanState;
+
+#define is_space(c) (((c) == ' ') || ((c) == '\t') || ((c) == '\r') ||      \
+                     ((c) == '\n'))
+
+#define is_name_char(c) (!is_space(c) && ((c) != '>') && ((c) != '/') &&    \
+                         ((c) != '<') && ((c) != '=') && ((c) != '"') &&     \
+                         ((c) != '\'') && ((c) != '&'))
+
+#define CDATA_OPEN "CDATA["
+#define CDATA_OPEN_LEN (sizeof(CDATA_OPEN) - 1)
+
+
+static void fail(SimpleXml *simpleXml)
 {
-    (void) attr;
+    simpleXml->status = S3StatusXmlParseFailure;
+}
 
-    SimpleXml *simpleXml = (SimpleXml *) user_data;
 
-    if (simpleXml->status != S3StatusOK) {
+// Character data outside of the root element is ignored
+static void characters(SimpleXml *simpleXml, const char *data, int dataLen)
+{
+    if (!simpleXml->elementDepth) {
         return;
     }
-    
-    // Assume that name has no non-ASCII in it
-    char *name = (char *) nameUtf8;
 
-    // Append the element to the element path
-    int len = strlen(name);
+    simpleXml->status = (*(simpleXml->callback))
+        (simpleXml->elements[simpleXml->elementDepth - 1],
+         simpleXml->elementPath, data, dataLen, simpleXml->callbackData);
+}
+
 
-    if ((simpleXml->elementPathLen + len + 1) >= 
-        (int) sizeof(simpleXml->elementPath)) {
-        // Cannot handle this element, stop!
-        simpleXml->status = S3StatusXmlParseFailure;
+static void start_element(SimpleXml *simpleXml)
+{
+    if ((simpleXml->elementDepth == SIMPLEXML_MAX_DEPTH) ||
+        ((simpleXml->elementPathLen + 1) >= 
+         (int) sizeof(simpleXml->elementPath))) {
+        fail(simpleXml);
         return;
     }
 
-    if (simpleXml->elementPathLen) {
+    simpleXml->elementPathLens[simpleXml->elementDepth] = 
+        simpleXml->elementPathLen;
+
+    if (simpleXml->elementDepth) {
         simpleXml->elementPath[simpleXml->elementPathLen++] = '/';
     }
-    strcpy(&(simpleXml->elementPath[simpleXml->elementPathLen]), name);
-    simpleXml->elementPathLen += len;
 }
 
 
-static void saxEndElement(void *user_data, const xmlChar *name)
+// Element names are accumulated directly onto the end of the element path
+static void append_name(SimpleXml *simpleXml, char c)
 {
-    (void) name;
-
-    SimpleXml *simpleXml = (SimpleXml *) user_data;
-
-    if (simpleXml->status != S3StatusOK) {
+    if ((simpleXml->elementPathLen + 1) >= 
+        (int) sizeof(simpleXml->elementPath)) {
+        // Cannot handle this element, stop!
+        fail(simpleXml);
         return;
     }
 
+    simpleXml->elementPath[simpleXml->elementPathLen++] = c;
+}
+
+
+static int element_name_offset(SimpleXml *simpleXml, int depth)
+{
+    return simpleXml->elementPathLens[depth] + (depth ? 1 : 0);
+}
+
+
+static void finish_start_element(SimpleXml *simpleXml)
+{
+    int depth = simpleXml->elementDepth;
+    int offset = element_name_offset(simpleXml, depth);
+
+    simpleXml->elementPath[simpleXml->elementPathLen] = 0;
+
+    simpleXml->elements[depth] = find_element
+        (depth ? simpleXml->elements[depth - 1] : SimpleXmlElementNone,
+         &(simpleXml->elementPath[offset]), simpleXml->elementPathLen - offset);
+
+    simpleXml->elementDepth++;
+}
+
+
+static void end_element(SimpleXml *simpleXml)
+{
     // Call back with 0 data
     simpleXml->status = (*(simpleXml->callback))
-        (simpleXml->elementPath, 0, 0, simpleXml->callbackData);
-
-    while ((simpleXml->elementPathLen > 0) &&
-           (simpleXml->elementPath[simpleXml->elementPathLen] != '/')) {
-        simpleXml->elementPathLen--;
-    }
+        (simpleXml->elements[simpleXml->elementDepth - 1],
+         simpleXml->elementPath, 0, 0, simpleXml->callbackData);
 
+    simpleXml->elementDepth--;
+    simpleXml->elementPathLen = 
+        simpleXml->elementPathLens[simpleXml->elementDepth];
     simpleXml->elementPath[simpleXml->elementPathLen] = 0;
 }
 
 
-static void saxCharacters(void *user_data, const xmlChar *ch, int len)
+// Matches one more character of an end tag name against the name of the
+// innermost open element; stateCount is the number matched so far
+static void match_end_name(SimpleXml *simpleXml, char c)
 {
-    SimpleXml *simpleXml = (SimpleXml *) user_data;
+    int offset = element_name_offset(simpleXml, simpleXml->elementDepth - 1);
 
-    if (simpleXml->status != S3StatusOK) {
+    if (((offset + simpleXml->stateCount) >= simpleXml->elementPathLen) ||
+        (simpleXml->elementPath[offset + simpleXml->stateCount] != c)) {
+        fail(simpleXml);
         return;
     }
 
-    simpleXml->status = (*(simpleXml->callback))
-        (simpleXml->elementPath, (char *) ch, len, simpleXml->callbackData);
+    simpleXml->stateCount++;
 }
 
 
-static void saxError(void *user_data, const char *msg, ...)
+static int end_name_matched(SimpleXml *simpleXml)
 {
-    (void) msg;
+    int offset = element_name_offset(simpleXml, simpleXml->elementDepth - 1);
 
-    SimpleXml *simpleXml = (SimpleXml *) user_data;
+    return ((offset + simpleXml->stateCount) == simpleXml->elementPathLen);
+}
 
-    if (simpleXml->status != S3StatusOK) {
-        return;
-    }
 
-    simpleXml->status = S3StatusXmlParseFailure;
-}
+static void entity(SimpleXml *simpleXml)
+{
+    const char *name = simpleXml->token;
+    int nameLen = simpleXml->tokenLen;
 
+#define entity_is(str)                                                  \
+    ((nameLen == (int) (sizeof(str) - 1)) && !memcmp(name, str, nameLen))
+
+    if (entity_is("lt")) {
+        characters(simpleXml, "<", 1);
+    }
+    else if (entity_is("gt")) {
+        characters(simpleXml, ">", 1);
+    }
+    else if (entity_is("amp")) {
+        characters(simpleXml, "&", 1);
+    }
+    else if (entity_is("quot")) {
+        characters(simpleXml, "\"", 1);
+    }
+    else if (entity_is("apos")) {
+        characters(simpleXml, "'", 1);
+    }
+    else if ((nameLen > 1) && (name[0] == '#')) {
+        // Numeric character reference
+        unsigned long code = 0;
+        int i = 1, base = 10;
+        if ((name[1] == 'x') || (name[1] == 'X')) {
+            base = 16, i = 2;
+        }
+        if (i == nameLen) {
+            fail(simpleXml);
+            return;
+        }
+        for (; i < nameLen; i++) {
+            char c = name[i];
+            int digit;
+            if ((c >= '0') && (c <= '9')) {
+                digit = c - '0';
+            }
+            else if ((base == 16) && (c >= 'a') && (c <= 'f')) {
+                digit = c - 'a' + 10;
+            }
+            else if ((base == 16) && (c >= 'A') && (c <= 'F')) {
+                digit = c - 'A' + 10;
+            }
+            else {
+                fail(simpleXml);
+                return;
+            }
+            code = (code * base) + digit;
+            if (code > 0x10FFFF) {
+                fail(simpleXml);
+                return;
+            }
+        }
+        // Encode as utf-8, reusing the token buffer
+        char *utf8 = simpleXml->token;
+        int len;
+        if (code < 0x80) {
+            utf8[0] = (char) code;
+            len = 1;
+        }
+        else if (code < 0x800) {
+            utf8[0] = (char) (0xC0 | (code >> 6));
+            utf8[1] = (char) (0x80 | (code & 0x3F));
+            len = 2;
+        }
+        else if (code < 0x10000) {
+            utf8[0] = (char) (0xE0 | (code >> 12));
+            utf8[1] = (char) (0x80 | ((code >> 6) & 0x3F));
+            utf8[2] = (char) (0x80 | (code & 0x3F));
+            len = 3;
+        }
+        else {
+            utf8[0] = (char) (0xF0 | (code >> 18));
+            utf8[1] = (char) (0x80 | ((code >> 12) & 0x3F));
+            utf8[2] = (char) (0x80 | ((code >> 6) & 0x3F));
+            utf8[3] = (char) (0x80 | (code & 0x3F));
+            len = 4;
+        }
+        characters(simpleXml, utf8, len);
+    }
+    else {
+        // No DTDs, so no other entities can be defined
+        fail(simpleXml);
+    }
+}
 
-static struct _xmlSAXHandler saxHandlerG =
-{
-    0, // internalSubsetSAXFunc
-    0, // isStandaloneSAXFunc
-    0, // hasInternalSubsetSAXFunc
-    0, // hasExternalSubsetSAXFunc
-    0, // resolveEntitySAXFunc
-    &saxGetEntity, // getEntitySAXFunc
-    0, // entityDeclSAXFunc
-    0, // notationDeclSAXFunc
-    0, // attributeDeclSAXFunc
-    0, // elementDeclSAXFunc
-    0, // unparsedEntityDeclSAXFunc
-    0, // setDocumentLocatorSAXFunc
-    0, // startDocumentSAXFunc
-    0, // endDocumentSAXFunc
-    &saxStartElement, // startElementSAXFunc
-    &saxEndElement, // endElementSAXFunc
-    0, // referenceSAXFunc
-    &saxCharacters, // charactersSAXFunc
-    0, // ignorableWhitespaceSAXFunc
-    0, // processingInstructionSAXFunc
-    0, // commentSAXFunc
-    0, // warningSAXFunc
-    &saxError, // errorSAXFunc
-    &saxError, // fatalErrorSAXFunc
-    0, // getParameterEntitySAXFunc
-    &saxCharacters, // cdataBlockSAXFunc
-    0, // externalSubsetSAXFunc
-    0, // initialized
-    0, // _private
-    0, // startElementNsSAX2Func
-    0, // endElementNsSAX2Func
-    0 // xmlStructuredErrorFunc serror;
-};
 
 void simplexml_initialize(SimpleXml *simpleXml, 
                           SimpleXmlCallback *callback, void *callbackData)
 {
     simpleXml->callback = callback;
     simpleXml->callbackData = callbackData;
+    simpleXml->elementPath[0] = 0;
     simpleXml->elementPathLen = 0;
+    simpleXml->elementDepth = 0;
+    simpleXml->state = ScanStateText;
+    simpleXml->stateCount = 0;
+    simpleXml->tokenLen = 0;
     simpleXml->status = S3StatusOK;
-    simpleXml->xmlParser = 0;
 }
 
 
 void simplexml_deinitialize(SimpleXml *simpleXml)
 {
-    if (simpleXml->xmlParser) {
-        xmlFreeParserCtxt(simpleXml->xmlParser);
-    }
+    // Nothing is allocated, so there is nothing to free
+    (void) simpleXml;
 }
 
 
 S3Status simplexml_add(SimpleXml *simpleXml, const char *data, int dataLen)
 {
-    if (!simpleXml->xmlParser &&
-        (!(simpleXml->xmlParser = xmlCreatePushParserCtxt
-           (&saxHandlerG, simpleXml, 0, 0, 0)))) {
-        return S3StatusInternalError;
-    }
-
-    if (xmlParseChunk((xmlParserCtxtPtr) simpleXml->xmlParser, 
-                      data, dataLen, 0)) {
-        return S3StatusXmlParseFailure;
+    const char *end = &(data[dataLen]);
+
+    while ((data < end) && (simpleXml->status == S3StatusOK)) {
+        // The states that consume runs of bytes handle them inline; all
+        // others consume exactly one byte per pass
+        if (simpleXml->state == ScanStateText) {
+            const char *start = data;
+            while ((data < end) && (*data != '<') && (*data != '&')) {
+                data++;
+            }
+            if (data > start) {
+                characters(simpleXml, start, data - start);
+            }
+            if (data < end) {
+                simpleXml->state = (*data++ == '<') ? 
+                    ScanStateTagOpen : ScanStateEntity;
+                simpleXml->tokenLen = 0;
+            }
+            continue;
+        }
+
+        if ((simpleXml->state == ScanStateCData) && !simpleXml->stateCount) {
+            const char *start = data;
+            while ((data < end) && (*data != ']')) {
+                data++;
+            }
+            if (data > start) {
+                characters(simpleXml, start, data - start);
+            }
+            if (data < end) {
+                // Possibly the start of the "]]>" terminator
+                simpleXml->stateCount = 1;
+                data++;
+            }
+            continue;
+        }
+
+        char c = *data++;
+
+        switch (simpleXml->state) {
+        case ScanStateEntity:
+            if (c == ';') {
+                entity(simpleXml);
+                simpleXml->state = ScanStateText;
+            }
+            else if (simpleXml->tokenLen < 
+                     (int) (sizeof(simpleXml->token) - 1)) {
+                simpleXml->token[simpleXml->tokenLen++] = c;
+            }
+            else {
+                fail(simpleXml);
+            }
+            break;
+        case ScanStateTagOpen:
+            if (c == '/') {
+                if (!simpleXml->elementDepth) {
+                    fail(simpleXml);
+                }
+                simpleXml->state = ScanStateEndTagName;
+                simpleXml->stateCount = 0;
+            }
+            else if (c == '!') {
+                simpleXml->state = ScanStateMarkup;
+            }
+            else if (c == '?') {
+                simpleXml->state = ScanStateProcessingInstruction;
+                simpleXml->stateCount = 0;
+            }
+            else if (is_name_char(c)) {
+                start_element(simpleXml);
+                append_name(simpleXml, c);
+                simpleXml->state = ScanStateStartTagName;
+            }
+            else {
+                fail(simpleXml);
+            }
+            break;
+        case ScanStateStartTagName:
+            if (is_name_char(c)) {
+                append_name(simpleXml, c);
+                break;
+            }
+            finish_start_element(simpleXml);
+            // Process the character that ended the name as part of the tag
+            // fall through
+        case ScanStateStartTag:
+            if (c == '>') {
+                simpleXml->state = ScanStateText;
+            }
+            else if (c == '/') {
+                simpleXml->state = ScanStateStartTagEmpty;
+            }
+            else if ((c == '"') || (c == '\'')) {
+                simpleXml->token[0] = c;
+                simpleXml->state = ScanStateStartTagQuote;
+            }
+            else {
+                // Attributes are of no interest; skip them
+                simpleXml->state = ScanStateStartTag;
+            }
+            break;
+        case ScanStateStartTagQuote:
+            if (c == simpleXml->token[0]) {
+                simpleXml->state = ScanStateStartTag;
+            }
+            break;
+        case ScanStateStartTagEmpty:
+            if (c == '>') {
+                end_element(simpleXml);
+                simpleXml->state = ScanStateText;
+            }
+            else {
+                fail(simpleXml);
+            }
+            break;
+        case ScanStateEndTagName:
+            if (is_name_char(c)) {
+                match_end_name(simpleXml, c);
+                break;
+            }
+            if (!end_name_matched(simpleXml)) {
+                fail(simpleXml);
+                break;
+            }
+            // fall through
+        case ScanStateEndTag:
+            if (c == '>') {
+                end_element(simpleXml);
+                simpleXml->state = ScanStateText;
+            }
+            else if (is_space(c)) {
+                simpleXml->state = ScanStateEndTag;
+            }
+            else {
+                fail(simpleXml);
+            }
+            break;
+        case ScanStateMarkup:
+            if (c == '-') {
+                simpleXml->state = ScanStateCommentOpen;
+            }
+            else if (c == '[') {
+                simpleXml->state = ScanStateCDataOpen;
+                simpleXml->stateCount = 0;
+            }
+            else {
+                // <!DOCTYPE and friends; stateCount tracks [ ] nesting
+                simpleXml->state = ScanStateDeclaration;
+                simpleXml->stateCount = 0;
+            }
+            break;
+        case ScanStateCommentOpen:
+            if (c == '-') {
+                simpleXml->state = ScanStateComment;
+                simpleXml->stateCount = 0;
+            }
+            else {
+                fail(simpleXml);
+            }
+            break;
+        case ScanStateComment:
+            // stateCount is the number of consecutive '-' seen
+            if ((c == '>') && (simpleXml->stateCount >= 2)) {
+                simpleXml->state = ScanStateText;
+            }
+            else if (c == '-') {
+                simpleXml->stateCount++;
+            }
+            else {
+                simpleXml->stateCount = 0;
+            }
+            break;
+        case ScanStateCDataOpen:
+            if (c != CDATA_OPEN[simpleXml->stateCount++]) {
+                fail(simpleXml);
+            }
+            else if (simpleXml->stateCount == CDATA_OPEN_LEN) {
+                simpleXml->state = ScanStateCData;
+                simpleXml->stateCount = 0;
+            }
+            break;
+        case ScanStateCData:
+            // stateCount is the number of ']' held back, at most 2
+            if (c == ']') {
+                if (simpleXml->stateCount == 2) {
+                    characters(simpleXml, "]", 1);
+                }
+                else {
+                    simpleXml->stateCount++;
+                }
+            }
+            else if ((c == '>') && (simpleXml->stateCount == 2)) {
+                simpleXml->state = ScanStateText;
+                simpleXml->stateCount = 0;
+            }
+            else {
+                // Not the terminator after all; emit what was held back and
+                // let the character be scanned as ordinary data
+                characters(simpleXml, "]]", simpleXml->stateCount);
+                simpleXml->stateCount = 0;
+                data--;
+            }
+            break;
+        case ScanStateDeclaration:
+            if (c == '[') {
+                simpleXml->stateCount++;
+            }
+            else if ((c == ']') && simpleXml->stateCount) {
+                simpleXml->stateCount--;
+            }
+            else if ((c == '>') && !simpleXml->stateCount) {
+                simpleXml->state = ScanStateText;
+            }
+            break;
+        case ScanStateProcessingInstruction:
+            // stateCount is 1 if the previous character was '?'
+            if ((c == '>') && simpleXml->stateCount) {
+                simpleXml->state = ScanStateText;
+            }
+            else {
+                simpleXml->stateCount = (c == '?');
+            }
+            break;
+        default:
+            fail(simpleXml);
+            break;
+        }
     }
 
     return simpleXml->status;
@@ -30,9 +30,11 @@
 #include <time.h>
 #include "simplexml.h"
 
-static S3Status simpleXmlCallback(const char *elementPath, const char *data,
+static S3Status simpleXmlCallback(SimpleXmlElement element,
+                                  const char *elementPath, const char *data,
                                   int dataLen, void *callbackData)
 {
+    (void) element;
     (void) callbackData;
 
     printf("[%s]: [%.*s]\n", elementPath, dataLen, data);
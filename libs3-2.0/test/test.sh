@@ -6,6 +6,9 @@
 # TEST_BUCKET_PREFIX - must be set to the test bucket prefix to use
 # S3_COMMAND - may be set to s3 command to use (i.e. valgrind s3); defaults
 #              to "s3"
+#
+# To run against the local stand-in rather than S3, start s3server and set
+# S3_HOSTNAME to its address (i.e. 127.0.0.1:8080) and S3_COMMAND to "s3 -u"
 
 if [ -z "$S3_ACCESS_KEY_ID" ]; then
     echo "S3_ACCESS_KEY_ID required"
@@ -40,6 +40,7 @@
  **/
 
 #include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -54,19 +55,18 @@
 
 // include forward declarations
 #include "libs3_wrapper.h"
+#include "s3fs_log.h"
 
 
-// Some Unix stuff (to work around Windows issues)
-#ifndef SLEEP_UNITS_PER_SECOND
-#define SLEEP_UNITS_PER_SECOND 1
-#endif
-
 // prototype declarations
 int __s3fs_test_bucket(const char *bucketName);
 int __s3fs_clear_bucket(const char *bucketName);
+int __s3fs_list_objects(const char *bucketName, const char *prefix, int max_keys, s3fs_list_callback *callback, void *data);
 int __s3fs_remove_object(const char *bucketName, const char *key);
 ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf, ssize_t start_byte, ssize_t byte_count);
-ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength); 
+ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength, const struct stat *attr); 
+int __s3fs_head_object(const char *bucketName, const char *key, struct stat *attr);
+int __s3fs_copy_object(const char *bucketName, const char *key, const char *newKey, const struct stat *attr);
 
 
 // Command-line options, saved as globals ------------------------------------
@@ -75,13 +75,36 @@ ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t
 static int showResponsePropertiesG = 0;
 static S3Protocol protocolG = S3ProtocolHTTPS;
 static S3UriStyle uriStyleG = S3UriStylePath;
-static int retriesG = 5;
+
+// Number of concurrent requests used for listing a whole bucket
+#define LIST_CONCURRENCY 16
+
+// Size of each part when copying an object too big to copy in one request
+#define COPY_PART_SIZE (1024ULL * 1024 * 1024)
+
+// Attempts made at any one request before giving up on it
+#define RETRY_MAX_ATTEMPTS 5
+
+// Bounds on the wait before retrying a request, in milliseconds
+#define RETRY_BASE_DELAY_MS 50
+#define RETRY_MAX_DELAY_MS 10000
+
+// Retries are paid for from a token bucket shared by all requests, which
+// holds at most RETRY_BUDGET_TOKENS and gets a token back for every request
+// that succeeds.  A request that S3 asked to slow down costs more to retry
+// than one that just failed.
+#define RETRY_BUDGET_TOKENS 500
+#define RETRY_COST 5
+#define RETRY_THROTTLED_COST 10
 
 
 // Environment variables, saved as globals ----------------------------------
 
 static const char *accessKeyIdG = 0;
 static const char *secretAccessKeyG = 0;
+static int hedgePercentileG = 0;
+static int initFlagsG = S3_INIT_ALL;
+static int64_t slowRequestUsG = 0;
 
 
 // Request results, saved as globals -----------------------------------------
@@ -89,6 +112,14 @@ static const char *secretAccessKeyG = 0;
 static int statusG = 0;
 static char errorDetailsG[4096] = { 0 };
 
+// Counts of what has been done, for s3fs_get_counters.  They are only
+// changed with the global lock held, but are read without it, so that
+// reading them never waits for a request.
+static s3fs_counters countersG;
+
+#define COUNT(counter, n) \
+    __atomic_fetch_add(&(countersG.counter), (n), __ATOMIC_RELAXED)
+
 
 
 // Option prefixes -----------------------------------------------------------
@@ -164,20 +195,95 @@ void s3fs_unlock() {
 #define TARGET_PREFIX_PREFIX_LEN (sizeof(TARGET_PREFIX_PREFIX) - 1)
 
 
+// request timing ------------------------------------------------------------
+
+static s3fs_request_callback *requestCallbackG = 0;
+
+void s3fs_set_request_callback(s3fs_request_callback *callback) {
+    requestCallbackG = callback;
+}
+
+// The time from one stage of a request to the next, in milliseconds; a stage
+// the request never reached took no time
+static double stage_ms(int64_t from, int64_t to)
+{
+    return ((to > from) ? (to - from) : 0) / 1000.0;
+}
+
+static void log_slow_request(const S3RequestTiming *timing)
+{
+    // a reused connection has no lookup, connect or handshake of its own
+    int64_t connected = timing->appConnectTime ? timing->appConnectTime :
+        timing->connectTime;
+
+    s3fs_warn("slow request: %s %s: %d %s, %.1f ms "
+              "(lookup %.1f, connect %.1f, tls %.1f, first byte %.1f, "
+              "transfer %.1f), %s connection, %lld bytes sent, "
+              "%lld received", timing->verb, timing->uri,
+            timing->httpResponseCode, S3_get_status_name(timing->status),
+            timing->totalTime / 1000.0,
+            stage_ms(0, timing->nameLookupTime),
+            stage_ms(timing->nameLookupTime, timing->connectTime),
+            stage_ms(timing->connectTime, timing->appConnectTime),
+            stage_ms(connected, timing->startTransferTime),
+            stage_ms(timing->startTransferTime, timing->totalTime),
+            timing->connectionReused ? "reused" : "new",
+            (long long) timing->bytesSent,
+            (long long) timing->bytesReceived);
+}
+
+static void requestTimingCallback(const S3RequestTiming *timing)
+{
+    if (!timing->connectionReused) {
+        COUNT(connections, 1);
+    }
+    if (slowRequestUsG && (timing->totalTime > slowRequestUsG)) {
+        log_slow_request(timing);
+    }
+    if (requestCallbackG) {
+        (*requestCallbackG)(timing);
+    }
+}
+
+
 // util ----------------------------------------------------------------------
 
 int s3fs_init_credentials() {
     accessKeyIdG = getenv("S3_ACCESS_KEY_ID");
     if (!accessKeyIdG) {
-        fprintf(stderr, "Missing environment variable: S3_ACCESS_KEY_ID\n");
+        s3fs_error("Missing environment variable: S3_ACCESS_KEY_ID");
         return -1;
     }
     secretAccessKeyG = getenv("S3_SECRET_ACCESS_KEY");
     if (!secretAccessKeyG) {
-        fprintf(stderr, 
-                "Missing environment variable: S3_SECRET_ACCESS_KEY\n");
+        s3fs_error("Missing environment variable: S3_SECRET_ACCESS_KEY");
         return -1;
     }
+    const char *hedgePercentile = getenv("S3_HEDGE_PERCENTILE");
+    if (hedgePercentile) {
+        hedgePercentileG = atoi(hedgePercentile);
+        if ((hedgePercentileG < 0) || (hedgePercentileG > 99)) {
+            s3fs_error("Invalid S3_HEDGE_PERCENTILE: %s", hedgePercentile);
+            return -1;
+        }
+    }
+    const char *unencrypted = getenv("S3_UNENCRYPTED");
+    if (unencrypted && *unencrypted && strcmp(unencrypted, "0")) {
+        protocolG = S3ProtocolHTTP;
+    }
+    const char *http2 = getenv("S3_HTTP2");
+    if (http2 && *http2 && strcmp(http2, "0")) {
+        initFlagsG |= S3_INIT_HTTP2;
+    }
+    const char *slowRequest = getenv("S3_SLOW_REQUEST_MS");
+    if (slowRequest) {
+        slowRequestUsG = (int64_t) (atof(slowRequest) * 1000);
+        if (slowRequestUsG <= 0) {
+            s3fs_error("Invalid S3_SLOW_REQUEST_MS: %s", slowRequest);
+            return -1;
+        }
+    }
+    S3_set_request_timing_callback(&requestTimingCallback);
     return 0;
 }
 
@@ -186,10 +292,10 @@ static void S3_init()
     S3Status status;
     const char *hostname = getenv("S3_HOSTNAME");
     
-    if ((status = S3_initialize("s3", S3_INIT_ALL, hostname))
+    if ((status = S3_initialize("s3", initFlagsG, hostname))
         != S3StatusOK) {
-        fprintf(stderr, "Failed to initialize libs3: %s\n", 
-                S3_get_status_name(status));
+        s3fs_error("Failed to initialize libs3: %s", 
+                   S3_get_status_name(status));
         exit(-1);
     }
 }
@@ -197,26 +303,94 @@ static void S3_init()
 static void printError()
 {
     if (statusG < S3StatusErrorAccessDenied) {
-        fprintf(stderr, "\nERROR: %s\n", S3_get_status_name(statusG));
+        s3fs_error("%s", S3_get_status_name(statusG));
     }
     else {
-        fprintf(stderr, "\nERROR: %s\n", S3_get_status_name(statusG));
-        fprintf(stderr, "%s\n", errorDetailsG);
+        s3fs_error("%s\n%s", S3_get_status_name(statusG), errorDetailsG);
     }
 }
 
-static int should_retry()
+// retries -------------------------------------------------------------------
+
+// Each request keeps its own retry state; the waits between attempts use
+// "decorrelated jitter", where each wait is picked at random between the
+// base delay and three times the previous wait.  This spreads out requests
+// that failed together so they don't all come back at once.
+typedef struct RetryState
+{
+    int attempts;
+    long delayMs;
+} RetryState;
+
+#define RETRY_STATE_INITIALIZER { 0, 0 }
+
+static int retryTokensG = RETRY_BUDGET_TOKENS;
+static unsigned int retrySeedG = 0;
+
+// Decides whether the last request, which finished with statusG, should be
+// made again, and if so waits before returning 1.  Must be called with the
+// global lock held; the lock is released while waiting, so that a request
+// that is backing off only holds up its own caller.  Callers that make more
+// than one request can't rely on the lock across them (see
+// libs3_wrapper.h).
+static int should_retry(RetryState *retry)
 {
-    if (retriesG--) {
-        // Sleep before next retry; start out with a 1 second sleep
-        static int retrySleepInterval = 1 * SLEEP_UNITS_PER_SECOND;
-        sleep(retrySleepInterval);
-        // Next sleep 1 second longer
-        retrySleepInterval++;
-        return 1;
+    int cost;
+
+    COUNT(requests, 1);
+    if (statusG != S3StatusOK) {
+        COUNT(errors, 1);
     }
 
-    return 0;
+    if (statusG == S3StatusOK) {
+        if (retryTokensG < RETRY_BUDGET_TOKENS) {
+            retryTokensG++;
+        }
+        return 0;
+    }
+    else if (statusG == S3StatusErrorSlowDown) {
+        // S3 returns this for 503 Slow Down / Service Unavailable
+        COUNT(throttled, 1);
+        cost = RETRY_THROTTLED_COST;
+    }
+    else if (S3_status_is_retryable(statusG)) {
+        cost = RETRY_COST;
+    }
+    else {
+        return 0;
+    }
+
+    // When the budget runs out, S3 is failing most requests; retrying would
+    // only add to its load
+    if ((++retry->attempts >= RETRY_MAX_ATTEMPTS) || (retryTokensG < cost)) {
+        return 0;
+    }
+
+    retryTokensG -= cost;
+    COUNT(retries, 1);
+
+    if (!retrySeedG) {
+        retrySeedG = (unsigned int) time(0) ^ (unsigned int) getpid();
+    }
+
+    long ceiling = retry->delayMs ? (retry->delayMs * 3) : RETRY_BASE_DELAY_MS;
+    if (ceiling > RETRY_MAX_DELAY_MS) {
+        ceiling = RETRY_MAX_DELAY_MS;
+    }
+    retry->delayMs = RETRY_BASE_DELAY_MS + 
+        (rand_r(&retrySeedG) % (ceiling - RETRY_BASE_DELAY_MS + 1));
+
+    struct timespec wait = 
+    {
+        retry->delayMs / 1000, (retry->delayMs % 1000) * 1000000
+    };
+
+    s3fs_unlock();
+    while ((nanosleep(&wait, &wait) == -1) && (errno == EINTR)) {
+    }
+    s3fs_lock();
+
+    return 1;
 }
 
 // response properties callback ----------------------------------------------
@@ -305,6 +479,24 @@ static void responseCompleteCallback(S3Status status,
 }
 
 
+void s3fs_get_counters(s3fs_counters *counters) {
+    counters->requests = __atomic_load_n(&(countersG.requests),
+                                         __ATOMIC_RELAXED);
+    counters->errors = __atomic_load_n(&(countersG.errors), __ATOMIC_RELAXED);
+    counters->retries = __atomic_load_n(&(countersG.retries),
+                                        __ATOMIC_RELAXED);
+    counters->throttled = __atomic_load_n(&(countersG.throttled),
+                                          __ATOMIC_RELAXED);
+    counters->hedges = __atomic_load_n(&(countersG.hedges), __ATOMIC_RELAXED);
+    counters->connections = __atomic_load_n(&(countersG.connections),
+                                            __ATOMIC_RELAXED);
+    counters->bytes_read = __atomic_load_n(&(countersG.bytes_read),
+                                           __ATOMIC_RELAXED);
+    counters->bytes_written = __atomic_load_n(&(countersG.bytes_written),
+                                              __ATOMIC_RELAXED);
+}
+
+
 int s3fs_test_bucket(const char *bucketName) {
     s3fs_lock();
     int rv = __s3fs_test_bucket(bucketName);
@@ -322,11 +514,12 @@ int __s3fs_test_bucket(const char *bucketName)
     };
 
     char locationConstraint[64];
+    RetryState retry = RETRY_STATE_INITIALIZER;
     do {
         S3_test_bucket(protocolG, uriStyleG, accessKeyIdG, secretAccessKeyG,
                        0, bucketName, sizeof(locationConstraint),
                        locationConstraint, 0, &responseHandler, 0);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+    } while (should_retry(&retry));
 
     const char *reason = "Unknown";
     int result = statusG == S3StatusOK ? 1 : 0;
@@ -346,7 +539,7 @@ int __s3fs_test_bucket(const char *bucketName)
         break;
     }
 
-    fprintf(stderr, "S3 test_bucket: %s\n", reason);
+    s3fs_info("S3 test_bucket: %s", reason);
 
     S3_deinitialize();
 
@@ -404,7 +597,8 @@ static S3Status traverseBucketCallback(int isTruncated, const char *nextMarker,
 
         // add key onto linked list; push at head
         struct node *el = malloc(sizeof(struct node));
-        el->key = strdup(content->key);
+        el->key = malloc(content->keyLen + 1);
+        memcpy(el->key, content->key, content->keyLen + 1);
         el->next = data->keylist;
         data->keylist = el;
     }
@@ -429,7 +623,7 @@ int __s3fs_clear_bucket(const char *bucketName) {
     S3_init();
 
     const char *prefix = 0, *marker = 0, *delimiter = 0;
-    int maxkeys = 0, allDetails = 0;
+    int allDetails = 0;
     
     S3BucketContext bucketContext =
     {
@@ -441,10 +635,12 @@ int __s3fs_clear_bucket(const char *bucketName) {
         secretAccessKeyG
     };
 
+    // Only the keys are needed, so skip date parsing
     S3ListBucketHandler listBucketHandler =
     {
         { &responsePropertiesCallback, &responseCompleteCallback },
-        &traverseBucketCallback
+        &traverseBucketCallback,
+        1
     };
 
     traverse_bucket_callback_data data;
@@ -454,22 +650,29 @@ int __s3fs_clear_bucket(const char *bucketName) {
     data.keylist = NULL;
     data.allDetails = allDetails;
 
+    struct node *klist;
+
+    // The order of the keys doesn't matter here, so list the whole bucket
+    // with many requests at once
+    RetryState retry = RETRY_STATE_INITIALIZER;
     do {
-        data.isTruncated = 0;
-        do {
-            S3_list_bucket(&bucketContext, prefix, data.nextMarker,
-                           delimiter, maxkeys, 0, &listBucketHandler, &data);
-        } while (S3_status_is_retryable(statusG) && should_retry());
-        if (statusG != S3StatusOK) {
-            break;
+        // A failed listing may have delivered some keys; start over
+        while (data.keylist) {
+            klist = data.keylist;
+            data.keylist = klist->next;
+            free(klist->key);
+            free(klist);
         }
-    } while (data.isTruncated && (!maxkeys || (data.keyCount < maxkeys)));
+        data.keyCount = 0;
+        S3_list_bucket_parallel(&bucketContext, prefix, delimiter,
+                                LIST_CONCURRENCY, &listBucketHandler, &data);
+    } while (should_retry(&retry));
 
     int rv = statusG == S3StatusOK ? 0 : -1;
 
     S3_deinitialize();
 
-    struct node *klist = data.keylist;
+    klist = data.keylist;
 
     // try to remove objects
     if (rv == 0) {
@@ -495,6 +698,180 @@ int __s3fs_clear_bucket(const char *bucketName) {
     return rv;
 }
 
+// list objects --------------------------------------------------------------
+
+typedef struct list_objects_callback_data
+{
+    int keyCount;
+    int keepKeys;
+    // The keys listed, in order, if they are wanted
+    struct node *keylist, **tail;
+} list_objects_callback_data;
+
+static void free_keylist(list_objects_callback_data *data)
+{
+    while (data->keylist) {
+        struct node *el = data->keylist;
+        data->keylist = el->next;
+        free(el->key);
+        free(el);
+    }
+    data->tail = &(data->keylist);
+    data->keyCount = 0;
+}
+
+static S3Status listObjectsCallback(int isTruncated, const char *nextMarker,
+                                    int contentsCount,
+                                    const S3ListBucketContent *contents,
+                                    int commonPrefixesCount,
+                                    const char **commonPrefixes,
+                                    void *callbackData)
+{
+    list_objects_callback_data *data =
+        (list_objects_callback_data *) callbackData;
+
+    (void) isTruncated;
+    (void) nextMarker;
+    (void) commonPrefixesCount;
+    (void) commonPrefixes;
+
+    int i;
+    for (i = 0; data->keepKeys && (i < contentsCount); i++) {
+        const S3ListBucketContent *content = &(contents[i]);
+
+        // add key onto linked list; append at tail, to keep S3's order
+        struct node *el = malloc(sizeof(struct node));
+        el->key = malloc(content->keyLen + 1);
+        memcpy(el->key, content->key, content->keyLen + 1);
+        el->next = NULL;
+        *(data->tail) = el;
+        data->tail = &(el->next);
+    }
+
+    data->keyCount += contentsCount;
+
+    return S3StatusOK;
+}
+
+int s3fs_list_objects(const char *bucketName, const char *prefix,
+                      int max_keys, s3fs_list_callback *callback,
+                      void *callbackData) {
+    s3fs_lock();
+    int rv = __s3fs_list_objects(bucketName, prefix, max_keys, callback,
+                                 callbackData);
+    s3fs_unlock();
+    return rv;
+}
+
+int __s3fs_list_objects(const char *bucketName, const char *prefix,
+                        int max_keys, s3fs_list_callback *callback,
+                        void *callbackData) {
+    S3_init();
+
+    S3BucketContext bucketContext =
+    {
+        0,
+        bucketName,
+        protocolG,
+        uriStyleG,
+        accessKeyIdG,
+        secretAccessKeyG
+    };
+
+    // Only the keys are wanted, so skip date parsing
+    S3ListBucketHandler listBucketHandler =
+    {
+        { &responsePropertiesCallback, &responseCompleteCallback },
+        &listObjectsCallback,
+        1
+    };
+
+    list_objects_callback_data data;
+    data.keylist = NULL;
+    data.keepKeys = (callback != NULL);
+
+    // The keys are passed on only once the listing has succeeded, so that
+    // a failed attempt that is retried doesn't pass any on twice
+    RetryState retry = RETRY_STATE_INITIALIZER;
+    do {
+        free_keylist(&data);
+        S3_list_bucket(&bucketContext, prefix, 0, 0, max_keys, 0,
+                       &listBucketHandler, &data);
+    } while (should_retry(&retry));
+
+    int rv = data.keyCount;
+
+    if (statusG != S3StatusOK) {
+        printError();
+        rv = -1;
+    }
+
+    S3_deinitialize();
+
+    struct node *el;
+    for (el = data.keylist; (rv >= 0) && el; el = el->next) {
+        (*callback)(el->key, callbackData);
+    }
+    free_keylist(&data);
+
+    return rv;
+}
+
+// file attributes -----------------------------------------------------------
+
+// File attributes are stored as x-amz-meta headers on the object itself, so
+// that they can be read back with a HEAD request instead of fetching the
+// object.  The values are decimal integers.
+
+#define ATTR_META_COUNT 4
+#define ATTR_META_MODE "mode"
+#define ATTR_META_UID "uid"
+#define ATTR_META_GID "gid"
+#define ATTR_META_MTIME "mtime"
+
+static int attr_to_meta(const struct stat *attr, S3NameValue *meta,
+                        char values[ATTR_META_COUNT][32])
+{
+    snprintf(values[0], sizeof(values[0]), "%u", (unsigned) attr->st_mode);
+    snprintf(values[1], sizeof(values[1]), "%u", (unsigned) attr->st_uid);
+    snprintf(values[2], sizeof(values[2]), "%u", (unsigned) attr->st_gid);
+    snprintf(values[3], sizeof(values[3]), "%lld",
+             (long long) attr->st_mtime);
+
+    meta[0].name = ATTR_META_MODE;
+    meta[1].name = ATTR_META_UID;
+    meta[2].name = ATTR_META_GID;
+    meta[3].name = ATTR_META_MTIME;
+
+    int i;
+    for (i = 0; i < ATTR_META_COUNT; i++) {
+        meta[i].value = values[i];
+    }
+
+    return ATTR_META_COUNT;
+}
+
+static void meta_to_attr(int metaCount, const S3NameValue *meta,
+                         struct stat *attr)
+{
+    int i;
+    for (i = 0; i < metaCount; i++) {
+        const char *name = meta[i].name, *value = meta[i].value;
+        if (!strcasecmp(name, ATTR_META_MODE)) {
+            attr->st_mode = (mode_t) strtoul(value, NULL, 10);
+        }
+        else if (!strcasecmp(name, ATTR_META_UID)) {
+            attr->st_uid = (uid_t) strtoul(value, NULL, 10);
+        }
+        else if (!strcasecmp(name, ATTR_META_GID)) {
+            attr->st_gid = (gid_t) strtoul(value, NULL, 10);
+        }
+        else if (!strcasecmp(name, ATTR_META_MTIME)) {
+            attr->st_mtime = (time_t) strtoll(value, NULL, 10);
+        }
+    }
+}
+
 // put object ----------------------------------------------------------------
 
 typedef struct put_object_callback_data
@@ -525,16 +902,14 @@ int putObjectDataCallback(int bufferSize, char *buffer,
     }
     data->written += ret;
     data->contentLength -= ret;
+    COUNT(bytes_written, ret);
 
     if (data->contentLength && !data->noStatus) {
-        // Avoid a weird bug in MingW, which won't print the second integer
-        // value properly when it's in the same call, so print separately
-        printf("%llu bytes remaining ", 
-               (unsigned long long) data->contentLength);
-        printf("(%d%% complete) ...\n",
-               (int) (((data->originalContentLength - 
-                        data->contentLength) * 100) /
-                      data->originalContentLength));
+        s3fs_debug("%llu bytes remaining (%d%% complete) ...",
+                   (unsigned long long) data->contentLength,
+                   (int) (((data->originalContentLength - 
+                            data->contentLength) * 100) /
+                          data->originalContentLength));
     }
 
     return ret;
@@ -542,12 +917,19 @@ int putObjectDataCallback(int bufferSize, char *buffer,
 
 ssize_t s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength) {
     s3fs_lock();
-    ssize_t rv = __s3fs_put_object(bucketName, key, buf, contentLength);
+    ssize_t rv = __s3fs_put_object(bucketName, key, buf, contentLength, NULL);
     s3fs_unlock();
     return rv;
 }
 
-ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength)
+ssize_t s3fs_put_object_attr(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength, const struct stat *attr) {
+    s3fs_lock();
+    ssize_t rv = __s3fs_put_object(bucketName, key, buf, contentLength, attr);
+    s3fs_unlock();
+    return rv;
+}
+
+ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t *buf, ssize_t contentLength, const struct stat *attr)
 {
     const char *cacheControl = 0, *contentType = 0, *md5 = 0;
     const char *contentDispositionFilename = 0, *contentEncoding = 0;
@@ -555,7 +937,14 @@ ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t
     S3CannedAcl cannedAcl = S3CannedAclPrivate;
     int metaPropertiesCount = 0;
     S3NameValue metaProperties[S3_MAX_METADATA_COUNT];
-    int noStatus = 0;
+    char metaValues[ATTR_META_COUNT][32];
+    // Progress is not wanted from a filesystem, and a line per buffer
+    // slows down big uploads
+    int noStatus = 1;
+
+    if (attr) {
+        metaPropertiesCount = attr_to_meta(attr, metaProperties, metaValues);
+    }
 
     put_object_callback_data data;
     memset(&data, 0, sizeof(put_object_callback_data));
@@ -596,10 +985,11 @@ ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t
         &putObjectDataCallback
     };
 
+    RetryState retry = RETRY_STATE_INITIALIZER;
     do {
         S3_put_object(&bucketContext, key, contentLength, &putProperties, 0,
                       &putObjectHandler, &data);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+    } while (should_retry(&retry));
 
     int result = data.written;
 
@@ -608,45 +998,288 @@ ssize_t __s3fs_put_object(const char *bucketName, const char *key, const uint8_t
         result = -1;
     }
     else if (data.contentLength) {
-        fprintf(stderr, "\nERROR: Failed to read remaining %llu bytes from "
-                "input\n", (unsigned long long) data.contentLength);
+        s3fs_error("Failed to read remaining %llu bytes from input",
+                   (unsigned long long) data.contentLength);
     }
 
     S3_deinitialize();
     return result;
 }
 
+// hedged reads --------------------------------------------------------------
+
+// A HEAD or GET that has had no response by the time most have had theirs is
+// probably stuck behind something slow, such as a bad connection or a busy
+// S3 host.  If S3_HEDGE_PERCENTILE is set, then once a read has waited longer
+// than that percentile of recent times to first response, the same request
+// is sent again alongside it.  Whichever of the two responds first is used,
+// and the other is abandoned right then, so the duplicate costs at most one
+// request, even for a large GET.
+
+// Recent times to first response are kept for each kind of read, and reads
+// aren't hedged until there are enough of them to go by
+#define HEDGE_SAMPLES 128
+#define HEDGE_MIN_SAMPLES 32
+
+typedef struct HedgeHistory
+{
+    // In the order they were taken, a ring in which next is the oldest once
+    // it is full; and the same samples kept in sorted order, so that a
+    // percentile is read straight off
+    double samples[HEDGE_SAMPLES];
+    double sorted[HEDGE_SAMPLES];
+    int count, next;
+} HedgeHistory;
+
+static HedgeHistory headHistoryG, getHistoryG;
+
+struct HedgedRead;
+
+// One copy of a hedged read
+typedef struct HedgeAttempt
+{
+    struct HedgedRead *read;
+    // Where the attempt's callbacks keep what it reads
+    void *callbackData;
+} HedgeAttempt;
+
+typedef struct HedgedRead
+{
+    // Makes attempt's request, on context if there is one
+    void (*start)(HedgeAttempt *attempt, S3RequestContext *context,
+                  void *startData);
+    void *startData;
+
+    HedgeAttempt attempts[2];
+    int attemptsCount;
+
+    // The attempt that responded first, once one has
+    HedgeAttempt *winner;
+    int finished;
+
+    double startTime, responseTime;
+} HedgedRead;
+
+static double monotonic_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// Returns the index in history->sorted of the first sample not less than
+// value
+static int sorted_index(const HedgeHistory *history, double value)
+{
+    int low = 0, high = history->count;
+
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (history->sorted[middle] < value) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+// Adds a sample to a history, in place of the oldest once it is full
+static void add_hedge_sample(HedgeHistory *history, double sample)
+{
+    int i;
+
+    if (history->count == HEDGE_SAMPLES) {
+        i = sorted_index(history, history->samples[history->next]);
+        memmove(&(history->sorted[i]), &(history->sorted[i + 1]),
+                (history->count - i - 1) * sizeof(double));
+        history->count--;
+    }
+
+    i = sorted_index(history, sample);
+    memmove(&(history->sorted[i + 1]), &(history->sorted[i]),
+            (history->count - i) * sizeof(double));
+    history->sorted[i] = sample;
+    history->count++;
+
+    history->samples[history->next] = sample;
+    history->next = (history->next + 1) % HEDGE_SAMPLES;
+}
+
+// Returns how long to wait for a response before hedging, in seconds, or -1
+// to not hedge
+static double hedge_delay(const HedgeHistory *history)
+{
+    if (!hedgePercentileG || (history->count < HEDGE_MIN_SAMPLES)) {
+        return -1;
+    }
+
+    return history->sorted[(history->count * hedgePercentileG) / 100];
+}
+
+// Called by an attempt when its response starts; returns S3StatusOK if it is
+// the attempt being used, or S3StatusInterrupted to abandon it
+static S3Status hedge_respond(HedgeAttempt *attempt)
+{
+    HedgedRead *read = attempt->read;
+
+    if (!read->winner) {
+        read->winner = attempt;
+        read->responseTime = monotonic_seconds();
+    }
+
+    return (read->winner == attempt) ? S3StatusOK : S3StatusInterrupted;
+}
+
+static void hedgedCompleteCallback(S3Status status, 
+                                   const S3ErrorDetails *error,
+                                   void *callbackData)
+{
+    HedgeAttempt *attempt = (HedgeAttempt *) callbackData;
+
+    // A failure is a response too; only the abandoned attempt is ignored
+    if (hedge_respond(attempt) == S3StatusOK) {
+        attempt->read->finished = 1;
+        responseCompleteCallback(status, error, 0);
+    }
+}
+
+// Makes the read, hedging it if it takes too long, and leaves the result of
+// the attempt that was used in statusG
+static void run_hedged_read(HedgedRead *read, HedgeHistory *history)
+{
+    double delay = hedge_delay(history);
+    S3RequestContext *context = 0;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        read->attempts[i].read = read;
+    }
+    read->attemptsCount = 1;
+    read->winner = 0;
+    read->finished = 0;
+    read->startTime = monotonic_seconds();
+
+    if ((delay < 0) || (S3_create_request_context(&context) != S3StatusOK)) {
+        // Made the usual way, without waiting to hedge
+        (*(read->start))(&(read->attempts[0]), 0, read->startData);
+    }
+    else {
+        (*(read->start))(&(read->attempts[0]), context, read->startData);
+
+        int requestsRemaining = 1;
+        while (!read->finished && requestsRemaining) {
+            int waiting = !read->winner && (read->attemptsCount == 1);
+            double elapsed = monotonic_seconds() - read->startTime;
+            if (waiting && (elapsed >= delay)) {
+                read->attemptsCount = 2;
+                COUNT(requests, 1);
+                COUNT(hedges, 1);
+                (*(read->start))(&(read->attempts[1]), context, 
+                                 read->startData);
+                continue;
+            }
+
+            fd_set readfds, writefds, exceptfds;
+            FD_ZERO(&readfds);
+            FD_ZERO(&writefds);
+            FD_ZERO(&exceptfds);
+            int maxfd;
+            if (S3_get_request_context_fdsets(context, &readfds, &writefds,
+                                              &exceptfds, &maxfd) 
+                != S3StatusOK) {
+                break;
+            }
+            int64_t timeout = S3_get_request_context_timeout(context);
+            if (waiting) {
+                int64_t untilHedge = ((delay - elapsed) * 1000) + 1;
+                if ((timeout == -1) || (untilHedge < timeout)) {
+                    timeout = untilHedge;
+                }
+            }
+            if (maxfd != -1) {
+                struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+                select(maxfd + 1, &readfds, &writefds, &exceptfds,
+                       (timeout == -1) ? 0 : &tv);
+            }
+            if (S3_runonce_request_context(context, &requestsRemaining)
+                != S3StatusOK) {
+                break;
+            }
+        }
+
+        // Abandons whichever attempt is still running; if that is the one
+        // that was being used, it completes as interrupted
+        S3_destroy_request_context(context);
+    }
+
+    // The time that the first attempt waited for a response; if the second
+    // one won, the first would have taken at least this long
+    if (read->winner && 
+        ((statusG == S3StatusOK) || (statusG == S3StatusHttpErrorNotFound) ||
+         (statusG == S3StatusErrorNoSuchKey))) {
+        add_hedge_sample(history, read->responseTime - read->startTime);
+    }
+}
+
+
 // get object ----------------------------------------------------------------
 
+// What a GET has read so far, over all of its tries
 struct get_callback_data {
     uint8_t *buf;
-    ssize_t bytes_read;
+    ssize_t bytes_read, buf_size;
+    // From the first response: the object's ETag, and how many bytes there
+    // are to read in all, or -1 until known
+    char etag[256];
+    ssize_t bytes_expected;
 };
 
+static S3Status getObjectPropertiesCallback
+    (const S3ResponseProperties *properties, void *callbackData)
+{
+    struct get_callback_data *get_context = (struct get_callback_data*)callbackData;
+
+    responsePropertiesCallback(properties, 0);
+
+    if (get_context->bytes_expected < 0) {
+        get_context->bytes_expected = 
+            get_context->bytes_read + properties->contentLength;
+        if (properties->eTag) {
+            snprintf(get_context->etag, sizeof(get_context->etag), "%s",
+                     properties->eTag);
+        }
+    }
+
+    return S3StatusOK;
+}
+
 S3Status getObjectDataCallback(int bufferSize, const char *buffer,
                                void *callbackData) {
     struct get_callback_data *get_context = (struct get_callback_data*)callbackData;
     if (bufferSize > 0) {
-        if (get_context->buf == NULL) {
-            // make new buffer
-            get_context->buf = malloc(sizeof(uint8_t) * bufferSize);
-            if (!get_context->buf) {
-                return S3StatusAbortedByCallback;
+        if (get_context->bytes_read + bufferSize > get_context->buf_size) {
+            // Grow by doubling, or straight to the expected size, so that a
+            // big object isn't copied over and over
+            ssize_t size = get_context->buf_size * 2;
+            if (size < get_context->bytes_read + bufferSize) {
+                size = get_context->bytes_read + bufferSize;
             }
-
-            memcpy(get_context->buf, buffer, bufferSize);
-        } else {
-            // reallocate buffer
-            uint8_t *tmp = malloc(sizeof(uint8_t) * (bufferSize + get_context->bytes_read));
+            if (size < get_context->bytes_expected) {
+                size = get_context->bytes_expected;
+            }
+            uint8_t *tmp = realloc(get_context->buf, sizeof(uint8_t) * size);
             if (!tmp) {
                 return S3StatusAbortedByCallback;
             }
-            
-            memcpy(tmp, get_context->buf, get_context->bytes_read);
-            memcpy(tmp + get_context->bytes_read, buffer, bufferSize);
-            free(get_context->buf);
             get_context->buf = tmp;
+            get_context->buf_size = size;
         }
+
+        memcpy(get_context->buf + get_context->bytes_read, buffer, bufferSize);
+        COUNT(bytes_read, bufferSize);
     }
 
     get_context->bytes_read += bufferSize;
@@ -663,6 +1296,56 @@ ssize_t s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf,
     return rv;
 }
 
+typedef struct GetObjectStart
+{
+    const S3BucketContext *bucketContext;
+    const char *key;
+    const S3GetConditions *getConditions;
+    uint64_t startByte, byteCount;
+} GetObjectStart;
+
+static S3Status hedgedGetObjectPropertiesCallback
+    (const S3ResponseProperties *properties, void *callbackData)
+{
+    HedgeAttempt *attempt = (HedgeAttempt *) callbackData;
+    S3Status status = hedge_respond(attempt);
+
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    return getObjectPropertiesCallback(properties, attempt->callbackData);
+}
+
+static S3Status hedgedGetObjectDataCallback(int bufferSize, const char *buffer,
+                                            void *callbackData)
+{
+    HedgeAttempt *attempt = (HedgeAttempt *) callbackData;
+    S3Status status = hedge_respond(attempt);
+
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    return getObjectDataCallback(bufferSize, buffer, attempt->callbackData);
+}
+
+static void start_get_object(HedgeAttempt *attempt, S3RequestContext *context,
+                             void *startData)
+{
+    GetObjectStart *start = (GetObjectStart *) startData;
+
+    S3GetObjectHandler getObjectHandler =
+    {
+        { &hedgedGetObjectPropertiesCallback, &hedgedCompleteCallback },
+        &hedgedGetObjectDataCallback
+    };
+
+    S3_get_object(start->bucketContext, start->key, start->getConditions,
+                  start->startByte, start->byteCount, context, 
+                  &getObjectHandler, attempt);
+}
+
 ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf, 
                         ssize_t start_byte, ssize_t byte_count) {
 
@@ -672,9 +1355,11 @@ ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf
 
     S3_init();
 
+    // Only the attempt of a hedged read that responds first gets to read
+    // anything, so they can share
     struct get_callback_data get_context;
-    get_context.buf = NULL;
-    get_context.bytes_read = 0;
+    memset(&get_context, 0, sizeof(get_context));
+    get_context.bytes_expected = -1;
     
     S3BucketContext bucketContext =
     {
@@ -694,23 +1379,52 @@ ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf
         ifNotMatch
     };
 
-    S3GetObjectHandler getObjectHandler =
+    GetObjectStart getObjectStart =
     {
-        { &responsePropertiesCallback, &responseCompleteCallback },
-        &getObjectDataCallback
+        &bucketContext, key, &getConditions, startByte, byteCount
     };
 
+    HedgedRead read;
+    read.start = &start_get_object;
+    read.startData = &getObjectStart;
+    read.attempts[0].callbackData = &get_context;
+    read.attempts[1].callbackData = &get_context;
+
+    RetryState retry = RETRY_STATE_INITIALIZER;
     do {
-        S3_get_object(&bucketContext, key, &getConditions, startByte,
-                      byteCount, 0, &getObjectHandler, &get_context);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+        // Each try picks up from where the last one got to, as long as the
+        // object is still the one that it was reading
+        ssize_t try_start = get_context.bytes_read;
+        getObjectStart.startByte = startByte + try_start;
+        getObjectStart.byteCount = byteCount ? (byteCount - try_start) : 0;
+        if (get_context.etag[0]) {
+            getConditions.ifMatchETag = get_context.etag;
+        }
+
+        run_hedged_read(&read, &getHistoryG);
+
+        if (get_context.bytes_expected >= 0) {
+            if (get_context.bytes_read >= get_context.bytes_expected) {
+                // Everything arrived, even if the transfer then failed
+                statusG = S3StatusOK;
+            }
+            else if (statusG == S3StatusOK) {
+                // The connection was closed early
+                statusG = S3StatusConnectionFailed;
+            }
+        }
+
+        // A try that got some of the object doesn't count against the
+        // attempts; a large read over a bad link gets there in the end
+        if (get_context.bytes_read > try_start) {
+            retry.attempts = 0;
+        }
+    } while (should_retry(&retry));
 
     ssize_t status = get_context.bytes_read;
     if (statusG != S3StatusOK) {
         status = -1;
-        if (get_context.buf) {
-            free (get_context.buf);
-        }
+        free(get_context.buf);
         printError();
     } else {
         *buf = get_context.buf; 
@@ -722,6 +1436,297 @@ ssize_t __s3fs_get_object(const char *bucketName, const char *key, uint8_t **buf
 }
 
 
+// head object ---------------------------------------------------------------
+
+static S3Status headObjectPropertiesCallback
+    (const S3ResponseProperties *properties, void *callbackData)
+{
+    struct stat *attr = (struct stat *) callbackData;
+
+    responsePropertiesCallback(properties, 0);
+
+    if (attr) {
+        attr->st_size = properties->contentLength;
+        attr->st_blocks = (attr->st_size / 512) + 1;
+        attr->st_nlink = 1;
+        // Objects written without attributes still have a modification time
+        if (properties->lastModified > 0) {
+            attr->st_mtime = (time_t) properties->lastModified;
+        }
+        meta_to_attr(properties->metaDataCount, properties->metaData, attr);
+        attr->st_atime = attr->st_ctime = attr->st_mtime;
+    }
+
+    return S3StatusOK;
+}
+
+
+typedef struct HeadObjectStart
+{
+    const S3BucketContext *bucketContext;
+    const char *key;
+} HeadObjectStart;
+
+static S3Status hedgedHeadObjectPropertiesCallback
+    (const S3ResponseProperties *properties, void *callbackData)
+{
+    HedgeAttempt *attempt = (HedgeAttempt *) callbackData;
+    S3Status status = hedge_respond(attempt);
+
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    return headObjectPropertiesCallback(properties, attempt->callbackData);
+}
+
+static void start_head_object(HedgeAttempt *attempt, S3RequestContext *context,
+                              void *startData)
+{
+    HeadObjectStart *start = (HeadObjectStart *) startData;
+
+    S3ResponseHandler responseHandler =
+    { 
+        &hedgedHeadObjectPropertiesCallback,
+        &hedgedCompleteCallback
+    };
+
+    S3_head_object(start->bucketContext, start->key, context, 
+                   &responseHandler, attempt);
+}
+
+
+int s3fs_head_object(const char *bucketName, const char *key, struct stat *attr) {
+    s3fs_lock();
+    int rv = __s3fs_head_object(bucketName, key, attr);
+    s3fs_unlock();
+    return rv;
+}
+
+int __s3fs_head_object(const char *bucketName, const char *key, struct stat *attr) {
+    S3_init();
+
+    if (attr) {
+        memset(attr, 0, sizeof(struct stat));
+    }
+
+    S3BucketContext bucketContext =
+    {
+        0,
+        bucketName,
+        protocolG,
+        uriStyleG,
+        accessKeyIdG,
+        secretAccessKeyG
+    };
+
+    HeadObjectStart headObjectStart = { &bucketContext, key };
+
+    // One for each attempt of a hedged read
+    struct stat attrs[2];
+
+    HedgedRead read;
+    read.start = &start_head_object;
+    read.startData = &headObjectStart;
+    read.attempts[0].callbackData = &(attrs[0]);
+    read.attempts[1].callbackData = &(attrs[1]);
+
+    RetryState retry = RETRY_STATE_INITIALIZER;
+    do {
+        memset(attrs, 0, sizeof(attrs));
+        run_hedged_read(&read, &headHistoryG);
+    } while (should_retry(&retry));
+
+    int result = statusG == S3StatusOK ? 0 : -1;
+
+    if (attr && (result == 0)) {
+        *attr = *((struct stat *) read.winner->callbackData);
+    }
+
+    // A missing object is an expected answer here, not an error
+    if ((statusG != S3StatusOK) &&
+        (statusG != S3StatusHttpErrorNotFound) &&
+        (statusG != S3StatusErrorNoSuchKey)) {
+        printError();
+    }
+
+    S3_deinitialize();
+
+    return result;
+}
+
+
+// copy object ---------------------------------------------------------------
+
+int s3fs_copy_object(const char *bucketName, const char *key, const char *newKey, const struct stat *attr) {
+    s3fs_lock();
+    int rv = __s3fs_copy_object(bucketName, key, newKey, attr);
+    s3fs_unlock();
+    return rv;
+}
+
+// Copies an object larger than S3_MAX_COPY_OBJECT_SIZE one part at a time
+static int copy_object_multipart(const S3BucketContext *bucketContext,
+                                 const char *key, const char *newKey,
+                                 uint64_t size, S3PutProperties *putProperties)
+{
+    S3ResponseHandler responseHandler =
+    {
+        &responsePropertiesCallback, &responseCompleteCallback
+    };
+
+    uint64_t partSize = COPY_PART_SIZE;
+    if ((size / partSize) >= S3_MAX_MULTIPART_PART_COUNT) {
+        partSize = (size / S3_MAX_MULTIPART_PART_COUNT) + 1;
+    }
+    int partsCount = (int) ((size + partSize - 1) / partSize);
+
+    char uploadId[S3_MAX_UPLOAD_ID_SIZE];
+    RetryState initiateRetry = RETRY_STATE_INITIALIZER;
+    do {
+        S3_initiate_multipart(bucketContext, newKey, putProperties,
+                              sizeof(uploadId), uploadId, 0,
+                              &responseHandler, 0);
+    } while (should_retry(&initiateRetry));
+
+    if (statusG != S3StatusOK) {
+        printError();
+        return -1;
+    }
+
+    char (*eTags)[256] = malloc(partsCount * sizeof(*eTags));
+    const char **partETags = malloc(partsCount * sizeof(char *));
+    int i, rv = (eTags && partETags) ? 0 : -1;
+
+    for (i = 0; (rv == 0) && (i < partsCount); i++) {
+        uint64_t startByte = i * partSize;
+        uint64_t byteCount = 
+            (size - startByte) < partSize ? (size - startByte) : partSize;
+        RetryState partRetry = RETRY_STATE_INITIALIZER;
+        do {
+            S3_copy_object_part(bucketContext, key, 0, newKey, uploadId,
+                                i + 1, startByte, byteCount, 
+                                sizeof(eTags[i]), eTags[i], 0,
+                                &responseHandler, 0);
+        } while (should_retry(&partRetry));
+        if (statusG != S3StatusOK) {
+            printError();
+            rv = -1;
+        }
+        else {
+            partETags[i] = eTags[i];
+        }
+    }
+
+    if (rv == 0) {
+        RetryState completeRetry = RETRY_STATE_INITIALIZER;
+        do {
+            S3_complete_multipart(bucketContext, newKey, uploadId, partsCount,
+                                  partETags, 0, &responseHandler, 0);
+        } while (should_retry(&completeRetry));
+        if (statusG != S3StatusOK) {
+            printError();
+            rv = -1;
+        }
+    }
+
+    // Don't leave the parts of a failed copy behind; S3 keeps (and bills
+    // for) them until the upload is aborted
+    if (rv < 0) {
+        RetryState abortRetry = RETRY_STATE_INITIALIZER;
+        do {
+            S3_abort_multipart(bucketContext, newKey, uploadId, 0,
+                               &responseHandler, 0);
+        } while (should_retry(&abortRetry));
+        if (statusG != S3StatusOK) {
+            printError();
+            s3fs_error("Failed to abort multipart upload %s of %s",
+                       uploadId, newKey);
+        }
+    }
+
+    free(eTags);
+    free(partETags);
+
+    return rv;
+}
+
+int __s3fs_copy_object(const char *bucketName, const char *key, const char *newKey, const struct stat *attr) {
+    // The size decides how to copy, and the attributes are carried over to
+    // a multipart copy, which doesn't keep the source's metadata
+    struct stat sourceAttr;
+    if (__s3fs_head_object(bucketName, key, &sourceAttr) < 0) {
+        return -1;
+    }
+    if (!attr && sourceAttr.st_mode) {
+        attr = &sourceAttr;
+    }
+
+    S3_init();
+
+    S3BucketContext bucketContext =
+    {
+        0,
+        bucketName,
+        protocolG,
+        uriStyleG,
+        accessKeyIdG,
+        secretAccessKeyG
+    };
+
+    S3NameValue metaProperties[ATTR_META_COUNT];
+    char metaValues[ATTR_META_COUNT][32];
+
+    S3PutProperties putProperties =
+    {
+        0,
+        0,
+        0,
+        0,
+        0,
+        -1,
+        S3CannedAclPrivate,
+        0,
+        metaProperties
+    };
+
+    if (attr) {
+        putProperties.metaDataCount = 
+            attr_to_meta(attr, metaProperties, metaValues);
+    }
+
+    int rv;
+
+    if ((uint64_t) sourceAttr.st_size > S3_MAX_COPY_OBJECT_SIZE) {
+        rv = copy_object_multipart(&bucketContext, key, newKey, 
+                                   sourceAttr.st_size, &putProperties);
+    }
+    else {
+        S3ResponseHandler responseHandler =
+        {
+            &responsePropertiesCallback, &responseCompleteCallback
+        };
+
+        RetryState retry = RETRY_STATE_INITIALIZER;
+        do {
+            S3_copy_object(&bucketContext, key, 0, newKey,
+                           attr ? &putProperties : 0, 0, 0, 0, 0,
+                           &responseHandler, 0);
+        } while (should_retry(&retry));
+
+        rv = statusG == S3StatusOK ? 0 : -1;
+
+        if (rv < 0) {
+            printError();
+        }
+    }
+
+    S3_deinitialize();
+
+    return rv;
+}
+
+
 int s3fs_remove_object(const char *bucketName, const char *key) {
     s3fs_lock();
     int rv = __s3fs_remove_object(bucketName, key);
@@ -747,9 +1752,10 @@ int __s3fs_remove_object(const char *bucketName, const char *key) {
         &responseCompleteCallback
     };
 
+    RetryState retry = RETRY_STATE_INITIALIZER;
     do {
         S3_delete_object(&bucketContext, key, 0, &responseHandler, 0);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+    } while (should_retry(&retry));
 
     int result = statusG == S3StatusOK ? 0 : -1;
 
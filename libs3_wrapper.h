@@ -12,14 +12,41 @@
 
 #include "libs3.h"
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <stdint.h>
 
+/*
+ * Calls are made one at a time, under a lock they share, except while a
+ * request that failed and is to be made again waits to be retried: the
+ * lock is let go for the wait, so that other calls go on in the meantime.
+ * So a call that makes more than one request is not atomic.  Another call
+ * may change the bucket between s3fs_copy_object's head of the source and
+ * its copy, so that the copy fails, and between s3fs_clear_bucket's
+ * listing and its removes, so that an object put meanwhile is left behind.
+ */
+
 /* 
  * Initialize credentials.  This function looks for two shell environment
  * variables: "S3_ACCESS_KEY_ID" and "S3_SECRET_ACCESS_KEY".  If they
  * exist, the function returns 0.  Otherwise it returns -1.
  * This function must be called before any other library functions
  * are called.
+ *
+ * If "S3_HEDGE_PERCENTILE" is set (to a number from 1 to 99), a HEAD or GET
+ * that hasn't had a response within that percentile of recent response
+ * times is sent a second time, and whichever copy responds first is used.
+ *
+ * If "S3_UNENCRYPTED" is set (to anything but 0), HTTP is used instead of
+ * HTTPS, as is needed to run against libs3's s3server stand-in.
+ *
+ * If "S3_HTTP2" is set (to anything but 0), requests are made with HTTP/2
+ * where the server supports it, so that concurrent requests share a
+ * connection.
+ *
+ * If "S3_SLOW_REQUEST_MS" is set, every request that takes longer than that
+ * many milliseconds is logged to stderr, with how long it spent looking up
+ * the host, connecting, in the TLS handshake, waiting for the first byte of
+ * the response and receiving the rest.
  */
 int s3fs_init_credentials();
 
@@ -37,6 +64,22 @@ int s3fs_test_bucket(const char *bucket);
  */
 int s3fs_clear_bucket(const char *bucket);  
 
+/*
+ * Called by s3fs_list_objects with each key listed, in order.
+ */
+typedef void s3fs_list_callback(const char *key, void *data);
+
+/*
+ * List the objects in a bucket whose keys begin with prefix (all of them
+ * if prefix is NULL), with a single request.  At most max_keys objects are
+ * listed; if max_keys is 0, s3 lists up to its limit of 1000.  If callback
+ * is not NULL, it is called with each key listed and data.
+ *
+ * Returns the number of objects listed, or -1 on failure.
+ */
+int s3fs_list_objects(const char *bucket, const char *prefix, int max_keys,
+                      s3fs_list_callback *callback, void *data);
+
 /*
  * Get/read an object from s3 in a given bucket, identified by the given key.
  *
@@ -68,6 +111,38 @@ ssize_t s3fs_get_object(const char *bucket, const char *key, uint8_t **buf,
 ssize_t s3fs_put_object(const char *bucket, const char *key, 
                         const uint8_t *buf, ssize_t byte_count); 
 
+/*
+ * Same as s3fs_put_object, but also stores the mode, uid, gid and mtime
+ * from attr with the object (as x-amz-meta headers), so that they can be
+ * read back by s3fs_head_object.
+ */
+ssize_t s3fs_put_object_attr(const char *bucket, const char *key, 
+                             const uint8_t *buf, ssize_t byte_count,
+                             const struct stat *attr);
+
+/*
+ * Check whether an object exists without fetching it.  If attr is not
+ * NULL, it is filled in from the object: st_size from its length, and
+ * st_mode, st_uid, st_gid and st_mtime from the attributes stored by
+ * s3fs_put_object_attr.  For an object stored without attributes, st_mode
+ * is 0 and st_mtime is the time the object was last written.
+ *
+ * This function returns 0 if the object exists and -1 otherwise.
+ */
+int s3fs_head_object(const char *bucket, const char *key, struct stat *attr);
+
+/*
+ * Copy an object to a new key in the same bucket.  The copy is done by s3
+ * itself (in parts, for objects too big to copy at once), so no object data
+ * passes through this host.  If attr is not NULL, the new object gets those
+ * attributes, as with s3fs_put_object_attr; otherwise it keeps the
+ * source's.
+ *
+ * This function returns 0 on success and -1 on failure.
+ */
+int s3fs_copy_object(const char *bucket, const char *key, 
+                     const char *newkey, const struct stat *attr);
+
 /* 
  * Remove a given object from the given bucket.
  *
@@ -75,4 +150,38 @@ ssize_t s3fs_put_object(const char *bucket, const char *key,
  */ 
 int s3fs_remove_object(const char *bucket, const char *key);
 
+/*
+ * Counts of the requests made to s3 so far, and of the object data sent
+ * and received.  Every try at a request counts as a request, including the
+ * second copy of a hedged read.
+ */
+typedef struct s3fs_counters {
+    uint64_t requests;
+    uint64_t errors;          // requests that failed
+    uint64_t retries;         // requests that were made again
+    uint64_t throttled;       // requests that s3 asked to slow down
+    uint64_t hedges;          // second copies of hedged reads
+    uint64_t connections;     // connections opened
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+} s3fs_counters;
+
+/*
+ * Get the counts so far.  This never waits for a request to finish.
+ */
+void s3fs_get_counters(s3fs_counters *counters);
+
+/*
+ * Called with the timing of each request made to s3 as it finishes (see
+ * S3RequestTiming in libs3.h), in the thread that made the s3fs call it
+ * was made for.
+ */
+typedef void s3fs_request_callback(const S3RequestTiming *timing);
+
+/*
+ * Set the callback made as each request finishes, or NULL for none.  Call
+ * this before making any requests.
+ */
+void s3fs_set_request_callback(s3fs_request_callback *callback);
+
 #endif // __LIBS3_WRAPPER_H__
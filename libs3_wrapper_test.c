@@ -5,14 +5,527 @@
  * You can use these tests to ensure that you have proper connectivity to
  * your s3bucket, and also as examples for how to use the libs3_wrapper
  * functions.  
+ *
+ * Run with any options, it is instead a load generator: for each
+ * combination of object size, concurrency and mix of operations, it runs
+ * threads making requests through the wrapper for a fixed time (or number
+ * of operations), and prints the throughput, operations per second and
+ * latency percentiles of each as CSV.  Run with -h for the options.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include "libs3_wrapper.h"
 #include "s3fs.h" // for environment strings to look for
 
+// load generator ------------------------------------------------------------
+
+#define MAX_SIZES 32
+#define MAX_CONCURRENCIES 32
+#define MAX_MIXES 16
+#define MAX_THREADS 1024
+
+enum { OP_GET, OP_PUT, OP_DELETE, OP_LIST, OP_COUNT };
+
+static const char *op_names[OP_COUNT] = { "get", "put", "delete", "list" };
+
+typedef struct mix {
+    const char *spec;     // as given, for the report
+    int weight[OP_COUNT];
+    int total;
+} mix;
+
+// The latencies of one kind of operation, in seconds
+typedef struct latencies {
+    double *values;
+    size_t count, size;
+} latencies;
+
+typedef struct op_stats {
+    latencies lat;
+    unsigned long long errors;
+    unsigned long long bytes;
+} op_stats;
+
+typedef struct load_config {
+    const char *bucket;
+    char prefix[256];
+    size_t size;
+    int concurrency;
+    const mix *mix;
+    int keys;             // objects that gets read
+    double duration;      // seconds, if ops is 0
+    unsigned long long ops;
+    const uint8_t *data;  // what puts write, size bytes
+
+    // Operations left to start, when running for a number of operations
+    unsigned long long ops_left;
+    pthread_mutex_t ops_lock;
+    double deadline;
+} load_config;
+
+typedef struct load_thread {
+    load_config *config;
+    pthread_t thread;
+    int id;
+    unsigned int seed;
+    op_stats stats[OP_COUNT];
+    // Objects this thread has put and not yet deleted
+    unsigned long long put_count, delete_count;
+} load_thread;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void add_latency(latencies *lat, double value) {
+    if (lat->count == lat->size) {
+        lat->size = lat->size ? lat->size * 2 : 1024;
+        lat->values = realloc(lat->values, lat->size * sizeof(double));
+        if (!lat->values) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+    }
+    lat->values[lat->count++] = value;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values, in milliseconds
+static double percentile(const latencies *lat, double p) {
+    if (!lat->count) {
+        return 0;
+    }
+    size_t rank = (size_t) (p * lat->count);
+    if (rank < p * lat->count) {
+        rank++;
+    }
+    if (rank < 1) {
+        rank = 1;
+    }
+    return lat->values[rank - 1] * 1000;
+}
+
+// Parses a size such as 512, 4k, 16m or 1g (powers of 1024)
+static int parse_size(const char *str, size_t *size) {
+    char *end;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (end == str) {
+        return -1;
+    }
+    switch (*end) {
+    case 'k': case 'K':
+        value <<= 10;
+        end++;
+        break;
+    case 'm': case 'M':
+        value <<= 20;
+        end++;
+        break;
+    case 'g': case 'G':
+        value <<= 30;
+        end++;
+        break;
+    }
+    if (*end) {
+        return -1;
+    }
+    *size = (size_t) value;
+    return 0;
+}
+
+// Parses a comma separated list of sizes; returns how many, or -1
+static int parse_sizes(char *str, size_t *sizes, int max) {
+    int count = 0;
+    char *save, *tok;
+    for (tok = strtok_r(str, ",", &save); tok; tok = strtok_r(0, ",", &save)) {
+        if ((count == max) || (parse_size(tok, &(sizes[count])) < 0)) {
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+// Parses a mix such as "get=70,put=20,delete=5,list=5"; an operation given
+// without a weight has weight 1
+static int parse_mix(const char *spec, mix *m) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    memset(m, 0, sizeof(*m));
+    m->spec = spec;
+
+    char *save, *tok;
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(0, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        int weight = 1;
+        if (eq) {
+            *eq = 0;
+            weight = atoi(eq + 1);
+            if (weight < 0) {
+                return -1;
+            }
+        }
+        int op;
+        for (op = 0; op < OP_COUNT; op++) {
+            if (!strcmp(tok, op_names[op])) {
+                break;
+            }
+        }
+        if (op == OP_COUNT) {
+            return -1;
+        }
+        m->weight[op] += weight;
+        m->total += weight;
+    }
+    return m->total > 0 ? 0 : -1;
+}
+
+static int pick_op(const mix *m, unsigned int *seed) {
+    int r = rand_r(seed) % m->total, op;
+    for (op = 0; op < OP_COUNT - 1; op++) {
+        if (r < m->weight[op]) {
+            break;
+        }
+        r -= m->weight[op];
+    }
+    return op;
+}
+
+// Whether another operation should be started
+static int keep_going(load_config *config) {
+    if (!config->ops) {
+        return now() < config->deadline;
+    }
+    int rv = 0;
+    pthread_mutex_lock(&config->ops_lock);
+    if (config->ops_left) {
+        config->ops_left--;
+        rv = 1;
+    }
+    pthread_mutex_unlock(&config->ops_lock);
+    return rv;
+}
+
+static void *load_thread_main(void *arg) {
+    load_thread *t = (load_thread *) arg;
+    load_config *config = t->config;
+    char key[512];
+
+    while (keep_going(config)) {
+        int op = pick_op(config->mix, &t->seed);
+        op_stats *stats = &(t->stats[op]);
+        uint8_t *buf = NULL;
+        ssize_t rv;
+
+        double start = now();
+        switch (op) {
+        case OP_GET:
+            // gets read the shared objects, which are never deleted
+            snprintf(key, sizeof(key), "%sobj%d", config->prefix,
+                     rand_r(&t->seed) % config->keys);
+            rv = s3fs_get_object(config->bucket, key, &buf, 0, 0);
+            break;
+        case OP_PUT:
+            // puts write objects of the thread's own, which deletes remove
+            snprintf(key, sizeof(key), "%sthread%d/%llu", config->prefix,
+                     t->id, t->put_count++);
+            rv = s3fs_put_object(config->bucket, key, config->data,
+                                 config->size);
+            break;
+        case OP_DELETE:
+            // With nothing left to delete, this deletes an object that
+            // isn't there, which s3 still answers
+            if (t->delete_count < t->put_count) {
+                snprintf(key, sizeof(key), "%sthread%d/%llu",
+                         config->prefix, t->id, t->delete_count++);
+            }
+            else {
+                snprintf(key, sizeof(key), "%sthread%d/none",
+                         config->prefix, t->id);
+            }
+            rv = s3fs_remove_object(config->bucket, key);
+            break;
+        default:
+            rv = s3fs_list_objects(config->bucket, config->prefix, 0, NULL,
+                                   NULL);
+            break;
+        }
+        double elapsed = now() - start;
+
+        if (buf) {
+            free(buf);
+        }
+        if (rv < 0) {
+            stats->errors++;
+            continue;
+        }
+        add_latency(&stats->lat, elapsed);
+        if ((op == OP_GET) || (op == OP_PUT)) {
+            stats->bytes += rv;
+        }
+    }
+
+    return NULL;
+}
+
+static void add_stats(op_stats *to, const op_stats *from) {
+    size_t i;
+    for (i = 0; i < from->lat.count; i++) {
+        add_latency(&to->lat, from->lat.values[i]);
+    }
+    to->errors += from->errors;
+    to->bytes += from->bytes;
+}
+
+static void print_row(const load_config *config, const char *op,
+                      op_stats *stats, double seconds) {
+    latencies *lat = &stats->lat;
+    qsort(lat->values, lat->count, sizeof(double), &compare_doubles);
+    printf("\"%s\",%llu,%d,%s,%llu,%llu,%.3f,%.1f,%.3f,"
+           "%.3f,%.3f,%.3f,%.3f,%.3f\n",
+           config->mix->spec, (unsigned long long) config->size,
+           config->concurrency, op, (unsigned long long) lat->count,
+           stats->errors, seconds, lat->count / seconds,
+           stats->bytes / seconds / (1024 * 1024),
+           percentile(lat, 0.50), percentile(lat, 0.90),
+           percentile(lat, 0.99), percentile(lat, 0.999),
+           percentile(lat, 1.0));
+    fflush(stdout);
+}
+
+static void run_config(load_config *config) {
+    static load_thread threads[MAX_THREADS];
+    char key[512];
+    int i, op;
+
+    // The objects that gets read
+    if (config->mix->weight[OP_GET]) {
+        for (i = 0; i < config->keys; i++) {
+            snprintf(key, sizeof(key), "%sobj%d", config->prefix, i);
+            if (s3fs_put_object(config->bucket, key, config->data,
+                                config->size) < 0) {
+                fprintf(stderr, "Failed to put %s\n", key);
+            }
+        }
+    }
+
+    config->ops_left = config->ops;
+    pthread_mutex_init(&config->ops_lock, NULL);
+
+    double start = now();
+    config->deadline = start + config->duration;
+    for (i = 0; i < config->concurrency; i++) {
+        memset(&threads[i], 0, sizeof(threads[i]));
+        threads[i].config = config;
+        threads[i].id = i;
+        threads[i].seed = (unsigned int) (start * 1000) + i;
+        if (pthread_create(&threads[i].thread, NULL, &load_thread_main,
+                           &threads[i])) {
+            fprintf(stderr, "Failed to start thread %d\n", i);
+            exit(-1);
+        }
+    }
+    for (i = 0; i < config->concurrency; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    double seconds = now() - start;
+
+    // Totals for each kind of operation, and for all of them
+    op_stats totals[OP_COUNT + 1];
+    memset(totals, 0, sizeof(totals));
+    for (i = 0; i < config->concurrency; i++) {
+        for (op = 0; op < OP_COUNT; op++) {
+            op_stats *from = &threads[i].stats[op];
+            add_stats(&totals[op], from);
+            add_stats(&totals[OP_COUNT], from);
+            free(from->lat.values);
+        }
+    }
+    for (op = 0; op < OP_COUNT; op++) {
+        if (config->mix->weight[op]) {
+            print_row(config, op_names[op], &totals[op], seconds);
+        }
+        free(totals[op].lat.values);
+    }
+    print_row(config, "all", &totals[OP_COUNT], seconds);
+    free(totals[OP_COUNT].lat.values);
+
+    pthread_mutex_destroy(&config->ops_lock);
+
+    // Clean up after this configuration
+    for (i = 0; i < config->concurrency; i++) {
+        unsigned long long n;
+        for (n = threads[i].delete_count; n < threads[i].put_count; n++) {
+            snprintf(key, sizeof(key), "%sthread%d/%llu", config->prefix,
+                     i, n);
+            s3fs_remove_object(config->bucket, key);
+        }
+    }
+    if (config->mix->weight[OP_GET]) {
+        for (i = 0; i < config->keys; i++) {
+            snprintf(key, sizeof(key), "%sobj%d", config->prefix, i);
+            s3fs_remove_object(config->bucket, key);
+        }
+    }
+}
+
+static void load_usage(const char *program) {
+    fprintf(stderr,
+"Usage: %s [options]\n"
+"\n"
+"Runs every combination of object size, concurrency and mix, and prints\n"
+"the results as CSV, with a row for each kind of operation in the mix and\n"
+"one for all of them.  Latencies are in milliseconds.\n"
+"\n"
+"  -s sizes     object sizes, comma separated, with an optional k, m or g\n"
+"               suffix (default 1,1k,64k,1m,16m)\n"
+"  -c counts    numbers of concurrent threads, comma separated\n"
+"               (default 1,4,16,64,256)\n"
+"  -m mix       weights of operations, such as get=70,put=20,delete=5,list=5\n"
+"               (the default); may be given more than once\n"
+"  -d seconds   how long to run each combination for (default 10)\n"
+"  -n ops       run each combination for this many operations instead\n"
+"  -k keys      number of objects that gets read (default 16)\n"
+"  -p prefix    prefix of the keys used (default loadtest/)\n"
+"\n"
+"Each thread holds the object it is getting or putting in memory, so mind\n"
+"sizes times concurrency.\n", program);
+}
+
+static int run_load_test(const char *bucket, int argc, char **argv) {
+    static char default_sizes[] = "1,1k,64k,1m,16m";
+    static char default_concurrencies[] = "1,4,16,64,256";
+    char *size_list = default_sizes, *concurrency_list = default_concurrencies;
+    const char *mix_specs[MAX_MIXES];
+    int mix_count = 0;
+    const char *prefix = "loadtest/";
+    load_config config;
+    int c;
+
+    memset(&config, 0, sizeof(config));
+    config.bucket = bucket;
+    config.duration = 10;
+    config.keys = 16;
+
+    while ((c = getopt(argc, argv, "s:c:m:d:n:k:p:h")) != -1) {
+        switch (c) {
+        case 's':
+            size_list = optarg;
+            break;
+        case 'c':
+            concurrency_list = optarg;
+            break;
+        case 'm':
+            if (mix_count == MAX_MIXES) {
+                fprintf(stderr, "At most %d mixes\n", MAX_MIXES);
+                return -1;
+            }
+            mix_specs[mix_count++] = optarg;
+            break;
+        case 'd':
+            config.duration = atof(optarg);
+            break;
+        case 'n':
+            config.ops = strtoull(optarg, NULL, 10);
+            break;
+        case 'k':
+            config.keys = atoi(optarg);
+            break;
+        case 'p':
+            prefix = optarg;
+            break;
+        default:
+            load_usage(argv[0]);
+            return c == 'h' ? 0 : -1;
+        }
+    }
+    if (optind < argc) {
+        load_usage(argv[0]);
+        return -1;
+    }
+    if (!mix_count) {
+        mix_specs[mix_count++] = "get=70,put=20,delete=5,list=5";
+    }
+
+    size_t sizes[MAX_SIZES], max_size = 0;
+    int size_count = parse_sizes(size_list, sizes, MAX_SIZES);
+    if (size_count <= 0) {
+        fprintf(stderr, "Bad sizes: %s\n", size_list);
+        return -1;
+    }
+    size_t concurrencies[MAX_CONCURRENCIES];
+    int concurrency_count = parse_sizes(concurrency_list, concurrencies,
+                                        MAX_CONCURRENCIES);
+    if (concurrency_count <= 0) {
+        fprintf(stderr, "Bad concurrencies: %s\n", concurrency_list);
+        return -1;
+    }
+    mix mixes[MAX_MIXES];
+    int i, j, k;
+    for (i = 0; i < mix_count; i++) {
+        if (parse_mix(mix_specs[i], &mixes[i]) < 0) {
+            fprintf(stderr, "Bad mix: %s\n", mix_specs[i]);
+            return -1;
+        }
+    }
+    for (i = 0; i < concurrency_count; i++) {
+        if ((concurrencies[i] < 1) || (concurrencies[i] > MAX_THREADS)) {
+            fprintf(stderr, "Concurrency must be from 1 to %d\n", MAX_THREADS);
+            return -1;
+        }
+    }
+    if ((config.keys < 1) || ((config.duration <= 0) && !config.ops)) {
+        load_usage(argv[0]);
+        return -1;
+    }
+
+    // One buffer, as big as the biggest object, is what every put writes
+    for (i = 0; i < size_count; i++) {
+        if (sizes[i] > max_size) {
+            max_size = sizes[i];
+        }
+    }
+    uint8_t *data = malloc(max_size ? max_size : 1);
+    if (!data) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    memset(data, 'x', max_size);
+    config.data = data;
+
+    printf("mix,size,concurrency,op,ops,errors,seconds,ops_per_sec,"
+           "mib_per_sec,p50_ms,p90_ms,p99_ms,p999_ms,max_ms\n");
+
+    for (i = 0; i < mix_count; i++) {
+        for (j = 0; j < size_count; j++) {
+            for (k = 0; k < concurrency_count; k++) {
+                config.mix = &mixes[i];
+                config.size = sizes[j];
+                config.concurrency = (int) concurrencies[k];
+                snprintf(config.prefix, sizeof(config.prefix),
+                         "%sm%d-s%llu-c%d/", prefix, i,
+                         (unsigned long long) config.size,
+                         config.concurrency);
+                run_config(&config);
+            }
+        }
+    }
+
+    free(data);
+    return 0;
+}
+
 int main(int argc, char **argv) {
 
     /*
@@ -41,13 +554,21 @@ int main(int argc, char **argv) {
         fprintf(stderr, "%s environment variable must be defined\n", S3BUCKET);
     }
 
-    printf("Using bucket: %s\n", s3bucket);
-    
     if (s3fs_init_credentials() < 0) {
         printf("Failed to initialize S3 credentials.\n");
         return -1;
     }
- 
+
+    // any options mean a load test (stdout is kept for the CSV)
+    if (argc > 1) {
+        if (!s3bucket) {
+            return -1;
+        }
+        return run_load_test(s3bucket, argc, argv);
+    }
+
+    printf("Using bucket: %s\n", s3bucket);
+    
     if (s3fs_test_bucket(s3bucket) < 0) {
         printf("Failed to connect to bucket (s3fs_test_bucket)\n");
     } else {
@@ -68,7 +589,7 @@ int main(int argc, char **argv) {
     if (rv < 0) {
         printf("Failure in s3fs_put_object\n");
     } else if (rv < object_length) {
-        printf("Failed to upload full test object (s3fs_put_object %d)\n", rv);
+        printf("Failed to upload full test object (s3fs_put_object %zd)\n", rv);
     } else {
         printf("Successfully put test object in s3 (s3fs_put_object)\n");
     }
@@ -79,7 +600,7 @@ int main(int argc, char **argv) {
     if (rv < 0) {
         printf("Failure in s3fs_get_object\n");
     } else if (rv < object_length) {
-        printf("Failed to retrieve entire object (s3fs_get_object %d)\n", rv);
+        printf("Failed to retrieve entire object (s3fs_get_object %zd)\n", rv);
     } else {
         printf("Successfully retrieved test object from s3 (s3fs_get_object)\n");
         if (strcmp((const char *)retrieved_object, test_object) == 0) {
@@ -105,7 +626,7 @@ int main(int argc, char **argv) {
     if (rv == -1) {
         printf("Got expected failure in trying to retrieve test object after removing it\n");
     } else {
-        printf("Unexpected return value in trying to retrieve an already-removed object: %d\n", rv);
+        printf("Unexpected return value in trying to retrieve an already-removed object: %zd\n", rv);
     }
 
     printf("Done with s3fs tests.  Share and enjoy.\n");
@@ -3,6 +3,12 @@
 
 #include "s3fs.h"
 #include "libs3_wrapper.h"
+#include "s3fs_dirlock.h"
+#include "s3fs_inode.h"
+#include "s3fs_log.h"
+#include "s3fs_stats.h"
+#include "s3fs_stream.h"
+#include "s3fs_trace.h"
 
 #include <ctype.h>
 #include <dirent.h>
@@ -17,12 +23,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/xattr.h>
 
 #define GET_PRIVATE_DATA ((s3context_t *) fuse_get_context()->private_data)
+#define BACKEND (GET_PRIVATE_DATA->backend)
 
-int fs_mkdir(const char *, mode_t);
+// A file opened for writing is copied to a local file in pieces of this
+// size, so that it is never all in memory at once
+#define LOAD_CHUNK (8 * 1024 * 1024)
+
+int fs_flush(const char *, struct fuse_file_info *);
+void fillstat(s3dirent_t, struct stat *);
 
 /*
  * For each function below, if you need to return an error,
@@ -44,23 +57,37 @@ int fs_mkdir(const char *, mode_t);
  */
 void *fs_init(struct fuse_conn_info *conn)
 {
-	fprintf(stderr, "fs_init --- initializing file system.\n");
+	// fuse_main has forked by now, so the thread writing the log survives
+	s3fs_log_start();
+	s3fs_info("fs_init --- initializing file system.");
+	// Have FUSE leave written data in the pipe the kernel spliced it
+	// into, so that fs_write_buf can splice it on into the file's local
+	// copy; and splice what fs_read_buf replies with from that copy out
+	// to the kernel, rather than reading it into memory first.
+	if (conn->capable & FUSE_CAP_SPLICE_READ)
+	{
+		conn->want |= FUSE_CAP_SPLICE_READ;
+	}
+	if (conn->capable & FUSE_CAP_SPLICE_WRITE)
+	{
+		conn->want |= FUSE_CAP_SPLICE_WRITE;
+	}
 	s3context_t *ctx = GET_PRIVATE_DATA;
-	if (s3fs_test_bucket(ctx->s3bucket) < 0)
+	if (BACKEND->test_bucket(ctx->s3bucket) < 0)
 	{
-		fprintf(stderr, "Failed to connect to bucket (s3fs_test_bucket)\n");
+		s3fs_error("Failed to connect to bucket (s3fs_test_bucket)");
 	}
 	else
 	{
-		fprintf(stderr, "Successfully connected to bucket (s3fs_test_bucket)\n");
+		s3fs_info("Successfully connected to bucket (s3fs_test_bucket)");
 	}
-	if (s3fs_clear_bucket(ctx->s3bucket) < 0)
+	if (BACKEND->clear_bucket(ctx->s3bucket) < 0)
 	{
-		fprintf(stderr, "Failed to clear bucket (s3fs_clear_bucket)\n");
+		s3fs_error("Failed to clear bucket (s3fs_clear_bucket)");
 	}
 	else
 	{
-		fprintf(stderr, "Successfully cleared the bucket (removed all objects)\n");
+		s3fs_info("Successfully cleared the bucket (removed all objects)");
 	}
 	s3dirent_t * newent = (s3dirent_t *) malloc(sizeof(s3dirent_t));
 	strcpy((newent->name),".");
@@ -75,13 +102,15 @@ void *fs_init(struct fuse_conn_info *conn)
 	newent->modify = now;
 	newent->access = now;
 	newent->change = now;	
-        ssize_t test = s3fs_put_object(ctx->s3bucket, "/", (uint8_t*)newent, sizeof(s3dirent_t));
+	struct stat attr;
+	fillstat(*newent, &attr);
+        ssize_t test = BACKEND->put_object(ctx->s3bucket, "/", (uint8_t*)newent, sizeof(s3dirent_t), &attr);
 	free(newent);
 	if(test < 0){
-		fprintf(stderr, "initialization failed.\n");
+		s3fs_error("initialization failed");
 	}
 	else if(test < sizeof(s3dirent_t)){
-		fprintf(stderr, "did not allocate full dirent.\n");
+		s3fs_error("did not allocate full dirent");
 	}
 	return (ctx->s3bucket);
 }
@@ -91,8 +120,9 @@ void *fs_init(struct fuse_conn_info *conn)
  * Called once on filesystem exit.
  */
 void fs_destroy(void *userdata) {
-    fprintf(stderr, "fs_destroy --- shutting down file system.\n");
+    s3fs_info("fs_destroy --- shutting down file system.");
     free(userdata);
+    s3fs_log_stop();
 }
 
 
@@ -108,7 +138,6 @@ void fillstat(s3dirent_t dirent, struct stat *statbuf)
 	statbuf->st_mtime = dirent.modify;
 	statbuf->st_ctime = dirent.change;
 	statbuf->st_blocks = (dirent.size/512) + 1; //????????
-	printf("%s%d\n\n\n", "fillstat size: ", statbuf->st_size);
 }
 
 
@@ -120,24 +149,47 @@ void fillstat(s3dirent_t dirent, struct stat *statbuf)
  */
 
 int fs_getattr(const char *path, struct stat *statbuf) {
-    fprintf(stderr, "fs_getattr(path=\"%s\")\n", path);
+    s3fs_debug("fs_getattr(path=\"%s\")", path);
+    if (s3fs_stats_path(path)) {
+	return s3fs_stats_getattr(path, statbuf);
+    }
     s3context_t *ctx = GET_PRIVATE_DATA;
     s3dirent_t * buffer = NULL;
     struct fuse_file_info *fi;
     char *bucket = (ctx->s3bucket);
+    // Objects carry their attributes as metadata, so a file needs only a HEAD.
+    // A directory's link count is kept in its own "." entry.
+    if (BACKEND->head_object(bucket, path, statbuf) < 0)
+    {
+	return -ENOENT;
+    }
+    if (S_ISREG(statbuf->st_mode))
+    {
+	return 0;
+    }
+    if (S_ISDIR(statbuf->st_mode))
+    {
+	if (BACKEND->get_object(bucket, path, (uint8_t**)&buffer, 0, 0) == -1)
+	{
+		free(buffer);
+		return -ENOENT;
+	}
+	fillstat(buffer[0], statbuf);
+	free(buffer);
+	return 0;
+    }
+    // written without attributes: fall back to the parent's entry
     if (!fs_opendir(path,  fi))//is a directory
     {
-    	if(s3fs_get_object(bucket, path, (uint8_t**)&buffer, 0,0)==-1)
+    	if(BACKEND->get_object(bucket, path, (uint8_t**)&buffer, 0,0)==-1)
    	{
 		free(buffer);
-		printf("%s\n\n\n\n\n\n\n\n\n\n\n","option0");
 
 		return -ENOENT;
    	}
 	else
 	{
 		fillstat(buffer[0], statbuf);
-		printf("%s%d\n\n\n", "statbuf size: ", statbuf->st_size);
 		free(buffer);
 		return 0;
 	}
@@ -146,19 +198,17 @@ int fs_getattr(const char *path, struct stat *statbuf) {
     {
 	char * pat = strdup(path);
 	char * dir = dirname(pat);
-	if(s3fs_get_object(bucket, path, (uint8_t**)&buffer, 0,0)==-1)
+	if(BACKEND->get_object(bucket, path, (uint8_t**)&buffer, 0,0)==-1)
 	{
 		free(buffer);
 		free(pat);
-		printf("%s\n\n\n\n\n\n\n\n\n","option1");
 
 		return -ENOENT;
 	}
-	if(s3fs_get_object(bucket, dir, (uint8_t**)&buffer, 0,0)==-1)
+	if(BACKEND->get_object(bucket, dir, (uint8_t**)&buffer, 0,0)==-1)
 	{
 		free(buffer);
 		free(pat);
-		printf("%s\n\n\n\n\n\n\n\n\n\n","option2");
 		return -ENOENT;
 	}
 	else
@@ -194,7 +244,10 @@ int fs_getattr(const char *path, struct stat *statbuf) {
  * this directory
  */
 int fs_opendir(const char *path, struct fuse_file_info *fi) {
-    fprintf(stderr, "fs_opendir(path=\"%s\")\n", path);
+    s3fs_debug("fs_opendir(path=\"%s\")", path);
+    if (s3fs_stats_path(path)) {
+	return s3fs_stats_opendir(path);
+    }
     s3context_t *ctx = GET_PRIVATE_DATA;
     if (!strcasecmp(path, "/")) //root entered on initialization
     {
@@ -204,31 +257,24 @@ int fs_opendir(const char *path, struct fuse_file_info *fi) {
     char * dir = dirname(pat);
     s3dirent_t *buffer = NULL;
 	char * bucket = (ctx->s3bucket);
-    if(s3fs_get_object(bucket, path, (uint8_t**)&buffer, 0, 0) == -1)
+    // only whether it's there; a file needn't be read for that
+    if(BACKEND->head_object(bucket, path, NULL) == -1)
     {
-	free(buffer);
 	free(pat);
-	printf(stderr, "%s\n\n\n\n\n\n","option3");
-	printf("%s",path);
 	return -ENOENT;
     }
-	free(buffer);
-	printf("%s\n", "test2");
-    int success = s3fs_get_object(bucket, dir, (uint8_t**)&buffer, 0, 0);
+    int success = BACKEND->get_object(bucket, dir, (uint8_t**)&buffer, 0, 0);
     free(pat);
 	if(success == -1)
     {
 	free(buffer);
-	printf("%s\n\n\n\n\n\n","option4");
 	return -ENOENT;
     }
-	printf(stderr, "%s\n", "test2.5");
 	int x = 0;
 	int length = success/sizeof(s3dirent_t);
 	char * dup = strdup(path);
 	for(; x < length; x++)
 	{
-		printf("%s%d\n", "test3", x);
 		s3dirent_t dirent = buffer[x];
 		if(strcmp((dirent.name), basename(dup)) == 0)
 		{
@@ -247,7 +293,6 @@ int fs_opendir(const char *path, struct fuse_file_info *fi) {
 		}
 	}
 	free(buffer);
-	printf(stderr, "%s\n\n\n\n\n\n\n\n\n\n","option6");
 	free(dup);
 	return -ENOENT;
 }
@@ -260,8 +305,11 @@ int fs_opendir(const char *path, struct fuse_file_info *fi) {
 int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
          struct fuse_file_info *fi)
 {
-    	fprintf(stderr, "fs_readdir(path=\"%s\", buf=%p, offset=%d)\n",
+    	s3fs_debug("fs_readdir(path=\"%s\", buf=%p, offset=%d)",
         path, buf, (int)offset);
+    if (s3fs_stats_path(path)) {
+	return s3fs_stats_readdir(path, buf, filler);
+    }
     	s3context_t *ctx = GET_PRIVATE_DATA;
 	int test = fs_opendir(path, fi);
 	if(test){
@@ -269,7 +317,7 @@ int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset
 	}
 	char *bucket = (ctx->s3bucket);
 	s3dirent_t * buffer = NULL;
-	int success = s3fs_get_object(bucket, path, (uint8_t**)&buffer, 0, 0);
+	int success = BACKEND->get_object(bucket, path, (uint8_t**)&buffer, 0, 0);
 	int length = success/sizeof(s3dirent_t);
         int x = 0;
 	for(; x < length; x++)
@@ -292,7 +340,7 @@ int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset
  * Release directory.
  */
 int fs_releasedir(const char *path, struct fuse_file_info *fi) {
-    fprintf(stderr, "fs_releasedir(path=\"%s\")\n", path);
+    s3fs_debug("fs_releasedir(path=\"%s\")", path);
     s3context_t *ctx = GET_PRIVATE_DATA;
     return 0;
 }
@@ -313,14 +361,16 @@ int adddirent(const char *path, mode_t mode, char * bucket)
 	newent->modify = now;
 	newent->access = now;
 	newent->change = now;
-        int test = s3fs_put_object(bucket, path, (uint8_t*)newent, sizeof(s3dirent_t)); 
+	struct stat attr;
+	fillstat(*newent, &attr);
+        int test = BACKEND->put_object(bucket, path, (uint8_t*)newent, sizeof(s3dirent_t), &attr); 
 	free(newent);
 	if(test < 0){
-                fprintf(stderr, "upload failed.\n");
+                s3fs_error("upload failed");
 		return -EIO;
         }
         else if(test < sizeof(s3dirent_t)){
-                fprintf(stderr, "did not allocate full dirent.\n");
+                s3fs_error("did not allocate full dirent");
                 return -EIO;
         }
         return 0;
@@ -332,7 +382,7 @@ int adddirtoparent(const char * path, char * bucket)
 	char * par = dirname(pat);
 	char * dup = strdup(path);
 	s3dirent_t * buffer = NULL;
-	int success = s3fs_get_object(bucket, par, (uint8_t**)&buffer, 0, 0);
+	int success = BACKEND->get_object(bucket, par, (uint8_t**)&buffer, 0, 0);
 	if(success ==-1)
 	{
 		free(buffer);
@@ -353,14 +403,16 @@ int adddirtoparent(const char * path, char * bucket)
 	strcpy(adding.name, basename(dup));
 	adding.size = sizeof(s3dirent_t);
 	newents[x] = adding;
-	int remove = s3fs_remove_object(bucket, par);
+	int remove = BACKEND->remove_object(bucket, par);
 	if(remove < 0){
 		free(buffer);
         	free(dup);
 		free(pat);
 		return -EIO;
 	}
-	int test = s3fs_put_object(bucket, par, (uint8_t *)newents, (length + 1)*sizeof(s3dirent_t));
+	struct stat attr;
+	fillstat(newents[0], &attr);
+	int test = BACKEND->put_object(bucket, par, (uint8_t *)newents, (length + 1)*sizeof(s3dirent_t), &attr);
 	if(test == -1){
 		free(newents);
 	        free(pat);
@@ -384,8 +436,11 @@ int adddirtoparent(const char * path, char * bucket)
  * use mode|S_IFDIR.
  */
 
-int fs_mkdir(const char *path, mode_t mode) {
-    fprintf(stderr, "fs_mkdir(path=\"%s\", mode=0%3o)\n", path, mode);
+static int __fs_mkdir(const char *path, mode_t mode) {
+    s3fs_debug("fs_mkdir(path=\"%s\", mode=0%3o)", path, mode);
+    if (s3fs_stats_path(path)) {
+	return -EACCES;
+    }
     s3context_t *ctx = GET_PRIVATE_DATA;
     char * bucket = (ctx->s3bucket);
 	struct fuse_file_info * fi;
@@ -405,11 +460,11 @@ int fs_mkdir(const char *path, mode_t mode) {
 	free(pat);
 	int test = adddirtoparent(path, bucket);
 	if(test < 0){
-                fprintf(stderr, "upload failed.\n");
+                s3fs_error("upload failed");
                 return -EIO;
         }
         else if(test < sizeof(s3dirent_t)){
-                fprintf(stderr, "did not allocate full dirent.\n");
+                s3fs_error("did not allocate full dirent");
                 return -EIO;
         }
 	return adddirent(path, mode, bucket);
@@ -422,21 +477,22 @@ int fs_mkdir(const char *path, mode_t mode) {
 /*
  * Remove a directory.
  */
-int fs_rmdir(const char *path) {
-    fprintf(stderr, "fs_rmdir(path=\"%s\")\n", path);
+static int __fs_rmdir(const char *path) {
+    s3fs_debug("fs_rmdir(path=\"%s\")", path);
+    if (s3fs_stats_path(path)) {
+	return -EACCES;
+    }
     s3context_t *ctx = GET_PRIVATE_DATA;
     struct fuse_file_info *fi;
 	int testingnum = fs_opendir(path, fi); //check if directory
 	if(testingnum){ //check if directory
-		fprintf("%s\n\n\n\n\n", "option remove");
 		return testingnum;
 	}
 	s3dirent_t * buffer = NULL;
 	char * bucket = (ctx->s3bucket);
-	int test = s3fs_get_object(ctx->s3bucket, path, (uint8_t**)&buffer, 0, 0);
+	int test = BACKEND->get_object(ctx->s3bucket, path, (uint8_t**)&buffer, 0, 0);
 	if(test == -1){
 		free(buffer);
-		fprintf("%s\n\n\n\n\n\n", "option the last");
 		return -ENOENT;
 	}
 	//we now know that it is here and a directory
@@ -448,7 +504,7 @@ int fs_rmdir(const char *path) {
 			return -ENOTEMPTY;
 		}
 	}
-	if(s3fs_remove_object(bucket, path) == -1){
+	if(BACKEND->remove_object(bucket, path) == -1){
 		free(buffer);
 		return -EIO;
 	}
@@ -457,10 +513,9 @@ int fs_rmdir(const char *path) {
 	free(buffer);
 	buffer = NULL;
 	//now to update parent
-	test = s3fs_get_object(bucket, par, (uint8_t**)&buffer, 0, 0);
+	test = BACKEND->get_object(bucket, par, (uint8_t**)&buffer, 0, 0);
 	if(test == -1){
 		free(buffer);
-		fprintf("%s\n\n\n\n\n", "Just kidding");
                 return -ENOENT;
         }
         x = 1;
@@ -472,22 +527,24 @@ int fs_rmdir(const char *path) {
 			{
 				buffer[x].type = 'U';
                		 	buffer[0].hardlinks--;
-				 if(s3fs_remove_object(bucket, par) == -1){
+				 if(BACKEND->remove_object(bucket, par) == -1){
 	        		        free(buffer);
 					free(dup);
 					free(pat);
                 			return -EIO;
         			}
-        			int test2 = s3fs_put_object(bucket, par, (uint8_t *)buffer, (length)*sizeof(s3dirent_t));
+				struct stat attr;
+				fillstat(buffer[0], &attr);
+        			int test2 = BACKEND->put_object(bucket, par, (uint8_t *)buffer, (length)*sizeof(s3dirent_t), &attr);
   	      			if(test2 < 0){
-             		  	  fprintf(stderr, "upload failed.\n");
+             		  	  s3fs_error("upload failed");
             			    	free(dup);
 					free(pat);
 					free(buffer);
 					return -EIO;
        				 }
      				   else if(test2 < sizeof(s3dirent_t)){
-               			 fprintf(stderr, "did not allocate full dirent.\n");
+               			 s3fs_error("did not allocate full dirent");
       			          	free(dup);
 					free(buffer);
 					free(pat);
@@ -522,13 +579,10 @@ int fs_rmdir(const char *path) {
 
 int filexist (char * path, char * bucket)
 {
-    s3dirent_t *buffer = NULL;
-    if(s3fs_get_object(bucket, path, (uint8_t**)&buffer, 0, 0) == -1)
+    if(BACKEND->head_object(bucket, path, NULL) == -1)
     {
-        free(buffer);
         return -ENOENT;
     }
-        free(buffer);
     	return 0;
 }
 
@@ -536,7 +590,7 @@ int addfiletoparent(char * bucket, char *path, mode_t mode, ssize_t size){
 	char * pat = strdup(path);
 	char * par = dirname(pat);
 	s3dirent_t * buffer = NULL;
-	int test = s3fs_get_object(bucket, par, (uint8_t**)&buffer, 0, 0);
+	int test = BACKEND->get_object(bucket, par, (uint8_t**)&buffer, 0, 0);
 	if(test == -1){
 		return -EIO;
 	}
@@ -563,13 +617,15 @@ int addfiletoparent(char * bucket, char *path, mode_t mode, ssize_t size){
 	newents[x] = newent;
 	free(dup);
 	free(buffer);
-	int remove = s3fs_remove_object(bucket, par);
+	int remove = BACKEND->remove_object(bucket, par);
         if(remove < 0){
                 free(newents);
                 free(pat);
                 return -EIO;
         }
-        test = s3fs_put_object(bucket, par, (uint8_t *)newents, (length + 1)*sizeof(s3dirent_t));
+	struct stat attr;
+	fillstat(newents[0], &attr);
+        test = BACKEND->put_object(bucket, par, (uint8_t *)newents, (length + 1)*sizeof(s3dirent_t), &attr);
         if(test == -1){
                 free(newents);
 	        free(pat);
@@ -580,8 +636,11 @@ int addfiletoparent(char * bucket, char *path, mode_t mode, ssize_t size){
 	return 0;
 }
 
-int fs_mknod(const char *path, mode_t mode, dev_t dev) {
-    fprintf(stderr, "fs_mknod(path=\"%s\", mode=0%3o)\n", path, mode);
+static int __fs_mknod(const char *path, mode_t mode, dev_t dev) {
+    s3fs_debug("fs_mknod(path=\"%s\", mode=0%3o)", path, mode);
+    if (s3fs_stats_path(path)) {
+	return -EACCES;
+    }
     s3context_t *ctx = GET_PRIVATE_DATA;
     char * pat = strdup(path);
     char * par = dirname(pat);
@@ -594,7 +653,13 @@ int fs_mknod(const char *path, mode_t mode, dev_t dev) {
 		free(pat);
 		return -ENOENT;
 	}
-	int test = s3fs_put_object(bucket, path, NULL, 0);
+	struct stat attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.st_mode = mode;
+	attr.st_uid = getuid();
+	attr.st_gid = getgid();
+	attr.st_mtime = time(NULL);
+	int test = BACKEND->put_object(bucket, path, NULL, 0, &attr);
 	if(test == -1){
 		free(pat);
 		return -EIO;
@@ -620,18 +685,34 @@ int fs_mknod(const char *path, mode_t mode, dev_t dev) {
  * which will be passed to all file operations.
  * (In stages 1 and 2, you are advised to keep this function very,
  * very simple.)
+ *
+ * If statbuf isn't NULL, it is filled in from the head that found the
+ * file, for fs_open to take the file's size from.
  */
-int fs_open(const char *path, struct fuse_file_info *fi) {
-    fprintf(stderr, "fs_open(path\"%s\")\n", path);
+static int __fs_open(const char *path, struct fuse_file_info *fi, struct stat *statbuf) {
+    s3fs_debug("fs_open(path=\"%s\")", path);
+    if (s3fs_stats_path(path)) {
+	return s3fs_stats_open(path, fi);
+    }
     s3context_t *ctx = GET_PRIVATE_DATA;
-	int test = filexist(path, ctx->s3bucket);
+	struct stat attr;
+	int test = BACKEND->head_object(ctx->s3bucket, path, &attr);
 	if(test){
 		return -ENOENT;
 	}
+	if(statbuf){
+		*statbuf = attr;
+	}
+	if(S_ISREG(attr.st_mode)){
+		return 0;
+	}
+	if(S_ISDIR(attr.st_mode)){
+		return -ENOENT;
+	}
 	char * pat = strdup(path);
 	char * par = dirname(pat);
 	s3dirent_t *buffer = NULL;
-	test = s3fs_get_object(ctx->s3bucket, par, (uint8_t**)&buffer, 0, 0);
+	test = BACKEND->get_object(ctx->s3bucket, par, (uint8_t**)&buffer, 0, 0);
         free(pat);
 	if(test == -1){
                 return -EIO;
@@ -665,6 +746,168 @@ int fs_open(const char *path, struct fuse_file_info *fi) {
 }
 
 
+/*
+ * The kernel keeps what it has cached of a file open to open only if the
+ * file hasn't changed since it was last opened; otherwise it drops it.
+ * The file gets an s3file_t of its own in fi->fh (see s3fs.h).  Streamed
+ * files can only be opened for reading (see s3fs_stream.h).
+ */
+int fs_open(const char *path, struct fuse_file_info *fi) {
+    // the size is found once, here, for reads to go by
+    struct stat attr;
+    int ret = __fs_open(path, fi, &attr);
+    if (ret || s3fs_stats_path(path)) {
+	return ret;
+    }
+    if (s3fs_stream_path(path) && ((fi->flags & O_ACCMODE) != O_RDONLY)) {
+	return -EOPNOTSUPP;
+    }
+    s3context_t *ctx = GET_PRIVATE_DATA;
+    s3file_t *file = calloc(1, sizeof(s3file_t));
+    if (!file) {
+	return -ENOMEM;
+    }
+    pthread_mutex_init(&file->lock, NULL);
+    file->fd = -1;
+    file->size = attr.st_size;
+    fi->fh = (uintptr_t) file;
+    if (!s3fs_stream_path(path)) {
+	fi->keep_cache = s3fs_inode_unchanged(ctx->s3bucket, path);
+	return 0;
+    }
+    // streamed files bypass the kernel's cache, and are read through a
+    // stream
+    fi->direct_io = 1;
+    file->stream = s3fs_stream_open(BACKEND, ctx->s3bucket, path, attr.st_size);
+    return 0;
+}
+
+/*
+ * Make a local file to copy an open file to: in $TMPDIR (or /tmp), and
+ * unlinked at once, so that it goes when it is closed.
+ */
+static int open_local_file(void)
+{
+	const char *dir = getenv("TMPDIR");
+	char name[PATH_MAX];
+	snprintf(name, sizeof(name), "%s/s3fs.XXXXXX", dir && *dir ? dir : "/tmp");
+	int fd = mkstemp(name);
+	if(fd >= 0){
+		unlink(name);
+	}
+	return fd;
+}
+
+/*
+ * Copy the whole of an open file to a local file, for it to be written
+ * to, if it hasn't been already.  The file's lock must be held.
+ */
+static int load_file(const char *path, s3file_t *file)
+{
+	if(file->fd >= 0){
+		return 0;
+	}
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	int fd = open_local_file();
+	if(fd < 0){
+		s3fs_error("Can't make a local copy of %s: %s", path, strerror(errno));
+		return -EIO;
+	}
+	off_t offset = 0;
+	while(offset < file->size){
+		ssize_t size = file->size - offset;
+		if(size > LOAD_CHUNK){
+			size = LOAD_CHUNK;
+		}
+		uint8_t *data = NULL;
+		ssize_t got = BACKEND->get_object(ctx->s3bucket, path, &data, offset, size);
+		if(got < 0 || (got && pwrite(fd, data, got, offset) != got)){
+			free(data);
+			close(fd);
+			return -EIO;
+		}
+		free(data);
+		offset += got;
+		// the file has been made shorter since it was opened
+		if(got < size){
+			file->size = offset;
+		}
+	}
+	file->fd = fd;
+	return 0;
+}
+
+/*
+ * Set the size of an open file, which must have been loaded: a file made
+ * longer reads as zeroes past its old end.  The file's lock must be held.
+ */
+static int resize_file(s3file_t *file, off_t size)
+{
+	if(ftruncate(file->fd, size) < 0){
+		return -errno;
+	}
+	file->size = size;
+	file->dirty = 1;
+	return 0;
+}
+
+/*
+ * Fetch a range of an open file, for fs_read and fs_read_buf: into buf,
+ * if it isn't NULL, and otherwise into a buffer of its own at *data (to
+ * be freed by the caller).  Returns the number of bytes read: fewer than
+ * size at the end of the file.  The file's size is the one it had when it
+ * was opened, or has been written to since, so that a read needn't ask
+ * the backend for it.
+ */
+static int read_range(const char *path, size_t size, off_t offset,
+		      struct fuse_file_info *fi, char *buf, uint8_t **data)
+{
+	s3context_t *ctx = GET_PRIVATE_DATA;
+	s3file_t *file = (s3file_t *)(uintptr_t)fi->fh;
+	if(data){
+		*data = NULL;
+	}
+	if(!file){
+		return -EBADF;
+	}
+	pthread_mutex_lock(&file->lock);
+	// s3 refuses a range beginning past the end
+	if(offset >= file->size || size == 0){
+		pthread_mutex_unlock(&file->lock);
+		return 0;
+	}
+	if(size > file->size - offset){
+		size = file->size - offset;
+	}
+	if(!buf && (file->fd >= 0 || file->stream) && !(buf = (char *)(*data = malloc(size)))){
+		pthread_mutex_unlock(&file->lock);
+		return -ENOMEM;
+	}
+	// what has been written to the file is read back from its local copy
+	if(file->fd >= 0){
+		ssize_t got = pread(file->fd, buf, size, offset);
+		pthread_mutex_unlock(&file->lock);
+		return got < 0 ? -errno : got;
+	}
+	pthread_mutex_unlock(&file->lock);
+	if(file->stream){
+		return s3fs_stream_read(file->stream, buf, size, offset);
+	}
+	uint8_t *got_data = NULL;
+	ssize_t got = BACKEND->get_object(ctx->s3bucket, path, &got_data, offset, size);
+	if(got < 0){
+		return -EIO;
+	}
+	if(buf){
+		memcpy(buf, got_data, got);
+		free(got_data);
+	}
+	else{
+		*data = got_data;
+	}
+	return got;
+}
+
 /* 
  * Read data from an open file
  *
@@ -673,119 +916,191 @@ int fs_open(const char *path, struct fuse_file_info *fi) {
  * substituted with zeroes.  
  */
 int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    fprintf(stderr, "fs_read(path=\"%s\", buf=%p, size=%d, offset=%d)\n",
+    s3fs_debug("fs_read(path=\"%s\", buf=%p, size=%d, offset=%d)",
         path, buf, (int)size, (int)offset);
- 	s3context_t *ctx = GET_PRIVATE_DATA;
-        if(fs_open(path, fi)){
-                return -ENOENT;
-        }
-        int test = s3fs_get_object(ctx->s3bucket, path, (uint8_t *)buf, offset, size);
-        if(test == -1){
-                return -EIO;
-        }
-	else if (test < size)
-	{
-		int x = test;
-		while (x < size)
-		{
-			buf[x] = 0;
-			x++;
+    if (s3fs_stats_path(path)) {
+	return s3fs_stats_read(buf, size, offset, fi);
+    }
+	return read_range(path, size, offset, fi, buf, NULL);
+}
+
+/*
+ * Read data from an open file into a buffer of our own, which FUSE
+ * replies from and then frees, rather than copying it into one of
+ * FUSE's as fs_read does.  Used in place of fs_read when FUSE has it.
+ * A file that has a local copy isn't read here at all: FUSE is handed
+ * the range of the copy, which it splices to the kernel if it can.
+ */
+int fs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fi) {
+    s3fs_debug("fs_read_buf(path=\"%s\", size=%d, offset=%d)",
+        path, (int)size, (int)offset);
+	struct fuse_bufvec *bufv = malloc(sizeof(struct fuse_bufvec));
+	if(!bufv){
+		return -ENOMEM;
+	}
+	s3file_t *file = s3fs_stats_path(path) ? NULL : (s3file_t *)(uintptr_t)fi->fh;
+	if(file){
+		pthread_mutex_lock(&file->lock);
+		if(file->fd >= 0){
+			if(offset >= file->size){
+				size = 0;
+			}
+			else if(size > file->size - offset){
+				size = file->size - offset;
+			}
+			*bufv = FUSE_BUFVEC_INIT(size);
+			bufv->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+			bufv->buf[0].fd = file->fd;
+			bufv->buf[0].pos = offset;
+			pthread_mutex_unlock(&file->lock);
+			*bufp = bufv;
+			return 0;
 		}
+		pthread_mutex_unlock(&file->lock);
+	}
+	uint8_t *data;
+	int got;
+    if (s3fs_stats_path(path)) {
+	if((data = malloc(size ? size : 1))){
+		got = s3fs_stats_read((char *)data, size, offset, fi);
 	}
- 	return test;
+	else{
+		got = -ENOMEM;
+	}
+    }
+    else {
+	got = read_range(path, size, offset, fi, NULL, &data);
+    }
+	if(got < 0){
+		free(data);
+		free(bufv);
+		return got;
+	}
+	*bufv = FUSE_BUFVEC_INIT(got);
+	bufv->buf[0].mem = data;
+	*bufp = bufv;
+	return 0;
 }
 
 
 /*
- * Write data to an open file
+ * Write data to an open file's local copy, from wherever FUSE has it: if
+ * it is still in the pipe FUSE spliced it into, it is spliced on from
+ * there, without being copied into memory at all.  Nothing is uploaded
+ * until the file is flushed (see fs_flush).
  *
  * Write should return exactly the number of bytes requested
  * except on error.
  */
-int fs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    fprintf(stderr, "fs_write(path=\"%s\", buf=%p, size=%d, offset=%d)\n",
-          path, buf, (int)size, (int)offset);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-        if(fs_open(path, fi)){
-                return -ENOENT;
-        }
-	char * buffer;
-        int test = s3fs_get_object(ctx->s3bucket, path, (uint8_t *)buffer, 0,0);
-        if(test == -1){
-                return -EIO;
-        }
-	int bufsize = test;
-        if (test < (size+offset))
-	{
-		bufsize = size+offset;
-	}
-	char newbuffer[bufsize];
-
-	int x = 0;
-	for(x; x < offset; x++);
-	{
-		newbuffer[x] = buffer[x];
+int fs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fi) {
+    size_t size = fuse_buf_size(buf);
+    s3fs_debug("fs_write_buf(path=\"%s\", size=%d, offset=%d)",
+          path, (int)size, (int)offset);
+    if (s3fs_stats_path(path)) {
+	return -EACCES;
+    }
+    s3file_t *file = (s3file_t *)(uintptr_t)fi->fh;
+	pthread_mutex_lock(&file->lock);
+	int ret = load_file(path, file);
+	if(ret){
+		pthread_mutex_unlock(&file->lock);
+		return ret;
 	}
-	x = 0;
-	for(; x < size; x++)
-	{
-		newbuffer[x+offset] = buf[x];
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+	dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	dst.buf[0].fd = file->fd;
+	dst.buf[0].pos = offset;
+	ssize_t copied = fuse_buf_copy(&dst, buf, 0);
+	if(copied > 0 && offset + copied > file->size){
+		file->size = offset + copied;
 	}
-	x = x + offset;
-	for(; x < test; x++)
-	{
-		newbuffer[x] = buffer[x];
+	file->dirty = 1;
+	pthread_mutex_unlock(&file->lock);
+	if(copied < 0 || (size_t)copied < size){
+		return copied < 0 ? copied : -EIO;
 	}
+	return size;
+}
 
-        char * pat = strdup(path);
-        char * par = dirname(pat);
-        s3dirent_t *buffer2 = NULL;
-        test = s3fs_get_object(ctx->s3bucket, par, (uint8_t**)&buffer2, 0, 0);
-        free(pat);
-        if(test == -1){
-                 return -EIO;
-        }
-	x = 0;
-        int length =  test/sizeof(s3dirent_t);
-        char * dup = strdup(path);
-        for(; x < length; x++){
-                s3dirent_t dirent = buffer2[x];
-                if(strcmp((dirent.name), basename(dup)) == 0)
-                {
-                        if (dirent.type == 'F')
-                        {
-                               fs_unlink(path);
-                                addfiletoparent(ctx->s3bucket, path, dirent.permissions, bufsize);
-                                 test = s3fs_put_object(ctx->s3bucket, path, (uint8_t*)newbuffer, bufsize);
-                                if(test < 0){
-                                        free(buffer);
-                                        free(buffer2);
-                                        free(dup);
-                                        return -EIO;
-                                }
-                                else if(test < dirent.size){
-                                        fprintf(stderr, "Failed to upload all data.");
-                                        free(buffer);
-                                        free(buffer2);
-                                        free(dup);
-                                        return -EIO;
-                                }
-                                free(buffer);
-                                free(buffer2);
-                                free(dup);
-                                return 0;
-                        }
-                }
-        }
-
-
-
-
-
-
+// for a FUSE without write_buf
+int fs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(size);
+    bufv.buf[0].mem = (void *)buf;
+    return fs_write_buf(path, &bufv, offset, fi);
+}
 
 
-} 
+/*
+ * Upload what has been written to an open file, and its new size and
+ * times to its entry in its directory.  Called on each close() of the
+ * file, so that errors are reported there, and on release.
+ */
+static int __fs_flush(const char *path, struct fuse_file_info *fi) {
+    s3fs_debug("fs_flush(path=\"%s\")", path);
+    if (s3fs_stats_path(path)) {
+	return 0;
+    }
+    s3context_t *ctx = GET_PRIVATE_DATA;
+    s3file_t *file = (s3file_t *)(uintptr_t)fi->fh;
+	pthread_mutex_lock(&file->lock);
+	if(!file->dirty){
+		pthread_mutex_unlock(&file->lock);
+		return 0;
+	}
+	char * pat = strdup(path);
+	char * par = dirname(pat);
+	s3dirent_t *entries = NULL;
+	ssize_t test = BACKEND->get_object(ctx->s3bucket, par, (uint8_t**)&entries, 0, 0);
+	if(test < 0){
+		pthread_mutex_unlock(&file->lock);
+		free(pat);
+		return -EIO;
+	}
+	int length = test/sizeof(s3dirent_t);
+	char * dup = strdup(path);
+	char * name = basename(dup);
+	int x = 1;
+	while(x < length && (entries[x].type != 'F' || strcmp(entries[x].name, name))){
+		x++;
+	}
+	int ret = -ENOENT;
+	// the local copy is uploaded from the kernel's cache of it, mapped
+	// rather than read into memory of our own
+	uint8_t *data = NULL;
+	if(x < length && file->size){
+		data = mmap(NULL, file->size, PROT_READ, MAP_SHARED, file->fd, 0);
+		if(data == MAP_FAILED){
+			s3fs_error("Can't map the local copy of %s: %s", path, strerror(errno));
+			data = NULL;
+			ret = -EIO;
+			x = length;
+		}
+	}
+	if(x < length){
+		time_t now = time(NULL);
+		entries[x].size = file->size;
+		entries[x].modify = now;
+		entries[x].change = now;
+		struct stat attr;
+		fillstat(entries[x], &attr);
+		ret = -EIO;
+		if(BACKEND->put_object(ctx->s3bucket, path, data, file->size, &attr) == file->size){
+			fillstat(entries[0], &attr);
+			if(BACKEND->put_object(ctx->s3bucket, par, (uint8_t *)entries, test, &attr) == test){
+				file->dirty = 0;
+				ret = 0;
+			}
+		}
+	}
+	if(data){
+		munmap(data, file->size);
+	}
+	pthread_mutex_unlock(&file->lock);
+	free(dup);
+	free(pat);
+	free(entries);
+	return ret;
+}
 /*
  * Release an open file
  *
@@ -800,82 +1115,153 @@ int fs_write(const char *path, const char *buf, size_t size, off_t offset, struc
  * file.  The return value of release is ignored.
  */
 int fs_release(const char *path, struct fuse_file_info *fi) {
-    fprintf(stderr, "fs_release(path=\"%s\")\n", path);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    return 0;
+    s3fs_debug("fs_release(path=\"%s\")", path);
+    if (s3fs_stats_path(path)) {
+	return s3fs_stats_release(fi);
+    }
+    s3file_t *file = (s3file_t *)(uintptr_t)fi->fh;
+    if (!file) {
+	return 0;
+    }
+    // written since the last close, as by a writable mmap
+    int ret = fs_flush(path, fi);
+    if (file->stream) {
+	s3fs_stream_close(file->stream);
+    }
+    pthread_mutex_destroy(&file->lock);
+    if (file->fd >= 0) {
+	close(file->fd);
+    }
+    free(file);
+    fi->fh = 0;
+    return ret;
 }
 
 
 /*
  * Rename a file.
  */
-int fs_rename(const char *path, const char *newpath) {
-    fprintf(stderr, "fs_rename(fpath=\"%s\", newpath=\"%s\")\n", path, newpath);
+static int __fs_rename(const char *path, const char *newpath) {
+    s3fs_debug("fs_rename(fpath=\"%s\", newpath=\"%s\")", path, newpath);
+    if (s3fs_stats_path(path) || s3fs_stats_path(newpath)) {
+	return -EACCES;
+    }
+    if (!strcmp(path, newpath)) {
+	return 0;
+    }
     s3context_t *ctx = GET_PRIVATE_DATA;
-     char * buffer = NULL;
-// same as other turncate except assume the file is "open"
-        int test = s3fs_get_object(ctx->s3bucket, path, (uint8_t**)&buffer, 0, 0);
-        if(test == -1){
-                free(buffer);
-                return -EIO;
-        }
-        char * pat = strdup(path);
-        char * par = dirname(pat);
-        s3dirent_t *buffer2 = NULL;
-        test = s3fs_get_object(ctx->s3bucket, par, (uint8_t**)&buffer2, 0, 0);
-        free(pat);
-        if(test == -1){
-		 return -EIO;
-        }
-        int x = 0;
-        int length =  test/sizeof(s3dirent_t);
-        char * dup = strdup(path);
-        for(; x < length; x++){
-                s3dirent_t dirent = buffer2[x];
-                if(strcmp((dirent.name), basename(dup)) == 0)
-                {
-                        if (dirent.type == 'F')
-                        {
-				fs_unlink(path);
-				addfiletoparent(ctx->s3bucket, newpath, dirent.permissions, dirent.size);
-                                 test = s3fs_put_object(ctx->s3bucket, newpath, (uint8_t*)buffer, dirent.size);
-                                if(test < 0){
-                                        free(buffer);
-                                        free(buffer2);
-                                       	free(dup);
-					return -EIO;
-                                }
-                                else if(test < dirent.size){
-                                        fprintf(stderr, "Failed to upload all data.");
-                                        free(buffer);
-                                        free(buffer2);
-                                        free(dup);
-					return -EIO;
-                                }
-				free(buffer);
-				free(buffer2);
-				free(dup);
-				return 0;
-			}
+	char * bucket = ctx->s3bucket;
+	char * pat = strdup(path);
+	char * par = dirname(pat);
+	char * dup = strdup(path);
+	char * name = basename(dup);
+	char * newpat = strdup(newpath);
+	char * newpar = dirname(newpat);
+	char * newdup = strdup(newpath);
+	char * newname = basename(newdup);
+	s3dirent_t *entries = NULL, *newentries = NULL;
+	int ret = -ENOENT;
+	ssize_t test = BACKEND->get_object(bucket, par, (uint8_t**)&entries, 0, 0);
+	if(test < 0){
+		ret = -EIO;
+		goto done;
+	}
+	int length = test/sizeof(s3dirent_t);
+	int x = 1;
+	while(x < length && (entries[x].type != 'F' || strcmp(entries[x].name, name))){
+		x++;
+	}
+	if(x == length){
+		goto done;
+	}
+	ret = -EIO;
+	// s3 copies the data itself; only drop the source once the copy and
+	// the entries for it are safely there
+	struct stat attr;
+	fillstat(entries[x], &attr);
+	if(BACKEND->copy_object(bucket, path, newpath, &attr) < 0){
+		goto done;
+	}
+	s3dirent_t entry = entries[x];
+	strcpy(entry.name, newname);
+	entry.change = time(NULL);
+	// the entry is taken out of its directory, and put (over any file
+	// of the new name) into the new one: the same one, more often than not
+	memmove(&entries[x], &entries[x + 1], (length - x - 1)*sizeof(s3dirent_t));
+	length--;
+	s3dirent_t **target = &entries;
+	int *targetlength = &length;
+	int newlength = 0;
+	if(strcmp(par, newpar)){
+		test = BACKEND->get_object(bucket, newpar, (uint8_t**)&newentries, 0, 0);
+		if(test < 0){
+			goto done;
 		}
+		newlength = test/sizeof(s3dirent_t);
+		target = &newentries;
+		targetlength = &newlength;
+	}
+	int y = 1;
+	while(y < *targetlength && strcmp((*target)[y].name, newname)){
+		y++;
+	}
+	if(y < *targetlength && (*target)[y].type != 'F'){
+		ret = -EISDIR;
+		goto done;
+	}
+	if(y == *targetlength){
+		// room for it, in place of the one taken out or at the end
+		s3dirent_t *grown = realloc(*target, (*targetlength + 1)*sizeof(s3dirent_t));
+		if(!grown){
+			ret = -ENOMEM;
+			goto done;
+		}
+		*target = grown;
+		(*targetlength)++;
+	}
+	(*target)[y] = entry;
+	if(newentries){
+		fillstat(newentries[0], &attr);
+		if(BACKEND->put_object(bucket, newpar, (uint8_t *)newentries, newlength*sizeof(s3dirent_t), &attr) < 0){
+			goto done;
+		}
+	}
+	fillstat(entries[0], &attr);
+	if(BACKEND->put_object(bucket, par, (uint8_t *)entries, length*sizeof(s3dirent_t), &attr) < 0){
+		goto done;
 	}
+	if(BACKEND->remove_object(bucket, path) < 0){
+		goto done;
+	}
+	ret = 0;
+done:
+	free(entries);
+	free(newentries);
+	free(pat);
+	free(dup);
+	free(newpat);
+	free(newdup);
+	return ret;
 }
 
 
 /*
  * Remove a file.
  */
-int fs_unlink(const char *path) {
-    fprintf(stderr, "fs_unlink(path=\"%s\")\n", path);
+static int __fs_unlink(const char *path) {
+    s3fs_debug("fs_unlink(path=\"%s\")", path);
+    if (s3fs_stats_path(path)) {
+	return -EACCES;
+    }
     s3context_t *ctx = GET_PRIVATE_DATA;
     struct fuse_file_info *fi;
-	if(fs_open(path, fi)){
+	if(__fs_open(path, fi, NULL)){
 		return -ENOENT;
 	}
 	char * pat = strdup(path);
 	char * par = dirname(pat);
 	s3dirent_t *buffer = NULL;
-	int test = s3fs_get_object(ctx->s3bucket, par, (uint8_t**)&buffer, 0, 0);
+	int test = BACKEND->get_object(ctx->s3bucket, par, (uint8_t**)&buffer, 0, 0);
         free(pat);
         if(test == -1){
                 return -EIO;
@@ -893,7 +1279,7 @@ int fs_unlink(const char *path) {
                                 dirent.type = 'U';
 				free(dup);
                                 free(buffer);
-				if(s3fs_remove_object(ctx->s3bucket, path) == -1){
+				if(BACKEND->remove_object(ctx->s3bucket, path) == -1){
                 		        return -EIO;
 			        }
 
@@ -908,16 +1294,23 @@ int fs_unlink(const char *path) {
 /*
  * Change the size of a file.
  */
-int fs_truncate(const char *path, off_t newsize) {
-    fprintf(stderr, "fs_truncate(path=\"%s\", newsize=%d)\n", path, (int)newsize);
+static int __fs_truncate(const char *path, off_t newsize) {
+    s3fs_debug("fs_truncate(path=\"%s\", newsize=%d)", path, (int)newsize);
+    if (s3fs_stats_path(path)) {
+	return -EACCES;
+    }
+    // a streamed file is only ever read
+    if (s3fs_stream_path(path)) {
+	return -EOPNOTSUPP;
+    }
     s3context_t *ctx = GET_PRIVATE_DATA;
 	struct fuse_file_info *fi;
-    int test = fs_open(path, fi);
+    int test = __fs_open(path, fi, NULL);
 	if(test){
 		return test;
 	}
 	s3dirent_t * buffer = NULL;
-	test = s3fs_get_object(ctx->s3bucket, path, (uint8_t**)&buffer, 0, 0);
+	test = BACKEND->get_object(ctx->s3bucket, path, (uint8_t**)&buffer, 0, 0);
 	if(test == -1){
 		free(buffer);
 		return -EIO;
@@ -925,7 +1318,7 @@ int fs_truncate(const char *path, off_t newsize) {
 	char * pat = strdup(path);
         char * par = dirname(pat);
 	s3dirent_t *buffer2 = NULL;
-        test = s3fs_get_object(ctx->s3bucket, par, (uint8_t**)&buffer2, 0, 0);
+        test = BACKEND->get_object(ctx->s3bucket, par, (uint8_t**)&buffer2, 0, 0);
         free(pat);
         if(test == -1){
                 return -EIO;
@@ -947,19 +1340,21 @@ int fs_truncate(const char *path, off_t newsize) {
         			dirent.access = now;
 	       			dirent.change = now;
                                 free(dup);
-                                if(s3fs_remove_object(ctx->s3bucket, path) == -1){
+                                if(BACKEND->remove_object(ctx->s3bucket, path) == -1){
                                         free(buffer);
 					free(buffer2);
 					return -EIO;
                                 }
-				test = s3fs_put_object(ctx->s3bucket, path, (uint8_t*)buffer, newsize);
+				struct stat attr;
+				fillstat(dirent, &attr);
+				test = BACKEND->put_object(ctx->s3bucket, path, (uint8_t*)buffer, newsize, &attr);
 				if(test < 0){
 					free(buffer);
 					free(buffer2);
 					return -EIO;
 				}
 				else if(test < newsize){
-					fprintf(stderr, "Failed to upload all data.");
+					s3fs_error("Failed to upload all data");
 					free(buffer);
 					free(buffer2);
 					return -EIO;
@@ -979,65 +1374,23 @@ int fs_truncate(const char *path, off_t newsize) {
  * depending on your implementation), you could possibly treat it the
  * same as fs_truncate.
  */
-int fs_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi) {
-    fprintf(stderr, "fs_ftruncate(path=\"%s\", offset=%d)\n", path, (int)offset);
-    s3context_t *ctx = GET_PRIVATE_DATA;
-    s3dirent_t * buffer = NULL;
-// same as other turncate except assume the file is "open"
-        int test = s3fs_get_object(ctx->s3bucket, path, (uint8_t**)&buffer, 0, 0);
-        if(test == -1){
-                free(buffer);
-                return -EIO;
-        }
-        char * pat = strdup(path);
-        char * par = dirname(pat);
-        s3dirent_t *buffer2 = NULL;
-        test = s3fs_get_object(ctx->s3bucket, par, (uint8_t**)&buffer2, 0, 0);
-        free(pat);
-        if(test == -1){
-                return -EIO;
-        }
-        int x = 0;
-        int length =  test/sizeof(s3dirent_t);
-        char * dup = strdup(path);
-        free(pat);
-        for(; x < length; x++){
-                s3dirent_t dirent = buffer2[x];
-                if(strcmp((dirent.name), basename(dup)) == 0)
-                {
-                        if (dirent.type == 'F')
-                        {
-                                dirent.size = offset;
-                                time_t now = time(NULL);
-                                ctime(&now);
-                                dirent.modify = now;
-                                dirent.access = now;
-                                dirent.change = now;
-                                free(dup);
-                                if(s3fs_remove_object(ctx->s3bucket, path) == -1){
-                                        free(buffer);
-					free(buffer2);
-                                        return -EIO;
-                                }
-                                test = s3fs_put_object(ctx->s3bucket, path, (uint8_t*)buffer, offset);
-                                if(test < 0){
-					free(buffer);
-					free(buffer2);
-                                        return -EIO;
-                                }
-                                else if(test < offset){
-                                        fprintf(stderr, "Failed to upload all data.");
-                                        free(buffer);
-					free(buffer2);
-                                        return -EIO;
-                                }
-                                free(buffer);
-				free(buffer2);
-                                return 0;
-                        }
-                }
-        }
-
+static int __fs_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi) {
+    s3fs_debug("fs_ftruncate(path=\"%s\", offset=%d)", path, (int)offset);
+    if (s3fs_stats_path(path)) {
+	return -EACCES;
+    }
+    s3file_t *file = (s3file_t *)(uintptr_t)fi->fh;
+    if (!file) {
+	return __fs_truncate(path, offset);
+    }
+    // made to the file's data, like a write, and uploaded with it
+	pthread_mutex_lock(&file->lock);
+	int ret = load_file(path, file);
+	if(!ret){
+		ret = resize_file(file, offset);
+	}
+	pthread_mutex_unlock(&file->lock);
+	return ret;
 }
 
 
@@ -1046,12 +1399,85 @@ int fs_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi) {
  * Later, actually check permissions (don't bother initially).
  */
 int fs_access(const char *path, int mask) {
-    fprintf(stderr, "fs_access(path=\"%s\", mask=0%o)\n", path, mask);
+    s3fs_debug("fs_access(path=\"%s\", mask=0%o)", path, mask);
+    if (s3fs_stats_path(path) && (mask & W_OK)) {
+	return -EACCES;
+    }
     s3context_t *ctx = GET_PRIVATE_DATA;
     return 0;
 }
 
 
+/*
+ * The operations that change a directory's entries, each run holding the
+ * locks on the directories it changes (see s3fs_dirlock.h), so that FUSE
+ * can call them from many threads at once.
+ */
+int fs_mknod(const char *path, mode_t mode, dev_t dev) {
+    s3fs_dirlock lock;
+    s3fs_lock_parents(&lock, path, NULL);
+    int ret = __fs_mknod(path, mode, dev);
+    s3fs_unlock_dirs(&lock);
+    return ret;
+}
+
+int fs_mkdir(const char *path, mode_t mode) {
+    s3fs_dirlock lock;
+    s3fs_lock_dir(&lock, path);
+    int ret = __fs_mkdir(path, mode);
+    s3fs_unlock_dirs(&lock);
+    return ret;
+}
+
+int fs_rmdir(const char *path) {
+    s3fs_dirlock lock;
+    s3fs_lock_dir(&lock, path);
+    int ret = __fs_rmdir(path);
+    s3fs_unlock_dirs(&lock);
+    return ret;
+}
+
+int fs_unlink(const char *path) {
+    s3fs_dirlock lock;
+    s3fs_lock_parents(&lock, path, NULL);
+    int ret = __fs_unlink(path);
+    s3fs_unlock_dirs(&lock);
+    return ret;
+}
+
+int fs_rename(const char *path, const char *newpath) {
+    s3fs_dirlock lock;
+    s3fs_lock_parents(&lock, path, newpath);
+    int ret = __fs_rename(path, newpath);
+    s3fs_unlock_dirs(&lock);
+    return ret;
+}
+
+int fs_flush(const char *path, struct fuse_file_info *fi) {
+    s3fs_dirlock lock;
+    s3fs_lock_parents(&lock, path, NULL);
+    int ret = __fs_flush(path, fi);
+    s3fs_unlock_dirs(&lock);
+    return ret;
+}
+
+int fs_truncate(const char *path, off_t newsize) {
+    s3fs_dirlock lock;
+    s3fs_lock_parents(&lock, path, NULL);
+    int ret = __fs_truncate(path, newsize);
+    s3fs_unlock_dirs(&lock);
+    return ret;
+}
+
+int fs_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi) {
+    s3fs_dirlock lock;
+    s3fs_lock_parents(&lock, path, NULL);
+    int ret = __fs_ftruncate(path, offset, fi);
+    s3fs_unlock_dirs(&lock);
+    return ret;
+}
+
+
 /*
  * The struct that contains pointers to all our callback
  * functions.  Those that are currently NULL aren't 
@@ -1076,7 +1502,7 @@ struct fuse_operations s3fs_ops = {
   .read        = fs_read,       // read contents from an open file
   .write       = fs_write,      // write contents to an open file
   .statfs      = NULL,          // file sys stat: not implemented
-  .flush       = NULL,          // flush file to stable storage: not implemented
+  .flush       = fs_flush,      // upload what was written to a file
   .release     = fs_release,    // release/close file
   .fsync       = NULL,          // sync file to disk: not implemented
   .setxattr    = NULL,          // not implemented
@@ -1092,7 +1518,9 @@ struct fuse_operations s3fs_ops = {
   .access      = fs_access,     // check access permissions for a file
   .create      = NULL,          // not implemented
   .ftruncate   = fs_ftruncate,  // truncate the file
-  .fgetattr    = NULL           // not implemented
+  .fgetattr    = NULL,          // not implemented
+  .write_buf   = fs_write_buf,  // write contents from FUSE's buffers
+  .read_buf    = fs_read_buf    // read contents into our own buffers
 };
 
 
@@ -1105,40 +1533,79 @@ struct fuse_operations s3fs_ops = {
  */
 int main(int argc, char *argv[]) {
 	fflush(stdout);
+    if (s3fs_log_init() < 0) {
+        return -1;
+    }
     // don't allow anything to continue if we're running as root.  bad stuff.
     if ((getuid() == 0) || (geteuid() == 0)) {
-    	fprintf(stderr, "Don't run this as root.\n");
+    	s3fs_error("Don't run this as root.");
     	return -1;
     }
     s3context_t *stateinfo = malloc(sizeof(s3context_t));
     memset(stateinfo, 0, sizeof(s3context_t));
 
-    char *s3key = getenv(S3ACCESSKEY);
-    if (!s3key) {
-        fprintf(stderr, "%s environment variable must be defined\n", S3ACCESSKEY);
-        return -1;
-    }
-    char *s3secret = getenv(S3SECRETKEY);
-    if (!s3secret) {
-        fprintf(stderr, "%s environment variable must be defined\n", S3SECRETKEY);
-        return -1;
-    }
     char *s3bucket = getenv(S3BUCKET);
     if (!s3bucket) {
-        fprintf(stderr, "%s environment variable must be defined\n", S3BUCKET);
+        s3fs_error("%s environment variable must be defined", S3BUCKET);
         return -1;
     }
     strncpy((*stateinfo).s3bucket, s3bucket, BUFFERSIZE);
 
-    fprintf(stderr, "Initializing s3 credentials\n");
-    s3fs_init_credentials(s3key, s3secret);
+    // the kernel keeps what it looks up, and the node table what it reads
+    // from the backend, for the same time, so that a change made by another
+    // writer is seen by both after at most this long
+    double timeout = S3FS_CACHE_TIMEOUT;
+    char *timeout_env = getenv(S3FSCACHETIMEOUT);
+    if (timeout_env) {
+	char *end;
+	timeout = strtod(timeout_env, &end);
+	if ((end == timeout_env) || *end || (timeout < 0)) {
+	    s3fs_error("Invalid %s: %s", S3FSCACHETIMEOUT, timeout_env);
+	    return -1;
+	}
+    }
 
-    fprintf(stderr, "Totally clearing s3 bucket\n");
-    s3fs_clear_bucket(s3bucket);
+    // the s3 backend checks for S3_ACCESS_KEY_ID and S3_SECRET_ACCESS_KEY
+    s3fs_info("Initializing storage backend");
+    s3fs_stats_init();
+    if (s3fs_stream_init() < 0) {
+	return -1;
+    }
+    // the node table sits in front of the timing, so that only the calls it
+    // can't answer itself are counted as backend calls
+    stateinfo->backend = s3fs_inode_backend(
+        s3fs_stats_backend(s3fs_backend_init(getenv(S3FSBACKEND))),
+        timeout);
+    if (!stateinfo->backend) {
+        return -1;
+    }
+
+    s3fs_info("Totally clearing s3 bucket");
+    stateinfo->backend->clear_bucket(s3bucket);
+
+    // operations are timed for /.s3fs/stats even when they aren't traced
+    char *trace = getenv(S3FSTRACE);
+    if (trace) {
+        s3fs_info("Tracing operations to %s", trace);
+    }
+    if (s3fs_trace_start(trace, &s3fs_ops) < 0) {
+        return -1;
+    }
+
+    // options given to the mount come after these, and so override them
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    char timeouts[128];
+    snprintf(timeouts, sizeof(timeouts),
+	     "-oattr_timeout=%g,entry_timeout=%g,negative_timeout=%g",
+	     timeout, timeout, timeout);
+    if (fuse_opt_insert_arg(&args, 1, timeouts) < 0) {
+	return -1;
+    }
 
-    fprintf(stderr, "Starting up FUSE file system.\n");
-    int fuse_stat = fuse_main(argc, argv, &s3fs_ops, stateinfo);
-    fprintf(stderr, "Startup function (fuse_main) returned %d\n", fuse_stat);
+    s3fs_info("Starting up FUSE file system.");
+    int fuse_stat = fuse_main(args.argc, args.argv, &s3fs_ops, stateinfo);
+    fuse_opt_free_args(&args);
+    s3fs_info("Startup function (fuse_main) returned %d", fuse_stat);
 
     return fuse_stat;
 }
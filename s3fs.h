@@ -2,10 +2,12 @@
 #define __USERSPACEFS_H__
 
 #include <sys/stat.h>
+#include <pthread.h>
 #include <stdint.h>   // for uint32_t, etc.
 #include <sys/time.h> // for struct timeval
 #include <sys/types.h>
 #include <unistd.h>
+#include "s3fs_backend.h"
 
 /* This code is based on the fine code written by Joseph Pfeiffer for his
    fuse system tutorial. */
@@ -16,12 +18,17 @@
 #define S3ACCESSKEY "S3_ACCESS_KEY_ID"
 #define S3SECRETKEY "S3_SECRET_ACCESS_KEY"
 #define S3BUCKET "S3_BUCKET"
+#define S3FSBACKEND "S3FS_BACKEND"
+// how long, in seconds, the kernel may cache attributes and lookups
+#define S3FSCACHETIMEOUT "S3FS_CACHE_TIMEOUT"
+#define S3FS_CACHE_TIMEOUT 60.0
 
 #define BUFFERSIZE 1024
 
 // store filesystem state information in this struct
 typedef struct {
     char s3bucket[BUFFERSIZE];
+    const s3fs_backend *backend; // where objects are kept; see s3fs_backend.h
 } s3context_t;
 
 /*
@@ -43,4 +50,18 @@ typedef struct s3dirent_t{
 	time_t change;
 } s3dirent_t;
 
+/*
+ * An open file, kept in fi->fh.  Writes are made to a copy of the whole
+ * file here, and only uploaded (with the file's entry in its directory)
+ * when the file is flushed or released.
+ */
+typedef struct s3file_t {
+	pthread_mutex_t lock;	// held by whatever reads or changes fd
+	int fd;			// an unlinked local copy of the file, made for
+				// it to be written to; else -1
+	off_t size;		// the file's size, as opened or as written
+	int dirty;		// whether fd has writes not yet uploaded
+	struct s3fs_stream *stream; // where it is read from, if streamed
+} s3file_t;
+
 #endif // __USERSPACEFS_H__
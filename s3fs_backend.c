@@ -0,0 +1,172 @@
+/*
+ * Choosing a storage backend, the s3 backend (which is libs3_wrapper), and
+ * asynchronous operations for all backends.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "s3fs_backend.h"
+
+// s3 ------------------------------------------------------------------------
+
+static int s3_init(const char *arg) {
+    (void) arg;
+    return s3fs_init_credentials();
+}
+
+const s3fs_backend s3fs_backend_s3 = {
+    "s3",
+    &s3_init,
+    &s3fs_test_bucket,
+    &s3fs_clear_bucket,
+    &s3fs_get_object,
+    &s3fs_put_object_attr,
+    &s3fs_head_object,
+    &s3fs_list_objects,
+    &s3fs_copy_object,
+    &s3fs_remove_object,
+    &s3fs_backend_get_object_async,
+    &s3fs_backend_put_object_async
+};
+
+// choosing a backend --------------------------------------------------------
+
+static const s3fs_backend *backends[] = {
+    &s3fs_backend_s3,
+    &s3fs_backend_memory,
+    &s3fs_backend_dir
+};
+
+const s3fs_backend *s3fs_backend_init(const char *spec) {
+    char name[64];
+    const char *arg = NULL;
+
+    if (!spec || !spec[0]) {
+        spec = "s3";
+    }
+    const char *colon = strchr(spec, ':');
+    if (colon) {
+        arg = colon + 1;
+        snprintf(name, sizeof(name), "%.*s", (int) (colon - spec), spec);
+    }
+    else {
+        snprintf(name, sizeof(name), "%s", spec);
+    }
+
+    unsigned int i;
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (!strcmp(name, backends[i]->name)) {
+            if ((*(backends[i]->init))(arg) < 0) {
+                fprintf(stderr, "Failed to set up the %s backend\n", name);
+                return NULL;
+            }
+            return backends[i];
+        }
+    }
+
+    fprintf(stderr, "Unknown backend: %s\n", spec);
+    return NULL;
+}
+
+// asynchronous operations ---------------------------------------------------
+
+typedef struct async_op {
+    const s3fs_backend *backend;
+    char *bucket, *key;
+    ssize_t start_byte, byte_count;
+    const uint8_t *buf;
+    struct stat attr;
+    int has_attr;
+    s3fs_get_callback *get_callback;
+    s3fs_put_callback *put_callback;
+    void *data;
+} async_op;
+
+static void *async_main(void *arg) {
+    async_op *op = (async_op *) arg;
+
+    if (op->get_callback) {
+        uint8_t *buf = NULL;
+        ssize_t rv = (*(op->backend->get_object))(op->bucket, op->key, &buf,
+                                                  op->start_byte,
+                                                  op->byte_count);
+        (*(op->get_callback))(rv, buf, op->data);
+    }
+    else {
+        ssize_t rv = (*(op->backend->put_object))
+            (op->bucket, op->key, op->buf, op->byte_count,
+             op->has_attr ? &(op->attr) : NULL);
+        (*(op->put_callback))(rv, op->data);
+    }
+
+    free(op->bucket);
+    free(op->key);
+    free(op);
+    return NULL;
+}
+
+static int async_start(async_op *op, const char *bucket, const char *key) {
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    op->bucket = malloc(strlen(bucket) + 1);
+    op->key = malloc(strlen(key) + 1);
+    if (!op->bucket || !op->key) {
+        goto failed;
+    }
+    strcpy(op->bucket, bucket);
+    strcpy(op->key, key);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rv = pthread_create(&thread, &attr, &async_main, op);
+    pthread_attr_destroy(&attr);
+    if (rv == 0) {
+        return 0;
+    }
+
+ failed:
+    free(op->bucket);
+    free(op->key);
+    free(op);
+    return -1;
+}
+
+int s3fs_backend_get_object_async(const s3fs_backend *backend,
+                                  const char *bucket, const char *key,
+                                  ssize_t start_byte, ssize_t byte_count,
+                                  s3fs_get_callback *callback, void *data) {
+    async_op *op = calloc(1, sizeof(async_op));
+    if (!op) {
+        return -1;
+    }
+    op->backend = backend;
+    op->start_byte = start_byte;
+    op->byte_count = byte_count;
+    op->get_callback = callback;
+    op->data = data;
+    return async_start(op, bucket, key);
+}
+
+int s3fs_backend_put_object_async(const s3fs_backend *backend,
+                                  const char *bucket, const char *key,
+                                  const uint8_t *buf, ssize_t byte_count,
+                                  const struct stat *attr,
+                                  s3fs_put_callback *callback, void *data) {
+    async_op *op = calloc(1, sizeof(async_op));
+    if (!op) {
+        return -1;
+    }
+    op->backend = backend;
+    op->buf = buf;
+    op->byte_count = byte_count;
+    if (attr) {
+        op->attr = *attr;
+        op->has_attr = 1;
+    }
+    op->put_callback = callback;
+    op->data = data;
+    return async_start(op, bucket, key);
+}
@@ -0,0 +1,111 @@
+/*
+ * Storage backends for s3fs.  The file system reaches its objects only
+ * through an s3fs_backend, so that it can run against something other than
+ * s3: in memory, to measure the cost of the file system itself without any
+ * network, or in a local directory.
+ *
+ * The backend is chosen when mounting, from the S3FS_BACKEND environment
+ * variable:
+ *  - "s3" (the default) uses s3, through libs3_wrapper
+ *  - "memory" keeps objects in memory, for as long as the mount
+ *  - "dir:PATH" keeps objects in files under the directory PATH
+ */
+#ifndef __S3FS_BACKEND_H__
+#define __S3FS_BACKEND_H__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include "libs3_wrapper.h"
+
+/*
+ * Called when an asynchronous get finishes, with what the get would have
+ * returned and the object read (to be freed by the callback).
+ */
+typedef void s3fs_get_callback(ssize_t result, uint8_t *buf, void *data);
+
+/*
+ * Called when an asynchronous put finishes, with what the put would have
+ * returned.
+ */
+typedef void s3fs_put_callback(ssize_t result, void *data);
+
+/*
+ * The operations of a backend.  Each behaves as the libs3_wrapper function
+ * of the same name does, and returns the same values.
+ */
+typedef struct s3fs_backend {
+    const char *name;
+
+    /*
+     * Set up the backend, with what followed the ':' in S3FS_BACKEND (or
+     * NULL).  Returns 0 on success and -1 on failure.
+     */
+    int (*init)(const char *arg);
+
+    int (*test_bucket)(const char *bucket);
+    int (*clear_bucket)(const char *bucket);
+
+    /*
+     * A ranged get reads byte_count bytes from start_byte; if both are 0,
+     * the whole object is read.
+     */
+    ssize_t (*get_object)(const char *bucket, const char *key, uint8_t **buf,
+                          ssize_t start_byte, ssize_t byte_count);
+    /*
+     * attr may be NULL, to store the object without attributes.
+     */
+    ssize_t (*put_object)(const char *bucket, const char *key,
+                          const uint8_t *buf, ssize_t byte_count,
+                          const struct stat *attr);
+    int (*head_object)(const char *bucket, const char *key,
+                       struct stat *attr);
+    int (*list_objects)(const char *bucket, const char *prefix, int max_keys,
+                        s3fs_list_callback *callback, void *data);
+    int (*copy_object)(const char *bucket, const char *key,
+                       const char *newkey, const struct stat *attr);
+    int (*remove_object)(const char *bucket, const char *key);
+
+    /*
+     * Start a get or put and return without waiting for it; callback is
+     * called (on another thread) when it finishes.  bucket and key are
+     * copied, but buf must stay valid until the callback.  Returns 0 if the
+     * operation was started and -1 otherwise.
+     */
+    int (*get_object_async)(const struct s3fs_backend *backend,
+                            const char *bucket, const char *key,
+                            ssize_t start_byte, ssize_t byte_count,
+                            s3fs_get_callback *callback, void *data);
+    int (*put_object_async)(const struct s3fs_backend *backend,
+                            const char *bucket, const char *key,
+                            const uint8_t *buf, ssize_t byte_count,
+                            const struct stat *attr,
+                            s3fs_put_callback *callback, void *data);
+} s3fs_backend;
+
+extern const s3fs_backend s3fs_backend_s3;
+extern const s3fs_backend s3fs_backend_memory;
+extern const s3fs_backend s3fs_backend_dir;
+
+/*
+ * Choose and set up a backend as described above, given the value of
+ * S3FS_BACKEND (which may be NULL).  Returns NULL, after printing why to
+ * stderr, if there is no such backend or it couldn't be set up.
+ */
+const s3fs_backend *s3fs_backend_init(const char *spec);
+
+/*
+ * Asynchronous gets and puts for any backend, each run on a thread of its
+ * own.  These are what the backends here use for their async operations.
+ */
+int s3fs_backend_get_object_async(const s3fs_backend *backend,
+                                  const char *bucket, const char *key,
+                                  ssize_t start_byte, ssize_t byte_count,
+                                  s3fs_get_callback *callback, void *data);
+int s3fs_backend_put_object_async(const s3fs_backend *backend,
+                                  const char *bucket, const char *key,
+                                  const uint8_t *buf, ssize_t byte_count,
+                                  const struct stat *attr,
+                                  s3fs_put_callback *callback, void *data);
+
+#endif // __S3FS_BACKEND_H__
@@ -0,0 +1,414 @@
+/*
+ * The directory backend: each object is kept in a file, under a directory
+ * for its bucket, in the directory given as "dir:PATH".  Objects survive
+ * the mount, and can be looked at with ordinary tools.
+ *
+ * Keys are escaped into file names, so that the "/a" and "/a/b" that s3fs
+ * stores for a directory and a file in it can both be files.  Each file
+ * begins with a fixed size header holding the object's attributes, and is
+ * written whole to a temporary file that is then renamed into place, so
+ * that an object is never seen half written.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include "s3fs_backend.h"
+
+// Size of the header: "mode uid gid mtime\n", in decimal, padded with spaces
+#define DIR_HEADER_SIZE 64
+
+// Listings are of at most this many keys, as with s3
+#define DIR_MAX_KEYS 1000
+
+static char *root = NULL;
+
+// Escapes str into a file name: everything but letters, digits, '-' and
+// '_' becomes %XX.  Returns -1 if it doesn't fit.
+static int escape(const char *str, char *name, size_t size) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t len = 0;
+
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+            ((c >= '0') && (c <= '9')) || (c == '-') || (c == '_')) {
+            if (len + 1 >= size) {
+                return -1;
+            }
+            name[len++] = c;
+        }
+        else {
+            if (len + 3 >= size) {
+                return -1;
+            }
+            name[len++] = '%';
+            name[len++] = hex[c >> 4];
+            name[len++] = hex[c & 15];
+        }
+    }
+    name[len] = 0;
+    return 0;
+}
+
+static int unhex(char c) {
+    return ((c >= '0') && (c <= '9')) ? c - '0' :
+        ((c >= 'A') && (c <= 'F')) ? c - 'A' + 10 :
+        ((c >= 'a') && (c <= 'f')) ? c - 'a' + 10 : -1;
+}
+
+// Undoes escape(), in place.  Returns -1 if name isn't an escaped key.
+static int unescape(char *name) {
+    char *from = name, *to = name;
+    while (*from) {
+        if (*from == '%') {
+            int hi = unhex(from[1]), lo = (hi < 0) ? -1 : unhex(from[2]);
+            if (lo < 0) {
+                return -1;
+            }
+            *to++ = (char) ((hi << 4) | lo);
+            from += 3;
+        }
+        else {
+            *to++ = *from++;
+        }
+    }
+    *to = 0;
+    return 0;
+}
+
+static int bucket_path(const char *bucket, char *path, size_t size) {
+    char name[NAME_MAX + 1];
+    if (escape(bucket, name, sizeof(name)) < 0) {
+        return -1;
+    }
+    return (snprintf(path, size, "%s/%s", root, name) < (int) size) ? 0 : -1;
+}
+
+static int object_path(const char *bucket, const char *key, char *path,
+                       size_t size) {
+    char name[NAME_MAX + 1];
+    if ((bucket_path(bucket, path, size) < 0) ||
+        (escape(key, name, sizeof(name)) < 0)) {
+        return -1;
+    }
+    size_t len = strlen(path);
+    return (snprintf(path + len, size - len, "/%s", name) < (int) (size - len))
+        ? 0 : -1;
+}
+
+static int read_header(int fd, struct stat *attr) {
+    char header[DIR_HEADER_SIZE + 1];
+    unsigned int mode, uid, gid;
+    long long mtime;
+    struct stat st;
+
+    if ((pread(fd, header, DIR_HEADER_SIZE, 0) != DIR_HEADER_SIZE) ||
+        (fstat(fd, &st) < 0)) {
+        return -1;
+    }
+    header[DIR_HEADER_SIZE] = 0;
+    if (sscanf(header, "%u %u %u %lld", &mode, &uid, &gid, &mtime) != 4) {
+        return -1;
+    }
+
+    memset(attr, 0, sizeof(struct stat));
+    attr->st_mode = mode;
+    attr->st_uid = uid;
+    attr->st_gid = gid;
+    attr->st_mtime = mtime;
+    attr->st_size = st.st_size - DIR_HEADER_SIZE;
+    return 0;
+}
+
+static int dir_init(const char *arg) {
+    if (!arg || !arg[0]) {
+        fprintf(stderr, "The dir backend needs a directory (dir:PATH)\n");
+        return -1;
+    }
+    if ((mkdir(arg, 0755) < 0) && (errno != EEXIST)) {
+        fprintf(stderr, "Failed to create %s: %s\n", arg, strerror(errno));
+        return -1;
+    }
+    root = strdup(arg);
+    return root ? 0 : -1;
+}
+
+static int dir_test_bucket(const char *bucket) {
+    (void) bucket;
+    return 0;
+}
+
+static int dir_clear_bucket(const char *bucket) {
+    char path[PATH_MAX], file[PATH_MAX + NAME_MAX + 2];
+    struct dirent *ent;
+    int rv = 0;
+
+    if (bucket_path(bucket, path, sizeof(path)) < 0) {
+        return -1;
+    }
+    DIR *d = opendir(path);
+    if (!d) {
+        return (errno == ENOENT) ? 0 : -1;
+    }
+    while ((ent = readdir(d))) {
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+            continue;
+        }
+        snprintf(file, sizeof(file), "%s/%s", path, ent->d_name);
+        if (unlink(file) < 0) {
+            rv = -1;
+        }
+    }
+    closedir(d);
+    return rv;
+}
+
+static ssize_t dir_get_object(const char *bucket, const char *key,
+                              uint8_t **buf, ssize_t start_byte,
+                              ssize_t byte_count) {
+    char path[PATH_MAX];
+    struct stat attr;
+    ssize_t rv = -1;
+
+    *buf = NULL;
+    if (object_path(bucket, key, path, sizeof(path)) < 0) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (read_header(fd, &attr) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = attr.st_size, start = 0, count = size;
+    // a range beginning past the end is an error, as it is with s3
+    if (start_byte || byte_count) {
+        start = start_byte;
+        count = (start < size) ? size - start : 0;
+        if (byte_count && ((size_t) byte_count < count)) {
+            count = byte_count;
+        }
+    }
+    if ((start_byte || byte_count) && (start >= size)) {
+        rv = -1;
+    }
+    else if (!count) {
+        rv = 0;
+    }
+    else if ((*buf = malloc(count))) {
+        rv = pread(fd, *buf, count, DIR_HEADER_SIZE + start);
+        if (rv != (ssize_t) count) {
+            free(*buf);
+            *buf = NULL;
+            rv = -1;
+        }
+    }
+    close(fd);
+
+    return rv;
+}
+
+static int write_all(int fd, const void *buf, size_t count) {
+    const char *c = buf;
+    while (count) {
+        ssize_t rv = write(fd, c, count);
+        if (rv < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        c += rv;
+        count -= rv;
+    }
+    return 0;
+}
+
+static ssize_t dir_put_object(const char *bucket, const char *key,
+                              const uint8_t *buf, ssize_t byte_count,
+                              const struct stat *attr) {
+    char dir[PATH_MAX], path[PATH_MAX], temp[PATH_MAX + 16];
+    char header[DIR_HEADER_SIZE + 1];
+
+    if ((bucket_path(bucket, dir, sizeof(dir)) < 0) ||
+        (object_path(bucket, key, path, sizeof(path)) < 0)) {
+        return -1;
+    }
+    if ((mkdir(dir, 0755) < 0) && (errno != EEXIST)) {
+        return -1;
+    }
+
+    // Without attributes, the mode is 0 and the time is now, as with s3
+    memset(header, ' ', DIR_HEADER_SIZE);
+    int len = snprintf(header, sizeof(header), "%u %u %u %lld",
+                       attr ? (unsigned) attr->st_mode : 0,
+                       attr ? (unsigned) attr->st_uid : 0,
+                       attr ? (unsigned) attr->st_gid : 0,
+                       attr ? (long long) attr->st_mtime :
+                       (long long) time(NULL));
+    header[len] = ' ';
+    header[DIR_HEADER_SIZE - 1] = '\n';
+
+    // temporary files begin with '.', which escaped keys never do
+    snprintf(temp, sizeof(temp), "%s/.tmpXXXXXX", dir);
+    int fd = mkstemp(temp);
+    if (fd < 0) {
+        return -1;
+    }
+    if ((write_all(fd, header, DIR_HEADER_SIZE) < 0) ||
+        (write_all(fd, buf, byte_count) < 0) || (close(fd) < 0) ||
+        (rename(temp, path) < 0)) {
+        unlink(temp);
+        return -1;
+    }
+
+    return byte_count;
+}
+
+static int dir_head_object(const char *bucket, const char *key,
+                           struct stat *attr) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (object_path(bucket, key, path, sizeof(path)) < 0) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    int rv = read_header(fd, attr ? attr : &st);
+    close(fd);
+    return rv;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static int dir_list_objects(const char *bucket, const char *prefix,
+                            int max_keys, s3fs_list_callback *callback,
+                            void *data) {
+    char path[PATH_MAX];
+    char **keys = NULL;
+    int count = 0, size = 0, i, rv = 0;
+    size_t prefix_len = prefix ? strlen(prefix) : 0;
+    struct dirent *ent;
+
+    if (bucket_path(bucket, path, sizeof(path)) < 0) {
+        return -1;
+    }
+    DIR *d = opendir(path);
+    if (!d) {
+        // a bucket nothing has been put in is empty
+        return (errno == ENOENT) ? 0 : -1;
+    }
+    while ((ent = readdir(d))) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        char *key = strdup(ent->d_name);
+        if (!key) {
+            rv = -1;
+            break;
+        }
+        if ((unescape(key) < 0) ||
+            strncmp(key, prefix ? prefix : "", prefix_len)) {
+            free(key);
+            continue;
+        }
+        if (count == size) {
+            size = size ? size * 2 : 64;
+            char **more = realloc(keys, size * sizeof(char *));
+            if (!more) {
+                free(key);
+                rv = -1;
+                break;
+            }
+            keys = more;
+        }
+        keys[count++] = key;
+    }
+    closedir(d);
+
+    if ((max_keys <= 0) || (max_keys > DIR_MAX_KEYS)) {
+        max_keys = DIR_MAX_KEYS;
+    }
+    if (!rv) {
+        if (count) {
+            qsort(keys, count, sizeof(char *), &compare_keys);
+        }
+        rv = (count < max_keys) ? count : max_keys;
+        for (i = 0; callback && (i < rv); i++) {
+            (*callback)(keys[i], data);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+
+    return rv;
+}
+
+static int dir_copy_object(const char *bucket, const char *key,
+                           const char *newkey, const struct stat *attr) {
+    struct stat oldattr;
+    uint8_t *buf = NULL;
+
+    if (dir_head_object(bucket, key, &oldattr) < 0) {
+        return -1;
+    }
+    ssize_t size = dir_get_object(bucket, key, &buf, 0, 0);
+    if (size < 0) {
+        return -1;
+    }
+
+    // Without new attributes, the copy keeps the original's
+    ssize_t rv = dir_put_object(bucket, newkey, buf, size,
+                                attr ? attr : &oldattr);
+    free(buf);
+
+    return (rv < 0) ? -1 : 0;
+}
+
+static int dir_remove_object(const char *bucket, const char *key) {
+    char path[PATH_MAX];
+
+    if (object_path(bucket, key, path, sizeof(path)) < 0) {
+        return -1;
+    }
+    // As with s3, removing an object that isn't there succeeds
+    if ((unlink(path) < 0) && (errno != ENOENT)) {
+        return -1;
+    }
+    return 0;
+}
+
+const s3fs_backend s3fs_backend_dir = {
+    "dir",
+    &dir_init,
+    &dir_test_bucket,
+    &dir_clear_bucket,
+    &dir_get_object,
+    &dir_put_object,
+    &dir_head_object,
+    &dir_list_objects,
+    &dir_copy_object,
+    &dir_remove_object,
+    &s3fs_backend_get_object_async,
+    &s3fs_backend_put_object_async
+};
@@ -0,0 +1,365 @@
+/*
+ * The memory backend: objects are kept in a hash table in memory, for as
+ * long as the mount.  There is no network and no copying beyond what the
+ * interface needs, so what's left is the cost of the file system itself.
+ *
+ * The table never grows, and its chains are locked in stripes, so that
+ * operations on different objects rarely wait for each other (as they
+ * would for libs3_wrapper's single lock).
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "s3fs_backend.h"
+
+#define MEMORY_CHAINS 65536
+#define MEMORY_STRIPES 64
+
+// Listings are of at most this many keys, as with s3
+#define MEMORY_MAX_KEYS 1000
+
+typedef struct mem_object {
+    char *bucket, *key;
+    uint8_t *data;
+    size_t size;
+    // st_size is the size; for an object stored without attributes,
+    // st_mode is 0 and st_mtime is when it was written
+    struct stat attr;
+    struct mem_object *next;
+} mem_object;
+
+static mem_object *chains[MEMORY_CHAINS];
+static pthread_rwlock_t stripes[MEMORY_STRIPES];
+
+static unsigned int hash(const char *bucket, const char *key) {
+    // FNV-1a, over the bucket and then the key
+    unsigned int h = 2166136261u;
+    const unsigned char *c;
+    for (c = (const unsigned char *) bucket; *c; c++) {
+        h = (h ^ *c) * 16777619u;
+    }
+    h = (h ^ '/') * 16777619u;
+    for (c = (const unsigned char *) key; *c; c++) {
+        h = (h ^ *c) * 16777619u;
+    }
+    return h % MEMORY_CHAINS;
+}
+
+static pthread_rwlock_t *stripe(unsigned int chain) {
+    return &(stripes[chain % MEMORY_STRIPES]);
+}
+
+// Returns the link to the object in its chain, which points to NULL if
+// there is no such object.  The chain's stripe must be locked.
+static mem_object **find(unsigned int chain, const char *bucket,
+                         const char *key) {
+    mem_object **link = &(chains[chain]);
+    while (*link && (strcmp((*link)->key, key) ||
+                     strcmp((*link)->bucket, bucket))) {
+        link = &((*link)->next);
+    }
+    return link;
+}
+
+static void free_object(mem_object *obj) {
+    free(obj->bucket);
+    free(obj->key);
+    free(obj->data);
+    free(obj);
+}
+
+static int memory_init(const char *arg) {
+    (void) arg;
+    int i;
+    for (i = 0; i < MEMORY_STRIPES; i++) {
+        if (pthread_rwlock_init(&(stripes[i]), NULL)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int memory_test_bucket(const char *bucket) {
+    (void) bucket;
+    return 0;
+}
+
+static int memory_clear_bucket(const char *bucket) {
+    unsigned int chain;
+    for (chain = 0; chain < MEMORY_CHAINS; chain++) {
+        pthread_rwlock_wrlock(stripe(chain));
+        mem_object **link = &(chains[chain]);
+        while (*link) {
+            mem_object *obj = *link;
+            if (!strcmp(obj->bucket, bucket)) {
+                *link = obj->next;
+                free_object(obj);
+            }
+            else {
+                link = &(obj->next);
+            }
+        }
+        pthread_rwlock_unlock(stripe(chain));
+    }
+    return 0;
+}
+
+static ssize_t memory_get_object(const char *bucket, const char *key,
+                                 uint8_t **buf, ssize_t start_byte,
+                                 ssize_t byte_count) {
+    unsigned int chain = hash(bucket, key);
+    ssize_t rv = -1;
+
+    *buf = NULL;
+    pthread_rwlock_rdlock(stripe(chain));
+    mem_object *obj = *find(chain, bucket, key);
+    if (obj) {
+        size_t start = 0, count = obj->size;
+        // a range beginning past the end is an error, as it is with s3
+        if (start_byte || byte_count) {
+            start = start_byte;
+            count = (start < obj->size) ? obj->size - start : 0;
+            if (byte_count && ((size_t) byte_count < count)) {
+                count = byte_count;
+            }
+        }
+        if ((start_byte || byte_count) && (start >= obj->size)) {
+            rv = -1;
+        }
+        else if (!count) {
+            rv = 0;
+        }
+        else if ((*buf = malloc(count))) {
+            memcpy(*buf, obj->data + start, count);
+            rv = count;
+        }
+    }
+    pthread_rwlock_unlock(stripe(chain));
+
+    return rv;
+}
+
+// Stores obj, which is then the table's, in place of any object with its
+// name
+static void store(mem_object *obj) {
+    unsigned int chain = hash(obj->bucket, obj->key);
+
+    pthread_rwlock_wrlock(stripe(chain));
+    mem_object **link = find(chain, obj->bucket, obj->key);
+    mem_object *old = *link;
+    obj->next = old ? old->next : chains[chain];
+    if (old) {
+        *link = obj;
+    }
+    else {
+        chains[chain] = obj;
+    }
+    pthread_rwlock_unlock(stripe(chain));
+
+    if (old) {
+        free_object(old);
+    }
+}
+
+static mem_object *new_object(const char *bucket, const char *key,
+                              uint8_t *data, size_t size,
+                              const struct stat *attr) {
+    mem_object *obj = calloc(1, sizeof(mem_object));
+    if (!obj) {
+        return NULL;
+    }
+    obj->bucket = strdup(bucket);
+    obj->key = strdup(key);
+    if (!obj->bucket || !obj->key) {
+        free_object(obj);
+        return NULL;
+    }
+    obj->data = data;
+    obj->size = size;
+    if (attr) {
+        obj->attr.st_mode = attr->st_mode;
+        obj->attr.st_uid = attr->st_uid;
+        obj->attr.st_gid = attr->st_gid;
+        obj->attr.st_mtime = attr->st_mtime;
+    }
+    else {
+        obj->attr.st_mtime = time(NULL);
+    }
+    obj->attr.st_size = size;
+    return obj;
+}
+
+static ssize_t memory_put_object(const char *bucket, const char *key,
+                                 const uint8_t *buf, ssize_t byte_count,
+                                 const struct stat *attr) {
+    uint8_t *data = NULL;
+    if (byte_count > 0) {
+        if (!(data = malloc(byte_count))) {
+            return -1;
+        }
+        memcpy(data, buf, byte_count);
+    }
+
+    mem_object *obj = new_object(bucket, key, data, byte_count, attr);
+    if (!obj) {
+        free(data);
+        return -1;
+    }
+    store(obj);
+
+    return byte_count;
+}
+
+static int memory_head_object(const char *bucket, const char *key,
+                              struct stat *attr) {
+    unsigned int chain = hash(bucket, key);
+
+    pthread_rwlock_rdlock(stripe(chain));
+    mem_object *obj = *find(chain, bucket, key);
+    if (obj && attr) {
+        *attr = obj->attr;
+    }
+    pthread_rwlock_unlock(stripe(chain));
+
+    return obj ? 0 : -1;
+}
+
+typedef struct listing {
+    char **keys;
+    int count, size;
+} listing;
+
+static int compare_keys(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static int memory_list_objects(const char *bucket, const char *prefix,
+                               int max_keys, s3fs_list_callback *callback,
+                               void *data) {
+    listing l = { NULL, 0, 0 };
+    size_t prefix_len = prefix ? strlen(prefix) : 0;
+    unsigned int chain;
+    int i, rv = 0;
+
+    for (chain = 0; (chain < MEMORY_CHAINS) && !rv; chain++) {
+        pthread_rwlock_rdlock(stripe(chain));
+        mem_object *obj;
+        for (obj = chains[chain]; obj; obj = obj->next) {
+            if (strcmp(obj->bucket, bucket) ||
+                strncmp(obj->key, prefix ? prefix : "", prefix_len)) {
+                continue;
+            }
+            if (l.count == l.size) {
+                l.size = l.size ? l.size * 2 : 64;
+                char **keys = realloc(l.keys, l.size * sizeof(char *));
+                if (!keys) {
+                    rv = -1;
+                    break;
+                }
+                l.keys = keys;
+            }
+            if (!(l.keys[l.count] = strdup(obj->key))) {
+                rv = -1;
+                break;
+            }
+            l.count++;
+        }
+        pthread_rwlock_unlock(stripe(chain));
+    }
+
+    if ((max_keys <= 0) || (max_keys > MEMORY_MAX_KEYS)) {
+        max_keys = MEMORY_MAX_KEYS;
+    }
+    if (!rv) {
+        if (l.count) {
+            qsort(l.keys, l.count, sizeof(char *), &compare_keys);
+        }
+        rv = (l.count < max_keys) ? l.count : max_keys;
+        for (i = 0; callback && (i < rv); i++) {
+            (*callback)(l.keys[i], data);
+        }
+    }
+
+    for (i = 0; i < l.count; i++) {
+        free(l.keys[i]);
+    }
+    free(l.keys);
+
+    return rv;
+}
+
+static int memory_copy_object(const char *bucket, const char *key,
+                              const char *newkey, const struct stat *attr) {
+    unsigned int chain = hash(bucket, key);
+    uint8_t *data = NULL;
+    struct stat oldattr;
+    size_t size = 0;
+    int found = 0, rv = 0;
+
+    pthread_rwlock_rdlock(stripe(chain));
+    mem_object *obj = *find(chain, bucket, key);
+    if (obj) {
+        found = 1;
+        size = obj->size;
+        oldattr = obj->attr;
+        if (size && (data = malloc(size))) {
+            memcpy(data, obj->data, size);
+        }
+        else if (size) {
+            rv = -1;
+        }
+    }
+    pthread_rwlock_unlock(stripe(chain));
+
+    if (!found || rv) {
+        return -1;
+    }
+
+    // Without new attributes, the copy keeps the original's (and so its
+    // time of writing, if it has no attributes)
+    mem_object *copy = new_object(bucket, newkey, data, size,
+                                  attr ? attr : &oldattr);
+    if (!copy) {
+        free(data);
+        return -1;
+    }
+    store(copy);
+
+    return 0;
+}
+
+static int memory_remove_object(const char *bucket, const char *key) {
+    unsigned int chain = hash(bucket, key);
+
+    pthread_rwlock_wrlock(stripe(chain));
+    mem_object **link = find(chain, bucket, key);
+    mem_object *obj = *link;
+    if (obj) {
+        *link = obj->next;
+    }
+    pthread_rwlock_unlock(stripe(chain));
+
+    // As with s3, removing an object that isn't there succeeds
+    if (obj) {
+        free_object(obj);
+    }
+    return 0;
+}
+
+const s3fs_backend s3fs_backend_memory = {
+    "memory",
+    &memory_init,
+    &memory_test_bucket,
+    &memory_clear_bucket,
+    &memory_get_object,
+    &memory_put_object,
+    &memory_head_object,
+    &memory_list_objects,
+    &memory_copy_object,
+    &memory_remove_object,
+    &s3fs_backend_get_object_async,
+    &s3fs_backend_put_object_async
+};
@@ -0,0 +1,498 @@
+/*
+ * Workload benchmark for a mounted s3fs.  Everything is done with ordinary
+ * system calls on the mount, so it measures the whole path: the kernel,
+ * FUSE, s3fs and the requests it makes.
+ *
+ * The phases are:
+ *  - metadata storms in directories of each size given: create, stat,
+ *    readdir, unlink, mkdir and rmdir of that many entries
+ *  - sequential and random writes and reads of a file, with each block
+ *    size given
+ *  - extracting a tar file, if one is given
+ *
+ * The ops/s and latency percentiles of each phase are printed as CSV.  Use
+ * s3fs_bench.sh to mount s3fs on libs3's s3server and run this against it.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_LIST 32
+
+typedef struct latencies {
+    double *values;       // seconds
+    size_t count, size;
+} latencies;
+
+typedef struct phase {
+    const char *name;
+    size_t dir_size;
+    size_t block_size;
+    latencies lat;
+    unsigned long long errors;
+    unsigned long long bytes;
+    double start;
+} phase;
+
+// Seconds a phase may run for before it stops starting operations
+static double phase_limit = 60;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// phases --------------------------------------------------------------------
+
+static void phase_begin(phase *p, const char *name, size_t dir_size,
+                        size_t block_size) {
+    memset(p, 0, sizeof(*p));
+    p->name = name;
+    p->dir_size = dir_size;
+    p->block_size = block_size;
+    p->start = now();
+}
+
+static int phase_expired(const phase *p) {
+    return (phase_limit > 0) && (now() - p->start >= phase_limit);
+}
+
+static void phase_add(phase *p, double start, int ok, size_t bytes) {
+    if (!ok) {
+        p->errors++;
+        return;
+    }
+    latencies *lat = &p->lat;
+    if (lat->count == lat->size) {
+        lat->size = lat->size ? lat->size * 2 : 1024;
+        lat->values = realloc(lat->values, lat->size * sizeof(double));
+        if (!lat->values) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+    }
+    lat->values[lat->count++] = now() - start;
+    p->bytes += bytes;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values, in milliseconds
+static double percentile(const latencies *lat, double q) {
+    if (!lat->count) {
+        return 0;
+    }
+    size_t rank = (size_t) (q * lat->count);
+    if (rank < q * lat->count) {
+        rank++;
+    }
+    if (rank < 1) {
+        rank = 1;
+    }
+    return lat->values[rank - 1] * 1000;
+}
+
+static void phase_end(phase *p) {
+    double seconds = now() - p->start;
+    latencies *lat = &p->lat;
+
+    qsort(lat->values, lat->count, sizeof(double), &compare_doubles);
+    printf("%s,%llu,%llu,%llu,%llu,%.3f,%.1f,%.3f,%.3f,%.3f,%.3f\n",
+           p->name, (unsigned long long) p->dir_size,
+           (unsigned long long) p->block_size, (unsigned long long) lat->count,
+           p->errors, seconds, lat->count / seconds,
+           p->bytes / seconds / (1024 * 1024), percentile(lat, 0.50),
+           percentile(lat, 0.99), percentile(lat, 1.0));
+    fflush(stdout);
+    free(lat->values);
+}
+
+// metadata ------------------------------------------------------------------
+
+static void run_metadata(const char *root, size_t n) {
+    char dir[4096], path[4096 + 32];
+    phase p;
+    size_t i, created;
+    double start;
+
+    snprintf(dir, sizeof(dir), "%s/dir%llu", root, (unsigned long long) n);
+    if (mkdir(dir, 0755) < 0) {
+        fprintf(stderr, "mkdir %s: %s\n", dir, strerror(errno));
+        return;
+    }
+
+    phase_begin(&p, "create", n, 0);
+    for (i = 0; (i < n) && !phase_expired(&p); i++) {
+        snprintf(path, sizeof(path), "%s/f%llu", dir, (unsigned long long) i);
+        start = now();
+        int fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (fd >= 0) {
+            close(fd);
+        }
+        phase_add(&p, start, fd >= 0, 0);
+    }
+    // the later phases only go as far as this one got
+    created = i;
+    phase_end(&p);
+
+    phase_begin(&p, "stat", n, 0);
+    for (i = 0; (i < created) && !phase_expired(&p); i++) {
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/f%llu", dir, (unsigned long long) i);
+        start = now();
+        phase_add(&p, start, stat(path, &st) == 0, 0);
+    }
+    phase_end(&p);
+
+    // each operation is a listing of the whole directory
+    phase_begin(&p, "readdir", n, 0);
+    for (i = 0; (i < 10) && !phase_expired(&p); i++) {
+        start = now();
+        DIR *d = opendir(dir);
+        if (d) {
+            while (readdir(d)) {
+            }
+            closedir(d);
+        }
+        phase_add(&p, start, d != NULL, 0);
+    }
+    phase_end(&p);
+
+    phase_begin(&p, "unlink", n, 0);
+    for (i = 0; i < created; i++) {
+        snprintf(path, sizeof(path), "%s/f%llu", dir, (unsigned long long) i);
+        start = now();
+        phase_add(&p, start, unlink(path) == 0, 0);
+    }
+    phase_end(&p);
+
+    phase_begin(&p, "mkdir", n, 0);
+    for (i = 0; (i < n) && !phase_expired(&p); i++) {
+        snprintf(path, sizeof(path), "%s/d%llu", dir, (unsigned long long) i);
+        start = now();
+        phase_add(&p, start, mkdir(path, 0755) == 0, 0);
+    }
+    created = i;
+    phase_end(&p);
+
+    phase_begin(&p, "rmdir", n, 0);
+    for (i = 0; i < created; i++) {
+        snprintf(path, sizeof(path), "%s/d%llu", dir, (unsigned long long) i);
+        start = now();
+        phase_add(&p, start, rmdir(path) == 0, 0);
+    }
+    phase_end(&p);
+
+    rmdir(dir);
+}
+
+// data ----------------------------------------------------------------------
+
+static void run_data(const char *root, size_t file_size, size_t block_size) {
+    char path[4096];
+    phase p;
+    size_t blocks = file_size / block_size, i;
+    double start;
+    int fd;
+
+    char *buf = malloc(block_size);
+    if (!buf || !blocks) {
+        fprintf(stderr, "Block size %llu doesn't fit the file size\n",
+                (unsigned long long) block_size);
+        free(buf);
+        return;
+    }
+    memset(buf, 'x', block_size);
+    snprintf(path, sizeof(path), "%s/data%llu", root,
+             (unsigned long long) block_size);
+
+    // The close is counted as an operation, since that's when s3fs may be
+    // writing the file out
+    phase_begin(&p, "seqwrite", 0, block_size);
+    start = now();
+    fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    phase_add(&p, start, fd >= 0, 0);
+    if (fd >= 0) {
+        for (i = 0; (i < blocks) && !phase_expired(&p); i++) {
+            start = now();
+            ssize_t rv = write(fd, buf, block_size);
+            phase_add(&p, start, rv == (ssize_t) block_size, block_size);
+        }
+        start = now();
+        phase_add(&p, start, close(fd) == 0, 0);
+    }
+    phase_end(&p);
+
+    phase_begin(&p, "seqread", 0, block_size);
+    fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        for (i = 0; (i < blocks) && !phase_expired(&p); i++) {
+            start = now();
+            ssize_t rv = read(fd, buf, block_size);
+            phase_add(&p, start, rv == (ssize_t) block_size, block_size);
+        }
+        close(fd);
+    }
+    else {
+        p.errors++;
+    }
+    phase_end(&p);
+
+    phase_begin(&p, "randread", 0, block_size);
+    fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        for (i = 0; (i < blocks) && !phase_expired(&p); i++) {
+            off_t offset = (off_t) (rand() % blocks) * block_size;
+            start = now();
+            ssize_t rv = pread(fd, buf, block_size, offset);
+            phase_add(&p, start, rv == (ssize_t) block_size, block_size);
+        }
+        close(fd);
+    }
+    else {
+        p.errors++;
+    }
+    phase_end(&p);
+
+    phase_begin(&p, "randwrite", 0, block_size);
+    fd = open(path, O_WRONLY);
+    if (fd >= 0) {
+        for (i = 0; (i < blocks) && !phase_expired(&p); i++) {
+            off_t offset = (off_t) (rand() % blocks) * block_size;
+            start = now();
+            ssize_t rv = pwrite(fd, buf, block_size, offset);
+            phase_add(&p, start, rv == (ssize_t) block_size, block_size);
+        }
+        start = now();
+        phase_add(&p, start, close(fd) == 0, 0);
+    }
+    else {
+        p.errors++;
+    }
+    phase_end(&p);
+
+    unlink(path);
+    free(buf);
+}
+
+// tar -----------------------------------------------------------------------
+
+// Counts the entries under path, not counting path itself
+static size_t count_entries(const char *path) {
+    char child[4096];
+    size_t count = 0;
+    struct dirent *ent;
+    DIR *d = opendir(path);
+
+    if (!d) {
+        return 0;
+    }
+    while ((ent = readdir(d))) {
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+            continue;
+        }
+        count++;
+        if (ent->d_type == DT_DIR) {
+            snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+            count += count_entries(child);
+        }
+    }
+    closedir(d);
+    return count;
+}
+
+// Extracting is timed as a whole, so the percentiles are all the total time,
+// and ops/s is of the entries extracted
+static void run_tar(const char *root, const char *tarfile) {
+    char dir[4096];
+
+    snprintf(dir, sizeof(dir), "%s/tar", root);
+    if (mkdir(dir, 0755) < 0) {
+        fprintf(stderr, "mkdir %s: %s\n", dir, strerror(errno));
+        return;
+    }
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        execlp("tar", "tar", "xf", tarfile, "-C", dir, (char *) NULL);
+        _exit(127);
+    }
+    int status = -1;
+    if (pid > 0) {
+        waitpid(pid, &status, 0);
+    }
+    double seconds = now() - start;
+    int failed = !WIFEXITED(status) || WEXITSTATUS(status);
+
+    size_t entries = count_entries(dir);
+    printf("tar,0,0,%llu,%d,%.3f,%.1f,0.000,%.3f,%.3f,%.3f\n",
+           (unsigned long long) entries, failed, seconds, entries / seconds,
+           seconds * 1000, seconds * 1000, seconds * 1000);
+    fflush(stdout);
+
+    pid = fork();
+    if (pid == 0) {
+        execlp("rm", "rm", "-rf", dir, (char *) NULL);
+        _exit(127);
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+// main ----------------------------------------------------------------------
+
+// Parses a size such as 512, 4k, 16m or 1g (powers of 1024)
+static int parse_size(const char *str, size_t *size) {
+    char *end;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (end == str) {
+        return -1;
+    }
+    switch (*end) {
+    case 'k': case 'K':
+        value <<= 10;
+        end++;
+        break;
+    case 'm': case 'M':
+        value <<= 20;
+        end++;
+        break;
+    case 'g': case 'G':
+        value <<= 30;
+        end++;
+        break;
+    }
+    if (*end) {
+        return -1;
+    }
+    *size = (size_t) value;
+    return 0;
+}
+
+// Parses a comma separated list of sizes; returns how many, or -1
+static int parse_sizes(char *str, size_t *sizes, int max) {
+    int count = 0;
+    char *save, *tok;
+    for (tok = strtok_r(str, ",", &save); tok; tok = strtok_r(0, ",", &save)) {
+        if ((count == max) || (parse_size(tok, &(sizes[count])) < 0) ||
+            !sizes[count]) {
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+"Usage: %s [options] DIRECTORY\n"
+"\n"
+"Runs the benchmark in DIRECTORY, which should be on a mounted s3fs, and\n"
+"prints a CSV row for each phase.  Latencies are in milliseconds.\n"
+"\n"
+"  -n sizes     directory sizes for the metadata storms, comma separated\n"
+"               (default 10,100,1000,10000,100000)\n"
+"  -f size      size of the file read and written, with an optional k, m\n"
+"               or g suffix (default 16m)\n"
+"  -b sizes     block sizes for reads and writes, comma separated\n"
+"               (default 4k,64k,1m)\n"
+"  -t tarfile   also time extracting tarfile\n"
+"  -T seconds   stop starting operations in a phase after this long, or 0\n"
+"               for no limit (default 60)\n"
+"  -M           skip the metadata storms\n"
+"  -D           skip the reads and writes\n", program);
+}
+
+int main(int argc, char **argv) {
+    static char default_dir_sizes[] = "10,100,1000,10000,100000";
+    static char default_block_sizes[] = "4k,64k,1m";
+    char *dir_size_list = default_dir_sizes;
+    char *block_size_list = default_block_sizes;
+    const char *tarfile = NULL;
+    size_t file_size = 16 * 1024 * 1024;
+    int metadata = 1, data = 1, c, i;
+
+    while ((c = getopt(argc, argv, "n:f:b:t:T:MDh")) != -1) {
+        switch (c) {
+        case 'n':
+            dir_size_list = optarg;
+            break;
+        case 'f':
+            if (parse_size(optarg, &file_size) < 0) {
+                fprintf(stderr, "Bad file size: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'b':
+            block_size_list = optarg;
+            break;
+        case 't':
+            tarfile = optarg;
+            break;
+        case 'T':
+            phase_limit = atof(optarg);
+            break;
+        case 'M':
+            metadata = 0;
+            break;
+        case 'D':
+            data = 0;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return -1;
+    }
+    const char *root = argv[optind];
+
+    size_t dir_sizes[MAX_LIST], block_sizes[MAX_LIST];
+    int dir_size_count = parse_sizes(dir_size_list, dir_sizes, MAX_LIST);
+    if (dir_size_count <= 0) {
+        fprintf(stderr, "Bad directory sizes: %s\n", dir_size_list);
+        return -1;
+    }
+    int block_size_count = parse_sizes(block_size_list, block_sizes,
+                                       MAX_LIST);
+    if (block_size_count <= 0) {
+        fprintf(stderr, "Bad block sizes: %s\n", block_size_list);
+        return -1;
+    }
+
+    printf("phase,dir_size,block_size,ops,errors,seconds,ops_per_sec,"
+           "mib_per_sec,p50_ms,p99_ms,max_ms\n");
+
+    if (metadata) {
+        for (i = 0; i < dir_size_count; i++) {
+            run_metadata(root, dir_sizes[i]);
+        }
+    }
+    if (data) {
+        for (i = 0; i < block_size_count; i++) {
+            run_data(root, file_size, block_sizes[i]);
+        }
+    }
+    if (tarfile) {
+        run_tar(root, tarfile);
+    }
+
+    return 0;
+}
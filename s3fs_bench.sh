@@ -0,0 +1,55 @@
+#!/bin/sh
+
+# Runs s3fs_bench against s3fs mounted on libs3's s3server stand-in, so
+# that nothing goes to S3.  Arguments are passed on to s3fs_bench (run
+# "./s3fs_bench -h" for them); its CSV goes to stdout.
+#
+# Build first with "make bench" here and "make s3server" in libs3-2.0.
+#
+# Environment:
+# S3SERVER - may be set to the s3server command to use (i.e. with -l to add
+#            latency, or -f to inject faults); defaults to
+#            "libs3-2.0/build/bin/s3server"
+# S3SERVER_PORT - may be set to the port for s3server; defaults to 8080
+# BENCH_MOUNT - may be set to the directory to mount s3fs on; defaults to a
+#               new temporary directory
+
+if [ -z "$S3SERVER" ]; then
+    S3SERVER=libs3-2.0/build/bin/s3server
+fi
+
+if [ -z "$S3SERVER_PORT" ]; then
+    S3SERVER_PORT=8080
+fi
+
+if [ -z "$BENCH_MOUNT" ]; then
+    BENCH_MOUNT=`mktemp -d`
+fi
+
+# s3server doesn't check signatures, so any credentials do
+S3_ACCESS_KEY_ID=${S3_ACCESS_KEY_ID:-bench}
+S3_SECRET_ACCESS_KEY=${S3_SECRET_ACCESS_KEY:-bench}
+S3_BUCKET=s3fs-bench
+S3_HOSTNAME=127.0.0.1:$S3SERVER_PORT
+S3_UNENCRYPTED=1
+export S3_ACCESS_KEY_ID S3_SECRET_ACCESS_KEY S3_BUCKET S3_HOSTNAME \
+    S3_UNENCRYPTED
+
+$S3SERVER -p $S3SERVER_PORT -b $S3_BUCKET &
+S3SERVER_PID=$!
+sleep 1
+
+# s3fs goes into the background once it has mounted
+if ! ./s3fs $BENCH_MOUNT 2> s3fs_bench.log; then
+    echo "Failed to mount s3fs; see s3fs_bench.log"
+    kill $S3SERVER_PID
+    exit -1
+fi
+
+./s3fs_bench "$@" $BENCH_MOUNT
+STATUS=$?
+
+fusermount -u $BENCH_MOUNT
+kill $S3SERVER_PID
+
+exit $STATUS
@@ -0,0 +1,89 @@
+/*
+ * The table of directory locks; see s3fs_dirlock.h.
+ */
+
+#include "s3fs_dirlock.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A power of two, big enough that directories in use at once rarely share
+#define DIRLOCK_STRIPES 256
+
+static pthread_mutex_t stripes[DIRLOCK_STRIPES] = {
+    [0 ... DIRLOCK_STRIPES - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+
+// FNV-1a of the first len bytes of path
+static pthread_mutex_t *stripe_of(const char *path, size_t len) {
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    // "/" and "" are both the root
+    if ((len == 1) && (path[0] == '/')) {
+        len = 0;
+    }
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char) path[i]) * 16777619u;
+    }
+    return &(stripes[hash & (DIRLOCK_STRIPES - 1)]);
+}
+
+// The length of the directory part of path: up to its last /
+static size_t parent_len(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? (size_t) (slash - path) : 0;
+}
+
+static void add(s3fs_dirlock *lock, pthread_mutex_t *mutex) {
+    int i;
+    for (i = 0; i < lock->count; i++) {
+        if (lock->locks[i] == mutex) {
+            return;
+        }
+    }
+    lock->locks[lock->count++] = mutex;
+}
+
+static int compare_locks(const void *a, const void *b) {
+    pthread_mutex_t *x = *(pthread_mutex_t * const *) a;
+    pthread_mutex_t *y = *(pthread_mutex_t * const *) b;
+    return (x < y) ? -1 : (x > y);
+}
+
+// Takes the locks added to lock, in address order
+static void take(s3fs_dirlock *lock) {
+    int i;
+
+    qsort(lock->locks, lock->count, sizeof(pthread_mutex_t *),
+          &compare_locks);
+    for (i = 0; i < lock->count; i++) {
+        pthread_mutex_lock(lock->locks[i]);
+    }
+}
+
+void s3fs_lock_parents(s3fs_dirlock *lock, const char *path,
+                       const char *newpath) {
+    lock->count = 0;
+    add(lock, stripe_of(path, parent_len(path)));
+    if (newpath) {
+        add(lock, stripe_of(newpath, parent_len(newpath)));
+    }
+    take(lock);
+}
+
+void s3fs_lock_dir(s3fs_dirlock *lock, const char *path) {
+    lock->count = 0;
+    add(lock, stripe_of(path, parent_len(path)));
+    add(lock, stripe_of(path, strlen(path)));
+    take(lock);
+}
+
+void s3fs_unlock_dirs(s3fs_dirlock *lock) {
+    int i;
+    for (i = lock->count - 1; i >= 0; i--) {
+        pthread_mutex_unlock(lock->locks[i]);
+    }
+    lock->count = 0;
+}
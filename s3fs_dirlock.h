@@ -0,0 +1,43 @@
+/*
+ * Locks on directories, so that FUSE can run s3fs's operations in many
+ * threads at once.
+ *
+ * A directory's entries are kept in a single object, which every operation
+ * that adds, removes or changes an entry reads, changes and writes back;
+ * two such operations on one directory at once would lose one's change.
+ * So each of them locks the directory it changes, and they run one at a
+ * time per directory.  Operations that only read need no lock.
+ *
+ * Directories are hashed to a fixed table of locks, so two directories
+ * may share a lock, but each lock is held only for one operation.
+ */
+#ifndef __S3FS_DIRLOCK_H__
+#define __S3FS_DIRLOCK_H__
+
+#include <pthread.h>
+
+typedef struct s3fs_dirlock {
+    pthread_mutex_t *locks[2];  // in the order they were taken
+    int count;
+} s3fs_dirlock;
+
+/*
+ * Lock the directory path is in, and also that newpath is in if newpath
+ * isn't NULL (for a rename).  Locks are taken in a fixed order, so any two
+ * operations can do this without deadlock.
+ */
+void s3fs_lock_parents(s3fs_dirlock *lock, const char *path,
+                       const char *newpath);
+
+/*
+ * Lock the directory path and the directory it is in, for making or
+ * removing the directory.
+ */
+void s3fs_lock_dir(s3fs_dirlock *lock, const char *path);
+
+/*
+ * Release the locks taken by one of the above.
+ */
+void s3fs_unlock_dirs(s3fs_dirlock *lock);
+
+#endif // __S3FS_DIRLOCK_H__
@@ -0,0 +1,463 @@
+/*
+ * The table of nodes in front of the backend; see s3fs_inode.h.
+ */
+
+#include "s3fs_inode.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The table starts with this many chains and doubles whenever it holds
+// twice as many nodes as chains
+#define INODE_CHAINS 1024
+
+// Past this many nodes, new ones aren't added and are read from the
+// backend each time
+#define INODE_MAX (1 << 20)
+
+typedef struct inode {
+    char *bucket, *key;
+    uint64_t ino;
+    // as the backend's head would give it: st_size is the size, and for an
+    // object stored without attributes, st_mode is 0
+    struct stat attr;
+    // a directory's entries, as stored; NULL until read
+    uint8_t *data;
+    // when the backend was last read or written for the node, in ns of the
+    // monotonic clock
+    uint64_t checked;
+    // the change that last wrote the object, and what it was when
+    // s3fs_inode_unchanged() last looked
+    uint64_t version, opened;
+    struct inode *next;
+} inode;
+
+static inode **chains = NULL;
+static unsigned int chain_count = 0;
+static unsigned int node_count = 0;
+static uint64_t next_ino = 2;   // 1 is FUSE's root
+
+// Counts the changes made to the table, so that what is read from the
+// backend is only added if nothing was written in the meantime
+static uint64_t changes = 0;
+
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Added to by readers under the read lock, and so atomically
+static s3fs_inode_counters counters;
+
+#define COUNT(counter) \
+    __atomic_fetch_add(&(counters.counter), 1, __ATOMIC_RELAXED)
+
+// the backend s3fs_inode_backend() wraps
+static const s3fs_backend *inner;
+
+// how long a node is trusted for after it was checked, in ns
+static uint64_t timeout_ns;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+// Whether a node can be used without asking the backend
+static int fresh(const inode *node) {
+    return (now_ns() - node->checked) < timeout_ns;
+}
+
+static unsigned int hash(const char *bucket, const char *key) {
+    // FNV-1a, over the bucket and then the key
+    unsigned int h = 2166136261u;
+    const unsigned char *c;
+    for (c = (const unsigned char *) bucket; *c; c++) {
+        h = (h ^ *c) * 16777619u;
+    }
+    h = (h ^ '/') * 16777619u;
+    for (c = (const unsigned char *) key; *c; c++) {
+        h = (h ^ *c) * 16777619u;
+    }
+    return h;
+}
+
+// Returns the link to the node in its chain, which points to NULL if there
+// is no such node.  The table must be locked.
+static inode **find(const char *bucket, const char *key) {
+    if (!chain_count) {
+        return NULL;
+    }
+    inode **link = &(chains[hash(bucket, key) & (chain_count - 1)]);
+    while (*link && (strcmp((*link)->key, key) ||
+                     strcmp((*link)->bucket, bucket))) {
+        link = &((*link)->next);
+    }
+    return link;
+}
+
+static void free_node(inode *node) {
+    free(node->bucket);
+    free(node->key);
+    free(node->data);
+    free(node);
+}
+
+// Doubles the number of chains, if there's the memory.  The table must be
+// write locked.
+static void grow(void) {
+    unsigned int count = chain_count ? (chain_count * 2) : INODE_CHAINS;
+    inode **grown = calloc(count, sizeof(inode *));
+    unsigned int i;
+
+    if (!grown) {
+        return;
+    }
+    for (i = 0; i < chain_count; i++) {
+        while (chains[i]) {
+            inode *node = chains[i];
+            chains[i] = node->next;
+            unsigned int chain = hash(node->bucket, node->key) & (count - 1);
+            node->next = grown[chain];
+            grown[chain] = node;
+        }
+    }
+    free(chains);
+    chains = grown;
+    chain_count = count;
+}
+
+// Removes a node from the table.  The table must be write locked.
+static void forget(const char *bucket, const char *key) {
+    inode **link = find(bucket, key);
+    if (link && *link) {
+        inode *node = *link;
+        *link = node->next;
+        free_node(node);
+        node_count--;
+    }
+    changes++;
+}
+
+// Sets a node's attributes, adding it if it isn't there, as an object of
+// size bytes stored with attr (which may be NULL); returns the node, or
+// NULL if it couldn't be added.  The table must be write locked.
+static inode *remember(const char *bucket, const char *key, ssize_t size,
+                       const struct stat *attr) {
+    inode **link = find(bucket, key);
+    inode *node = link ? *link : NULL;
+
+    changes++;
+    if (!node) {
+        if (node_count >= INODE_MAX) {
+            return NULL;
+        }
+        if (node_count >= (chain_count * 2)) {
+            grow();
+        }
+        if (!(node = calloc(1, sizeof(inode)))) {
+            return NULL;
+        }
+        node->bucket = strdup(bucket);
+        node->key = strdup(key);
+        if (!node->bucket || !node->key) {
+            free_node(node);
+            return NULL;
+        }
+        node->ino = next_ino++;
+        link = find(bucket, key);
+        node->next = *link;
+        *link = node;
+        node_count++;
+    }
+
+    free(node->data);
+    node->data = NULL;
+    memset(&(node->attr), 0, sizeof(struct stat));
+    if (attr) {
+        node->attr.st_mode = attr->st_mode;
+        node->attr.st_uid = attr->st_uid;
+        node->attr.st_gid = attr->st_gid;
+        node->attr.st_mtime = attr->st_mtime;
+    }
+    else {
+        node->attr.st_mtime = time(NULL);
+    }
+    node->attr.st_size = size;
+    node->attr.st_ino = node->ino;
+    node->version = changes;
+    node->checked = now_ns();
+    return node;
+}
+
+// Sets a node's attributes to what the backend's head gave, as remember()
+// does; but a node that hasn't changed is only noted as checked, keeping
+// its entries and version.  The table must be write locked.
+static inode *refresh(const char *bucket, const char *key,
+                      const struct stat *attr) {
+    inode **link = find(bucket, key);
+    inode *node = link ? *link : NULL;
+
+    if (node && (node->attr.st_size == attr->st_size) &&
+        (node->attr.st_mode == attr->st_mode) &&
+        (node->attr.st_mtime == attr->st_mtime)) {
+        node->checked = now_ns();
+        return node;
+    }
+    if ((node = remember(bucket, key, attr->st_size, attr))) {
+        node->attr = *attr;
+        node->attr.st_ino = node->ino;
+    }
+    return node;
+}
+
+static void forget_all(void) {
+    unsigned int i;
+
+    pthread_rwlock_wrlock(&table_lock);
+    for (i = 0; i < chain_count; i++) {
+        while (chains[i]) {
+            inode *node = chains[i];
+            chains[i] = node->next;
+            free_node(node);
+        }
+    }
+    node_count = 0;
+    changes++;
+    pthread_rwlock_unlock(&table_lock);
+}
+
+int s3fs_inode_unchanged(const char *bucket, const char *key) {
+    int unchanged = 0;
+
+    pthread_rwlock_wrlock(&table_lock);
+    inode **link = find(bucket, key);
+    if (link && *link) {
+        unchanged = ((*link)->opened == (*link)->version);
+        (*link)->opened = (*link)->version;
+    }
+    pthread_rwlock_unlock(&table_lock);
+    return unchanged;
+}
+
+void s3fs_inode_get_counters(s3fs_inode_counters *c) {
+    c->head_hits = __atomic_load_n(&(counters.head_hits), __ATOMIC_RELAXED);
+    c->head_misses = __atomic_load_n(&(counters.head_misses),
+                                     __ATOMIC_RELAXED);
+    c->dir_hits = __atomic_load_n(&(counters.dir_hits), __ATOMIC_RELAXED);
+    c->dir_misses = __atomic_load_n(&(counters.dir_misses),
+                                    __ATOMIC_RELAXED);
+    c->stale = __atomic_load_n(&(counters.stale), __ATOMIC_RELAXED);
+    pthread_rwlock_rdlock(&table_lock);
+    c->nodes = node_count;
+    pthread_rwlock_unlock(&table_lock);
+}
+
+// the backend ---------------------------------------------------------------
+
+static int inode_init(const char *arg) {
+    return (*(inner->init))(arg);
+}
+
+static int inode_test_bucket(const char *bucket) {
+    return (*(inner->test_bucket))(bucket);
+}
+
+static int inode_clear_bucket(const char *bucket) {
+    int rv = (*(inner->clear_bucket))(bucket);
+    forget_all();
+    return rv;
+}
+
+static ssize_t inode_get_object(const char *bucket, const char *key,
+                                uint8_t **buf, ssize_t start_byte,
+                                ssize_t byte_count) {
+    int whole = !start_byte && !byte_count;
+    ssize_t size = -1;
+
+    pthread_rwlock_rdlock(&table_lock);
+    inode **link = find(bucket, key);
+    inode *node = link ? *link : NULL;
+    int dir = node && S_ISDIR(node->attr.st_mode);
+    int stale = dir && node->data && !fresh(node);
+    if (whole && dir && node->data && !stale) {
+        COUNT(dir_hits);
+        size = node->attr.st_size;
+        // as the backends do, an empty object is read as NULL
+        *buf = NULL;
+        if (size && (*buf = malloc(size))) {
+            memcpy(*buf, node->data, size);
+        }
+        else if (size) {
+            size = -1;
+        }
+    }
+    else if (whole && dir) {
+        COUNT(dir_misses);
+        if (stale) {
+            COUNT(stale);
+        }
+    }
+    uint64_t seen = changes;
+    pthread_rwlock_unlock(&table_lock);
+
+    if (size >= 0) {
+        return size;
+    }
+
+    ssize_t rv = (*(inner->get_object))(bucket, key, buf, start_byte,
+                                        byte_count);
+
+    // keep a directory's entries, unless it has been written since or
+    // another get has kept them first
+    if (whole && dir && (rv >= 0)) {
+        pthread_rwlock_wrlock(&table_lock);
+        link = find(bucket, key);
+        node = link ? *link : NULL;
+        if ((changes == seen) && node && !node->data &&
+            (node->attr.st_size == rv) &&
+            (node->data = malloc(rv ? rv : 1)) && rv) {
+            memcpy(node->data, *buf, rv);
+        }
+        pthread_rwlock_unlock(&table_lock);
+    }
+    return rv;
+}
+
+static ssize_t inode_put_object(const char *bucket, const char *key,
+                                const uint8_t *buf, ssize_t byte_count,
+                                const struct stat *attr) {
+    ssize_t rv = (*(inner->put_object))(bucket, key, buf, byte_count, attr);
+
+    pthread_rwlock_wrlock(&table_lock);
+    if (rv != byte_count) {
+        // it is not known what is there now
+        forget(bucket, key);
+    }
+    else {
+        inode *node = remember(bucket, key, byte_count, attr);
+        // a directory's entries are read far more often than written
+        if (node && S_ISDIR(node->attr.st_mode) &&
+            (node->data = malloc(byte_count ? byte_count : 1)) &&
+            byte_count) {
+            memcpy(node->data, buf, byte_count);
+        }
+    }
+    pthread_rwlock_unlock(&table_lock);
+    return rv;
+}
+
+static int inode_head_object(const char *bucket, const char *key,
+                             struct stat *attr) {
+    int found = 0;
+
+    pthread_rwlock_rdlock(&table_lock);
+    inode **link = find(bucket, key);
+    if (link && *link && fresh(*link)) {
+        if (attr) {
+            *attr = (*link)->attr;
+        }
+        found = 1;
+        COUNT(head_hits);
+    }
+    else {
+        COUNT(head_misses);
+        if (link && *link) {
+            COUNT(stale);
+        }
+    }
+    uint64_t seen = changes;
+    pthread_rwlock_unlock(&table_lock);
+
+    if (found) {
+        return 0;
+    }
+
+    // not in the table, or there too long to be trusted
+    struct stat got;
+    int rv = (*(inner->head_object))(bucket, key, &got);
+    pthread_rwlock_wrlock(&table_lock);
+    if (changes == seen) {
+        if (rv == 0) {
+            inode *node = refresh(bucket, key, &got);
+            if (node) {
+                got = node->attr;
+            }
+        }
+        else {
+            forget(bucket, key);
+        }
+    }
+    pthread_rwlock_unlock(&table_lock);
+    if ((rv == 0) && attr) {
+        *attr = got;
+    }
+    return rv;
+}
+
+static int inode_list_objects(const char *bucket, const char *prefix,
+                              int max_keys, s3fs_list_callback *callback,
+                              void *data) {
+    return (*(inner->list_objects))(bucket, prefix, max_keys, callback, data);
+}
+
+static int inode_copy_object(const char *bucket, const char *key,
+                             const char *newkey, const struct stat *attr) {
+    int rv = (*(inner->copy_object))(bucket, key, newkey, attr);
+
+    pthread_rwlock_wrlock(&table_lock);
+    inode **link = find(bucket, key);
+    inode *node = link ? *link : NULL;
+    if ((rv == 0) && node) {
+        // without new attributes, the copy keeps the original's
+        struct stat oldattr = node->attr;
+        inode *copy = remember(bucket, newkey, oldattr.st_size,
+                               attr ? attr : &oldattr);
+        if (copy && !attr) {
+            copy->attr.st_mtime = oldattr.st_mtime;
+        }
+    }
+    else {
+        forget(bucket, newkey);
+    }
+    pthread_rwlock_unlock(&table_lock);
+    return rv;
+}
+
+static int inode_remove_object(const char *bucket, const char *key) {
+    int rv = (*(inner->remove_object))(bucket, key);
+
+    pthread_rwlock_wrlock(&table_lock);
+    forget(bucket, key);
+    pthread_rwlock_unlock(&table_lock);
+    return rv;
+}
+
+static s3fs_backend inode_backend = {
+    NULL,
+    &inode_init,
+    &inode_test_bucket,
+    &inode_clear_bucket,
+    &inode_get_object,
+    &inode_put_object,
+    &inode_head_object,
+    &inode_list_objects,
+    &inode_copy_object,
+    &inode_remove_object,
+    NULL,
+    NULL
+};
+
+const s3fs_backend *s3fs_inode_backend(const s3fs_backend *backend,
+                                       double timeout) {
+    if (!backend) {
+        return NULL;
+    }
+    inner = backend;
+    timeout_ns = timeout * 1e9;
+    inode_backend.name = backend->name;
+    // these call back into inode_backend's get and put
+    inode_backend.get_object_async = backend->get_object_async;
+    inode_backend.put_object_async = backend->put_object_async;
+    return &inode_backend;
+}
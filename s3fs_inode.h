@@ -0,0 +1,62 @@
+/*
+ * An in-memory table of the file system's nodes, so that operations find a
+ * node's attributes, and a directory's entries, without going to the
+ * backend for them.
+ *
+ * Each node is kept under its path, with an inode number of its own (given
+ * as st_ino, which FUSE passes on when mounted with -o use_ino), the
+ * attributes it was stored with and, for a directory, its entries.  The
+ * table sits in front of the backend and is kept up to date by the puts,
+ * copies and removes that go through it.  Nodes not in the table are read
+ * from the backend and added.  This saves trips to the backend, not the
+ * work of resolving paths: the file system still takes each path apart
+ * (into its directory and name) on every operation, as FUSE's high-level
+ * API hands it paths rather than nodes.
+ *
+ * This mount's own writes keep the table right, but another mount or
+ * client can change the bucket behind it.  So a node is only trusted for
+ * a timeout after it was last read from or written to the backend; after
+ * that, it is headed again before it is used.  A node whose size, mode or
+ * mtime has changed is stored again, with a new version and without its
+ * entries, and one that is gone is removed.  A change that keeps all three
+ * (such as a rewrite of the same size within a second) is missed until
+ * something else changes.  Within the timeout, the table can be that far
+ * behind another writer, as can the kernel's own cache.
+ */
+#ifndef __S3FS_INODE_H__
+#define __S3FS_INODE_H__
+
+#include "s3fs_backend.h"
+
+/*
+ * Returns a backend that does what backend does, answering heads, and
+ * whole gets of directories, from the table; a node is checked against
+ * the backend again once it is timeout seconds old.
+ */
+const s3fs_backend *s3fs_inode_backend(const s3fs_backend *backend,
+                                       double timeout);
+
+/*
+ * Returns whether an object is as it was when this was last called for it,
+ * and notes it as it is now.  The first call for an object, and any after
+ * it has been written, return 0; so does any for an object not in the
+ * table.  A file system can keep the kernel's cache of a file it opens
+ * while this returns 1, and have it dropped otherwise.
+ */
+int s3fs_inode_unchanged(const char *bucket, const char *key);
+
+typedef struct s3fs_inode_counters {
+    uint64_t head_hits;         // heads answered from the table
+    uint64_t head_misses;       // heads that went to the backend
+    uint64_t dir_hits;          // whole gets of directories answered
+    uint64_t dir_misses;        // and those that went to the backend
+    uint64_t stale;             // misses for nodes past the timeout
+    uint64_t nodes;             // in the table now
+} s3fs_inode_counters;
+
+/*
+ * Get the counts so far.
+ */
+void s3fs_inode_get_counters(s3fs_inode_counters *counters);
+
+#endif // __S3FS_INODE_H__
@@ -0,0 +1,282 @@
+/*
+ * Logging for s3fs through per-thread rings written out by a background
+ * thread; see s3fs_log.h.
+ */
+
+#include "s3fs_log.h"
+#include "s3fs_slot.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// Each thread's ring holds this many messages, each cut to LOG_MESSAGE_MAX
+// bytes
+#define LOG_RING_SLOTS 256
+#define LOG_MESSAGE_MAX 496
+
+// How often the rings are written out, in ms
+#define LOG_INTERVAL_MS 10
+
+// The time, level and newline around a message
+#define LOG_LINE_MAX (LOG_MESSAGE_MAX + 64)
+
+typedef struct log_entry {
+    uint64_t time;              // ns since the epoch
+    int level;
+    int len;
+    char text[LOG_MESSAGE_MAX];
+} log_entry;
+
+// The messages logged by one thread.  Only that thread writes entries and
+// moves head on; only the background thread moves tail on.  When the
+// thread exits the ring is handed on to the next thread to start.
+typedef struct log_ring {
+    s3fs_slot slot;
+    log_entry entries[LOG_RING_SLOTS];
+    uint64_t head;              // entries logged
+    uint64_t tail;              // entries written out
+    uint64_t dropped;           // messages dropped since last written out
+} log_ring;
+
+int s3fs_log_level = S3FS_LOG_INFO;
+
+static const char *level_names[] = { "error", "warn", "info", "debug" };
+
+// every ring there has been
+static s3fs_slots all_rings = S3FS_SLOTS_INITIALIZER(log_ring);
+
+static __thread log_ring *my_ring = NULL;
+
+// the background thread, and whether it is running and should stop
+static pthread_t writer;
+static int running = 0;
+static int stopping = 0;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+
+// lines are gathered here and written out in as few writes as possible
+static char out[64 * 1024];
+static size_t out_len = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+// Formats a message as a line of the log; returns its length
+static int format_line(char *line, uint64_t ns, int level, const char *text,
+                       int len) {
+    time_t seconds = ns / 1000000000;
+    struct tm tm;
+    char date[32];
+
+    if (len && (text[len - 1] == '\n')) {
+        len--;
+    }
+    localtime_r(&seconds, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+    int n = snprintf(line, LOG_LINE_MAX, "%s.%06u %-5s %.*s\n", date,
+                     (unsigned) ((ns % 1000000000) / 1000),
+                     level_names[level], len, text);
+    return (n < LOG_LINE_MAX) ? n : LOG_LINE_MAX - 1;
+}
+
+// logging -------------------------------------------------------------------
+
+// Returns this thread's ring, or NULL if there is no memory for it
+static log_ring *get_ring(void) {
+    if (!my_ring) {
+        my_ring = s3fs_slot_get(&all_rings);
+    }
+    return my_ring;
+}
+
+// Formats and writes a message to stderr straight away
+static void write_now(int level, const char *format, va_list args) {
+    char text[LOG_MESSAGE_MAX], line[LOG_LINE_MAX];
+
+    int len = vsnprintf(text, sizeof(text), format, args);
+    if (len < 0) {
+        len = 0;
+    }
+    else if (len >= LOG_MESSAGE_MAX) {
+        len = LOG_MESSAGE_MAX - 1;
+    }
+    len = format_line(line, now_ns(), level, text, len);
+    fwrite(line, len, 1, stderr);
+}
+
+void s3fs_log_write(int level, const char *format, ...) {
+    log_ring *ring = NULL;
+    va_list args;
+
+    if (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        ring = get_ring();
+    }
+
+    uint64_t head = ring ? ring->head : 0;
+    uint64_t used = ring ?
+        head - __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE) : 0;
+    if (ring && (used >= LOG_RING_SLOTS)) {
+        // errors are never dropped, only written out of order
+        if (level != S3FS_LOG_ERROR) {
+            __atomic_fetch_add(&(ring->dropped), 1, __ATOMIC_RELAXED);
+            return;
+        }
+        ring = NULL;
+    }
+
+    // written as it is logged before the background thread starts (or if
+    // there is no memory for a ring)
+    if (!ring) {
+        va_start(args, format);
+        write_now(level, format, args);
+        va_end(args);
+        return;
+    }
+
+    // write the rings out early rather than start dropping messages
+    if (used == LOG_RING_SLOTS / 2) {
+        pthread_cond_signal(&writer_cond);
+    }
+
+    log_entry *entry = &(ring->entries[head % LOG_RING_SLOTS]);
+    entry->time = now_ns();
+    entry->level = level;
+    va_start(args, format);
+    entry->len = vsnprintf(entry->text, LOG_MESSAGE_MAX, format, args);
+    va_end(args);
+    if (entry->len < 0) {
+        entry->len = 0;
+    }
+    else if (entry->len >= LOG_MESSAGE_MAX) {
+        entry->len = LOG_MESSAGE_MAX - 1;
+    }
+    __atomic_store_n(&(ring->head), head + 1, __ATOMIC_RELEASE);
+}
+
+int s3fs_log_init(void) {
+    const char *level = getenv(S3FSLOGLEVEL);
+    int i;
+
+    if (!level) {
+        return 0;
+    }
+    for (i = 0; i <= S3FS_LOG_DEBUG; i++) {
+        if (!strcasecmp(level, level_names[i])) {
+            s3fs_log_level = i;
+            return 0;
+        }
+    }
+    fprintf(stderr, "Invalid %s: %s\n", S3FSLOGLEVEL, level);
+    return -1;
+}
+
+// writing out ---------------------------------------------------------------
+
+static void flush_out(void) {
+    if (out_len) {
+        fwrite(out, out_len, 1, stderr);
+        fflush(stderr);
+        out_len = 0;
+    }
+}
+
+static void add_line(uint64_t ns, int level, const char *text, int len) {
+    if (out_len + LOG_LINE_MAX > sizeof(out)) {
+        flush_out();
+    }
+    out_len += format_line(out + out_len, ns, level, text, len);
+}
+
+// Writes out every message in the rings, in the order they were logged
+static void write_rings(void) {
+    log_ring *rings, *ring;
+
+    // rings are only ever added at the front of the list, so the part of
+    // it from rings on doesn't change
+    rings = s3fs_slots_first(&all_rings);
+    for (;;) {
+        log_ring *first = NULL;
+        for (ring = rings; ring; ring = (log_ring *) ring->slot.next) {
+            uint64_t tail = ring->tail;
+            if ((tail != __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE)) &&
+                (!first || (ring->entries[tail % LOG_RING_SLOTS].time <
+                            first->entries[first->tail %
+                                           LOG_RING_SLOTS].time))) {
+                first = ring;
+            }
+        }
+        if (!first) {
+            break;
+        }
+        log_entry *entry = &(first->entries[first->tail % LOG_RING_SLOTS]);
+        add_line(entry->time, entry->level, entry->text, entry->len);
+        __atomic_store_n(&(first->tail), first->tail + 1, __ATOMIC_RELEASE);
+    }
+
+    for (ring = rings; ring; ring = (log_ring *) ring->slot.next) {
+        uint64_t dropped = __atomic_exchange_n(&(ring->dropped), 0,
+                                               __ATOMIC_RELAXED);
+        if (dropped) {
+            char text[64];
+            int len = snprintf(text, sizeof(text),
+                               "%llu messages dropped; logging too fast",
+                               (unsigned long long) dropped);
+            add_line(now_ns(), S3FS_LOG_WARN, text, len);
+        }
+    }
+    flush_out();
+}
+
+static void *writer_thread(void *arg) {
+    struct timespec ts;
+
+    (void) arg;
+    pthread_mutex_lock(&writer_lock);
+    while (!stopping) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += LOG_INTERVAL_MS * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&writer_cond, &writer_lock, &ts);
+        pthread_mutex_unlock(&writer_lock);
+        write_rings();
+        pthread_mutex_lock(&writer_lock);
+    }
+    pthread_mutex_unlock(&writer_lock);
+    return NULL;
+}
+
+int s3fs_log_start(void) {
+    stopping = 0;
+    if (pthread_create(&writer, NULL, &writer_thread, NULL)) {
+        return -1;
+    }
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void s3fs_log_stop(void) {
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    pthread_mutex_lock(&writer_lock);
+    stopping = 1;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_lock);
+    pthread_join(writer, NULL);
+
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    // whatever was logged while the thread stopped
+    write_rings();
+}
@@ -0,0 +1,71 @@
+/*
+ * Leveled logging for s3fs that keeps writes to stderr off the threads
+ * doing the work.
+ *
+ * A message is formatted straight into a ring buffer of the logging
+ * thread's own, without taking a lock, and a background thread started by
+ * s3fs_log_start() writes the rings out to stderr.  Until it is started
+ * (and after it is stopped), messages are written to stderr as they are
+ * logged.  If a thread logs faster than the rings are written out, its
+ * messages are dropped, and how many is logged in their place; errors are
+ * written straight to stderr instead.
+ *
+ * Messages more verbose than S3FS_LOG_MAX_LEVEL are compiled out
+ * altogether; by default that is S3FS_LOG_INFO, so that debug messages
+ * cost nothing unless built with make LOG_LEVEL=S3FS_LOG_DEBUG.  Of
+ * those compiled in, the ones logged are those no more verbose than the
+ * level named by the S3FS_LOG_LEVEL environment variable (error, warn,
+ * info or debug), info if it isn't set.
+ */
+#ifndef __S3FS_LOG_H__
+#define __S3FS_LOG_H__
+
+#define S3FSLOGLEVEL "S3FS_LOG_LEVEL"
+
+#define S3FS_LOG_ERROR 0
+#define S3FS_LOG_WARN  1
+#define S3FS_LOG_INFO  2
+#define S3FS_LOG_DEBUG 3
+
+#ifndef S3FS_LOG_MAX_LEVEL
+#define S3FS_LOG_MAX_LEVEL S3FS_LOG_INFO
+#endif
+
+// the most verbose level logged
+extern int s3fs_log_level;
+
+#define s3fs_log(level, ...)                                        \
+    do {                                                            \
+        if (((level) <= S3FS_LOG_MAX_LEVEL) &&                      \
+            ((level) <= s3fs_log_level)) {                          \
+            s3fs_log_write((level), __VA_ARGS__);                   \
+        }                                                           \
+    } while (0)
+
+#define s3fs_error(...) s3fs_log(S3FS_LOG_ERROR, __VA_ARGS__)
+#define s3fs_warn(...)  s3fs_log(S3FS_LOG_WARN, __VA_ARGS__)
+#define s3fs_info(...)  s3fs_log(S3FS_LOG_INFO, __VA_ARGS__)
+#define s3fs_debug(...) s3fs_log(S3FS_LOG_DEBUG, __VA_ARGS__)
+
+/*
+ * Log a message (printf style, without a newline) at a level.  Use the
+ * macros above instead, which check the level first.
+ */
+void s3fs_log_write(int level, const char *format, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+/*
+ * Set the level from S3FS_LOG_LEVEL.  Returns 0 on success and -1 if it
+ * doesn't name a level.
+ */
+int s3fs_log_init(void);
+
+/*
+ * Start and stop the thread that writes messages out.  Stopping writes out
+ * any messages left.  As fuse_main forks, the thread should be started
+ * from the file system's init.
+ */
+int s3fs_log_start(void);
+void s3fs_log_stop(void);
+
+#endif // __S3FS_LOG_H__
@@ -0,0 +1,647 @@
+/*
+ * Replays a trace recorded by s3fs (see s3fs_trace.h) against a mounted
+ * s3fs, and compares the latencies of the replay with those traced.
+ *
+ * Each thread in the trace is replayed by a thread of its own, which
+ * issues the system call that most directly causes each operation (stat
+ * for getattr, pread for read, and so on) at the time it was traced,
+ * divided by the speed-up given.  s3fs empties its bucket when it mounts,
+ * so a trace recorded from a mount replays correctly on a fresh one.
+ *
+ * The latency of a system call includes the kernel and any other
+ * operations it causes, and so is not quite that of the operation.  To
+ * compare like with like, trace the mount being replayed against too, and
+ * compare the two traces with -c.
+ *
+ * The distributions are printed as CSV, a row for each kind of operation.
+ * The requests to s3 in a trace can be printed too, with the time each
+ * spent in each stage, to see where the time of slow operations went.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include "s3fs_trace.h"
+
+typedef struct trace_op {
+    s3fs_trace_record record;
+    char *path, *newpath;       // newpath is only for a rename
+    double replay_latency;      // seconds
+    int replay_ok;
+} trace_op;
+
+// A request to s3 made for one of the operations
+typedef struct trace_request {
+    s3fs_trace_record record;
+    s3fs_trace_request request;
+    char *text;                 // verb and URI
+} trace_request;
+
+typedef struct trace {
+    trace_op *ops;
+    size_t count;
+    trace_request *requests;
+    size_t request_count;
+} trace;
+
+// A file or directory opened by the replay, for the reads, writes and
+// releases that follow
+typedef struct open_file {
+    char *path;
+    int fd;
+    DIR *dir;
+    struct open_file *next;
+} open_file;
+
+typedef struct replay_thread {
+    trace_op **ops;             // in the order they started
+    size_t count;
+    pthread_t thread;
+} replay_thread;
+
+static const char *mount_point;
+static double speed = 1;
+static double replay_start;
+
+static open_file *open_files = NULL;
+static pthread_mutex_t open_files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// reading traces ------------------------------------------------------------
+
+static void *grow(void *array, size_t count, size_t *size, size_t item) {
+    if (count < *size) {
+        return array;
+    }
+    *size = *size ? *size * 2 : 4096;
+    array = realloc(array, *size * item);
+    if (!array) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    return array;
+}
+
+// Reads the rest of a request's record, after its s3fs_trace_record;
+// returns 0 on success and -1 if the record is cut short
+static int read_request(FILE *f, const s3fs_trace_record *record,
+                        trace_request *r) {
+    size_t len = record->path_len - sizeof(s3fs_trace_request);
+
+    r->record = *record;
+    if ((record->path_len < sizeof(s3fs_trace_request)) ||
+        (fread(&(r->request), sizeof(s3fs_trace_request), 1, f) != 1)) {
+        return -1;
+    }
+    r->text = malloc(len + 1);
+    if (!r->text) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    if (fread(r->text, 1, len, f) != len) {
+        free(r->text);
+        return -1;
+    }
+    r->text[len] = 0;
+    return 0;
+}
+
+static int read_trace(const char *file, trace *t) {
+    s3fs_trace_header header;
+    size_t size = 0, request_size = 0;
+
+    memset(t, 0, sizeof(trace));
+    FILE *f = fopen(file, "r");
+    if (!f) {
+        perror(file);
+        return -1;
+    }
+    if ((fread(&header, sizeof(header), 1, f) != 1) ||
+        memcmp(header.magic, S3FS_TRACE_MAGIC, sizeof(header.magic))) {
+        fprintf(stderr, "%s is not an s3fs trace\n", file);
+        fclose(f);
+        return -1;
+    }
+
+    for (;;) {
+        t->ops = grow(t->ops, t->count, &size, sizeof(trace_op));
+        trace_op *op = &(t->ops[t->count]);
+        memset(op, 0, sizeof(trace_op));
+        if (fread(&(op->record), sizeof(s3fs_trace_record), 1, f) != 1) {
+            break;
+        }
+        if (op->record.op == S3FS_TRACE_REQUEST) {
+            t->requests = grow(t->requests, t->request_count, &request_size,
+                               sizeof(trace_request));
+            if (read_request(f, &(op->record),
+                             &(t->requests[t->request_count])) < 0) {
+                break;
+            }
+            t->request_count++;
+            continue;
+        }
+        op->path = malloc(op->record.path_len + 1);
+        if (!op->path) {
+            fprintf(stderr, "Out of memory\n");
+            exit(-1);
+        }
+        // a record cut short is the end of a trace that wasn't stopped
+        if ((op->record.op >= S3FS_TRACE_OPS) ||
+            (fread(op->path, 1, op->record.path_len, f) !=
+             op->record.path_len)) {
+            free(op->path);
+            break;
+        }
+        op->path[op->record.path_len] = 0;
+        if (op->record.op == S3FS_TRACE_RENAME) {
+            size_t len = strlen(op->path);
+            op->newpath = (len < op->record.path_len) ?
+                op->path + len + 1 : op->path + len;
+        }
+        t->count++;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static void free_trace(trace *t) {
+    size_t i;
+    for (i = 0; i < t->count; i++) {
+        free(t->ops[i].path);
+    }
+    free(t->ops);
+    for (i = 0; i < t->request_count; i++) {
+        free(t->requests[i].text);
+    }
+    free(t->requests);
+}
+
+static void print_trace(const trace *t) {
+    size_t i;
+
+    printf("start_ms,latency_ms,thread,op,path,offset,size,result\n");
+    for (i = 0; i < t->count; i++) {
+        const trace_op *op = &(t->ops[i]);
+        printf("%.3f,%.3f,%u,%s,\"%s%s%s\",%lld,%u,%d\n",
+               op->record.start / 1e6, op->record.latency / 1e6,
+               op->record.thread, s3fs_trace_op_name(op->record.op),
+               op->path, op->newpath ? " -> " : "",
+               op->newpath ? op->newpath : "",
+               (long long) op->record.offset, op->record.size,
+               op->record.result);
+    }
+}
+
+// The time from one stage of a request to the next, in milliseconds; a stage
+// the request never reached took no time
+static double stage_ms(uint32_t from, uint32_t to) {
+    return ((to > from) ? (to - from) : 0) / 1e3;
+}
+
+static void print_requests(const trace *t) {
+    size_t i;
+
+    printf("start_ms,latency_ms,thread,op_start_ms,request,http_status,"
+           "status,reused,lookup_ms,connect_ms,tls_ms,first_byte_ms,"
+           "transfer_ms,bytes_sent,bytes_received\n");
+    for (i = 0; i < t->request_count; i++) {
+        const trace_request *r = &(t->requests[i]);
+        const s3fs_trace_request *q = &(r->request);
+        uint32_t connected = q->app_connect ? q->app_connect : q->connect;
+        uint32_t total = r->record.latency / 1000;
+        printf("%.3f,%.3f,%u,%.3f,\"%s\",%u,%d,%u,%.3f,%.3f,%.3f,%.3f,"
+               "%.3f,%llu,%llu\n",
+               r->record.start / 1e6, r->record.latency / 1e6,
+               r->record.thread, q->op_start / 1e6, r->text,
+               q->http_status, r->record.result, q->reused,
+               stage_ms(0, q->name_lookup),
+               stage_ms(q->name_lookup, q->connect),
+               stage_ms(q->connect, q->app_connect),
+               stage_ms(connected, q->start_transfer),
+               q->start_transfer ? stage_ms(q->start_transfer, total) : 0,
+               (unsigned long long) q->bytes_sent,
+               (unsigned long long) q->bytes_received);
+    }
+}
+
+// replaying -----------------------------------------------------------------
+
+static void add_open_file(const char *path, int fd, DIR *dir) {
+    open_file *file = malloc(sizeof(open_file));
+    if (!file || !(file->path = strdup(path))) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    file->fd = fd;
+    file->dir = dir;
+    pthread_mutex_lock(&open_files_lock);
+    file->next = open_files;
+    open_files = file;
+    pthread_mutex_unlock(&open_files_lock);
+}
+
+// Removes and returns the file most recently opened at path, of the kind
+// asked for, or NULL
+static open_file *take_open_file(const char *path, int dir) {
+    pthread_mutex_lock(&open_files_lock);
+    open_file **link = &open_files;
+    while (*link && (strcmp((*link)->path, path) || (!(*link)->dir != !dir))) {
+        link = &((*link)->next);
+    }
+    open_file *file = *link;
+    if (file) {
+        *link = file->next;
+    }
+    pthread_mutex_unlock(&open_files_lock);
+    return file;
+}
+
+static void close_open_file(open_file *file) {
+    if (file->dir) {
+        closedir(file->dir);
+    }
+    else {
+        close(file->fd);
+    }
+    free(file->path);
+    free(file);
+}
+
+// Reads or writes through the file most recently opened at path, opening it
+// for just this if it isn't open
+static int replay_io(const trace_op *op, const char *path) {
+    static char block[1024 * 1024];
+    size_t size = op->record.size;
+    int rv;
+
+    if (size > sizeof(block)) {
+        size = sizeof(block);
+    }
+    open_file *file = take_open_file(path, 0);
+    int fd = file ? file->fd : open(path, O_RDWR);
+    if (fd < 0) {
+        return -1;
+    }
+    switch (op->record.op) {
+    case S3FS_TRACE_READ:
+        rv = (pread(fd, block, size, op->record.offset) < 0) ? -1 : 0;
+        break;
+    case S3FS_TRACE_WRITE:
+        rv = (pwrite(fd, block, size, op->record.offset) < 0) ? -1 : 0;
+        break;
+    default:
+        rv = ftruncate(fd, op->record.offset);
+        break;
+    }
+    if (file) {
+        add_open_file(file->path, file->fd, NULL);
+        free(file->path);
+        free(file);
+    }
+    else {
+        close(fd);
+    }
+    return rv;
+}
+
+static int replay_readdir(const char *path) {
+    struct dirent *ent;
+
+    open_file *file = take_open_file(path, 1);
+    DIR *dir = file ? file->dir : opendir(path);
+    if (!dir) {
+        return -1;
+    }
+    rewinddir(dir);
+    while ((ent = readdir(dir))) {
+    }
+    if (file) {
+        add_open_file(file->path, -1, file->dir);
+        free(file->path);
+        free(file);
+    }
+    else {
+        closedir(dir);
+    }
+    return 0;
+}
+
+// Issues the system call for op; returns 0 if it succeeded
+static int replay_op(const trace_op *op) {
+    char path[4096 + 256], newpath[4096 + 256];
+    struct stat st;
+    open_file *file;
+    int fd;
+    DIR *dir;
+
+    snprintf(path, sizeof(path), "%s%s", mount_point, op->path);
+    switch (op->record.op) {
+    case S3FS_TRACE_GETATTR:
+        return lstat(path, &st);
+    case S3FS_TRACE_MKNOD:
+        return mknod(path, op->record.size, 0);
+    case S3FS_TRACE_MKDIR:
+        return mkdir(path, op->record.size & 07777);
+    case S3FS_TRACE_UNLINK:
+        return unlink(path);
+    case S3FS_TRACE_RMDIR:
+        return rmdir(path);
+    case S3FS_TRACE_RENAME:
+        snprintf(newpath, sizeof(newpath), "%s%s", mount_point, op->newpath);
+        return rename(path, newpath);
+    case S3FS_TRACE_TRUNCATE:
+        return truncate(path, op->record.offset);
+    case S3FS_TRACE_OPEN:
+        // creating and truncating are traced as operations of their own
+        fd = open(path, op->record.size & ~(O_CREAT | O_EXCL | O_TRUNC));
+        if (fd < 0) {
+            return -1;
+        }
+        add_open_file(path, fd, NULL);
+        return 0;
+    case S3FS_TRACE_READ:
+    case S3FS_TRACE_WRITE:
+    case S3FS_TRACE_FTRUNCATE:
+        return replay_io(op, path);
+    case S3FS_TRACE_FLUSH:
+        // made by the close() that a release is replayed with
+        return 0;
+    case S3FS_TRACE_RELEASE:
+    case S3FS_TRACE_RELEASEDIR:
+        file = take_open_file(path, op->record.op == S3FS_TRACE_RELEASEDIR);
+        if (file) {
+            close_open_file(file);
+        }
+        return 0;
+    case S3FS_TRACE_OPENDIR:
+        if (!(dir = opendir(path))) {
+            return -1;
+        }
+        add_open_file(path, -1, dir);
+        return 0;
+    case S3FS_TRACE_READDIR:
+        return replay_readdir(path);
+    case S3FS_TRACE_ACCESS:
+        return access(path, op->record.size);
+    }
+    return -1;
+}
+
+static void *replay_main(void *arg) {
+    replay_thread *rt = (replay_thread *) arg;
+    size_t i;
+
+    for (i = 0; i < rt->count; i++) {
+        trace_op *op = rt->ops[i];
+        if (speed > 0) {
+            double wait = replay_start + (op->record.start / 1e9 / speed) -
+                now();
+            if (wait > 0) {
+                struct timespec ts;
+                ts.tv_sec = (time_t) wait;
+                ts.tv_nsec = (long) ((wait - ts.tv_sec) * 1e9);
+                nanosleep(&ts, NULL);
+            }
+        }
+        double start = now();
+        op->replay_ok = (replay_op(op) == 0);
+        op->replay_latency = now() - start;
+    }
+    return NULL;
+}
+
+static int compare_thread_start(const void *a, const void *b) {
+    const s3fs_trace_record *x = &((*(trace_op * const *) a)->record);
+    const s3fs_trace_record *y = &((*(trace_op * const *) b)->record);
+    if (x->thread != y->thread) {
+        return (x->thread > y->thread) - (x->thread < y->thread);
+    }
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+static void replay(trace *t) {
+    trace_op **ops = malloc(t->count * sizeof(trace_op *));
+    replay_thread *threads = calloc(t->count ? t->count : 1,
+                                    sizeof(replay_thread));
+    size_t i, count = 0;
+
+    if (!ops || !threads) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    for (i = 0; i < t->count; i++) {
+        ops[i] = &(t->ops[i]);
+    }
+    if (t->count) {
+        qsort(ops, t->count, sizeof(trace_op *), &compare_thread_start);
+    }
+    for (i = 0; i < t->count; i++) {
+        if (!i || (ops[i]->record.thread != ops[i - 1]->record.thread)) {
+            threads[count++].ops = &(ops[i]);
+        }
+        threads[count - 1].count++;
+    }
+
+    replay_start = now();
+    for (i = 0; i < count; i++) {
+        if (pthread_create(&(threads[i].thread), NULL, &replay_main,
+                           &(threads[i]))) {
+            fprintf(stderr, "Failed to start a thread\n");
+            exit(-1);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+
+    while (open_files) {
+        open_file *file = open_files;
+        open_files = file->next;
+        close_open_file(file);
+    }
+    free(threads);
+    free(ops);
+}
+
+// comparing -----------------------------------------------------------------
+
+typedef struct latencies {
+    double *values;             // seconds
+    size_t count;
+} latencies;
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values, in milliseconds
+static double percentile(const latencies *lat, double q) {
+    if (!lat->count) {
+        return 0;
+    }
+    size_t rank = (size_t) (q * lat->count);
+    if (rank < q * lat->count) {
+        rank++;
+    }
+    if (rank < 1) {
+        rank = 1;
+    }
+    return lat->values[rank - 1] * 1000;
+}
+
+// Gathers the latencies of the operations of kind op (or all if op is -1),
+// from the trace or from its replay
+static void gather(const trace *t, int op, int replayed, latencies *lat) {
+    size_t i;
+
+    lat->values = malloc((t->count ? t->count : 1) * sizeof(double));
+    lat->count = 0;
+    if (!lat->values) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    for (i = 0; i < t->count; i++) {
+        const trace_op *o = &(t->ops[i]);
+        if ((op < 0) || (o->record.op == op)) {
+            lat->values[lat->count++] = replayed ? o->replay_latency :
+                o->record.latency / 1e9;
+        }
+    }
+    qsort(lat->values, lat->count, sizeof(double), &compare_doubles);
+}
+
+// Counts the operations of kind op (or all) whose replay succeeded where
+// the traced operation failed, or the other way round
+static size_t mismatches(const trace *t, int op) {
+    size_t i, count = 0;
+    for (i = 0; i < t->count; i++) {
+        const trace_op *o = &(t->ops[i]);
+        if (((op < 0) || (o->record.op == op)) &&
+            (o->replay_ok != (o->record.result >= 0))) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Prints a row comparing a's latencies with b's (or with a's replay, if b
+// is NULL) for each kind of operation, and then for all
+static void compare(const trace *a, const trace *b) {
+    int op;
+
+    printf("op,ops_a,ops_b,mismatches,a_p50_ms,a_p90_ms,a_p99_ms,a_max_ms,"
+           "b_p50_ms,b_p90_ms,b_p99_ms,b_max_ms\n");
+    for (op = 0; op <= S3FS_TRACE_OPS; op++) {
+        int kind = (op == S3FS_TRACE_OPS) ? -1 : op;
+        latencies la, lb;
+        gather(a, kind, 0, &la);
+        gather(b ? b : a, kind, !b, &lb);
+        if (la.count || lb.count) {
+            printf("%s,%llu,%llu,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,"
+                   "%.3f\n", (kind < 0) ? "all" : s3fs_trace_op_name(kind),
+                   (unsigned long long) la.count,
+                   (unsigned long long) lb.count,
+                   (unsigned long long) (b ? 0 : mismatches(a, kind)),
+                   percentile(&la, 0.50), percentile(&la, 0.90),
+                   percentile(&la, 0.99), percentile(&la, 1.0),
+                   percentile(&lb, 0.50), percentile(&lb, 0.90),
+                   percentile(&lb, 0.99), percentile(&lb, 1.0));
+        }
+        free(la.values);
+        free(lb.values);
+    }
+}
+
+// main ----------------------------------------------------------------------
+
+static void usage(const char *program) {
+    fprintf(stderr,
+"Usage: %s [-s speed] TRACE DIRECTORY\n"
+"       %s -c TRACE TRACE\n"
+"       %s -p TRACE\n"
+"       %s -r TRACE\n"
+"\n"
+"Replays TRACE, recorded by s3fs with S3FS_TRACE set, against the s3fs\n"
+"mounted on DIRECTORY, and prints a CSV row for each kind of operation\n"
+"comparing the latencies traced (a) with those of the replay (b), and\n"
+"counting the operations whose replay succeeded where the traced operation\n"
+"failed or the other way round.  Latencies are in milliseconds.\n"
+"\n"
+"  -s speed     replay this many times faster than traced, or 0 for as\n"
+"               fast as possible (default 1)\n"
+"  -c           compare the latencies of two traces, without replaying\n"
+"  -p           print a trace as CSV\n"
+"  -r           print the requests to s3 in a trace as CSV, each with the\n"
+"               thread and start of the operation it was made for\n",
+            program, program, program, program);
+}
+
+int main(int argc, char **argv) {
+    int compare_traces = 0, print = 0, requests = 0, c;
+    trace a, b;
+
+    while ((c = getopt(argc, argv, "s:cprh")) != -1) {
+        switch (c) {
+        case 's':
+            speed = atof(optarg);
+            break;
+        case 'c':
+            compare_traces = 1;
+            break;
+        case 'p':
+            print = 1;
+            break;
+        case 'r':
+            requests = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : -1;
+        }
+    }
+    if ((optind != argc - ((print || requests) ? 1 : 2)) || (speed < 0) ||
+        ((print + requests + compare_traces) > 1)) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (read_trace(argv[optind], &a) < 0) {
+        return -1;
+    }
+    if (print) {
+        print_trace(&a);
+    }
+    else if (requests) {
+        print_requests(&a);
+    }
+    else if (compare_traces) {
+        if (read_trace(argv[optind + 1], &b) < 0) {
+            return -1;
+        }
+        compare(&a, &b);
+        free_trace(&b);
+    }
+    else {
+        mount_point = argv[optind + 1];
+        replay(&a);
+        compare(&a, NULL);
+    }
+    free_trace(&a);
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * Per-thread slots; see s3fs_slot.h.
+ */
+
+#include "s3fs_slot.h"
+
+#include <stdlib.h>
+
+static void release_slot(void *arg) {
+    s3fs_slot *slot = arg;
+
+    pthread_mutex_lock(&(slot->slots->lock));
+    slot->in_use = 0;
+    pthread_mutex_unlock(&(slot->slots->lock));
+}
+
+void *s3fs_slot_get(s3fs_slots *slots) {
+    s3fs_slot *slot = NULL;
+
+    pthread_mutex_lock(&(slots->lock));
+    if (!slots->has_key &&
+        !pthread_key_create(&(slots->key), &release_slot)) {
+        slots->has_key = 1;
+    }
+    if (slots->has_key) {
+        for (slot = slots->first; slot && slot->in_use; slot = slot->next) {
+        }
+        if (!slot && (slot = calloc(1, slots->size))) {
+            slot->slots = slots;
+            slot->next = slots->first;
+            slots->first = slot;
+        }
+    }
+    if (slot) {
+        slot->in_use = 1;
+    }
+    pthread_mutex_unlock(&(slots->lock));
+
+    if (slot) {
+        pthread_setspecific(slots->key, slot);
+    }
+    return slot;
+}
+
+void *s3fs_slots_first(s3fs_slots *slots) {
+    s3fs_slot *first;
+
+    pthread_mutex_lock(&(slots->lock));
+    first = slots->first;
+    pthread_mutex_unlock(&(slots->lock));
+    return first;
+}
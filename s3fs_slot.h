@@ -0,0 +1,48 @@
+/*
+ * Per-thread slots, for state that one thread writes without taking a
+ * lock and that other threads read, such as log rings and statistics.
+ *
+ * A slot is a struct that starts with an s3fs_slot.  A thread gets one the
+ * first time it asks, and gives it up when it exits, to be handed on to
+ * the next thread that asks; so there are only ever as many slots as there
+ * have been threads at once.  Slots are never freed, and are only ever
+ * added at the front of the list, so the part of the list from any slot on
+ * doesn't change.
+ */
+#ifndef __S3FS_SLOT_H__
+#define __S3FS_SLOT_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+typedef struct s3fs_slot {
+    struct s3fs_slot *next;
+    struct s3fs_slots *slots;   // the list it is on
+    int in_use;
+} s3fs_slot;
+
+typedef struct s3fs_slots {
+    size_t size;                // of each slot
+    s3fs_slot *first;
+    pthread_mutex_t lock;
+    pthread_key_t key;
+    int has_key;
+} s3fs_slots;
+
+#define S3FS_SLOTS_INITIALIZER(type) \
+    { sizeof(type), NULL, PTHREAD_MUTEX_INITIALIZER, 0, 0 }
+
+/*
+ * Returns this thread's slot, or NULL if there is no memory for one.  A new
+ * slot is zeroed; one handed on keeps what the last thread left in it.
+ * This takes a lock, so callers keep the slot in a __thread variable.
+ */
+void *s3fs_slot_get(s3fs_slots *slots);
+
+/*
+ * Returns the newest slot, from which every slot so far can be reached by
+ * following next, or NULL if there are none.
+ */
+void *s3fs_slots_first(s3fs_slots *slots);
+
+#endif // __S3FS_SLOT_H__
@@ -0,0 +1,66 @@
+/*
+ * Statistics on what s3fs is doing: a latency histogram for each FUSE
+ * operation and for each call to the backend, counts of the requests
+ * made to s3, their retries and the bytes moved, and counts of the heads
+ * and directory reads that the node table answers and misses (see
+ * s3fs_inode.h).  They can be read in the mount, as text from
+ * /.s3fs/stats and as JSON from /.s3fs/stats.json.
+ *
+ * Each thread records into histograms of its own, without taking a lock;
+ * reading the statistics adds up every thread's.  The histograms have 16
+ * buckets for every power of two nanoseconds, so the percentiles read from
+ * them are within about 3% of the latencies recorded.
+ */
+#ifndef __S3FS_STATS_H__
+#define __S3FS_STATS_H__
+
+#include "s3fs.h"
+
+#include <fuse.h>
+#include <stdint.h>
+
+#define S3FS_STATS_DIR "/.s3fs"
+
+typedef enum s3fs_stats_call {
+    S3FS_STATS_TEST_BUCKET,
+    S3FS_STATS_CLEAR_BUCKET,
+    S3FS_STATS_GET_OBJECT,
+    S3FS_STATS_PUT_OBJECT,
+    S3FS_STATS_HEAD_OBJECT,
+    S3FS_STATS_LIST_OBJECTS,
+    S3FS_STATS_COPY_OBJECT,
+    S3FS_STATS_REMOVE_OBJECT,
+    S3FS_STATS_CALLS
+} s3fs_stats_call;
+
+/*
+ * Start keeping statistics.  Called once, before the file system starts.
+ */
+void s3fs_stats_init(void);
+
+/*
+ * Record that a FUSE operation (an s3fs_trace_op) took ns nanoseconds.
+ */
+void s3fs_stats_op(int op, uint64_t ns);
+
+/*
+ * Returns a backend that does what backend does, recording the latency of
+ * each call and the bytes each get and put moves.
+ */
+const s3fs_backend *s3fs_stats_backend(const s3fs_backend *backend);
+
+/*
+ * The files under S3FS_STATS_DIR are made by these, which the file system's
+ * operations call in place of their own for any path that
+ * s3fs_stats_path() says is one of them.  Everything there is read-only.
+ */
+int s3fs_stats_path(const char *path);
+int s3fs_stats_getattr(const char *path, struct stat *statbuf);
+int s3fs_stats_opendir(const char *path);
+int s3fs_stats_readdir(const char *path, void *buf, fuse_fill_dir_t filler);
+int s3fs_stats_open(const char *path, struct fuse_file_info *fi);
+int s3fs_stats_read(char *buf, size_t size, off_t offset,
+                    struct fuse_file_info *fi);
+int s3fs_stats_release(struct fuse_file_info *fi);
+
+#endif // __S3FS_STATS_H__
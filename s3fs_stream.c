@@ -0,0 +1,280 @@
+/*
+ * Streaming reads through a pool of chunks; see s3fs_stream.h.
+ */
+
+#include "s3fs_stream.h"
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Chunks are fetched this many bytes at a time
+#define STREAM_CHUNK (8 * 1024 * 1024)
+
+// How many chunks there are between all the streams, and how many one
+// stream fetches ahead (counting the one being read)
+#define STREAM_BUFFERS 16
+#define STREAM_AHEAD 4
+
+typedef struct chunk {
+    off_t start;                // where in the object it begins
+    uint8_t *data;              // as read by the backend
+    ssize_t size;               // bytes read, or -1 if the fetch failed
+    int done;                   // whether the fetch has finished
+    int dropped;                // whether its stream is done with it
+} chunk;
+
+struct s3fs_stream {
+    const s3fs_backend *backend;
+    char *bucket, *key;
+    off_t size;
+    // the chunks being fetched and read, in order, from where the object
+    // was last read
+    chunk *window[STREAM_AHEAD];
+    int count;
+    // whether a read is using the window; reads of a stream take turns
+    int reading;
+};
+
+// NULL, or the patterns from S3FS_STREAM, ending in NULL
+static char **patterns = NULL;
+
+// Everything about streams and their chunks is under this lock, which
+// stream_cond is signalled under when a fetch finishes
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_cond = PTHREAD_COND_INITIALIZER;
+
+// chunks not being fetched or held by a stream
+static int buffers_free = STREAM_BUFFERS;
+
+int s3fs_stream_init(void) {
+    const char *env = getenv(S3FSSTREAM);
+    char *copy, *pattern, *save;
+    int count = 1;
+    const char *c;
+
+    if (!env || !*env) {
+        return 0;
+    }
+    for (c = env; *c; c++) {
+        count += (*c == ',');
+    }
+    patterns = calloc(count + 1, sizeof(char *));
+    if (!patterns || !(copy = strdup(env))) {
+        free(patterns);
+        patterns = NULL;
+        return -1;
+    }
+    count = 0;
+    for (pattern = strtok_r(copy, ",", &save); pattern;
+         pattern = strtok_r(NULL, ",", &save)) {
+        patterns[count++] = pattern;
+    }
+    return 0;
+}
+
+int s3fs_stream_path(const char *path) {
+    char **pattern;
+
+    for (pattern = patterns; pattern && *pattern; pattern++) {
+        if (!fnmatch(*pattern, path, 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// fetching ------------------------------------------------------------------
+
+// Frees a chunk and gives its buffer back to the pool.  The lock must be
+// held.
+static void free_chunk(chunk *c) {
+    free(c->data);
+    free(c);
+    buffers_free++;
+}
+
+// Called, on a thread of the backend's, when a chunk has been read
+static void fetched(ssize_t result, uint8_t *buf, void *data) {
+    chunk *c = (chunk *) data;
+
+    pthread_mutex_lock(&stream_lock);
+    c->data = buf;
+    c->size = result;
+    c->done = 1;
+    if (c->dropped) {
+        free_chunk(c);
+    }
+    pthread_cond_broadcast(&stream_cond);
+    pthread_mutex_unlock(&stream_lock);
+}
+
+// Lets go of a stream's chunk: freed if it has been read, and otherwise
+// when its fetch finishes.  The lock must be held.
+static void drop(chunk *c) {
+    if (c->done) {
+        free_chunk(c);
+    }
+    else {
+        c->dropped = 1;
+    }
+}
+
+// Drops the first n chunks of the window.  The lock must be held.
+static void drop_first(s3fs_stream *stream, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        drop(stream->window[i]);
+    }
+    memmove(stream->window, stream->window + n,
+            (stream->count - n) * sizeof(chunk *));
+    stream->count -= n;
+}
+
+// Fetches chunks after the last in the window (from start, if the window
+// is empty) until it is full, the object ends or the pool runs out.  The
+// lock must be held.
+static void fill(s3fs_stream *stream, off_t start) {
+    while ((stream->count < STREAM_AHEAD) && buffers_free) {
+        if (stream->count) {
+            start = stream->window[stream->count - 1]->start + STREAM_CHUNK;
+        }
+        if (start >= stream->size) {
+            return;
+        }
+        chunk *c = calloc(1, sizeof(chunk));
+        if (!c) {
+            return;
+        }
+        c->start = start;
+        ssize_t count = stream->size - start;
+        if (count > STREAM_CHUNK) {
+            count = STREAM_CHUNK;
+        }
+        buffers_free--;
+        if ((*(stream->backend->get_object_async))
+                (stream->backend, stream->bucket, stream->key, start, count,
+                 &fetched, c) < 0) {
+            free_chunk(c);
+            return;
+        }
+        stream->window[stream->count++] = c;
+    }
+}
+
+// streams -------------------------------------------------------------------
+
+s3fs_stream *s3fs_stream_open(const s3fs_backend *backend,
+                              const char *bucket, const char *key,
+                              off_t size) {
+    s3fs_stream *stream = calloc(1, sizeof(s3fs_stream));
+    if (!stream) {
+        return NULL;
+    }
+    stream->backend = backend;
+    stream->bucket = strdup(bucket);
+    stream->key = strdup(key);
+    stream->size = size;
+    if (!stream->bucket || !stream->key) {
+        s3fs_stream_close(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+// Reads from the chunk the read at offset is in, with the lock held.
+// Returns the number of bytes read (0 if there is no chunk for it to be
+// had from the pool), or -EIO.
+static int read_chunk(s3fs_stream *stream, char *buf, size_t size,
+                      off_t offset) {
+    off_t start = offset - (offset % STREAM_CHUNK);
+    int i;
+
+    // a read anywhere but in the window starts it again from there
+    for (i = 0; (i < stream->count) && (stream->window[i]->start != start);
+         i++) {
+    }
+    drop_first(stream, i);
+    fill(stream, start);
+    if (!stream->count) {
+        return 0;
+    }
+
+    chunk *c = stream->window[0];
+    while (!c->done) {
+        pthread_cond_wait(&stream_cond, &stream_lock);
+    }
+    if (c->size < 0) {
+        // fetched again if it is read again
+        drop_first(stream, 1);
+        return -EIO;
+    }
+    if (offset - c->start >= c->size) {
+        return -EIO;
+    }
+    if ((ssize_t) size > c->size - (offset - c->start)) {
+        size = c->size - (offset - c->start);
+    }
+    memcpy(buf, c->data + (offset - c->start), size);
+    return size;
+}
+
+int s3fs_stream_read(s3fs_stream *stream, char *buf, size_t size,
+                     off_t offset) {
+    size_t done = 0;
+
+    if (offset >= stream->size) {
+        return 0;
+    }
+    if ((off_t) size > stream->size - offset) {
+        size = stream->size - offset;
+    }
+
+    pthread_mutex_lock(&stream_lock);
+    while (stream->reading) {
+        pthread_cond_wait(&stream_cond, &stream_lock);
+    }
+    stream->reading = 1;
+    while (done < size) {
+        int got = read_chunk(stream, buf + done, size - done, offset + done);
+        if (got <= 0) {
+            stream->reading = 0;
+            pthread_cond_broadcast(&stream_cond);
+            pthread_mutex_unlock(&stream_lock);
+            // a read cut short by a failed fetch returns what it got
+            if (got < 0) {
+                return done ? (int) done : got;
+            }
+            // no chunk to be had: read the rest without one
+            uint8_t *data = NULL;
+            ssize_t rv = (*(stream->backend->get_object))
+                (stream->bucket, stream->key, &data, offset + done,
+                 size - done);
+            if (rv > 0) {
+                memcpy(buf + done, data, rv);
+            }
+            free(data);
+            if (rv < 0) {
+                return done ? (int) done : -EIO;
+            }
+            return done + rv;
+        }
+        done += got;
+    }
+    stream->reading = 0;
+    pthread_cond_broadcast(&stream_cond);
+    pthread_mutex_unlock(&stream_lock);
+    return done;
+}
+
+void s3fs_stream_close(s3fs_stream *stream) {
+    pthread_mutex_lock(&stream_lock);
+    drop_first(stream, stream->count);
+    pthread_mutex_unlock(&stream_lock);
+    free(stream->bucket);
+    free(stream->key);
+    free(stream);
+}
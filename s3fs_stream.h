@@ -0,0 +1,67 @@
+/*
+ * Streaming reads of very large files, such as media and backups, which
+ * are read once from start to end and gain nothing from being cached.
+ *
+ * The files streamed are those whose paths match one of the fnmatch(3)
+ * patterns in the S3FS_STREAM environment variable, separated by commas
+ * (such as "*.mkv,*.tar", or "*" for every file).  They are opened for
+ * direct I/O, so that the kernel doesn't cache them, and a file opened only
+ * for reading is read through a stream: the chunks just ahead of where it
+ * is being read are fetched from the backend in parallel, and each is
+ * freed as soon as reading moves past it.
+ *
+ * The chunks every stream has are taken from one pool, of 16 chunks of
+ * 8 MB, so streams never hold more than 128 MB between them.  A stream
+ * that can't get a chunk from the pool reads just what it is asked for
+ * straight from the backend.
+ *
+ * Streamed files are read-only: opening one for writing, or truncating it,
+ * fails with EOPNOTSUPP.  Writing one would need a copy of the whole of it
+ * until it is flushed, which is what streaming is there to avoid; so they
+ * are put in the bucket by other means, and only read through the mount.
+ */
+#ifndef __S3FS_STREAM_H__
+#define __S3FS_STREAM_H__
+
+#include "s3fs_backend.h"
+
+#include <sys/types.h>
+
+#define S3FSSTREAM "S3FS_STREAM"
+
+typedef struct s3fs_stream s3fs_stream;
+
+/*
+ * Read the patterns from S3FS_STREAM.  Returns 0 on success and -1 if
+ * there is no memory for them.
+ */
+int s3fs_stream_init(void);
+
+/*
+ * Returns whether the file at path is streamed.
+ */
+int s3fs_stream_path(const char *path);
+
+/*
+ * Start streaming an object of size bytes from a backend.  Returns NULL if
+ * there is no memory for the stream.
+ */
+s3fs_stream *s3fs_stream_open(const s3fs_backend *backend,
+                              const char *bucket, const char *key,
+                              off_t size);
+
+/*
+ * Read size bytes from offset into buf.  Returns the number of bytes read,
+ * which is fewer than size at the end of the object or if a fetch failed
+ * part way, or -EIO if a fetch failed before anything was read.
+ */
+int s3fs_stream_read(s3fs_stream *stream, char *buf, size_t size,
+                     off_t offset);
+
+/*
+ * Stop streaming, and free the stream.  Fetches still running finish on
+ * their own.
+ */
+void s3fs_stream_close(s3fs_stream *stream);
+
+#endif // __S3FS_STREAM_H__
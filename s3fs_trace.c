@@ -0,0 +1,367 @@
+/*
+ * Recording a trace of the FUSE operations s3fs handles; see s3fs_trace.h.
+ *
+ * Each operation in the fuse_operations is replaced with one that times
+ * the original, adds the time to the statistics and appends a record.  A
+ * record is written with a single fwrite, which stdio does under the
+ * stream's lock, so records from different threads don't interleave.
+ *
+ * The requests an operation makes to s3 are made in the thread running it,
+ * so the operation a request was made for is kept in a thread variable.
+ */
+
+#include "s3fs.h"
+#include "libs3_wrapper.h"
+#include "s3fs_stats.h"
+#include "s3fs_trace.h"
+
+#include <fuse.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Records are buffered this much before being written to the file
+#define TRACE_BUFFER_SIZE (1024 * 1024)
+
+// The most of a request's verb and URI that is recorded
+#define REQUEST_TEXT_MAX 4096
+
+static FILE *trace_file = NULL;
+static uint64_t trace_start;
+
+// the operations being traced
+static struct fuse_operations traced;
+
+// the operation this thread is running, if any: when it started and the
+// thread that caused it
+static __thread uint64_t op_start;
+static __thread uint32_t op_thread;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+// Called as an operation starts; returns the time it started
+static uint64_t begin(void) {
+    op_start = now_ns();
+    op_thread = fuse_get_context()->pid;
+    return op_start;
+}
+
+static void record(s3fs_trace_op op, uint64_t start, const char *path,
+                   const char *newpath, int64_t offset, uint32_t size,
+                   int result) {
+    char buf[sizeof(s3fs_trace_record) + 2 * (PATH_MAX + 1)];
+    s3fs_trace_record *r = (s3fs_trace_record *) buf;
+    uint64_t end = now_ns();
+
+    op_start = 0;
+    s3fs_stats_op(op, end - start);
+    if (!trace_file) {
+        return;
+    }
+
+    size_t len = strlen(path);
+    if (len > PATH_MAX) {
+        len = PATH_MAX;
+    }
+    memcpy(buf + sizeof(s3fs_trace_record), path, len);
+    if (newpath) {
+        size_t newlen = strlen(newpath);
+        if (newlen > PATH_MAX) {
+            newlen = PATH_MAX;
+        }
+        buf[sizeof(s3fs_trace_record) + len] = 0;
+        memcpy(buf + sizeof(s3fs_trace_record) + len + 1, newpath, newlen);
+        len += newlen + 1;
+    }
+
+    memset(r, 0, sizeof(s3fs_trace_record));
+    r->start = start - trace_start;
+    r->latency = end - start;
+    r->offset = offset;
+    r->size = size;
+    r->result = result;
+    r->thread = op_thread;
+    r->op = op;
+    r->path_len = len;
+
+    fwrite(buf, sizeof(s3fs_trace_record) + len, 1, trace_file);
+}
+
+static uint32_t microseconds(int64_t us) {
+    return ((us < 0) || (us > UINT32_MAX)) ? 0 : (uint32_t) us;
+}
+
+static void record_request(const S3RequestTiming *timing) {
+    char buf[sizeof(s3fs_trace_record) + sizeof(s3fs_trace_request) +
+             REQUEST_TEXT_MAX];
+    s3fs_trace_record *r = (s3fs_trace_record *) buf;
+    s3fs_trace_request *q =
+        (s3fs_trace_request *) (buf + sizeof(s3fs_trace_record));
+    char *text = buf + sizeof(s3fs_trace_record) + sizeof(s3fs_trace_request);
+    uint64_t end = now_ns();
+
+    if (!trace_file) {
+        return;
+    }
+
+    int len = snprintf(text, REQUEST_TEXT_MAX, "%s %s", timing->verb,
+                       timing->uri);
+    if (len < 0) {
+        len = 0;
+    }
+    else if (len >= REQUEST_TEXT_MAX) {
+        len = REQUEST_TEXT_MAX - 1;
+    }
+
+    memset(r, 0, sizeof(s3fs_trace_record) + sizeof(s3fs_trace_request));
+    r->latency = timing->totalTime * 1000;
+    r->start = end - r->latency - trace_start;
+    r->result = timing->status;
+    r->thread = op_start ? op_thread : 0;
+    r->op = S3FS_TRACE_REQUEST;
+    r->path_len = sizeof(s3fs_trace_request) + len;
+    q->op_start = op_start ? op_start - trace_start : 0;
+    q->bytes_sent = timing->bytesSent;
+    q->bytes_received = timing->bytesReceived;
+    q->name_lookup = microseconds(timing->nameLookupTime);
+    q->connect = microseconds(timing->connectTime);
+    q->app_connect = microseconds(timing->appConnectTime);
+    q->start_transfer = microseconds(timing->startTransferTime);
+    q->http_status = timing->httpResponseCode;
+    q->reused = timing->connectionReused;
+
+    fwrite(buf, sizeof(s3fs_trace_record) + r->path_len, 1, trace_file);
+}
+
+// traced operations ---------------------------------------------------------
+
+static int trace_getattr(const char *path, struct stat *statbuf) {
+    uint64_t start = begin();
+    int rv = (*traced.getattr)(path, statbuf);
+    record(S3FS_TRACE_GETATTR, start, path, NULL, 0, 0, rv);
+    return rv;
+}
+
+static int trace_mknod(const char *path, mode_t mode, dev_t dev) {
+    uint64_t start = begin();
+    int rv = (*traced.mknod)(path, mode, dev);
+    record(S3FS_TRACE_MKNOD, start, path, NULL, 0, mode, rv);
+    return rv;
+}
+
+static int trace_mkdir(const char *path, mode_t mode) {
+    uint64_t start = begin();
+    int rv = (*traced.mkdir)(path, mode);
+    record(S3FS_TRACE_MKDIR, start, path, NULL, 0, mode, rv);
+    return rv;
+}
+
+static int trace_unlink(const char *path) {
+    uint64_t start = begin();
+    int rv = (*traced.unlink)(path);
+    record(S3FS_TRACE_UNLINK, start, path, NULL, 0, 0, rv);
+    return rv;
+}
+
+static int trace_rmdir(const char *path) {
+    uint64_t start = begin();
+    int rv = (*traced.rmdir)(path);
+    record(S3FS_TRACE_RMDIR, start, path, NULL, 0, 0, rv);
+    return rv;
+}
+
+static int trace_rename(const char *path, const char *newpath) {
+    uint64_t start = begin();
+    int rv = (*traced.rename)(path, newpath);
+    record(S3FS_TRACE_RENAME, start, path, newpath, 0, 0, rv);
+    return rv;
+}
+
+static int trace_truncate(const char *path, off_t newsize) {
+    uint64_t start = begin();
+    int rv = (*traced.truncate)(path, newsize);
+    record(S3FS_TRACE_TRUNCATE, start, path, NULL, newsize, 0, rv);
+    return rv;
+}
+
+static int trace_open(const char *path, struct fuse_file_info *fi) {
+    uint64_t start = begin();
+    int rv = (*traced.open)(path, fi);
+    record(S3FS_TRACE_OPEN, start, path, NULL, 0, fi->flags, rv);
+    return rv;
+}
+
+static int trace_read(const char *path, char *buf, size_t size, off_t offset,
+                      struct fuse_file_info *fi) {
+    uint64_t start = begin();
+    int rv = (*traced.read)(path, buf, size, offset, fi);
+    record(S3FS_TRACE_READ, start, path, NULL, offset, size, rv);
+    return rv;
+}
+
+static int trace_write(const char *path, const char *buf, size_t size,
+                       off_t offset, struct fuse_file_info *fi) {
+    uint64_t start = begin();
+    int rv = (*traced.write)(path, buf, size, offset, fi);
+    record(S3FS_TRACE_WRITE, start, path, NULL, offset, size, rv);
+    return rv;
+}
+
+static int trace_read_buf(const char *path, struct fuse_bufvec **bufp,
+                          size_t size, off_t offset,
+                          struct fuse_file_info *fi) {
+    uint64_t start = begin();
+    int rv = (*traced.read_buf)(path, bufp, size, offset, fi);
+    // recorded as a read, of what was read
+    record(S3FS_TRACE_READ, start, path, NULL, offset, size,
+           rv ? rv : (int) fuse_buf_size(*bufp));
+    return rv;
+}
+
+static int trace_write_buf(const char *path, struct fuse_bufvec *buf,
+                           off_t offset, struct fuse_file_info *fi) {
+    uint64_t start = begin();
+    size_t size = fuse_buf_size(buf);
+    int rv = (*traced.write_buf)(path, buf, offset, fi);
+    record(S3FS_TRACE_WRITE, start, path, NULL, offset, size, rv);
+    return rv;
+}
+
+static int trace_release(const char *path, struct fuse_file_info *fi) {
+    uint64_t start = begin();
+    int rv = (*traced.release)(path, fi);
+    record(S3FS_TRACE_RELEASE, start, path, NULL, 0, 0, rv);
+    return rv;
+}
+
+static int trace_flush(const char *path, struct fuse_file_info *fi) {
+    uint64_t start = begin();
+    int rv = (*traced.flush)(path, fi);
+    record(S3FS_TRACE_FLUSH, start, path, NULL, 0, 0, rv);
+    return rv;
+}
+
+static int trace_opendir(const char *path, struct fuse_file_info *fi) {
+    uint64_t start = begin();
+    int rv = (*traced.opendir)(path, fi);
+    record(S3FS_TRACE_OPENDIR, start, path, NULL, 0, 0, rv);
+    return rv;
+}
+
+static int trace_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *fi) {
+    uint64_t start = begin();
+    int rv = (*traced.readdir)(path, buf, filler, offset, fi);
+    record(S3FS_TRACE_READDIR, start, path, NULL, offset, 0, rv);
+    return rv;
+}
+
+static int trace_releasedir(const char *path, struct fuse_file_info *fi) {
+    uint64_t start = begin();
+    int rv = (*traced.releasedir)(path, fi);
+    record(S3FS_TRACE_RELEASEDIR, start, path, NULL, 0, 0, rv);
+    return rv;
+}
+
+static int trace_access(const char *path, int mask) {
+    uint64_t start = begin();
+    int rv = (*traced.access)(path, mask);
+    record(S3FS_TRACE_ACCESS, start, path, NULL, 0, mask, rv);
+    return rv;
+}
+
+static int trace_ftruncate(const char *path, off_t newsize,
+                           struct fuse_file_info *fi) {
+    uint64_t start = begin();
+    int rv = (*traced.ftruncate)(path, newsize, fi);
+    record(S3FS_TRACE_FTRUNCATE, start, path, NULL, newsize, 0, rv);
+    return rv;
+}
+
+static void trace_destroy(void *userdata) {
+    if (traced.destroy) {
+        (*traced.destroy)(userdata);
+    }
+    s3fs_trace_stop();
+}
+
+// starting and stopping -----------------------------------------------------
+
+// Replaces ops->name with trace_name, if s3fs has it
+#define TRACE(name) if (ops->name) { ops->name = &trace_##name; }
+
+static int open_trace(const char *path) {
+    s3fs_trace_header header;
+    struct timespec ts;
+
+    trace_file = fopen(path, "w");
+    if (!trace_file) {
+        perror(path);
+        return -1;
+    }
+    setvbuf(trace_file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, S3FS_TRACE_MAGIC, sizeof(header.magic));
+    header.start = ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+    trace_start = now_ns();
+    // flushed now, as fuse_main forks and the parent's buffer is flushed
+    // too when it exits
+    if ((fwrite(&header, sizeof(header), 1, trace_file) != 1) ||
+        fflush(trace_file)) {
+        perror(path);
+        fclose(trace_file);
+        trace_file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int s3fs_trace_start(const char *path, struct fuse_operations *ops) {
+    if (path) {
+        if (open_trace(path) < 0) {
+            return -1;
+        }
+        s3fs_set_request_callback(&record_request);
+    }
+
+    traced = *ops;
+    TRACE(getattr);
+    TRACE(mknod);
+    TRACE(mkdir);
+    TRACE(unlink);
+    TRACE(rmdir);
+    TRACE(rename);
+    TRACE(truncate);
+    TRACE(open);
+    TRACE(read);
+    TRACE(write);
+    TRACE(read_buf);
+    TRACE(write_buf);
+    TRACE(flush);
+    TRACE(release);
+    TRACE(opendir);
+    TRACE(readdir);
+    TRACE(releasedir);
+    TRACE(access);
+    TRACE(ftruncate);
+    // the trace is written out when the file system goes away
+    ops->destroy = &trace_destroy;
+
+    return 0;
+}
+
+void s3fs_trace_stop(void) {
+    s3fs_set_request_callback(NULL);
+    if (trace_file) {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+}
@@ -0,0 +1,107 @@
+/*
+ * Tracing of the FUSE operations s3fs handles, so that real workloads can
+ * be replayed against a mount (with s3fs_replay) to tune it.
+ *
+ * When the S3FS_TRACE environment variable names a file, every operation
+ * is appended to it as an s3fs_trace_record followed by its path.  The
+ * file begins with an s3fs_trace_header.  Records are written in the order
+ * operations finish, in the byte order of the machine.
+ *
+ * Each request made to s3 is recorded too, with how long each stage of it
+ * took, so that the time of a slow operation can be put down to name
+ * lookups, connecting, TLS handshakes or the server.  Its record comes
+ * before that of the operation it was made for, which it names by the
+ * operation's thread and start.
+ */
+#ifndef __S3FS_TRACE_H__
+#define __S3FS_TRACE_H__
+
+#include <stdint.h>
+
+#define S3FSTRACE "S3FS_TRACE"
+
+#define S3FS_TRACE_MAGIC "S3FSTRC2"
+
+typedef enum s3fs_trace_op {
+    S3FS_TRACE_GETATTR,
+    S3FS_TRACE_MKNOD,
+    S3FS_TRACE_MKDIR,
+    S3FS_TRACE_UNLINK,
+    S3FS_TRACE_RMDIR,
+    S3FS_TRACE_RENAME,
+    S3FS_TRACE_TRUNCATE,
+    S3FS_TRACE_OPEN,
+    S3FS_TRACE_READ,
+    S3FS_TRACE_WRITE,
+    S3FS_TRACE_RELEASE,
+    S3FS_TRACE_OPENDIR,
+    S3FS_TRACE_READDIR,
+    S3FS_TRACE_RELEASEDIR,
+    S3FS_TRACE_ACCESS,
+    S3FS_TRACE_FTRUNCATE,
+    S3FS_TRACE_FLUSH,
+    S3FS_TRACE_OPS
+} s3fs_trace_op;
+
+static inline const char *s3fs_trace_op_name(int op) {
+    static const char *names[S3FS_TRACE_OPS] = {
+        "getattr", "mknod", "mkdir", "unlink", "rmdir", "rename",
+        "truncate", "open", "read", "write", "release", "opendir", "readdir",
+        "releasedir", "access", "ftruncate", "flush"
+    };
+    return ((op >= 0) && (op < S3FS_TRACE_OPS)) ? names[op] : "unknown";
+}
+
+// The op of the record of a request to s3, which is followed by an
+// s3fs_trace_request and then the request's verb, a space and its URI
+#define S3FS_TRACE_REQUEST 0x100
+
+typedef struct s3fs_trace_header {
+    char magic[8];           // S3FS_TRACE_MAGIC, without its NUL
+    uint64_t start;          // when tracing began, in ns since the epoch
+} s3fs_trace_header;
+
+typedef struct s3fs_trace_record {
+    uint64_t start;          // ns from the start of the trace
+    uint64_t latency;        // ns
+    int64_t offset;          // read, write and readdir offset; truncate size
+    uint32_t size;           // read and write size; mknod and mkdir mode;
+                             // open flags; access mask
+    int32_t result;          // what the operation returned; a request's
+                             // S3Status
+    uint32_t thread;         // thread id of the process that caused it
+    uint16_t op;             // s3fs_trace_op, or S3FS_TRACE_REQUEST
+    uint16_t path_len;       // bytes of path that follow; for a rename,
+                             // the path, a NUL and the new path; for a
+                             // request, all that follows
+} s3fs_trace_record;
+
+typedef struct s3fs_trace_request {
+    uint64_t op_start;       // start of the operation it was made for, as in
+                             // that operation's record; 0 if none
+    uint64_t bytes_sent;     // of the request and response bodies
+    uint64_t bytes_received;
+    uint32_t name_lookup;    // us from the start of the request until the
+    uint32_t connect;        // host was looked up, the connection made, the
+    uint32_t app_connect;    // TLS handshake done and the first byte of the
+    uint32_t start_transfer; // response received; 0 for any not reached
+    uint32_t http_status;    // 0 if there was no response
+    uint32_t reused;         // nonzero if the connection was already open
+} s3fs_trace_request;
+
+/*
+ * Start tracing to the file path, replacing the operations in ops with
+ * ones that call the original and then record the operation.  The time
+ * each takes is also added to the statistics (see s3fs_stats.h), which is
+ * all that is done if path is NULL.  Returns 0 on success and -1 on
+ * failure.
+ */
+struct fuse_operations;
+int s3fs_trace_start(const char *path, struct fuse_operations *ops);
+
+/*
+ * Write out any records not yet written and stop tracing.
+ */
+void s3fs_trace_stop(void);
+
+#endif // __S3FS_TRACE_H__